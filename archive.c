@@ -3,55 +3,2052 @@
  * @brief Archiving function for Seclume.
  */
 
+#define _GNU_SOURCE /* realpath in <stdlib.h>, SEEK_DATA and SEEK_HOLE in <unistd.h>, fallocate in <fcntl.h> */
+
 #include "seclume.h"
 #include <string.h>
 #include <stdlib.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <time.h>
+#include <sys/mman.h>
 #include <unistd.h>
+#include <libgen.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
+#include <setjmp.h>
 #include <openssl/rand.h>
 
+/** @brief Maximum payload bytes a worker may queue ahead of the writer for one file */
+#define JOB_QUEUE_MAX (4 * (CHUNK_SIZE + CHUNK_OVERHEAD))
+/** @brief Bytes at the start of the next input file the kernel is asked to read ahead */
+#define PREFETCH_SIZE (4U << 20)
+
+/**
+ * @brief Destination of the payload bytes produced for one file.
+ */
+typedef struct {
+    int (*write)(void *ctx, const uint8_t *data, size_t len); /**< Returns 0 on success, 1 on failure */
+    void *ctx;                                                /**< Sink-specific state */
+    long (*tell)(void *ctx);                                  /**< Archive offset of the next byte (-1 on failure), NULL if unknown */
+} PayloadSink;
+
+/**
+ * @brief Settings shared by every file of an archive run.
+ */
+typedef struct {
+    const uint8_t *file_key; /**< File encryption key */
+    int level;               /**< Compression level (0-9) */
+    CompressionAlgo algo;    /**< Compression algorithm (COMPRESSION_AUTO picks one per file) */
+    size_t block_size;       /**< Block size in block-parallel mode, 0 for streamed payloads */
+    int block_threads;       /**< Threads compressing the blocks of one file in block-parallel mode */
+    const ArchiveIndex *base; /**< Index of the base archive in incremental mode (with lookup table), NULL otherwise */
+    DedupStore *dedup;       /**< Chunk store in dedup mode (files are then archived one at a time), NULL otherwise */
+    struct SolidBlock *solid; /**< Open solid block in solid mode (files are then archived one at a time), NULL otherwise */
+    const uint8_t *meta_key; /**< Metadata key, which workers use to emit whole entries of a streamed archive */
+    uint64_t *stream_pos;    /**< Bytes written so far to a streamed archive (writer only), NULL for seekable archives */
+    const char *stdin_name;  /**< Filename recorded for the input read from standard input ("-") */
+    int sparse;              /**< Set when the holes of sparse files are recorded in an extent map instead of stored (version 15+) */
+    const uint8_t *dict;     /**< Dictionary zlib and zstd streams are compressed with (version 16+), NULL if none */
+    size_t dict_len;         /**< Length of dict */
+    int use_uring;           /**< Set when the parallel writer submits its writes through io_uring */
+} ArchiveSettings;
+
+/**
+ * @brief Result of archiving one input file, handed to the writer.
+ */
+typedef struct {
+    FileEntryPlain plain;    /**< Metadata to encrypt into the FileEntry */
+    int64_t mtime;           /**< Modification time of the input file */
+    uint8_t hash[HASH_SIZE]; /**< SHA-256 of the file contents */
+    int in_base;             /**< Set if the file is unchanged and stays in the base archive (no payload) */
+    int solid;               /**< Set if the file's data was packed into the open solid block */
+    uint64_t solid_offset;   /**< Offset of the file's data in the solid block */
+    int streamed;            /**< Set if the entries of a streamed archive were emitted with the payload */
+} ArchivedFile;
+
+/**
+ * @brief Solid block being filled with small files, and the index records waiting for it.
+ *
+ * The block is one compressed stream written as a chunked payload. Records of
+ * the files packed into it (and of unchanged files archived meanwhile, to keep
+ * the index in input order) are added to the index once the block is closed
+ * and its size is known.
+ */
+typedef struct SolidBlock {
+    FILE *out;             /**< Archive file */
+    ArchiveIndex *index;   /**< Central index */
+    long payload_pos;      /**< Archive offset of the block payload, -1 until data was written */
+    ChunkCipher cc;        /**< Chunk cipher of the block */
+    uint64_t written;      /**< Payload bytes written (nonce and chunks) */
+    uint64_t in_bytes;     /**< Uncompressed bytes fed into the block */
+    size_t comp_fill;      /**< Compressed bytes pending in the scratch buffer */
+    ArchivedFile *members; /**< Records waiting for the block to be closed, in input order */
+    int count;             /**< Number of waiting records */
+    int cap;               /**< Allocated slots in members */
+} SolidBlock;
+
+/**
+ * @brief Per-thread scratch buffers and contexts for compressing and encrypting files.
+ *
+ * The cipher and encoder contexts are created once per thread and reset between
+ * files. In block-parallel mode in and comp hold one block slot per block thread.
+ */
+typedef struct {
+    GcmKey file_gk;     /**< File key cipher context */
+    GcmKey meta_gk;     /**< Metadata key cipher context (streamed archives only) */
+    int meta_ready;     /**< Set once meta_gk was initialized */
+    EVP_MD_CTX *md;     /**< Content hash context */
+    CodecStream cs;     /**< Encoder reused by streamed payloads */
+    int cs_ready;       /**< Set once cs was initialized */
+    int cs_dict;        /**< Set if cs was given the archive's dictionary */
+    uint8_t *in;        /**< Input data */
+    uint8_t *comp;      /**< Compressed data */
+    uint8_t *rec;       /**< Encrypted chunk record */
+    size_t in_size;     /**< Size of one input slot */
+    size_t comp_size;   /**< Size of one compressed slot */
+    CodecBlock *blocks; /**< Block descriptors (block-parallel mode only) */
+    int slots;          /**< Number of block slots */
+    CompressionAlgo codec; /**< Codec of the file being archived */
+    int codec_threads;  /**< Threads a zstd encoder may use (when files are archived one at a time) */
+    SparseExtent *extents; /**< Extent map of the sparse file being archived (SPARSE_MAX_EXTENTS, allocated on first use) */
+} ArchiveScratch;
+
+/**
+ * @brief Allocates per-thread scratch buffers and the file key cipher context.
+ * @param scratch Buffers to allocate.
+ * @param settings Archive settings.
+ * @return 0 on success, 1 on failure.
+ */
+static int alloc_scratch(ArchiveScratch *scratch, const ArchiveSettings *settings) {
+    memset(scratch, 0, sizeof(*scratch));
+    scratch->slots = 1;
+    scratch->in_size = CHUNK_SIZE;
+    scratch->comp_size = CHUNK_SIZE;
+    if (settings->block_size) {
+        scratch->slots = settings->block_threads;
+        scratch->in_size = settings->block_size;
+        scratch->comp_size = compress_bound(settings->block_size, settings->algo);
+        scratch->blocks = calloc(scratch->slots, sizeof(CodecBlock));
+    }
+    scratch->in = malloc(scratch->slots * scratch->in_size);
+    scratch->comp = malloc(scratch->slots * scratch->comp_size);
+    scratch->rec = malloc(scratch->comp_size + CHUNK_OVERHEAD);
+    if (!scratch->in || !scratch->comp || !scratch->rec || (settings->block_size && !scratch->blocks)) {
+        fprintf(stderr, "Error: Memory allocation failed for stream buffers\n");
+        free(scratch->in);
+        free(scratch->comp);
+        free(scratch->rec);
+        free(scratch->blocks);
+        return 1;
+    }
+    scratch->md = EVP_MD_CTX_new();
+    if (!scratch->md || gcm_key_init(&scratch->file_gk, settings->file_key, 1) != 0) {
+        if (!scratch->md) fprintf(stderr, "Error: Failed to create hash context\n");
+        EVP_MD_CTX_free(scratch->md);
+        free(scratch->in);
+        free(scratch->comp);
+        free(scratch->rec);
+        free(scratch->blocks);
+        return 1;
+    }
+    if (settings->stream_pos) {
+        if (gcm_key_init(&scratch->meta_gk, settings->meta_key, 1) != 0) {
+            gcm_key_free(&scratch->file_gk);
+            EVP_MD_CTX_free(scratch->md);
+            free(scratch->in);
+            free(scratch->comp);
+            free(scratch->rec);
+            free(scratch->blocks);
+            return 1;
+        }
+        scratch->meta_ready = 1;
+    }
+    return 0;
+}
+
+/**
+ * @brief Wipes and frees per-thread scratch buffers and contexts.
+ * @param scratch Buffers to free.
+ */
+static void free_scratch(ArchiveScratch *scratch) {
+    gcm_key_free(&scratch->file_gk);
+    if (scratch->meta_ready) gcm_key_free(&scratch->meta_gk);
+    EVP_MD_CTX_free(scratch->md);
+    if (scratch->cs_ready) codec_stream_end(&scratch->cs);
+    secure_zero(scratch->in, scratch->slots * scratch->in_size);
+    secure_zero(scratch->comp, scratch->slots * scratch->comp_size);
+    free(scratch->in);
+    free(scratch->comp);
+    free(scratch->rec);
+    free(scratch->blocks);
+    free(scratch->extents);
+}
+
+/**
+ * @brief Prepares scratch buffers kept from an earlier run for the files of another archive.
+ *
+ * The cipher contexts get the archive's keys. The encoder is dropped if it was
+ * built for another level, or with a dictionary, which belongs to one archive.
+ *
+ * @param scratch Scratch buffers allocated by alloc_scratch() for a run without blocks.
+ * @param settings Settings of the new run (without blocks).
+ * @return 0 on success, 1 on failure (the scratch must then be freed).
+ */
+static int reuse_scratch(ArchiveScratch *scratch, const ArchiveSettings *settings) {
+    if (scratch->cs_ready && (scratch->cs.level != settings->level || scratch->cs_dict || settings->dict)) {
+        codec_stream_end(&scratch->cs);
+        scratch->cs_ready = 0;
+    }
+    if (gcm_key_rekey(&scratch->file_gk, settings->file_key) != 0) return 1;
+    if (!settings->stream_pos) return 0;
+    if (scratch->meta_ready) return gcm_key_rekey(&scratch->meta_gk, settings->meta_key);
+    if (gcm_key_init(&scratch->meta_gk, settings->meta_key, 1) != 0) return 1;
+    scratch->meta_ready = 1;
+    return 0;
+}
+
+/**
+ * @brief Prepares the scratch encoder for a new stream, replacing it if it uses another codec.
+ *
+ * A new zlib or zstd encoder gets the archive's dictionary, if any; a reset
+ * encoder keeps it.
+ *
+ * @param scratch Scratch buffers.
+ * @param settings Archive settings.
+ * @param codec Codec of the stream.
+ * @return 0 on success, 1 on failure.
+ */
+static int start_encoder(ArchiveScratch *scratch, const ArchiveSettings *settings, CompressionAlgo codec) {
+    if (scratch->cs_ready && scratch->cs.algo != codec) {
+        codec_stream_end(&scratch->cs);
+        scratch->cs_ready = 0;
+    }
+    if (scratch->cs_ready) return codec_stream_reset(&scratch->cs);
+    if (codec_stream_init(&scratch->cs, codec, settings->level, 0) != 0) return 1;
+    scratch->cs_dict = settings->dict && (codec == COMPRESSION_ZLIB || codec == COMPRESSION_ZSTD);
+    if (scratch->cs_dict && codec_stream_set_dict(&scratch->cs, settings->dict, settings->dict_len) != 0) {
+        codec_stream_end(&scratch->cs);
+        return 1;
+    }
+    codec_stream_set_workers(&scratch->cs, scratch->codec_threads);
+    scratch->cs_ready = 1;
+    return 0;
+}
+
+/**
+ * @brief Copy out of an input mapping in progress on this thread, for the SIGBUS handler.
+ *
+ * Reading a page of a mapping past the end of a file that shrank raises
+ * SIGBUS. Mapped input is only read by map_copy(), which the handler leaves
+ * with siglongjmp() when the faulting address lies in the range it copies.
+ */
+typedef struct {
+    sigjmp_buf env;                 /**< Return point of map_copy() */
+    const uint8_t *volatile start;  /**< Start of the range being copied */
+    volatile size_t len;            /**< Length of the range */
+    volatile sig_atomic_t active;   /**< Set while the copy runs */
+} MapCopy;
+
+/** @brief Copy in progress on the calling thread */
+static __thread MapCopy map_copy_state;
+/** @brief Disposition of SIGBUS before map_handler_install() */
+static struct sigaction map_prev_action;
+/** @brief Set while map_sigbus_handler() is installed; input files are only mapped then */
+static int map_handler_installed;
+
+/**
+ * @brief SIGBUS handler: abandons a copy out of a shrunken input mapping.
+ *
+ * Only async-signal-safe work is done: a fault inside the range map_copy()
+ * copies jumps back into it, and any other bus error gets the previous
+ * disposition back, which then applies when the access is retried.
+ *
+ * @param sig Signal number.
+ * @param info Signal information with the faulting address.
+ * @param ucontext Unused.
+ */
+static void map_sigbus_handler(int sig, siginfo_t *info, void *ucontext) {
+    (void)ucontext;
+    uintptr_t addr = (uintptr_t)info->si_addr;
+    if (map_copy_state.active && addr - (uintptr_t)map_copy_state.start < map_copy_state.len) {
+        siglongjmp(map_copy_state.env, 1);
+    }
+    sigaction(sig, &map_prev_action, NULL);
+}
+
+/**
+ * @brief Installs map_sigbus_handler() for the length of an archiving run.
+ *
+ * SA_NODEFER keeps SIGBUS unblocked in the handler, so jumping out of it
+ * needs no signal mask to be saved and restored around every copy.
+ */
+static void map_handler_install(void) {
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_sigaction = map_sigbus_handler;
+    sa.sa_flags = SA_SIGINFO | SA_NODEFER;
+    sigemptyset(&sa.sa_mask);
+    map_handler_installed = sigaction(SIGBUS, &sa, &map_prev_action) == 0;
+}
+
+/**
+ * @brief Restores the SIGBUS disposition map_handler_install() replaced.
+ */
+static void map_handler_restore(void) {
+    if (!map_handler_installed) return;
+    sigaction(SIGBUS, &map_prev_action, NULL);
+    map_handler_installed = 0;
+}
+
+/**
+ * @brief Copies a range of an input mapping, failing if the file no longer holds it.
+ * @param dst Output buffer.
+ * @param src Start of the range in the mapping.
+ * @param len Length of the range.
+ * @return 0 on success, 1 if a page of the range is past the end of the file.
+ */
+static int map_copy(uint8_t *dst, const uint8_t *src, size_t len) {
+    map_copy_state.start = src;
+    map_copy_state.len = len;
+    if (sigsetjmp(map_copy_state.env, 0)) {
+        map_copy_state.active = 0;
+        return 1;
+    }
+    map_copy_state.active = 1;
+    memcpy(dst, src, len);
+    map_copy_state.active = 0;
+    return 0;
+}
+
+/**
+ * @brief An input file being archived, read through a mapping or with fread.
+ *
+ * Of a sparse file only the data extents are read, back to back: offsets and
+ * size then count the bytes of the extents.
+ */
+typedef struct {
+    FILE *fp;           /**< Open input file */
+    const uint8_t *map; /**< Read-only mapping of the whole file, read with map_copy(); NULL to use fread */
+    const char *name;   /**< Input filename (for messages) */
+    size_t size;        /**< Size of the input file in bytes (SIZE_MAX until EOF for standard input) */
+    EVP_MD_CTX *md;     /**< Content hash updated with every byte read */
+    int until_eof;      /**< Set for standard input: reading stops at EOF, which sets size */
+    const SparseExtent *extents; /**< Data extents of a sparse file (read with pread), NULL to read the whole file */
+    size_t extent_count; /**< Number of extents */
+    size_t extent;       /**< Extent holding the next byte to read */
+    size_t extent_pos;   /**< Data bytes in the extents before extent */
+} InputFile;
+
+/**
+ * @brief Reads data bytes of a sparse input file from its extents.
+ * @param in Input file with extents.
+ * @param offset Offset of the bytes in the data of the extents.
+ * @param want Number of bytes; the extents must hold at least offset + want bytes.
+ * @param buf Output buffer.
+ * @return Number of bytes read (less than want on EOF, which leaves errno 0, or error).
+ */
+static size_t read_extents(InputFile *in, size_t offset, size_t want, uint8_t *buf) {
+    errno = 0;
+    if (offset < in->extent_pos) {
+        in->extent = 0;
+        in->extent_pos = 0;
+    }
+    size_t done = 0;
+    /* Past the last extent the read comes up short, which the caller reports as EOF */
+    while (done < want && in->extent < in->extent_count) {
+        const SparseExtent *ext = &in->extents[in->extent];
+        size_t skip = offset + done - in->extent_pos;
+        if (skip == ext->length) {
+            in->extent_pos += ext->length;
+            in->extent++;
+            continue;
+        }
+        size_t piece = ext->length - skip < want - done ? ext->length - skip : want - done;
+        ssize_t got = pread(fileno(in->fp), buf + done, piece, ext->offset + skip);
+        if (got <= 0) break;
+        done += got;
+    }
+    return done;
+}
+
+/**
+ * @brief Finds the data extents of a sparse input file.
+ *
+ * A file whose data occupies more than SPARSE_MAX_EXTENTS extents has the rest
+ * of its data, holes included, recorded in its last extent.
+ *
+ * @param fd Open input file.
+ * @param size File size.
+ * @param extents Output extents (SPARSE_MAX_EXTENTS slots).
+ * @param data_size Output number of data bytes in the extents.
+ * @return Number of extents, or -1 if the file has no holes or they cannot be queried.
+ */
+static long find_data_extents(int fd, size_t size, SparseExtent *extents, size_t *data_size) {
+#if defined(SEEK_DATA) && defined(SEEK_HOLE)
+    size_t count = 0;
+    off_t pos = 0;
+    *data_size = 0;
+    while ((size_t)pos < size) {
+        off_t data = lseek(fd, pos, SEEK_DATA);
+        /* ENXIO: only a hole is left up to the end of the file; data past size was written after fstat() */
+        if ((data == -1 && errno == ENXIO) || (data != -1 && (size_t)data >= size)) break;
+        off_t hole = data == -1 ? -1 : lseek(fd, data, SEEK_HOLE);
+        if (hole == -1) return -1;
+        if ((size_t)hole > size) hole = size;
+        if (count == SPARSE_MAX_EXTENTS) {
+            /* Out of extents: the last one takes everything up to the end */
+            *data_size += size - (extents[count - 1].offset + extents[count - 1].length);
+            extents[count - 1].length = size - extents[count - 1].offset;
+            break;
+        }
+        extents[count].offset = data;
+        extents[count].length = hole - data;
+        *data_size += hole - data;
+        count++;
+        pos = hole;
+    }
+    if (lseek(fd, 0, SEEK_SET) != 0 || *data_size == size) return -1;
+    return count;
+#else
+    (void)fd;
+    (void)size;
+    (void)extents;
+    (void)data_size;
+    return -1;
+#endif
+}
+
+/**
+ * @brief Starts the content hash of an input file.
+ *
+ * The hash of a sparse file covers its extent map followed by the data of the
+ * extents, so files with the same data in other places hash differently.
+ *
+ * @param in Input file.
+ * @return 0 on success, 1 on failure.
+ */
+static int input_hash_init(InputFile *in) {
+    if (EVP_DigestInit_ex(in->md, EVP_sha256(), NULL) != 1 ||
+        (in->extents && EVP_DigestUpdate(in->md, in->extents, in->extent_count * sizeof(SparseExtent)) != 1)) {
+        fprintf(stderr, "Error: Failed to initialize hash for %s\n", in->name);
+        return 1;
+    }
+    return 0;
+}
+
+/**
+ * @brief Returns the next want bytes of an input file.
+ *
+ * The bytes are copied out of the mapping of a mapped file, and read
+ * otherwise, into buf; they are then added to the content hash. Input read until EOF may return fewer
+ * bytes: hitting EOF sets in->size, and callers clamp want to it.
+ *
+ * @param in Input file.
+ * @param offset Offset of the bytes (the total consumed so far).
+ * @param want Number of bytes.
+ * @param buf Buffer of at least want bytes.
+ * @param data Pointer to store the location of the bytes (buf).
+ * @return 0 on success, 1 on failure.
+ */
+static int input_read(InputFile *in, size_t offset, size_t want, uint8_t *buf, const uint8_t **data) {
+    StageTimer timer;
+    stage_begin(&timer);
+    size_t got = want;
+    if (in->map && map_copy(buf, in->map + offset, want) != 0) {
+        struct stat st;
+        if (fstat(fileno(in->fp), &st) != 0) st.st_size = 0;
+        fprintf(stderr, "Error: Unexpected EOF reading input file %s (file shrank to %lu of %lu bytes while it was read)\n",
+                in->name, (unsigned long)st.st_size, (unsigned long)in->size);
+        return 1;
+    } else if (!in->map && want) {
+        got = in->extents ? read_extents(in, offset, want, buf) : fread(buf, 1, want, in->fp);
+    }
+    stage_end(&timer, STAGE_READ, got);
+    if (got < want && in->until_eof && !ferror(in->fp)) {
+        in->size = offset + got;
+    } else if (got < want) {
+        if (in->extents ? errno == 0 : feof(in->fp)) {
+            fprintf(stderr, "Error: Unexpected EOF reading input file %s (read %lu of %lu bytes)\n",
+                    in->name, offset + got, in->size);
+        } else {
+            fprintf(stderr, "Error: Failed to read input file %s: %s\n", in->name, strerror(errno));
+        }
+        return 1;
+    }
+    if (in->until_eof && offset + got > MAX_FILE_SIZE) {
+        fprintf(stderr, "Error: Input file %s exceeds max size (%llu bytes)\n", in->name, MAX_FILE_SIZE);
+        return 1;
+    }
+    *data = buf;
+    stage_begin(&timer);
+    if (got && EVP_DigestUpdate(in->md, buf, got) != 1) {
+        fprintf(stderr, "Error: Failed to hash input file %s\n", in->name);
+        return 1;
+    }
+    stage_end(&timer, STAGE_HASH, got);
+    return 0;
+}
+
+/**
+ * @brief Streams one input file through the encoder and chunk cipher into a payload sink.
+ * @param in Input file.
+ * @param cs Initialized encoder stream.
+ * @param cc Initialized chunk cipher.
+ * @param scratch Scratch buffers.
+ * @param sink Destination of the chunk records.
+ * @param written Pointer to the running count of payload bytes written.
+ * @return 0 on success, 1 on failure.
+ */
+static int stream_file_payload(InputFile *in, CodecStream *cs, ChunkCipher *cc,
+                               ArchiveScratch *scratch, PayloadSink *sink, uint64_t *written) {
+    size_t read_size = 0;
+    uint8_t *comp_ptr = scratch->comp;
+    size_t comp_avail = CHUNK_SIZE;
+    for (;;) {
+        size_t chunk = in->size - read_size < CHUNK_SIZE ? in->size - read_size : CHUNK_SIZE;
+        const uint8_t *in_ptr;
+        if (input_read(in, read_size, chunk, scratch->in, &in_ptr) != 0) return 1;
+        if (chunk > in->size - read_size) chunk = in->size - read_size;
+        if (read_size == 0 && verbosity >= VERBOSE_DEBUG && chunk >= 4) {
+            fprintf(stderr, "First 4 bytes of %s: %02x %02x %02x %02x\n",
+                    in->name, in_ptr[0], in_ptr[1], in_ptr[2], in_ptr[3]);
+        }
+        read_size += chunk;
+        int finish = read_size == in->size;
+        size_t in_left = chunk;
+        for (;;) {
+            int r = codec_stream_run(cs, &in_ptr, &in_left, &comp_ptr, &comp_avail, finish);
+            if (r < 0) return 1;
+            if (r == 1 || comp_avail == 0) {
+                /* A full buffer is only the final chunk once the encoder reports the end */
+                size_t rec_len;
+                if (chunk_encrypt(cc, scratch->comp, CHUNK_SIZE - comp_avail, r == 1, scratch->rec, &rec_len) != 0) return 1;
+                if (sink->write(sink->ctx, scratch->rec, rec_len) != 0) {
+                    fprintf(stderr, "Error: Failed to write encrypted data for %s\n", in->name);
+                    return 1;
+                }
+                *written += rec_len;
+                comp_ptr = scratch->comp;
+                comp_avail = CHUNK_SIZE;
+                if (r == 1) return 0;
+            } else if (in_left == 0 && !finish) {
+                break;
+            }
+        }
+    }
+}
+
+/**
+ * @brief Encrypts one stored input file chunk by chunk, straight from the input buffer.
+ *
+ * The chunks are the ones a COMPRESSION_STORE encoder would produce, without
+ * copying the data through the compressed buffer.
+ *
+ * @param in Input file.
+ * @param cc Initialized chunk cipher.
+ * @param scratch Scratch buffers.
+ * @param sink Destination of the chunk records.
+ * @param written Pointer to the running count of payload bytes written.
+ * @return 0 on success, 1 on failure.
+ */
+static int stream_file_stored(InputFile *in, ChunkCipher *cc, ArchiveScratch *scratch,
+                              PayloadSink *sink, uint64_t *written) {
+    size_t read_size = 0;
+    /* An empty input still gets its final chunk */
+    do {
+        size_t chunk = in->size - read_size < CHUNK_SIZE ? in->size - read_size : CHUNK_SIZE;
+        const uint8_t *data;
+        if (input_read(in, read_size, chunk, scratch->in, &data) != 0) return 1;
+        if (chunk > in->size - read_size) chunk = in->size - read_size;
+        read_size += chunk;
+        size_t rec_len;
+        if (chunk_encrypt(cc, data, chunk, read_size == in->size, scratch->rec, &rec_len) != 0) return 1;
+        if (sink->write(sink->ctx, scratch->rec, rec_len) != 0) {
+            fprintf(stderr, "Error: Failed to write encrypted data for %s\n", in->name);
+            return 1;
+        }
+        *written += rec_len;
+    } while (read_size < in->size);
+    return 0;
+}
+
+/**
+ * @brief Splits one input file into independently compressed blocks, one chunk per block.
+ *
+ * Up to scratch->slots blocks are read at a time and compressed in parallel, then
+ * encrypted and emitted in order.
+ *
+ * @param in Input file.
+ * @param settings Archive settings.
+ * @param cc Initialized chunk cipher.
+ * @param scratch Scratch buffers.
+ * @param sink Destination of the chunk records.
+ * @param written Pointer to the running count of payload bytes written.
+ * @return 0 on success, 1 on failure.
+ */
+static int stream_file_blocks(InputFile *in, const ArchiveSettings *settings,
+                              ChunkCipher *cc, ArchiveScratch *scratch, PayloadSink *sink, uint64_t *written) {
+    size_t read_size = 0;
+    while (read_size < in->size) {
+        int count = 0;
+        for (; count < scratch->slots && read_size < in->size; count++) {
+            size_t want = in->size - read_size < settings->block_size ? in->size - read_size : settings->block_size;
+            const uint8_t *data;
+            if (input_read(in, read_size, want, scratch->in + count * scratch->in_size, &data) != 0) return 1;
+            CodecBlock block = { data, want, scratch->comp + count * scratch->comp_size, scratch->comp_size, 0 };
+            scratch->blocks[count] = block;
+            read_size += want;
+        }
+        /* Stored blocks are encrypted straight from the input */
+        int stored = scratch->codec == COMPRESSION_STORE;
+        if (!stored && compress_blocks(scratch->blocks, count, settings->level, scratch->codec, count) != 0) {
+            fprintf(stderr, "Error: Block compression failed for %s\n", in->name);
+            return 1;
+        }
+        for (int b = 0; b < count; b++) {
+            size_t rec_len;
+            int final = read_size == in->size && b == count - 1;
+            const CodecBlock *block = &scratch->blocks[b];
+            if (chunk_encrypt(cc, stored ? block->in : block->out, stored ? block->in_len : block->out_len, final,
+                              scratch->rec, &rec_len) != 0) {
+                return 1;
+            }
+            if (sink->write(sink->ctx, scratch->rec, rec_len) != 0) {
+                fprintf(stderr, "Error: Failed to write encrypted data for %s\n", in->name);
+                return 1;
+            }
+            *written += rec_len;
+        }
+    }
+    return 0;
+}
+
+/**
+ * @brief Splits one input file into content-defined chunks and stores each new chunk once.
+ *
+ * Every payload chunk holds one segment: a chunk seen before in the archive
+ * becomes a DedupRef to its first record, a new chunk is compressed on its own
+ * and recorded in the chunk store.
+ *
+ * @param in Input file.
+ * @param settings Archive settings (with a chunk store).
+ * @param cc Initialized chunk cipher.
+ * @param base_nonce Base nonce of the payload.
+ * @param scratch Scratch buffers.
+ * @param sink Destination of the chunk records (must report archive offsets).
+ * @param written Pointer to the running count of payload bytes written.
+ * @return 0 on success, 1 on failure.
+ */
+static int stream_file_dedup(InputFile *in, const ArchiveSettings *settings, ChunkCipher *cc,
+                             const uint8_t *base_nonce, ArchiveScratch *scratch, PayloadSink *sink, uint64_t *written) {
+    DedupStore *store = settings->dedup;
+    size_t read_size = 0;
+    size_t buf_start = 0;
+    size_t done = 0;
+    while (done < in->size) {
+        if (read_size < in->size && read_size - done < DEDUP_MAX_CHUNK) {
+            size_t keep = read_size - done;
+            memmove(scratch->in, scratch->in + (done - buf_start), keep);
+            buf_start = done;
+            size_t want = in->size - read_size < scratch->in_size - keep ? in->size - read_size : scratch->in_size - keep;
+            const uint8_t *data;
+            if (input_read(in, read_size, want, scratch->in + keep, &data) != 0) return 1;
+            read_size += want;
+        }
+        const uint8_t *chunk = scratch->in + (done - buf_start);
+        size_t len = dedup_chunk_length(store, chunk, read_size - done);
+        done += len;
+        uint8_t hash[HASH_SIZE];
+        if (EVP_Digest(chunk, len, hash, NULL, EVP_sha256(), NULL) != 1) {
+            fprintf(stderr, "Error: Failed to hash chunk of %s\n", in->name);
+            return 1;
+        }
+        long offset = sink->tell(sink->ctx);
+        if (offset == -1) {
+            fprintf(stderr, "Error: Failed to get archive position for %s: %s\n", in->name, strerror(errno));
+            return 1;
+        }
+        const DedupRef *ref = dedup_store_find(store, hash);
+        size_t seg_len;
+        if (ref) {
+            memcpy(scratch->comp, ref, sizeof(*ref));
+            seg_len = sizeof(*ref);
+            store->dup_bytes += len;
+        } else {
+            scratch->comp[0] = DEDUP_SEGMENT_DATA;
+            size_t comp_len = compress_data(chunk, len, scratch->comp + 1, scratch->comp_size - 1, settings->level, scratch->codec);
+            if (comp_len == 0) {
+                fprintf(stderr, "Error: Compression failed for chunk of %s\n", in->name);
+                return 1;
+            }
+            seg_len = comp_len + 1;
+            DedupRef new_ref = { .type = DEDUP_SEGMENT_REF, .codec = scratch->codec, .offset = offset, .index = cc->index,
+                                 .length = len };
+            memcpy(new_ref.base_nonce, base_nonce, AES_NONCE_SIZE);
+            if (dedup_store_add(store, hash, &new_ref) != 0) return 1;
+            store->unique_bytes += len;
+        }
+        size_t rec_len;
+        if (chunk_encrypt(cc, scratch->comp, seg_len, done == in->size, scratch->rec, &rec_len) != 0) return 1;
+        if (sink->write(sink->ctx, scratch->rec, rec_len) != 0) {
+            fprintf(stderr, "Error: Failed to write encrypted data for %s\n", in->name);
+            return 1;
+        }
+        *written += rec_len;
+    }
+    return 0;
+}
+
+/**
+ * @brief Compresses and encrypts one input file as a chunked payload (version 7+).
+ *
+ * Emits the base nonce followed by the encrypted chunks, reading, compressing
+ * and encrypting CHUNK_SIZE bytes at a time so memory use does not depend on the
+ * file size. In block-parallel mode each chunk instead holds one independently
+ * compressed block of settings->block_size input bytes, and in dedup mode
+ * one deduplicated segment. The chunks of a sparse file follow a first chunk
+ * holding its extent map.
+ *
+ * @param in Input file.
+ * @param settings Archive settings.
+ * @param scratch Scratch buffers.
+ * @param sink Destination of the payload.
+ * @param payload_size Pointer to store the number of bytes emitted (nonce and chunks).
+ * @return 0 on success, 1 on failure.
+ */
+static int write_file_payload(InputFile *in, const ArchiveSettings *settings,
+                              ArchiveScratch *scratch, PayloadSink *sink, uint64_t *payload_size) {
+    uint8_t base_nonce[AES_NONCE_SIZE];
+    if (RAND_bytes(base_nonce, AES_NONCE_SIZE) != 1) {
+        fprintf(stderr, "Error: Random number generation failed for file nonce\n");
+        return 1;
+    }
+    verbose_print(VERBOSE_DEBUG, "Generated random file nonce");
+    if (sink->write(sink->ctx, base_nonce, AES_NONCE_SIZE) != 0) {
+        fprintf(stderr, "Error: Failed to write encrypted data for %s\n", in->name);
+        return 1;
+    }
+    ChunkCipher cc;
+    chunk_cipher_init(&cc, &scratch->file_gk, base_nonce);
+    uint64_t written = AES_NONCE_SIZE;
+    if (in->extents) {
+        size_t rec_len;
+        if (chunk_encrypt(&cc, (const uint8_t *)in->extents, in->extent_count * sizeof(SparseExtent), 0, scratch->rec,
+                          &rec_len) != 0) {
+            return 1;
+        }
+        if (sink->write(sink->ctx, scratch->rec, rec_len) != 0) {
+            fprintf(stderr, "Error: Failed to write encrypted data for %s\n", in->name);
+            return 1;
+        }
+        written += rec_len;
+    }
+    int ret;
+    if (settings->dedup) {
+        ret = stream_file_dedup(in, settings, &cc, base_nonce, scratch, sink, &written);
+    } else if (settings->block_size) {
+        ret = stream_file_blocks(in, settings, &cc, scratch, sink, &written);
+    } else if (scratch->codec == COMPRESSION_STORE) {
+        ret = stream_file_stored(in, &cc, scratch, sink, &written);
+    } else {
+        if (start_encoder(scratch, settings, scratch->codec) != 0) return 1;
+        ret = stream_file_payload(in, &scratch->cs, &cc, scratch, sink, &written);
+    }
+    if (ret == 0) {
+        verbose_print(VERBOSE_DEBUG, "Compressed and encrypted %lu bytes into %lu chunks", in->size, (unsigned long)cc.index);
+        *payload_size = written;
+    }
+    return ret;
+}
+
+/**
+ * @brief Encrypts a file's metadata into a FileEntry under a fresh nonce.
+ * @param plain Metadata to encrypt.
+ * @param meta_gk Metadata key cipher context.
+ * @param entry Output entry.
+ * @return 0 on success, 1 on failure.
+ */
+static int encrypt_file_entry(const FileEntryPlain *plain, GcmKey *meta_gk, FileEntry *entry) {
+    if (RAND_bytes(entry->nonce, AES_NONCE_SIZE) != 1) {
+        fprintf(stderr, "Error: Random number generation failed for metadata nonce\n");
+        return 1;
+    }
+    verbose_print(VERBOSE_DEBUG, "Generated random metadata nonce");
+    if (gcm_key_encrypt(meta_gk, entry->nonce, NULL, 0, (const uint8_t *)plain, sizeof(FileEntryPlain),
+                        entry->encrypted_data, entry->tag) != 0) {
+        fprintf(stderr, "Error: Failed to encrypt metadata for %s\n", plain->filename);
+        return 1;
+    }
+    verbose_print(VERBOSE_DEBUG, "Encrypted metadata");
+    return 0;
+}
+
+/**
+ * @brief Emits one whole entry of a streamed archive (version 14+).
+ *
+ * The lead FileEntry carries the filename, mode and codec with both sizes 0;
+ * it is followed by the payload and a second FileEntry with the real sizes,
+ * so the archive can be written without seeking back and read front to back.
+ * Every payload has a final chunk, even that of an empty file.
+ *
+ * @param in Input file.
+ * @param settings Archive settings (streamed archive).
+ * @param scratch Scratch buffers (with the metadata key cipher context).
+ * @param sink Destination of the entry.
+ * @param file Archived file (metadata set); the sizes are filled in.
+ * @return 0 on success, 1 on failure.
+ */
+static int write_stream_entry(InputFile *in, const ArchiveSettings *settings, ArchiveScratch *scratch,
+                              PayloadSink *sink, ArchivedFile *file) {
+    FileEntry entry;
+    file->plain.compressed_size = 0;
+    file->plain.original_size = 0;
+    if (encrypt_file_entry(&file->plain, &scratch->meta_gk, &entry) != 0) return 1;
+    if (sink->write(sink->ctx, (const uint8_t *)&entry, sizeof(entry)) != 0) {
+        fprintf(stderr, "Error: Failed to write metadata for %s\n", file->plain.filename);
+        return 1;
+    }
+    uint64_t payload_size;
+    if (write_file_payload(in, settings, scratch, sink, &payload_size) != 0) return 1;
+    file->plain.compressed_size = payload_size - AES_NONCE_SIZE;
+    file->plain.original_size = in->size;
+    if (encrypt_file_entry(&file->plain, &scratch->meta_gk, &entry) != 0) return 1;
+    if (sink->write(sink->ctx, (const uint8_t *)&entry, sizeof(entry)) != 0) {
+        fprintf(stderr, "Error: Failed to write metadata for %s\n", file->plain.filename);
+        return 1;
+    }
+    /* The index record of an empty file has no payload size, as in seekable archives */
+    if (in->size == 0) file->plain.compressed_size = 0;
+    file->streamed = 1;
+    return 0;
+}
+
+/**
+ * @brief Feeds uncompressed data into the solid block, writing every full compressed chunk.
+ *
+ * The block payload is started on the first data; finishing a block that never
+ * received data writes nothing.
+ *
+ * @param sb Solid block.
+ * @param settings Archive settings.
+ * @param scratch Scratch buffers (the encoder and compressed buffer belong to the block while it is open;
+ *                codec is the block's codec when it is started).
+ * @param data Uncompressed data.
+ * @param len Length of data.
+ * @param finish If 1, end the compressed stream and write the final chunk.
+ * @return 0 on success, 1 on failure.
+ */
+static int solid_feed(SolidBlock *sb, const ArchiveSettings *settings, ArchiveScratch *scratch,
+                      const uint8_t *data, size_t len, int finish) {
+    if (sb->payload_pos == -1) {
+        if (finish && len == 0) return 0;
+        uint8_t base_nonce[AES_NONCE_SIZE];
+        if (RAND_bytes(base_nonce, AES_NONCE_SIZE) != 1) {
+            fprintf(stderr, "Error: Random number generation failed for solid block nonce\n");
+            return 1;
+        }
+        sb->payload_pos = ftell(sb->out);
+        if (sb->payload_pos == -1 || fwrite(base_nonce, AES_NONCE_SIZE, 1, sb->out) != 1) {
+            fprintf(stderr, "Error: Failed to write solid block: %s\n", strerror(errno));
+            return 1;
+        }
+        chunk_cipher_init(&sb->cc, &scratch->file_gk, base_nonce);
+        if (start_encoder(scratch, settings, scratch->codec) != 0) return 1;
+        sb->written = AES_NONCE_SIZE;
+        sb->comp_fill = 0;
+    }
+    uint8_t *comp_ptr = scratch->comp + sb->comp_fill;
+    size_t comp_avail = CHUNK_SIZE - sb->comp_fill;
+    for (;;) {
+        int r = codec_stream_run(&scratch->cs, &data, &len, &comp_ptr, &comp_avail, finish);
+        if (r < 0) return 1;
+        if (r == 1 || comp_avail == 0) {
+            size_t rec_len;
+            if (chunk_encrypt(&sb->cc, scratch->comp, CHUNK_SIZE - comp_avail, r == 1, scratch->rec, &rec_len) != 0) return 1;
+            StageTimer timer;
+            stage_begin(&timer);
+            if (fwrite(scratch->rec, 1, rec_len, sb->out) != rec_len) {
+                fprintf(stderr, "Error: Failed to write solid block: %s\n", strerror(errno));
+                return 1;
+            }
+            stage_end(&timer, STAGE_WRITE, rec_len);
+            sb->written += rec_len;
+            comp_ptr = scratch->comp;
+            comp_avail = CHUNK_SIZE;
+            if (r == 1) break;
+        } else if (len == 0 && !finish) {
+            break;
+        }
+    }
+    sb->comp_fill = CHUNK_SIZE - comp_avail;
+    return 0;
+}
+
+/**
+ * @brief Packs the contents of one input file into the solid block.
+ * @param sb Solid block.
+ * @param settings Archive settings.
+ * @param scratch Scratch buffers.
+ * @param in Input file.
+ * @param file Archived file; receives the offset of its data in the block.
+ * @return 0 on success, 1 on failure.
+ */
+static int solid_add_data(SolidBlock *sb, const ArchiveSettings *settings, ArchiveScratch *scratch,
+                          InputFile *in, ArchivedFile *file) {
+    file->solid_offset = sb->in_bytes;
+    for (size_t offset = 0; offset < in->size;) {
+        size_t want = in->size - offset < CHUNK_SIZE ? in->size - offset : CHUNK_SIZE;
+        const uint8_t *data;
+        if (input_read(in, offset, want, scratch->in, &data) != 0 ||
+            solid_feed(sb, settings, scratch, data, want, 0) != 0) {
+            return 1;
+        }
+        offset += want;
+    }
+    sb->in_bytes += in->size;
+    return 0;
+}
+
+/**
+ * @brief Finishes the open solid block and adds the waiting records to the index.
+ * @param sb Solid block.
+ * @param settings Archive settings.
+ * @param scratch Scratch buffers.
+ * @return 0 on success, 1 on failure.
+ */
+static int solid_close(SolidBlock *sb, const ArchiveSettings *settings, ArchiveScratch *scratch) {
+    if (sb->count == 0 && sb->payload_pos == -1) return 0;
+    if (solid_feed(sb, settings, scratch, NULL, 0, 1) != 0) return 1;
+    for (int i = 0; i < sb->count; i++) {
+        ArchivedFile *m = &sb->members[i];
+        uint16_t flags = m->in_base ? INDEX_FLAG_IN_BASE : INDEX_FLAG_SOLID;
+        uint64_t offset = 0;
+        if (!m->in_base && m->plain.original_size > 0) {
+            offset = sb->payload_pos;
+            m->plain.compressed_size = sb->written - AES_NONCE_SIZE;
+        }
+        if (archive_index_add(sb->index, offset, &m->plain, m->mtime, m->hash, flags, m->solid_offset) != 0) return 1;
+    }
+    if (sb->payload_pos != -1) {
+        verbose_print(VERBOSE_BASIC, "Wrote solid block: %d files, %lu bytes compressed to %lu bytes", sb->count,
+                      (unsigned long)sb->in_bytes, (unsigned long)sb->written);
+    }
+    sb->payload_pos = -1;
+    sb->in_bytes = 0;
+    sb->count = 0;
+    return 0;
+}
+
+/**
+ * @brief Queues the record of a file packed into (or archived while filling) the solid block.
+ *
+ * The block is closed once it holds SOLID_BLOCK_SIZE bytes or SOLID_MAX_FILES records.
+ *
+ * @param sb Solid block.
+ * @param settings Archive settings.
+ * @param scratch Scratch buffers.
+ * @param file Archived file.
+ * @return 0 on success, 1 on failure.
+ */
+static int solid_add_member(SolidBlock *sb, const ArchiveSettings *settings, ArchiveScratch *scratch,
+                            const ArchivedFile *file) {
+    if (sb->count == sb->cap) {
+        int cap = sb->cap ? sb->cap * 2 : 256;
+        ArchivedFile *members = realloc(sb->members, cap * sizeof(ArchivedFile));
+        if (!members) {
+            fprintf(stderr, "Error: Memory allocation failed for solid block\n");
+            return 1;
+        }
+        sb->members = members;
+        sb->cap = cap;
+    }
+    sb->members[sb->count++] = *file;
+    if (file->in_base) {
+        verbose_print(VERBOSE_BASIC, "Unchanged file: %s (kept in base archive)", file->plain.filename);
+    } else {
+        verbose_print(VERBOSE_BASIC, "Packed %sfile: %s (permissions: 0%o)", file->plain.original_size == 0 ? "empty " : "",
+                      file->plain.filename, file->plain.mode);
+    }
+    if (sb->count >= SOLID_MAX_FILES || sb->in_bytes >= SOLID_BLOCK_SIZE) return solid_close(sb, settings, scratch);
+    return 0;
+}
+
+/**
+ * @brief Checks whether an input file is unchanged since the base archive.
+ *
+ * Files whose size, mtime and mode match their base record are hashed; if the
+ * SHA-256 matches too, the file stays in the base archive. Otherwise the input
+ * is rewound and the content hash restarted for archiving.
+ *
+ * @param settings Archive settings (with a base index).
+ * @param scratch Scratch buffers.
+ * @param in Input file.
+ * @param file Archived file state (metadata and mtime set).
+ * @return 1 if the file is unchanged, 0 if it must be archived, -1 on failure.
+ */
+static int check_base_file(const ArchiveSettings *settings, ArchiveScratch *scratch, InputFile *in, ArchivedFile *file) {
+    IndexEntry base_entry;
+    if (!archive_index_find(settings->base, file->plain.filename, &base_entry) ||
+        base_entry.plain.original_size != file->plain.original_size || base_entry.mtime != file->mtime ||
+        base_entry.plain.mode != file->plain.mode) {
+        return 0;
+    }
+    for (size_t offset = 0; offset < in->size;) {
+        size_t want = in->size - offset < CHUNK_SIZE ? in->size - offset : CHUNK_SIZE;
+        const uint8_t *data;
+        if (input_read(in, offset, want, scratch->in, &data) != 0) return -1;
+        offset += want;
+    }
+    if (EVP_DigestFinal_ex(scratch->md, file->hash, NULL) != 1) {
+        fprintf(stderr, "Error: Failed to hash input file %s\n", in->name);
+        return -1;
+    }
+    if (memcmp(file->hash, base_entry.hash, HASH_SIZE) == 0) {
+        file->in_base = 1;
+        file->plain.compressed_size = base_entry.plain.compressed_size;
+        return 1;
+    }
+    verbose_print(VERBOSE_DEBUG, "Contents of %s changed since the base archive", in->name);
+    if (!in->map && fseek(in->fp, 0, SEEK_SET) != 0) {
+        fprintf(stderr, "Error: Failed to rewind input file %s\n", in->name);
+        return -1;
+    }
+    return input_hash_init(in) != 0 ? -1 : 0;
+}
+
+/**
+ * @brief Checks whether a sample of an input file shrinks under fast compression.
+ *
+ * Up to PROBE_WINDOWS windows spread over the file are compressed with zlib at
+ * level 1; data that cannot be squeezed at that level (encrypted, random or
+ * already compressed) gains nothing from the slower codecs either. The windows
+ * of a sparse file are taken from the data of its extents.
+ *
+ * @param scratch Scratch buffers (in and rec are overwritten; comp may hold data of an open solid block).
+ * @param in Open input file (nothing is added to its content hash).
+ * @param size Bytes to sample from (the data bytes of a sparse file).
+ * @return 1 if the sample shrank by at least 1/PROBE_MIN_GAIN, 0 otherwise.
+ */
+static int probe_compressible(ArchiveScratch *scratch, InputFile *in, size_t size) {
+    size_t sample = 0;
+    for (int w = 0; w < PROBE_WINDOWS && sample < size; w++) {
+        size_t want = size - sample < PROBE_WINDOW ? size - sample : PROBE_WINDOW;
+        off_t offset = size <= PROBE_WINDOW * PROBE_WINDOWS ? (off_t)sample
+                                                            : (off_t)((size - PROBE_WINDOW) / (PROBE_WINDOWS - 1) * w);
+        ssize_t got = in->extents ? (ssize_t)read_extents(in, offset, want, scratch->in + sample)
+                                  : pread(fileno(in->fp), scratch->in + sample, want, offset);
+        if (got <= 0) break;
+        sample += got;
+    }
+    /* Unreadable files are compressed as usual, and the read error is reported there */
+    if (sample == 0) return 1;
+    size_t comp_len = compress_data(scratch->in, sample, scratch->rec, scratch->comp_size, 1, COMPRESSION_ZLIB);
+    verbose_print(VERBOSE_DEBUG, "Probe compressed %lu sampled bytes to %lu", (unsigned long)sample, (unsigned long)comp_len);
+    return comp_len != 0 && comp_len <= sample - sample / PROBE_MIN_GAIN;
+}
+
+/**
+ * @brief Picks the codec of one input file.
+ *
+ * In auto mode the first bytes of the file are sampled, and files in already
+ * compressed formats are stored. Files of PROBE_MIN_SIZE or more are then
+ * probed, and stored if the probe does not shrink them.
+ *
+ * @param settings Archive settings.
+ * @param scratch Scratch buffers.
+ * @param in Open input file.
+ * @param filename Input file path.
+ * @param size Data size of the file (0 when unknown, which skips the probe).
+ * @return Codec of the file's data.
+ */
+static CompressionAlgo select_file_codec(const ArchiveSettings *settings, ArchiveScratch *scratch, InputFile *in,
+                                         const char *filename, size_t size) {
+    CompressionAlgo codec = settings->algo;
+    if (codec == COMPRESSION_AUTO) {
+        uint8_t head[CODEC_SAMPLE_SIZE];
+        ssize_t head_len = pread(fileno(in->fp), head, sizeof(head), 0);
+        codec = codec_auto_select(filename, head, head_len > 0 ? (size_t)head_len : 0);
+    }
+    if (codec != COMPRESSION_STORE && size >= PROBE_MIN_SIZE && !probe_compressible(scratch, in, size)) {
+        verbose_print(VERBOSE_BASIC, "Storing incompressible file: %s", filename);
+        codec = COMPRESSION_STORE;
+    }
+    verbose_print(VERBOSE_DEBUG, "Codec for %s: %s", filename, codec_name(codec));
+    return codec;
+}
+
+/**
+ * @brief Reads, compresses and encrypts one input file.
+ *
+ * Empty files produce no payload, and neither do files left in the base archive
+ * in incremental mode. The metadata is returned in file for the writer to
+ * encrypt once the payload size is known; in a streamed archive the whole
+ * entry goes to the sink instead, and every file gets a payload. The input
+ * "-" is standard input, read until EOF and archived as settings->stdin_name.
+ * With settings->sparse, a file with holes is archived as the map of its data
+ * extents and their data only.
+ *
+ * @param filename Input file path.
+ * @param settings Archive settings.
+ * @param scratch Scratch buffers.
+ * @param sink Destination of the payload.
+ * @param file Output metadata, mtime and content hash of the file.
+ * @return 0 on success, 1 on failure.
+ */
+static int archive_one_file(const char *filename, const ArchiveSettings *settings, ArchiveScratch *scratch,
+                            PayloadSink *sink, ArchivedFile *file) {
+    int from_stdin = strcmp(filename, "-") == 0;
+    if (from_stdin) filename = settings->stdin_name;
+    verbose_print(VERBOSE_BASIC, from_stdin ? "Processing standard input as: %s" : "Processing file: %s", filename);
+    /* A duplicate of standard input, so closing it leaves stdin itself open */
+    int stdin_fd = from_stdin ? dup(STDIN_FILENO) : -1;
+    FILE *in = from_stdin ? (stdin_fd == -1 ? NULL : fdopen(stdin_fd, "rb")) : fopen(filename, "rb");
+    if (!in) {
+        if (stdin_fd != -1) close(stdin_fd);
+        fprintf(stderr, "Error: Cannot open input file %s: %s\n", filename, strerror(errno));
+        return 1;
+    }
+    struct stat st;
+    if (fstat(fileno(in), &st) != 0) {
+        fprintf(stderr, "Error: Cannot stat input file %s: %s\n", filename, strerror(errno));
+        fclose(in);
+        return 1;
+    }
+    size_t in_size = from_stdin ? SIZE_MAX : (size_t)st.st_size;
+    /* Empty standard input is archived like an empty file, without a payload */
+    if (from_stdin) {
+        int c = getc(in);
+        if (c == EOF && ferror(in)) {
+            fprintf(stderr, "Error: Failed to read input file %s: %s\n", filename, strerror(errno));
+            fclose(in);
+            return 1;
+        }
+        if (c == EOF) in_size = 0;
+        else ungetc(c, in);
+    }
+    uint32_t file_mode = from_stdin ? 0644 : st.st_mode & (S_IRWXU | S_IRWXG | S_IRWXO);
+    memset(file, 0, sizeof(*file));
+    strncpy(file->plain.filename, filename, MAX_FILENAME - 1);
+    file->plain.filename[MAX_FILENAME - 1] = '\0';
+    file->plain.mode = file_mode;
+    file->plain.original_size = from_stdin ? 0 : in_size;
+    file->mtime = from_stdin ? time(NULL) : st.st_mtime;
+    InputFile input = { .fp = in, .name = filename, .size = in_size, .md = scratch->md,
+                        .until_eof = from_stdin && in_size != 0 };
+    /* Holes only show as allocated blocks short of the file size */
+    if (settings->sparse && !from_stdin && in_size > 0 && in_size <= MAX_SPARSE_FILE_SIZE &&
+        (uint64_t)st.st_blocks * 512 < in_size) {
+        if (!scratch->extents) scratch->extents = malloc(SPARSE_MAX_EXTENTS * sizeof(SparseExtent));
+        size_t data_size;
+        long count = scratch->extents ? find_data_extents(fileno(in), in_size, scratch->extents, &data_size) : -1;
+        if (count >= 0) {
+            input.extents = scratch->extents;
+            input.extent_count = count;
+            input.size = data_size;
+            verbose_print(VERBOSE_DEBUG, "Sparse file %s: %lu data bytes in %ld extents", filename,
+                          (unsigned long)data_size, count);
+        }
+    }
+    if (input_hash_init(&input) != 0) {
+        fclose(in);
+        return 1;
+    }
+    if (in_size == 0 && !settings->stream_pos) {
+        verbose_print(VERBOSE_BASIC, "Processing empty file: %s", filename);
+        file->plain.codec = settings->algo == COMPRESSION_AUTO ? AUTO_CODEC : settings->algo;
+        fclose(in);
+        file->solid = settings->solid != NULL;
+        return EVP_DigestFinal_ex(scratch->md, file->hash, NULL) != 1;
+    }
+    if (!from_stdin && input.size > MAX_FILE_SIZE) {
+        fprintf(stderr, "Error: Input file %s exceeds max size (%llu bytes)\n", filename, MAX_FILE_SIZE);
+        fclose(in);
+        return 1;
+    }
+    if (!from_stdin) verbose_print(VERBOSE_DEBUG, "File size: %lu bytes, mode: 0%o", in_size, file_mode);
+    void *map = MAP_FAILED;
+    /* A file that shrinks while it is mapped must fail cleanly, so files are only mapped under the SIGBUS handler */
+    if (map_handler_installed && !from_stdin && !input.extents && in_size >= MMAP_MIN_SIZE) {
+        map = mmap(NULL, in_size, PROT_READ, MAP_PRIVATE, fileno(in), 0);
+        if (map != MAP_FAILED) {
+            posix_madvise(map, in_size, POSIX_MADV_SEQUENTIAL);
+            input.map = map;
+            verbose_print(VERBOSE_DEBUG, "Mapped %s for reading", filename);
+        } else {
+            verbose_print(VERBOSE_DEBUG, "Cannot map %s (%s), reading it instead", filename, strerror(errno));
+        }
+    }
+    /* Standard input is read once, so it is neither compared with the base nor probed */
+    int ret = settings->base && !from_stdin ? check_base_file(settings, scratch, &input, file) : 0;
+    if (ret == 0) {
+        scratch->codec = select_file_codec(settings, scratch, &input, filename, from_stdin ? 0 : input.size);
+        file->plain.codec = scratch->codec | (input.extents ? ENTRY_CODEC_SPARSE : 0);
+    }
+    /* Stored files keep out of solid blocks, which use one codec for all members, and sparse files need their map */
+    int solid = settings->solid && in_size < SOLID_FILE_MAX && scratch->codec != COMPRESSION_STORE && !input.extents;
+    uint64_t payload_size = 0;
+    if (ret == 0) {
+        if (solid) {
+            ret = solid_add_data(settings->solid, settings, scratch, &input, file);
+            file->solid = 1;
+        } else {
+            /* A file with a payload of its own ends the open solid block */
+            ret = settings->solid ? solid_close(settings->solid, settings, scratch) : 0;
+            if (ret == 0 && settings->stream_pos) ret = write_stream_entry(&input, settings, scratch, sink, file);
+            else if (ret == 0) ret = write_file_payload(&input, settings, scratch, sink, &payload_size);
+        }
+        if (ret == 0 && EVP_DigestFinal_ex(scratch->md, file->hash, NULL) != 1) {
+            fprintf(stderr, "Error: Failed to hash input file %s\n", filename);
+            ret = 1;
+        }
+    } else {
+        ret = ret < 0;
+    }
+    if (map != MAP_FAILED) {
+        munmap(map, in_size);
+    }
+    fclose(in);
+    if (ret != 0) return 1;
+    if (from_stdin) file->plain.original_size = input.size;
+    if (file->in_base || file->solid || file->streamed) return 0;
+    verbose_print(VERBOSE_DEBUG, "Encrypted file to %lu bytes", payload_size);
+    file->plain.compressed_size = payload_size - AES_NONCE_SIZE;
+    return 0;
+}
+
+/**
+ * @brief Sink that writes payload bytes straight to the archive file.
+ *
+ * A placeholder FileEntry is written before the first payload byte so the real
+ * entry can be filled in once the payload size is known. Streamed archives get
+ * no placeholder (their entries are part of the bytes written) and count the
+ * bytes written instead of asking the file position.
+ */
+typedef struct {
+    FILE *out;            /**< Archive file */
+    long entry_pos;       /**< Offset of the placeholder FileEntry (first byte in a streamed archive), or -1 if none was written */
+    uint64_t *stream_pos; /**< Bytes written to a streamed archive, NULL for seekable archives */
+} FileSink;
+
+/**
+ * @brief Writes payload bytes to the archive, preceded by a placeholder entry on first use.
+ * @param ctx FileSink.
+ * @param data Payload bytes.
+ * @param len Number of bytes.
+ * @return 0 on success, 1 on failure.
+ */
+static int file_sink_write(void *ctx, const uint8_t *data, size_t len) {
+    FileSink *fs = ctx;
+    if (fs->stream_pos) {
+        if (fs->entry_pos == -1) fs->entry_pos = *fs->stream_pos;
+    } else if (fs->entry_pos == -1) {
+        FileEntry placeholder;
+        memset(&placeholder, 0, sizeof(placeholder));
+        fs->entry_pos = ftell(fs->out);
+        if (fs->entry_pos == -1 || fwrite(&placeholder, sizeof(placeholder), 1, fs->out) != 1) return 1;
+    }
+    StageTimer timer;
+    stage_begin(&timer);
+    size_t written = fwrite(data, 1, len, fs->out);
+    stage_end(&timer, STAGE_WRITE, written);
+    if (fs->stream_pos) *fs->stream_pos += written;
+    return written != len;
+}
+
+/**
+ * @brief Returns the archive offset the next payload byte is written at.
+ * @param ctx FileSink.
+ * @return Offset, or -1 on failure.
+ */
+static long file_sink_tell(void *ctx) {
+    FileSink *fs = ctx;
+    return fs->stream_pos ? (long)*fs->stream_pos : ftell(fs->out);
+}
+
+/**
+ * @brief Records a written FileEntry in the central index.
+ * @param index Central index.
+ * @param entry_pos Archive offset of the entry.
+ * @param file Archived file.
+ * @return 0 on success, 1 on failure.
+ */
+static int index_file_entry(ArchiveIndex *index, long entry_pos, const ArchivedFile *file) {
+    const FileEntryPlain *plain_entry = &file->plain;
+    if (archive_index_add(index, entry_pos, plain_entry, file->mtime, file->hash, 0, 0) != 0) return 1;
+    if (plain_entry->original_size == 0) {
+        verbose_print(VERBOSE_BASIC, "Archived empty file: %s (permissions: 0%o)", plain_entry->filename, plain_entry->mode);
+    } else {
+        verbose_print(VERBOSE_BASIC, "Archived file: %s (permissions: 0%o)", plain_entry->filename, plain_entry->mode);
+    }
+    return 0;
+}
+
+/**
+ * @brief Encrypts a file's metadata, writes its FileEntry and records it in the central index.
+ *
+ * Files left in the base archive only get an INDEX_FLAG_IN_BASE index record,
+ * and entries of a streamed archive, already written with the payload, only
+ * their index record.
+ *
+ * @param out Archive file.
+ * @param entry_pos Offset of the placeholder entry (of the lead entry in a streamed archive), or -1 to append the entry.
+ * @param file Archived file.
+ * @param meta_gk Metadata key cipher context.
+ * @param index Central index.
+ * @return 0 on success, 1 on failure.
+ */
+static int write_file_entry(FILE *out, long entry_pos, const ArchivedFile *file, GcmKey *meta_gk,
+                            ArchiveIndex *index) {
+    const FileEntryPlain *plain_entry = &file->plain;
+    if (file->in_base) {
+        if (archive_index_add(index, 0, plain_entry, file->mtime, file->hash, INDEX_FLAG_IN_BASE, 0) != 0) return 1;
+        verbose_print(VERBOSE_BASIC, "Unchanged file: %s (kept in base archive)", plain_entry->filename);
+        return 0;
+    }
+    FileEntry entry;
+    if (file->streamed) {
+        /* The entries were written with the payload */
+    } else if (encrypt_file_entry(plain_entry, meta_gk, &entry) != 0) {
+        return 1;
+    } else if (entry_pos == -1) {
+        entry_pos = ftell(out);
+        if (entry_pos == -1 || fwrite(&entry, sizeof(entry), 1, out) != 1) {
+            fprintf(stderr, "Error: Failed to write metadata for %s\n", plain_entry->filename);
+            return 1;
+        }
+    } else if (fseek(out, entry_pos, SEEK_SET) != 0 || fwrite(&entry, sizeof(entry), 1, out) != 1 ||
+               fseek(out, 0, SEEK_END) != 0) {
+        fprintf(stderr, "Error: Failed to write metadata for %s\n", plain_entry->filename);
+        return 1;
+    }
+    return index_file_entry(index, entry_pos, file);
+}
+
+/**
+ * @brief Payload bytes queued by a worker for the writer.
+ */
+typedef struct QueuedChunk {
+    struct QueuedChunk *next; /**< Next queued chunk of the same file */
+    size_t len;               /**< Number of bytes in data */
+    uint8_t data[];           /**< Payload bytes */
+} QueuedChunk;
+
+/**
+ * @brief State of one file in the parallel archiving pipeline.
+ */
+typedef struct {
+    QueuedChunk *head;          /**< Oldest queued payload chunk */
+    QueuedChunk *tail;          /**< Newest queued payload chunk */
+    size_t queued;              /**< Bytes currently queued */
+    int done;                   /**< 1 once the worker finished, -1 if it failed */
+    ArchivedFile file;          /**< Metadata and hash, valid once done is 1 */
+} ArchiveJob;
+
+/**
+ * @brief Shared state of the archiving worker pool.
+ */
+typedef struct {
+    const char **filenames;          /**< Input files */
+    int file_count;                  /**< Number of input files */
+    const ArchiveSettings *settings; /**< Archive settings */
+    ArchiveJob *jobs;                /**< Ring of job slots; file i uses slot i % ring */
+    int ring;                        /**< Number of job slots */
+    int next_job;                    /**< Next file to hand to a worker */
+    int next_write;                  /**< File the writer is emitting; files up to next_write + ring - 1 may be claimed */
+    BufferPool buffers;              /**< Storage of queued chunks */
+    int abort;                       /**< Set when the run failed */
+    pthread_mutex_t lock;            /**< Protects all fields above */
+    pthread_cond_t job_cond;         /**< Signals the writer that a job has progressed */
+    pthread_cond_t space_cond;       /**< Signals workers that queued data was written or a slot was freed */
+} ArchivePool;
+
+/**
+ * @brief Sink that queues payload bytes of one job for the writer thread.
+ */
+typedef struct {
+    ArchivePool *pool; /**< Worker pool */
+    ArchiveJob *job;   /**< Job the bytes belong to */
+} QueueSink;
+
+/**
+ * @brief Queues payload bytes, waiting while the job's queue is full.
+ * @param ctx QueueSink.
+ * @param data Payload bytes.
+ * @param len Number of bytes.
+ * @return 0 on success, 1 on failure or if the run was aborted.
+ */
+static int queue_sink_write(void *ctx, const uint8_t *data, size_t len) {
+    QueueSink *qs = ctx;
+    QueuedChunk *chunk = buffer_pool_get(&qs->pool->buffers, sizeof(QueuedChunk) + len);
+    if (!chunk) return 1;
+    chunk->next = NULL;
+    chunk->len = len;
+    memcpy(chunk->data, data, len);
+    pthread_mutex_lock(&qs->pool->lock);
+    while (qs->job->queued >= JOB_QUEUE_MAX && !qs->pool->abort) {
+        pthread_cond_wait(&qs->pool->space_cond, &qs->pool->lock);
+    }
+    if (qs->pool->abort) {
+        pthread_mutex_unlock(&qs->pool->lock);
+        buffer_pool_put(&qs->pool->buffers, chunk);
+        return 1;
+    }
+    if (qs->job->tail) qs->job->tail->next = chunk;
+    else qs->job->head = chunk;
+    qs->job->tail = chunk;
+    qs->job->queued += len;
+    pthread_cond_signal(&qs->pool->job_cond);
+    pthread_mutex_unlock(&qs->pool->lock);
+    return 0;
+}
+
+/**
+ * @brief Write-behind output of whole entries for the parallel archiving writer.
+ *
+ * The entry and payload of a finished file are assembled in one buffer and
+ * written with a single write at the end of the archive, on the WriteBehind
+ * thread or through io_uring, while the next file is assembled in the other
+ * buffer. Writes go to the file descriptor at tracked offsets, so the stdio
+ * stream is flushed before the first one and moved to the tracked end before
+ * it is used again (see entry_writer_sync()).
+ */
+typedef struct {
+    FILE *out;                          /**< Archive file */
+    WriteBehind wb;                     /**< Writer of the assembled buffers */
+    uint8_t *bufs[WRITE_BEHIND_SLOTS];  /**< Entry and payload of one file per slot */
+    size_t sizes[WRITE_BEHIND_SLOTS];   /**< Allocated size of each buffer */
+    int slot;                           /**< Slot the next file is assembled in */
+    int active;                         /**< Set while writes are posted past the stdio position */
+    long pos;                           /**< Archive offset of the next byte, valid while active */
+} EntryWriter;
+
+/**
+ * @brief Waits for the posted writes and moves the stdio stream to the end of the written data.
+ * @param ew Entry writer.
+ * @return 0 on success, 1 on failure.
+ */
+static int entry_writer_sync(EntryWriter *ew) {
+    if (!ew->active) return 0;
+    ew->active = 0;
+    int error = write_behind_wait(&ew->wb);
+    if (error) {
+        fprintf(stderr, "Error: Failed to write archive: %s\n", strerror(error));
+        return 1;
+    }
+    return fseek(ew->out, ew->pos, SEEK_SET) != 0;
+}
+
+/**
+ * @brief Writes the entry and the queued payload of a finished job as one buffer and records the entry.
+ * @param ew Entry writer.
+ * @param pool Worker pool.
+ * @param job Finished job whose whole payload is queued.
+ * @param meta_gk Metadata key cipher context.
+ * @param index Central index.
+ * @return 0 on success, 1 on failure.
+ */
+static int entry_writer_put(EntryWriter *ew, ArchivePool *pool, ArchiveJob *job, GcmKey *meta_gk,
+                            ArchiveIndex *index) {
+    int slot = ew->slot;
+    int error = write_behind_wait_slot(&ew->wb, slot);
+    if (error) {
+        fprintf(stderr, "Error: Failed to write archive: %s\n", strerror(error));
+        return 1;
+    }
+    pthread_mutex_lock(&pool->lock);
+    QueuedChunk *chunk = job->head;
+    size_t len = sizeof(FileEntry) + job->queued;
+    job->head = job->tail = NULL;
+    job->queued = 0;
+    pthread_cond_broadcast(&pool->space_cond);
+    pthread_mutex_unlock(&pool->lock);
+    int ret = 0;
+    if (len > ew->sizes[slot]) {
+        uint8_t *buf = realloc(ew->bufs[slot], len);
+        if (buf) {
+            ew->bufs[slot] = buf;
+            ew->sizes[slot] = len;
+        } else {
+            fprintf(stderr, "Error: Memory allocation failed for archive output\n");
+            ret = 1;
+        }
+    }
+    FileEntry entry;
+    if (ret == 0 && encrypt_file_entry(&job->file.plain, meta_gk, &entry) != 0) ret = 1;
+    if (ret == 0) memcpy(ew->bufs[slot], &entry, sizeof(entry));
+    size_t used = sizeof(entry);
+    while (chunk) {
+        QueuedChunk *next = chunk->next;
+        if (ret == 0) memcpy(ew->bufs[slot] + used, chunk->data, chunk->len);
+        used += chunk->len;
+        buffer_pool_put(&pool->buffers, chunk);
+        chunk = next;
+    }
+    if (ret != 0) return 1;
+    if (!ew->active) {
+        if (fflush(ew->out) != 0 || (ew->pos = ftell(ew->out)) == -1) {
+            fprintf(stderr, "Error: Failed to write archive: %s\n", strerror(errno));
+            return 1;
+        }
+        ew->active = 1;
+    }
+    if (index_file_entry(index, ew->pos, &job->file) != 0) return 1;
+    write_behind_post(&ew->wb, slot, fileno(ew->out), ew->bufs[slot], len, ew->pos);
+    ew->pos += len;
+    ew->slot = (slot + 1) % WRITE_BEHIND_SLOTS;
+    return 0;
+}
+
+/**
+ * @brief Asks the kernel to start reading the beginning of an input file.
+ *
+ * Called for the next file of the run, so its first data is in the page cache
+ * by the time a worker gets to it; sequential readahead takes over from there.
+ *
+ * @param filename Input file path (failures are ignored and reported when the file is archived).
+ */
+static void prefetch_input(const char *filename) {
+    int fd = open(filename, O_RDONLY);
+    if (fd == -1) return;
+    posix_fadvise(fd, 0, PREFETCH_SIZE, POSIX_FADV_WILLNEED);
+    close(fd);
+}
+
+/**
+ * @brief Works on one run of the pool: claims files in order and compresses and encrypts them.
+ * @param pool Worker pool of the run.
+ * @param scratch Scratch buffers of the thread, kept between runs.
+ * @param have_scratch Set while scratch is allocated; updated.
+ */
+static void archive_worker(ArchivePool *pool, ArchiveScratch *scratch, int *have_scratch) {
+    if (*have_scratch && reuse_scratch(scratch, pool->settings) != 0) {
+        free_scratch(scratch);
+        *have_scratch = 0;
+    }
+    if (!*have_scratch) *have_scratch = alloc_scratch(scratch, pool->settings) == 0;
+    for (;;) {
+        pthread_mutex_lock(&pool->lock);
+        if (!*have_scratch) pool->abort = 1;
+        while (!pool->abort && pool->next_job < pool->file_count && pool->next_job >= pool->next_write + pool->ring) {
+            pthread_cond_wait(&pool->space_cond, &pool->lock);
+        }
+        int i = pool->abort ? pool->file_count : pool->next_job++;
+        pthread_mutex_unlock(&pool->lock);
+        if (i >= pool->file_count) break;
+        if (i + 1 < pool->file_count) prefetch_input(pool->filenames[i + 1]);
+        ArchiveJob *job = &pool->jobs[i % pool->ring];
+        QueueSink qs = { pool, job };
+        PayloadSink sink = { queue_sink_write, &qs, NULL };
+        ArchivedFile file;
+        int ret = archive_one_file(pool->filenames[i], pool->settings, scratch, &sink, &file);
+        pthread_mutex_lock(&pool->lock);
+        if (ret == 0) {
+            job->file = file;
+            job->done = 1;
+        } else {
+            job->done = -1;
+            pool->abort = 1;
+            pthread_cond_broadcast(&pool->space_cond);
+        }
+        pthread_cond_broadcast(&pool->job_cond);
+        pthread_mutex_unlock(&pool->lock);
+    }
+    pthread_mutex_lock(&pool->lock);
+    pthread_cond_broadcast(&pool->job_cond);
+    pthread_mutex_unlock(&pool->lock);
+}
+
+/**
+ * @brief Archiving worker threads shared by the runs of a process.
+ *
+ * Threads are started on first use. While retained (for a batch, see
+ * archive_workers_retain()) they wait for the next run instead of exiting and
+ * keep their ArchiveScratch, so a later run only loads its keys into the
+ * cipher contexts and reuses the buffers and, at the same level and without a
+ * dictionary, the encoder.
+ */
+typedef struct {
+    pthread_t *threads;   /**< Started threads */
+    int count;            /**< Number of started threads */
+    ArchivePool *run;     /**< Run the threads work on, NULL between runs */
+    uint64_t generation;  /**< Number of runs posted, so a thread joins each run once */
+    int seats;            /**< Threads the current run still takes */
+    int busy;             /**< Threads still working on the current run */
+    int retain;           /**< Set while threads are kept between runs */
+    int stop;             /**< Set to end the threads */
+    pthread_mutex_t lock; /**< Protects all fields above */
+    pthread_cond_t cond;  /**< Signals a posted run, a finished worker, or stop */
+} ArchiveCrew;
+
+/** @brief Worker threads of the process */
+static ArchiveCrew crew = { .lock = PTHREAD_MUTEX_INITIALIZER, .cond = PTHREAD_COND_INITIALIZER };
+
+/**
+ * @brief Worker thread: joins posted runs until the crew is stopped, then wipes its scratch.
+ * @param arg Unused.
+ * @return NULL.
+ */
+static void *crew_thread(void *arg) {
+    (void)arg;
+    ArchiveScratch scratch;
+    int have_scratch = 0;
+    uint64_t seen = 0;
+    pthread_mutex_lock(&crew.lock);
+    for (;;) {
+        while (!crew.stop && (crew.generation == seen || crew.seats == 0)) pthread_cond_wait(&crew.cond, &crew.lock);
+        if (crew.stop) break;
+        seen = crew.generation;
+        crew.seats--;
+        ArchivePool *pool = crew.run;
+        pthread_mutex_unlock(&crew.lock);
+        archive_worker(pool, &scratch, &have_scratch);
+        pthread_mutex_lock(&crew.lock);
+        if (--crew.busy == 0) pthread_cond_broadcast(&crew.cond);
+    }
+    pthread_mutex_unlock(&crew.lock);
+    if (have_scratch) free_scratch(&scratch);
+    return NULL;
+}
+
+/**
+ * @brief Hands a run to jobs worker threads, starting the missing ones.
+ * @param pool Worker pool of the run.
+ * @param jobs Number of threads to work on it.
+ * @return 0 on success, 1 if the threads could not be started (the run is not posted).
+ */
+static int crew_post(ArchivePool *pool, int jobs) {
+    pthread_mutex_lock(&crew.lock);
+    if (crew.count < jobs) {
+        pthread_t *threads = realloc(crew.threads, jobs * sizeof(pthread_t));
+        if (threads) {
+            crew.threads = threads;
+            while (crew.count < jobs && pthread_create(&crew.threads[crew.count], NULL, crew_thread, NULL) == 0) {
+                crew.count++;
+            }
+        }
+        if (crew.count < jobs) {
+            fprintf(stderr, "Error: Failed to start worker thread\n");
+            pthread_mutex_unlock(&crew.lock);
+            return 1;
+        }
+    }
+    crew.run = pool;
+    crew.generation++;
+    crew.seats = jobs;
+    crew.busy = jobs;
+    pthread_cond_broadcast(&crew.cond);
+    pthread_mutex_unlock(&crew.lock);
+    return 0;
+}
+
+/**
+ * @brief Waits until every thread of the posted run has left it.
+ */
+static void crew_wait(void) {
+    pthread_mutex_lock(&crew.lock);
+    while (crew.busy > 0) pthread_cond_wait(&crew.cond, &crew.lock);
+    crew.run = NULL;
+    pthread_mutex_unlock(&crew.lock);
+}
+
+/**
+ * @brief Ends the worker threads, which wipe and free their scratch buffers.
+ */
+static void crew_stop(void) {
+    pthread_mutex_lock(&crew.lock);
+    crew.stop = 1;
+    pthread_cond_broadcast(&crew.cond);
+    pthread_mutex_unlock(&crew.lock);
+    for (int t = 0; t < crew.count; t++) pthread_join(crew.threads[t], NULL);
+    free(crew.threads);
+    crew.threads = NULL;
+    crew.count = 0;
+    crew.stop = 0;
+}
+
+/**
+ * @brief Keeps the archiving worker threads and their contexts between runs, or stops them.
+ * @param retain 1 to keep them after each run (batch mode), 0 to stop them now and after every later run.
+ */
+void archive_workers_retain(int retain) {
+    crew.retain = retain;
+    if (!retain) crew_stop();
+}
+
+/**
+ * @brief Archives files on a pool of worker threads with the calling thread as the single writer.
+ *
+ * Workers read, compress and encrypt files in parallel; the writer emits the
+ * entries in input order, so the archive layout matches the serial path. With
+ * a single worker this still pipelines the run: file N+1 is prefetched and
+ * compressed while the payload of file N is written. Files whose payload fits
+ * in their queue are written as one buffer of entry and payload through an
+ * EntryWriter, without going back to patch a placeholder entry; larger files
+ * go through stdio with a placeholder once the earlier writes are done. Job
+ * state lives in a ring of 2 * jobs slots, so memory use does not grow with the
+ * number of files.
+ *
+ * @param out Archive file, positioned after the header.
+ * @param filenames Input files.
+ * @param file_count Number of input files.
+ * @param settings Archive settings.
+ * @param meta_gk Metadata key cipher context.
+ * @param index Central index.
+ * @param jobs Number of worker threads.
+ * @return 0 on success, 1 on failure.
+ */
+static int archive_parallel(FILE *out, const char **filenames, int file_count, const ArchiveSettings *settings,
+                            GcmKey *meta_gk, ArchiveIndex *index, int jobs) {
+    ArchivePool pool = { .filenames = filenames, .file_count = file_count, .settings = settings, .ring = 2 * jobs };
+    pool.jobs = calloc(pool.ring, sizeof(ArchiveJob));
+    if (!pool.jobs) {
+        fprintf(stderr, "Error: Memory allocation failed for worker pool\n");
+        return 1;
+    }
+    pthread_mutex_init(&pool.lock, NULL);
+    buffer_pool_init(&pool.buffers);
+    pthread_cond_init(&pool.job_cond, NULL);
+    pthread_cond_init(&pool.space_cond, NULL);
+    EntryWriter ew = { .out = out };
+    /* Streamed archives write every file through the sink, so only seekable ones need the writer */
+    int have_writer = !settings->stream_pos && write_behind_start(&ew.wb, settings->use_uring) == 0;
+    int ret = have_writer || settings->stream_pos ? 0 : 1;
+    int posted = ret == 0 && crew_post(&pool, jobs) == 0;
+    if (posted) verbose_print(VERBOSE_DEBUG, "Running on %d worker threads", jobs);
+    else ret = 1;
+    for (int i = 0; i < file_count && ret == 0; i++) {
+        ArchiveJob *job = &pool.jobs[i % pool.ring];
+        FileSink fs = { out, -1, settings->stream_pos };
+        pthread_mutex_lock(&pool.lock);
+        /* A file whose whole payload fits in its queue gets its entry written first, with no placeholder to patch */
+        while (job->done == 0 && job->queued < JOB_QUEUE_MAX && !pool.abort) {
+            pthread_cond_wait(&pool.job_cond, &pool.lock);
+        }
+        int entry_first = job->done == 1 && !pool.abort && !settings->stream_pos;
+        pthread_mutex_unlock(&pool.lock);
+        if (entry_first && !job->file.in_base) {
+            if (entry_writer_put(&ew, &pool, job, meta_gk, index) != 0) ret = 1;
+        } else if (entry_first) {
+            /* Only an index record, nothing is written */
+            if (write_file_entry(out, -1, &job->file, meta_gk, index) != 0) ret = 1;
+        } else if (entry_writer_sync(&ew) != 0) {
+            ret = 1;
+        }
+        pthread_mutex_lock(&pool.lock);
+        while (ret == 0) {
+            while (!job->head && job->done == 0 && !pool.abort) {
+                pthread_cond_wait(&pool.job_cond, &pool.lock);
+            }
+            if (pool.abort || job->done < 0) {
+                ret = 1;
+                break;
+            }
+            if (!job->head) break;
+            QueuedChunk *chunk = job->head;
+            job->head = chunk->next;
+            if (!job->head) job->tail = NULL;
+            job->queued -= chunk->len;
+            pthread_cond_broadcast(&pool.space_cond);
+            pthread_mutex_unlock(&pool.lock);
+            int write_ret = file_sink_write(&fs, chunk->data, chunk->len);
+            buffer_pool_put(&pool.buffers, chunk);
+            pthread_mutex_lock(&pool.lock);
+            if (write_ret != 0) {
+                fprintf(stderr, "Error: Failed to write encrypted data for %s\n", filenames[i]);
+                ret = 1;
+                break;
+            }
+        }
+        if (ret != 0) {
+            pool.abort = 1;
+            pthread_cond_broadcast(&pool.space_cond);
+        }
+        pthread_mutex_unlock(&pool.lock);
+        if (ret == 0 && !entry_first && write_file_entry(out, fs.entry_pos, &job->file, meta_gk, index) != 0) {
+            pthread_mutex_lock(&pool.lock);
+            pool.abort = 1;
+            pthread_cond_broadcast(&pool.space_cond);
+            pthread_mutex_unlock(&pool.lock);
+            ret = 1;
+        }
+        if (ret == 0) {
+            pthread_mutex_lock(&pool.lock);
+            memset(job, 0, sizeof(*job));
+            pool.next_write = i + 1;
+            pthread_cond_broadcast(&pool.space_cond);
+            pthread_mutex_unlock(&pool.lock);
+        }
+    }
+    if (entry_writer_sync(&ew) != 0) ret = 1;
+    if (have_writer) write_behind_stop(&ew.wb);
+    for (int s = 0; s < WRITE_BEHIND_SLOTS; s++) free(ew.bufs[s]);
+    if (posted) {
+        crew_wait();
+        if (!crew.retain) crew_stop();
+    }
+    for (int i = 0; i < pool.ring; i++) {
+        while (pool.jobs[i].head) {
+            QueuedChunk *chunk = pool.jobs[i].head;
+            pool.jobs[i].head = chunk->next;
+            buffer_pool_put(&pool.buffers, chunk);
+        }
+    }
+    buffer_pool_free(&pool.buffers);
+    pthread_cond_destroy(&pool.space_cond);
+    pthread_cond_destroy(&pool.job_cond);
+    pthread_mutex_destroy(&pool.lock);
+    free(pool.jobs);
+    return ret;
+}
+
 /**
- * @brief Archives and encrypts files into a .slm archive.
- * @param output Path to the output archive file (.slm).
- * @param filenames Array of input file or directory paths.
+ * @brief Archives every input file, writing its entry and payload and recording it in the index.
+ *
+ * Files are processed on jobs worker threads feeding a writer unless the archive
+ * is block-parallel, deduplicated or solid; a dry run only checks that the
+ * inputs can be archived. Large inputs are mapped while the run holds the
+ * SIGBUS handler, whose previous disposition is restored at the end.
+ *
+ * @param out Archive file (NULL for a dry run).
+ * @param filenames Input file paths.
  * @param file_count Number of input files.
- * @param password Password for encryption.
- * @param force If 1, overwrite existing output file.
- * @param compression_level Compression level (0-9).
- * @param compression_algo Compression algorithm (COMPRESSION_ZLIB or COMPRESSION_LZMA).
- * @param comment Archive comment (NULL if none).
- * @param outdir Output directory for extraction (NULL if none).
- * @param dry_run If 1, simulate archiving without writing to disk.
- * @param weak_password If 1, allow weak passwords.
- * @param exclude_patterns Array of exclusion patterns (e.g., "*.log").
- * @param exclude_pattern_count Number of exclusion patterns.
+ * @param settings Archive settings.
+ * @param meta_gk Metadata key cipher context.
+ * @param index Central index.
+ * @param jobs Number of worker threads.
+ * @param dry_run If 1, only stat the inputs.
  * @return 0 on success, 1 on failure.
  */
-int archive_files(const char *output, const char **filenames, int file_count, const char *password,
-                 int force, int compression_level, CompressionAlgo compression_algo, const char *comment,
-                 const char *outdir, int dry_run, int weak_password, const char **exclude_patterns, int exclude_pattern_count) {
-    if (!output || !filenames || !password || file_count <= 0 || file_count > MAX_FILES) {
+static int create_archive_entries(FILE *out, const char **filenames, int file_count, const ArchiveSettings *settings,
+                                  GcmKey *meta_gk, ArchiveIndex *index, int jobs, int dry_run) {
+    if (dry_run) {
+        for (int i = 0; i < file_count; i++) {
+            struct stat st;
+            if (strcmp(filenames[i], "-") == 0) {
+                verbose_print(VERBOSE_BASIC, "Archived standard input as: %s", settings->stdin_name);
+                continue;
+            }
+            if (stat(filenames[i], &st) != 0) {
+                fprintf(stderr, "Error: Cannot stat input file %s: %s\n", filenames[i], strerror(errno));
+                return 1;
+            }
+            /* Sparse files are sized by their allocated blocks, close to the data they have */
+            uint64_t data_size = settings->sparse && (uint64_t)st.st_size <= MAX_SPARSE_FILE_SIZE &&
+                                         (uint64_t)st.st_blocks * 512 < (uint64_t)st.st_size
+                                     ? (uint64_t)st.st_blocks * 512 : (uint64_t)st.st_size;
+            if (data_size > MAX_FILE_SIZE) {
+                fprintf(stderr, "Error: Input file %s exceeds max size (%llu bytes)\n", filenames[i], MAX_FILE_SIZE);
+                return 1;
+            }
+            verbose_print(VERBOSE_BASIC, "Archived %sfile: %s (permissions: 0%o)", st.st_size == 0 ? "empty " : "",
+                          filenames[i], st.st_mode & (S_IRWXU | S_IRWXG | S_IRWXO));
+        }
+        return 0;
+    }
+    map_handler_install();
+    int ret = 0;
+    if (file_count > 1 && !settings->block_size && !settings->dedup && !settings->solid) {
+        ret = archive_parallel(out, filenames, file_count, settings, meta_gk, index, jobs < file_count ? jobs : file_count);
+        map_handler_restore();
+        return ret;
+    }
+    ArchiveScratch scratch;
+    if (alloc_scratch(&scratch, settings) != 0) {
+        map_handler_restore();
+        return 1;
+    }
+    scratch.codec_threads = jobs;
+    for (int i = 0; i < file_count && ret == 0; i++) {
+        FileSink fs = { out, -1, settings->stream_pos };
+        PayloadSink sink = { file_sink_write, &fs, file_sink_tell };
+        ArchivedFile file;
+        if (archive_one_file(filenames[i], settings, &scratch, &sink, &file) != 0) {
+            ret = 1;
+            break;
+        }
+        /* Unchanged files archived while a solid block is open wait with it, keeping the index in input order */
+        ret = settings->solid && (file.solid || (file.in_base && settings->solid->count > 0))
+                  ? solid_add_member(settings->solid, settings, &scratch, &file)
+                  : write_file_entry(out, fs.entry_pos, &file, meta_gk, index);
+    }
+    if (ret == 0 && settings->solid) ret = solid_close(settings->solid, settings, &scratch);
+    free_scratch(&scratch);
+    map_handler_restore();
+    return ret;
+}
+
+/**
+ * @brief Loads the central index of the base archive of an incremental archive.
+ *
+ * The base must be a version 10+ archive protected by the same password. The
+ * path recorded in the new archive is the base's filename if both archives
+ * live in the same directory, and its absolute path otherwise.
+ *
+ * @param base_archive Path to the base archive.
+ * @param password Password of both archives.
+ * @param output Path of the archive being created.
+ * @param base_index Output index of the base archive, with lookup table.
+ * @param base_salt Output salt of the base archive (SALT_SIZE bytes).
+ * @param stored_path Output path to record (caller frees).
+ * @return 0 on success, 1 on failure.
+ */
+static int load_base_index(const char *base_archive, const char *password, const char *output,
+                           ArchiveIndex *base_index, uint8_t *base_salt, char **stored_path) {
+    ArchiveHeader header;
+    uint8_t file_key[AES_KEY_SIZE];
+    uint8_t meta_key[AES_KEY_SIZE];
+    FILE *in = open_archive(base_archive, password, &header, file_key, meta_key);
+    if (!in) return 1;
+    secure_zero(file_key, AES_KEY_SIZE);
+    struct stat base_st, out_st;
+    if (fstat(fileno(in), &base_st) == 0 && stat(output, &out_st) == 0 &&
+        base_st.st_dev == out_st.st_dev && base_st.st_ino == out_st.st_ino) {
+        fprintf(stderr, "Error: Base archive %s is the output archive\n", base_archive);
+        secure_zero(meta_key, AES_KEY_SIZE);
+        fclose(in);
+        return 1;
+    }
+    if (header.version < ARCHIVE_VERSION_INCREMENTAL) {
+        fprintf(stderr, "Error: Base archive %s has version %d; incremental archives need a version %d+ base\n",
+                base_archive, header.version, ARCHIVE_VERSION_INCREMENTAL);
+        secure_zero(meta_key, AES_KEY_SIZE);
+        fclose(in);
+        return 1;
+    }
+    GcmKey meta_gk;
+    if (gcm_key_init(&meta_gk, meta_key, 0) != 0) {
+        secure_zero(meta_key, AES_KEY_SIZE);
+        fclose(in);
+        return 1;
+    }
+    secure_zero(meta_key, AES_KEY_SIZE);
+    int ret = read_archive_index(in, &header, &meta_gk, base_index);
+    gcm_key_free(&meta_gk);
+    fclose(in);
+    if (ret != 0) return 1;
+    if (archive_index_build_lookup(base_index) != 0) {
+        archive_index_free(base_index);
+        return 1;
+    }
+    memcpy(base_salt, header.salt, SALT_SIZE);
+    char *base_real = realpath(base_archive, NULL);
+    char *base_copy = strdup(base_archive);
+    char *out_copy = strdup(output);
+    char *base_dir = base_copy ? realpath(dirname(base_copy), NULL) : NULL;
+    char *out_dir = out_copy ? realpath(dirname(out_copy), NULL) : NULL;
+    if (base_real && base_dir && out_dir && strcmp(base_dir, out_dir) == 0) {
+        const char *name = strrchr(base_real, '/');
+        *stored_path = strdup(name ? name + 1 : base_real);
+    } else {
+        *stored_path = base_real ? strdup(base_real) : NULL;
+    }
+    free(base_real);
+    free(base_copy);
+    free(out_copy);
+    free(base_dir);
+    free(out_dir);
+    if (!*stored_path) {
+        fprintf(stderr, "Error: Cannot resolve base archive path %s: %s\n", base_archive, strerror(errno));
+        archive_index_free(base_index);
+        return 1;
+    }
+    verbose_print(VERBOSE_BASIC, "Incremental archive on top of %s (%u files)", base_archive, header.file_count);
+    return 0;
+}
+
+/**
+ * @brief Writes a .slm archive; see archive_files() for the parameters.
+ *
+ * An output of "-" streams the archive to standard output: every entry is
+ * written whole with its sizes after the payload, and offsets are counted
+ * instead of asked from the file position, so nothing is ever rewritten.
+ *
+ * @param base Index of the base archive with lookup table (NULL for a full archive).
+ * @param base_salt Salt of the base archive.
+ * @param base_path Base archive path to record in the index.
+ * @return 0 on success, 1 on failure.
+ */
+static int create_archive(const char *output, const char **filenames, int file_count, const char *password,
+                          int force, int compression_level, CompressionAlgo compression_algo, const char *comment,
+                          const char *outdir, int dry_run, int weak_password, int jobs, int block_parallel,
+                          int dedup, int solid, int train_dict, const char *stdin_name, int use_uring,
+                          const ArchiveIndex *base,
+                          const uint8_t *base_salt, const char *base_path) {
+    if (!output || !filenames || !password || file_count <= 0 || file_count > MAX_FILES || jobs < 1) {
         fprintf(stderr, "Error: Invalid archive parameters\n");
         return 1;
     }
     if (check_password_strength(password, weak_password) != 0) {
         return 1;
     }
+    if (compression_algo > COMPRESSION_AUTO || compression_algo == COMPRESSION_STORE || !codec_available(compression_algo)) {
+        fprintf(stderr, "Error: Compression algorithm %s is not available in this build\n", codec_name(compression_algo));
+        return 1;
+    }
+    if (dedup && block_parallel) {
+        fprintf(stderr, "Error: Dedup mode cannot be combined with block-parallel mode\n");
+        return 1;
+    }
+    if (solid && (block_parallel || dedup)) {
+        fprintf(stderr, "Error: Solid mode cannot be combined with block-parallel or dedup mode\n");
+        return 1;
+    }
+    if (train_dict && (block_parallel || dedup || solid)) {
+        fprintf(stderr, "Error: Dictionary mode cannot be combined with block-parallel, dedup or solid mode\n");
+        return 1;
+    }
+    if (train_dict && compression_algo != COMPRESSION_ZLIB && compression_algo != COMPRESSION_ZSTD &&
+        compression_algo != COMPRESSION_AUTO) {
+        fprintf(stderr, "Error: Dictionary mode needs zlib, zstd or auto compression\n");
+        return 1;
+    }
     if (outdir && (strlen(outdir) >= MAX_OUTDIR - AES_NONCE_SIZE - AES_TAG_SIZE || has_path_traversal(outdir))) {
         fprintf(stderr, "Error: Invalid or too long output directory: %s\n", outdir);
         return 1;
     }
-    if (!force && !dry_run && access(output, F_OK) == 0) {
+    int stream = strcmp(output, "-") == 0;
+    if (stream && (block_parallel || dedup || solid || train_dict)) {
+        fprintf(stderr, "Error: Streamed archives cannot be combined with block-parallel, dedup, solid or dictionary mode\n");
+        return 1;
+    }
+    if (stream && !dry_run && isatty(STDOUT_FILENO)) {
+        fprintf(stderr, "Error: Refusing to write archive data to a terminal\n");
+        return 1;
+    }
+    int stdin_inputs = 0;
+    for (int i = 0; i < file_count; i++) stdin_inputs += filenames[i] && strcmp(filenames[i], "-") == 0;
+    if (stdin_inputs > 1) {
+        fprintf(stderr, "Error: Standard input can only be archived once\n");
+        return 1;
+    }
+    if (stdin_inputs && (block_parallel || dedup || solid)) {
+        fprintf(stderr, "Error: Standard input cannot be archived in block-parallel, dedup or solid mode\n");
+        return 1;
+    }
+    if (stdin_inputs && (!stdin_name || !*stdin_name || strlen(stdin_name) >= MAX_FILENAME ||
+                         has_path_traversal(stdin_name))) {
+        fprintf(stderr, "Error: Invalid or too long filename: %s\n", stdin_name ? stdin_name : "(null)");
+        return 1;
+    }
+    if (!force && !dry_run && !stream && access(output, F_OK) == 0) {
         fprintf(stderr, "Error: Output file %s exists. Use -f to overwrite.\n", output);
         return 1;
     }
+    uint8_t *dict = NULL;
+    size_t dict_len = 0;
+    CompressionAlgo dict_codec = compression_algo == COMPRESSION_AUTO ? AUTO_CODEC : compression_algo;
+    if (train_dict && train_dictionary(filenames, file_count, dict_codec, &dict, &dict_len) != 0) return 1;
     FILE *out = NULL;
     if (!dry_run) {
-        out = fopen(output, "wb");
+        /* A duplicate of standard output, so closing the archive leaves stdout itself open */
+        int stdout_fd = stream ? dup(STDOUT_FILENO) : -1;
+        out = stream ? (stdout_fd == -1 ? NULL : fdopen(stdout_fd, "wb")) : fopen(output, "wb");
         if (!out) {
+            if (stdout_fd != -1) close(stdout_fd);
+            free(dict);
             fprintf(stderr, "Error: Cannot open output file %s: %s\n", output, strerror(errno));
             return 1;
         }
@@ -59,31 +2056,43 @@ int archive_files(const char *output, const char **filenames, int file_count, co
     uint8_t salt[SALT_SIZE];
     if (RAND_bytes(salt, SALT_SIZE) != 1) {
         fprintf(stderr, "Error: Random number generation failed for salt\n");
+        free(dict);
         if (out) fclose(out);
         return 1;
     }
     verbose_print(VERBOSE_DEBUG, "Generated random salt");
     uint8_t file_key[AES_KEY_SIZE];
     uint8_t meta_key[AES_KEY_SIZE];
-    if (derive_key(password, salt, file_key, "file encryption") != 0 ||
-        derive_key(password, salt, meta_key, "metadata encryption") != 0) {
+    if (derive_archive_keys(password, salt, ARCHIVE_VERSION, file_key, meta_key) != 0) {
+        free(dict);
         if (out) fclose(out);
         return 1;
     }
     verbose_print(VERBOSE_DEBUG, "Derived encryption keys");
+    if (!dry_run) key_cache_store(password, salt, ARCHIVE_VERSION, file_key, meta_key);
     size_t comment_len = comment ? strlen(comment) : 0;
     if (comment_len > MAX_COMMENT - AES_NONCE_SIZE - AES_TAG_SIZE) {
         fprintf(stderr, "Error: Archive comment too long (max %d bytes)\n", MAX_COMMENT - AES_NONCE_SIZE - AES_TAG_SIZE);
         secure_zero(file_key, AES_KEY_SIZE);
         secure_zero(meta_key, AES_KEY_SIZE);
+        free(dict);
         if (out) fclose(out);
         return 1;
     }
     size_t outdir_len = outdir ? strlen(outdir) : 0;
-    ArchiveHeader header = { .magic = "SLM", .version = 6, .file_count = file_count,
+    ArchiveHeader header = { .magic = "SLM", .version = ARCHIVE_VERSION, .file_count = file_count,
                             .compression_level = compression_level, .compression_algo = compression_algo,
                             .comment_len = comment_len, .outdir_len = outdir_len };
     memset(header.reserved, 0, sizeof(header.reserved));
+    if (block_parallel) {
+        header.reserved[0] |= ARCHIVE_FLAG_BLOCKS;
+        header.reserved[1] = BLOCK_SIZE_LOG2;
+    }
+    if (base) header.reserved[0] |= ARCHIVE_FLAG_INCREMENTAL;
+    if (dedup) header.reserved[0] |= ARCHIVE_FLAG_DEDUP;
+    if (solid) header.reserved[0] |= ARCHIVE_FLAG_SOLID;
+    if (stream) header.reserved[0] |= ARCHIVE_FLAG_STREAM;
+    if (dict) header.reserved[0] |= ARCHIVE_FLAG_DICT;
     memcpy(header.salt, salt, SALT_SIZE);
     if (comment_len > 0) {
         uint8_t comment_nonce[AES_NONCE_SIZE];
@@ -92,6 +2101,7 @@ int archive_files(const char *output, const char **filenames, int file_count, co
             fprintf(stderr, "Error: Random number generation failed for comment nonce\n");
             secure_zero(file_key, AES_KEY_SIZE);
             secure_zero(meta_key, AES_KEY_SIZE);
+            free(dict);
             if (out) fclose(out);
             return 1;
         }
@@ -101,6 +2111,7 @@ int archive_files(const char *output, const char **filenames, int file_count, co
             fprintf(stderr, "Error: Failed to encrypt archive comment\n");
             secure_zero(file_key, AES_KEY_SIZE);
             secure_zero(meta_key, AES_KEY_SIZE);
+            free(dict);
             if (out) fclose(out);
             return 1;
         }
@@ -116,6 +2127,7 @@ int archive_files(const char *output, const char **filenames, int file_count, co
             fprintf(stderr, "Error: Random number generation failed for outdir nonce\n");
             secure_zero(file_key, AES_KEY_SIZE);
             secure_zero(meta_key, AES_KEY_SIZE);
+            free(dict);
             if (out) fclose(out);
             return 1;
         }
@@ -125,6 +2137,7 @@ int archive_files(const char *output, const char **filenames, int file_count, co
             fprintf(stderr, "Error: Failed to encrypt output directory\n");
             secure_zero(file_key, AES_KEY_SIZE);
             secure_zero(meta_key, AES_KEY_SIZE);
+            free(dict);
             if (out) fclose(out);
             return 1;
         }
@@ -136,6 +2149,7 @@ int archive_files(const char *output, const char **filenames, int file_count, co
     if (compute_hmac(file_key, (uint8_t *)&header, offsetof(ArchiveHeader, hmac), header.hmac) != 0) {
         secure_zero(file_key, AES_KEY_SIZE);
         secure_zero(meta_key, AES_KEY_SIZE);
+        free(dict);
         if (out) fclose(out);
         return 1;
     }
@@ -143,236 +2157,420 @@ int archive_files(const char *output, const char **filenames, int file_count, co
         fprintf(stderr, "Error: Failed to write archive header\n");
         secure_zero(file_key, AES_KEY_SIZE);
         secure_zero(meta_key, AES_KEY_SIZE);
+        free(dict);
         fclose(out);
         return 1;
     }
-    verbose_print(VERBOSE_BASIC, "Wrote archive header (version 6, compression %s level %d, comment len %u, outdir len %u)",
-                  compression_algo == COMPRESSION_ZLIB ? "zlib" : "LZMA", compression_level, comment_len, outdir_len);
+    verbose_print(VERBOSE_BASIC, "Wrote archive header (version %d, compression %s level %d, comment len %u, outdir len %u)",
+                  ARCHIVE_VERSION, codec_name(compression_algo), compression_level, comment_len, outdir_len);
+    if (block_parallel) {
+        verbose_print(VERBOSE_BASIC, "Block-parallel mode: %uMB blocks on %d threads", 1U << (BLOCK_SIZE_LOG2 - 20), jobs);
+    }
+    uint64_t stream_pos = sizeof(header);
+    if (stream) verbose_print(VERBOSE_BASIC, "Streaming archive to standard output");
     for (int i = 0; i < file_count; i++) {
         const char *filename = filenames[i];
         if (!filename || strlen(filename) >= MAX_FILENAME || has_path_traversal(filename)) {
             fprintf(stderr, "Error: Invalid or too long filename: %s\n", filename ? filename : "(null)");
             secure_zero(file_key, AES_KEY_SIZE);
             secure_zero(meta_key, AES_KEY_SIZE);
+            free(dict);
             if (out) fclose(out);
             return 1;
         }
-        verbose_print(VERBOSE_BASIC, "Processing file: %s", filename);
-        FILE *in = dry_run ? NULL : fopen(filename, "rb");
-        if (!dry_run && !in) {
-            fprintf(stderr, "Error: Cannot open input file %s: %s\n", filename, strerror(errno));
+    }
+    GcmKey meta_gk;
+    if (gcm_key_init(&meta_gk, meta_key, 1) != 0) {
+        secure_zero(file_key, AES_KEY_SIZE);
+        secure_zero(meta_key, AES_KEY_SIZE);
+        free(dict);
+        if (out) fclose(out);
+        return 1;
+    }
+    ArchiveIndex index;
+    archive_index_init(&index);
+    if ((base && archive_index_set_base(&index, base_salt, base_path) != 0) ||
+        (dict && archive_index_set_dict(&index, dict, dict_len) != 0)) {
+        archive_index_free(&index);
+        gcm_key_free(&meta_gk);
+        secure_zero(file_key, AES_KEY_SIZE);
+        secure_zero(meta_key, AES_KEY_SIZE);
+        free(dict);
+        if (out) fclose(out);
+        return 1;
+    }
+    uint8_t chunk_key[AES_KEY_SIZE];
+    DedupStore store;
+    if (dedup) {
+        if (hkdf_expand_key(file_key, chunk_key, "dedup chunks") != 0) {
+            archive_index_free(&index);
+            gcm_key_free(&meta_gk);
             secure_zero(file_key, AES_KEY_SIZE);
             secure_zero(meta_key, AES_KEY_SIZE);
+            free(dict);
             if (out) fclose(out);
             return 1;
         }
-        struct stat st;
-        if (dry_run ? stat(filename, &st) != 0 : fstat(fileno(in), &st) != 0) {
-            fprintf(stderr, "Error: Cannot stat input file %s: %s\n", filename, strerror(errno));
-            secure_zero(file_key, AES_KEY_SIZE);
-            secure_zero(meta_key, AES_KEY_SIZE);
-            if (in) fclose(in);
-            if (out) fclose(out);
-            return 1;
+        dedup_store_init(&store);
+        verbose_print(VERBOSE_BASIC, "Dedup mode: %uKB to %uKB content-defined chunks", DEDUP_MIN_CHUNK >> 10, DEDUP_MAX_CHUNK >> 10);
+    }
+    SolidBlock block = { .out = out, .index = &index, .payload_pos = -1 };
+    if (solid) {
+        verbose_print(VERBOSE_BASIC, "Solid mode: files under %uKB packed into %uMB blocks", SOLID_FILE_MAX >> 10,
+                      SOLID_BLOCK_SIZE >> 20);
+    }
+    ArchiveSettings settings = { .file_key = dedup ? chunk_key : file_key, .level = compression_level,
+                                 .algo = compression_algo, .block_size = block_parallel ? (size_t)1 << BLOCK_SIZE_LOG2 : 0,
+                                 .block_threads = jobs, .base = base, .dedup = dedup ? &store : NULL,
+                                 .solid = solid ? &block : NULL, .meta_key = meta_key,
+                                 .stream_pos = stream ? &stream_pos : NULL, .stdin_name = stdin_name,
+                                 .sparse = !block_parallel && !dedup && !stream, .dict = dict, .dict_len = dict_len,
+                                 .use_uring = use_uring };
+    int ret = create_archive_entries(out, filenames, file_count, &settings, &meta_gk, &index, jobs, dry_run);
+    free(block.members);
+    if (dedup) {
+        if (ret == 0 && !dry_run) {
+            verbose_print(VERBOSE_BASIC, "Deduplicated %lu of %lu bytes into %lu unique chunks",
+                          (unsigned long)store.dup_bytes, (unsigned long)(store.dup_bytes + store.unique_bytes),
+                          (unsigned long)store.count);
         }
-        size_t in_size = st.st_size;
-        uint32_t file_mode = st.st_mode & (S_IRWXU | S_IRWXG | S_IRWXO);
-        if (in_size == 0) {
-            verbose_print(VERBOSE_BASIC, "Processing empty file: %s", filename);
-            FileEntryPlain plain_entry = { .compressed_size = 0, .original_size = 0, .mode = file_mode, .reserved = 0 };
-            strncpy(plain_entry.filename, filename, MAX_FILENAME - 1);
-            plain_entry.filename[MAX_FILENAME - 1] = '\0';
-
-            uint8_t meta_nonce[AES_NONCE_SIZE];
-            if (!dry_run && RAND_bytes(meta_nonce, AES_NONCE_SIZE) != 1) {
-                fprintf(stderr, "Error: Random number generation failed for metadata nonce\n");
-                secure_zero(file_key, AES_KEY_SIZE);
-                secure_zero(meta_key, AES_KEY_SIZE);
-                if (out) fclose(out);
-                return 1;
-            }
-            verbose_print(VERBOSE_DEBUG, "Generated random metadata nonce");
-
-            FileEntry entry;
-            memcpy(entry.nonce, meta_nonce, AES_NONCE_SIZE);
-            size_t meta_enc_size;
-            if (!dry_run && encrypt_aes_gcm(meta_key, meta_nonce, (uint8_t *)&plain_entry, sizeof(FileEntryPlain),
-                                           entry.encrypted_data, &meta_enc_size, entry.tag) != 0) {
-                fprintf(stderr, "Error: Failed to encrypt metadata for %s\n", filename);
-                secure_zero(file_key, AES_KEY_SIZE);
-                secure_zero(meta_key, AES_KEY_SIZE);
-                if (out) fclose(out);
-                return 1;
-            }
-            verbose_print(VERBOSE_DEBUG, "Encrypted metadata");
+        dedup_store_free(&store);
+        secure_zero(chunk_key, AES_KEY_SIZE);
+    }
+    if (ret != 0) {
+        archive_index_free(&index);
+        gcm_key_free(&meta_gk);
+        secure_zero(file_key, AES_KEY_SIZE);
+        secure_zero(meta_key, AES_KEY_SIZE);
+        free(dict);
+        if (out) fclose(out);
+        return 1;
+    }
+    if (!dry_run && write_archive_index(out, stream ? (long)stream_pos : -1, &index, &meta_gk, 0) != 0) {
+        archive_index_free(&index);
+        gcm_key_free(&meta_gk);
+        secure_zero(file_key, AES_KEY_SIZE);
+        secure_zero(meta_key, AES_KEY_SIZE);
+        free(dict);
+        fclose(out);
+        return 1;
+    }
+    archive_index_free(&index);
+    gcm_key_free(&meta_gk);
+    free(dict);
+    secure_zero(file_key, AES_KEY_SIZE);
+    secure_zero(meta_key, AES_KEY_SIZE);
+    if (out && fclose(out) != 0) {
+        fprintf(stderr, "Error: Failed to write archive %s: %s\n", stream ? "to standard output" : output, strerror(errno));
+        return 1;
+    }
+    verbose_print(VERBOSE_BASIC, dry_run ? "Dry run completed for archive: %s" : "Archive created: %s",
+                  stream ? "standard output" : output);
+    return 0;
+}
 
-            if (!dry_run && fwrite(&entry, sizeof(entry), 1, out) != 1) {
-                fprintf(stderr, "Error: Failed to write metadata for %s\n", filename);
-                secure_zero(file_key, AES_KEY_SIZE);
-                secure_zero(meta_key, AES_KEY_SIZE);
-                if (out) fclose(out);
-                return 1;
-            }
-            verbose_print(VERBOSE_BASIC, "Archived empty file: %s (permissions: 0%o)", filename, file_mode);
-            if (in) fclose(in);
-            continue;
-        }
-        if (in_size > MAX_FILE_SIZE) {
-            fprintf(stderr, "Error: Input file %s exceeds max size (%llu bytes)\n", filename, MAX_FILE_SIZE);
-            secure_zero(file_key, AES_KEY_SIZE);
-            secure_zero(meta_key, AES_KEY_SIZE);
-            if (in) fclose(in);
-            if (out) fclose(out);
-            return 1;
-        }
-        verbose_print(VERBOSE_DEBUG, "File size: %lu bytes, mode: 0%o", in_size, file_mode);
-        uint8_t *in_buf = dry_run ? NULL : malloc(in_size);
-        if (!dry_run && !in_buf) {
-            fprintf(stderr, "Error: Memory allocation failed for input buffer\n");
-            secure_zero(file_key, AES_KEY_SIZE);
-            secure_zero(meta_key, AES_KEY_SIZE);
-            if (in) fclose(in);
-            if (out) fclose(out);
-            return 1;
-        }
-        size_t read_size = 0;
-        if (!dry_run) {
-            while (read_size < in_size) {
-                size_t chunk = fread(in_buf + read_size, 1, in_size - read_size, in);
-                if (chunk == 0) {
-                    if (feof(in)) {
-                        fprintf(stderr, "Error: Unexpected EOF reading input file %s (read %lu of %lu bytes)\n",
-                                filename, read_size, in_size);
-                    } else {
-                        fprintf(stderr, "Error: Failed to read input file %s: %s\n", filename, strerror(errno));
-                    }
-                    free(in_buf);
-                    secure_zero(file_key, AES_KEY_SIZE);
-                    secure_zero(meta_key, AES_KEY_SIZE);
-                    fclose(in);
-                    if (out) fclose(out);
-                    return 1;
-                }
-                read_size += chunk;
-            }
-        }
-        if (verbosity >= VERBOSE_DEBUG && !dry_run && in_size >= 4) {
-            fprintf(stderr, "First 4 bytes of %s: %02x %02x %02x %02x\n",
-                    filename, in_buf[0], in_buf[1], in_buf[2], in_buf[3]);
-        }
-        size_t comp_buf_size = in_size + (in_size / (compression_algo == COMPRESSION_ZLIB ? 100 : 4)) + 1024;
-        uint8_t *comp_buf = malloc(comp_buf_size);
-        if (!comp_buf) {
-            fprintf(stderr, "Error: Memory allocation failed for compression buffer (%lu bytes)\n", comp_buf_size);
-            if (in_buf) free(in_buf);
-            secure_zero(file_key, AES_KEY_SIZE);
-            secure_zero(meta_key, AES_KEY_SIZE);
-            if (in) fclose(in);
-            if (out) fclose(out);
-            return 1;
-        }
-        size_t comp_size = dry_run ? in_size : compress_data(in_buf, in_size, comp_buf, comp_buf_size, compression_level, compression_algo);
-        if (comp_size == 0) {
-            if (in_buf) free(in_buf);
-            free(comp_buf);
-            secure_zero(file_key, AES_KEY_SIZE);
-            secure_zero(meta_key, AES_KEY_SIZE);
-            if (in) fclose(in);
-            if (out) fclose(out);
-            return 1;
-        }
-        uint8_t file_nonce[AES_NONCE_SIZE];
-        if (!dry_run && RAND_bytes(file_nonce, AES_NONCE_SIZE) != 1) {
-            fprintf(stderr, "Error: Random number generation failed for file nonce\n");
-            if (in_buf) free(in_buf);
-            free(comp_buf);
-            secure_zero(file_key, AES_KEY_SIZE);
-            secure_zero(meta_key, AES_KEY_SIZE);
-            if (in) fclose(in);
-            if (out) fclose(out);
-            return 1;
-        }
-        verbose_print(VERBOSE_DEBUG, "Generated random file nonce");
-        uint8_t *enc_buf = dry_run ? NULL : malloc(comp_size);
-        if (!dry_run && !enc_buf) {
-            fprintf(stderr, "Error: Memory allocation failed for encryption buffer\n");
-            if (in_buf) free(in_buf);
-            free(comp_buf);
-            secure_zero(file_key, AES_KEY_SIZE);
-            secure_zero(meta_key, AES_KEY_SIZE);
-            if (in) fclose(in);
-            if (out) fclose(out);
-            return 1;
-        }
-        size_t enc_size;
-        uint8_t file_tag[AES_TAG_SIZE];
-        if (!dry_run && encrypt_aes_gcm(file_key, file_nonce, comp_buf, comp_size, enc_buf, &enc_size, file_tag) != 0) {
-            if (in_buf) free(in_buf);
-            free(comp_buf);
-            if (enc_buf) free(enc_buf);
-            secure_zero(file_key, AES_KEY_SIZE);
-            secure_zero(meta_key, AES_KEY_SIZE);
-            if (in) fclose(in);
-            if (out) fclose(out);
+/**
+ * @brief Archives and encrypts files into a .slm archive.
+ * @param output Path to the output archive file (.slm), or "-" to stream the archive to standard output.
+ * @param filenames Array of input file or directory paths.
+ * @param file_count Number of input files.
+ * @param password Password for encryption.
+ * @param force If 1, overwrite existing output file.
+ * @param compression_level Compression level (0-9).
+ * @param compression_algo Compression algorithm (zlib, LZMA, zstd, LZ4, or COMPRESSION_AUTO to store already compressed
+ *                         files and compress the rest with AUTO_CODEC).
+ * @param comment Archive comment (NULL if none).
+ * @param outdir Output directory for extraction (NULL if none).
+ * @param dry_run If 1, simulate archiving without writing to disk.
+ * @param weak_password If 1, allow weak passwords.
+ * @param jobs Number of worker threads compressing and encrypting files (1 = serial).
+ * @param block_parallel If 1, compress each file as independent blocks on jobs threads instead of
+ *                       compressing several files at once.
+ * @param dedup If 1, split files into content-defined chunks and store each distinct chunk once; files are
+ *              then compressed one at a time.
+ * @param solid If 1, pack files under SOLID_FILE_MAX into shared compressed blocks; files are then
+ *              compressed one at a time.
+ * @param train_dict If 1, train a compression dictionary on a sample of the small input files and compress
+ *                   every zlib and zstd file with it; the archive gets none if too few files can be sampled.
+ * @param base_archive Base archive of an incremental archive (NULL for a full archive). Files unchanged
+ *                     since the base are recorded in the index only and extracted from the base.
+ * @param stdin_name Filename recorded for standard input, archived when an input is "-".
+ * @param use_uring If 1, submit the archive writes of the worker pool through io_uring (HAVE_IO_URING builds).
+ * @return 0 on success, 1 on failure.
+ */
+int archive_files(const char *output, const char **filenames, int file_count, const char *password,
+                 int force, int compression_level, CompressionAlgo compression_algo, const char *comment,
+                 const char *outdir, int dry_run, int weak_password, int jobs, int block_parallel, int dedup,
+                 int solid, int train_dict, const char *base_archive, const char *stdin_name, int use_uring) {
+    if (!base_archive) {
+        return create_archive(output, filenames, file_count, password, force, compression_level, compression_algo,
+                              comment, outdir, dry_run, weak_password, jobs, block_parallel, dedup, solid, train_dict,
+                              stdin_name, use_uring, NULL, NULL, NULL);
+    }
+    if (!password) {
+        fprintf(stderr, "Error: Invalid archive parameters\n");
+        return 1;
+    }
+    ArchiveIndex base_index;
+    archive_index_init(&base_index);
+    uint8_t base_salt[SALT_SIZE];
+    char *base_path = NULL;
+    if (load_base_index(base_archive, password, output, &base_index, base_salt, &base_path) != 0) return 1;
+    int ret = create_archive(output, filenames, file_count, password, force, compression_level, compression_algo,
+                             comment, outdir, dry_run, weak_password, jobs, block_parallel, dedup, solid, train_dict,
+                             stdin_name, use_uring, &base_index, base_salt, base_path);
+    archive_index_free(&base_index);
+    free(base_path);
+    return ret;
+}
+
+/**
+ * @brief Compares two filenames for qsort().
+ * @param a Pointer to the first filename.
+ * @param b Pointer to the second filename.
+ * @return strcmp() of the filenames.
+ */
+static int compare_names(const void *a, const void *b) {
+    return strcmp(*(const char * const *)a, *(const char * const *)b);
+}
+
+/**
+ * @brief Finds a filename given more than once to one append run.
+ * @param filenames Input file paths ("-" for standard input).
+ * @param file_count Number of input files.
+ * @param stdin_name Filename recorded for standard input.
+ * @param repeat Output repeated filename (NULL if none).
+ * @return 0 on success, 1 on failure.
+ */
+static int find_repeated_name(const char **filenames, int file_count, const char *stdin_name, const char **repeat) {
+    *repeat = NULL;
+    const char **names = malloc(file_count * sizeof(char *));
+    if (!names) {
+        fprintf(stderr, "Error: Memory allocation failed for file list\n");
+        return 1;
+    }
+    for (int i = 0; i < file_count; i++) names[i] = strcmp(filenames[i], "-") == 0 ? stdin_name : filenames[i];
+    qsort(names, file_count, sizeof(char *), compare_names);
+    for (int i = 1; i < file_count && !*repeat; i++) {
+        if (strcmp(names[i - 1], names[i]) == 0) *repeat = names[i];
+    }
+    free(names);
+    return 0;
+}
+
+/**
+ * @brief Releases the disk blocks of the index an append superseded.
+ *
+ * The bytes stay in the archive (only the index of the last trailer is read)
+ * but are turned into a hole where the file system supports it, so repeated
+ * appends do not pile up stale indexes on disk.
+ *
+ * @param out Archive file.
+ * @param offset Archive offset of the old index.
+ * @param len Length of the old index and trailer.
+ */
+static void release_old_index(FILE *out, long offset, long len) {
+#ifdef FALLOC_FL_PUNCH_HOLE
+    if (fallocate(fileno(out), FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, offset, len) != 0) {
+        verbose_print(VERBOSE_DEBUG, "Cannot release the old index (%s), keeping its %ld bytes", strerror(errno), len);
+        return;
+    }
+    verbose_print(VERBOSE_DEBUG, "Released the old index (%ld bytes)", len);
+#else
+    (void)out;
+    (void)offset;
+    (void)len;
+#endif
+}
+
+/**
+ * @brief Appends files to an existing archive without rewriting its entries.
+ *
+ * The new entries are written after the old trailer, followed by the index
+ * extended with their records and a new trailer. No byte of the archive before
+ * the append is changed, the header included: its file count stays the count
+ * the archive was created with. The new trailer is the commit point. It is
+ * written only once the entries and index are synced to disk, and readers
+ * take the index from the trailer at the end of the file. Once it is synced
+ * too, the blocks of the old index are released. Existing payloads are never
+ * read, recompressed or re-encrypted. Files are compressed with the codec and
+ * level recorded in the header.
+ *
+ * A failed append cuts the file back to its old size. One interrupted by a
+ * crash before the commit leaves a file whose last bytes are not a valid
+ * trailer, which every reader refuses. The recovery rule is to truncate the
+ * file to the old size printed when the append started, which restores the
+ * archive as it was.
+ *
+ * Only version 17+ archives can be appended to. Older versions require the
+ * trailer to count exactly the files of the header, so binaries reading them
+ * would misread an appended archive. Block-parallel, dedup and streamed archives are refused;
+ * files appended to solid and incremental archives are stored on their own,
+ * and those appended to dictionary archives are compressed with the archive's
+ * dictionary.
+ *
+ * @param archive Path to the archive file (.slm).
+ * @param filenames Input file paths ("-" for standard input).
+ * @param file_count Number of input files.
+ * @param password Password of the archive.
+ * @param jobs Number of worker threads compressing and encrypting files (1 = serial).
+ * @param stdin_name Filename recorded for standard input, archived when an input is "-".
+ * @param use_uring If 1, submit the archive writes of the worker pool through io_uring (HAVE_IO_URING builds).
+ * @return 0 on success, 1 on failure.
+ */
+int append_files(const char *archive, const char **filenames, int file_count, const char *password, int jobs,
+                 const char *stdin_name, int use_uring) {
+    if (!archive || !filenames || !password || file_count <= 0 || file_count > MAX_FILES || jobs < 1) {
+        fprintf(stderr, "Error: Invalid append parameters\n");
+        return 1;
+    }
+    if (strcmp(archive, "-") == 0) {
+        fprintf(stderr, "Error: Files can only be appended to an archive file\n");
+        return 1;
+    }
+    int stdin_inputs = 0;
+    for (int i = 0; i < file_count; i++) {
+        const char *filename = filenames[i];
+        if (!filename || strlen(filename) >= MAX_FILENAME || has_path_traversal(filename)) {
+            fprintf(stderr, "Error: Invalid or too long filename: %s\n", filename ? filename : "(null)");
             return 1;
         }
-        verbose_print(VERBOSE_DEBUG, "Encrypted file to %lu bytes", enc_size);
-        FileEntryPlain plain_entry = { .compressed_size = enc_size, .original_size = in_size,
-                                      .mode = file_mode, .reserved = 0 };
-        strncpy(plain_entry.filename, filename, MAX_FILENAME - 1);
-        plain_entry.filename[MAX_FILENAME - 1] = '\0';
-        uint8_t meta_nonce[AES_NONCE_SIZE];
-        if (!dry_run && RAND_bytes(meta_nonce, AES_NONCE_SIZE) != 1) {
-            fprintf(stderr, "Error: Random number generation failed for metadata nonce\n");
-            if (in_buf) free(in_buf);
-            free(comp_buf);
-            if (enc_buf) free(enc_buf);
-            secure_zero(file_key, AES_KEY_SIZE);
-            secure_zero(meta_key, AES_KEY_SIZE);
-            if (in) fclose(in);
-            if (out) fclose(out);
-            return 1;
+        stdin_inputs += strcmp(filename, "-") == 0;
+    }
+    if (stdin_inputs > 1) {
+        fprintf(stderr, "Error: Standard input can only be archived once\n");
+        return 1;
+    }
+    if (stdin_inputs && (!stdin_name || !*stdin_name || strlen(stdin_name) >= MAX_FILENAME ||
+                         has_path_traversal(stdin_name))) {
+        fprintf(stderr, "Error: Invalid or too long filename: %s\n", stdin_name ? stdin_name : "(null)");
+        return 1;
+    }
+    ArchiveHeader header;
+    uint8_t file_key[AES_KEY_SIZE];
+    uint8_t meta_key[AES_KEY_SIZE];
+    FILE *in = open_archive(archive, password, &header, file_key, meta_key);
+    if (!in) return 1;
+    uint8_t flags = header.reserved[0];
+    int refused = 1;
+    if (header.version < ARCHIVE_VERSION_APPEND) {
+        fprintf(stderr, "Error: Archive %s has version %d; files can only be appended to version %d+ archives\n",
+                archive, header.version, ARCHIVE_VERSION_APPEND);
+    } else if (flags & (ARCHIVE_FLAG_BLOCKS | ARCHIVE_FLAG_DEDUP | ARCHIVE_FLAG_STREAM)) {
+        fprintf(stderr, "Error: Files cannot be appended to %s archives\n",
+                flags & ARCHIVE_FLAG_BLOCKS ? "block-parallel" : flags & ARCHIVE_FLAG_DEDUP ? "dedup" : "streamed");
+    } else if (header.compression_algo > COMPRESSION_AUTO || header.compression_algo == COMPRESSION_STORE ||
+               !codec_available(header.compression_algo) || header.compression_level > 9) {
+        fprintf(stderr, "Error: Compression algorithm %s of the archive is not available in this build\n",
+                header.compression_algo > COMPRESSION_AUTO ? "unknown" : codec_name(header.compression_algo));
+    } else {
+        refused = 0;
+    }
+    GcmKey meta_gk;
+    ArchiveIndex index;
+    ArchiveTrailer trailer;
+    memset(&trailer, 0, sizeof(trailer));
+    archive_index_init(&index);
+    if (refused || gcm_key_init(&meta_gk, meta_key, 0) != 0) {
+        secure_zero(file_key, AES_KEY_SIZE);
+        secure_zero(meta_key, AES_KEY_SIZE);
+        fclose(in);
+        return 1;
+    }
+    int ret = read_archive_index(in, &header, &meta_gk, &index);
+    gcm_key_free(&meta_gk);
+    /* The trailer gives the offset the new entries start at */
+    if (ret == 0) ret = read_archive_trailer(in, &header, &trailer);
+    fclose(in);
+    if (ret == 0 && index.count + (uint64_t)file_count > MAX_FILES) {
+        fprintf(stderr, "Error: Too many files in archive (max %d)\n", MAX_FILES);
+        ret = 1;
+    }
+    if (ret == 0) ret = archive_index_build_lookup(&index);
+    /* The index buffer moves as records are added, so the encoders get a copy of the dictionary */
+    uint8_t *dict = NULL;
+    if (ret == 0 && index.dict_len > 0) {
+        dict = malloc(index.dict_len);
+        if (!dict) {
+            fprintf(stderr, "Error: Memory allocation failed for compression dictionary\n");
+            ret = 1;
+        } else {
+            memcpy(dict, index.data + index.dict_offset, index.dict_len);
         }
-        verbose_print(VERBOSE_DEBUG, "Generated random metadata nonce");
-        FileEntry entry;
-        memcpy(entry.nonce, meta_nonce, AES_NONCE_SIZE);
-        size_t meta_enc_size;
-        if (!dry_run && encrypt_aes_gcm(meta_key, meta_nonce, (uint8_t *)&plain_entry, sizeof(FileEntryPlain),
-                                       entry.encrypted_data, &meta_enc_size, entry.tag) != 0) {
-            fprintf(stderr, "Error: Failed to encrypt metadata for %s\n", filename);
-            if (in_buf) free(in_buf);
-            free(comp_buf);
-            if (enc_buf) free(enc_buf);
-            secure_zero(file_key, AES_KEY_SIZE);
-            secure_zero(meta_key, AES_KEY_SIZE);
-            if (in) fclose(in);
-            if (out) fclose(out);
-            return 1;
+    }
+    for (int i = 0; i < file_count && ret == 0; i++) {
+        IndexEntry entry;
+        const char *name = strcmp(filenames[i], "-") == 0 ? stdin_name : filenames[i];
+        if (archive_index_find(&index, name, &entry)) {
+            fprintf(stderr, "Error: %s is already in archive %s\n", name, archive);
+            ret = 1;
         }
-        verbose_print(VERBOSE_DEBUG, "Encrypted metadata");
-        if (!dry_run && (fwrite(&entry, sizeof(entry), 1, out) != 1 ||
-                         fwrite(file_nonce, AES_NONCE_SIZE, 1, out) != 1 ||
-                         fwrite(file_tag, AES_TAG_SIZE, 1, out) != 1 ||
-                         fwrite(enc_buf, 1, enc_size, out) != enc_size)) {
-            fprintf(stderr, "Error: Failed to write encrypted data for %s\n", filename);
-            if (in_buf) free(in_buf);
-            free(comp_buf);
-            if (enc_buf) free(enc_buf);
-            secure_zero(file_key, AES_KEY_SIZE);
-            secure_zero(meta_key, AES_KEY_SIZE);
-            fclose(in);
-            if (out) fclose(out);
-            return 1;
+    }
+    /* A name given twice would be added twice, and extracting the second copy fails */
+    const char *repeat;
+    if (ret == 0 && find_repeated_name(filenames, file_count, stdin_name, &repeat) != 0) ret = 1;
+    if (ret == 0 && repeat) {
+        fprintf(stderr, "Error: %s is already in archive %s\n", repeat, archive);
+        ret = 1;
+    }
+    FILE *out = ret == 0 ? fopen(archive, "r+b") : NULL;
+    if (ret == 0 && !out) {
+        fprintf(stderr, "Error: Cannot open archive file %s for writing: %s\n", archive, strerror(errno));
+        ret = 1;
+    }
+    long index_offset = (long)trailer.index_offset;
+    long old_size = index_offset + (long)trailer.index_size + (long)sizeof(trailer);
+    /* Appends leave the header alone, so the size tells whether another one ran since the archive was read */
+    ArchiveHeader current;
+    struct stat st;
+    if (out && (fread(&current, sizeof(current), 1, out) != 1 || memcmp(&current, &header, sizeof(header)) != 0 ||
+                fstat(fileno(out), &st) != 0 || st.st_size != old_size)) {
+        fprintf(stderr, "Error: Archive %s changed while it was opened\n", archive);
+        ret = 1;
+    }
+    if (ret == 0 && gcm_key_init(&meta_gk, meta_key, 1) != 0) ret = 1;
+    if (ret != 0) {
+        free(dict);
+        archive_index_free(&index);
+        secure_zero(file_key, AES_KEY_SIZE);
+        secure_zero(meta_key, AES_KEY_SIZE);
+        if (out) fclose(out);
+        return 1;
+    }
+    verbose_print(VERBOSE_BASIC, "Appending %d files to %s (%u files, %ld bytes, compression %s level %d)", file_count,
+                  archive, index.count, old_size, codec_name(header.compression_algo), header.compression_level);
+    /* The old trailer stays the last valid one until the new trailer is on disk */
+    if (fseek(out, old_size, SEEK_SET) != 0) {
+        fprintf(stderr, "Error: Failed to prepare archive %s for appending: %s\n", archive, strerror(errno));
+        ret = 1;
+    }
+    ArchiveSettings settings = { .file_key = file_key, .level = header.compression_level,
+                                 .algo = header.compression_algo, .block_threads = jobs, .meta_key = meta_key,
+                                 .stdin_name = stdin_name, .sparse = header.version >= ARCHIVE_VERSION_SPARSE,
+                                 .dict = dict, .dict_len = index.dict_len, .use_uring = use_uring };
+    if (ret == 0) ret = create_archive_entries(out, filenames, file_count, &settings, &meta_gk, &index, jobs, 0);
+    if (ret == 0) ret = write_archive_index(out, -1, &index, &meta_gk, 1);
+    if (ret != 0) {
+        /* Nothing before old_size was changed, so cutting the file restores the archive */
+        if (fflush(out) != 0 || ftruncate(fileno(out), old_size) != 0) {
+            fprintf(stderr, "Error: Failed to remove the partial append; truncate %s to %ld bytes to restore it\n",
+                    archive, old_size);
+        } else {
+            verbose_print(VERBOSE_BASIC, "Restored archive %s, no files were appended", archive);
         }
-        verbose_print(VERBOSE_BASIC, "Archived file: %s (permissions: 0%o)", filename, file_mode);
-        if (in_buf) free(in_buf);
-        free(comp_buf);
-        if (enc_buf) free(enc_buf);
-        if (in) fclose(in);
     }
+    if (ret == 0) release_old_index(out, index_offset, old_size - index_offset);
+    uint32_t total = index.count;
+    archive_index_free(&index);
+    free(dict);
+    gcm_key_free(&meta_gk);
     secure_zero(file_key, AES_KEY_SIZE);
     secure_zero(meta_key, AES_KEY_SIZE);
-    if (out) fclose(out);
-    verbose_print(VERBOSE_BASIC, dry_run ? "Dry run completed for archive: %s" : "Archive created: %s", output);
+    if (fclose(out) != 0 && ret == 0) {
+        fprintf(stderr, "Error: Failed to write archive %s: %s\n", archive, strerror(errno));
+        ret = 1;
+    }
+    if (ret != 0) return 1;
+    verbose_print(VERBOSE_BASIC, "Appended %d files to %s (%u files)", file_count, archive, total);
     return 0;
 }
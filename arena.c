@@ -0,0 +1,156 @@
+/**
+ * @file arena.c
+ * @brief Path arena and scratch buffer pool for Seclume.
+ */
+
+#include "seclume.h"
+#include <string.h>
+#include <stdlib.h>
+#include <stddef.h>
+
+/**
+ * @brief Initializes an empty path arena.
+ * @param arena Arena to initialize.
+ */
+void path_arena_init(PathArena *arena) {
+    arena->head = NULL;
+}
+
+/**
+ * @brief Frees every block of a path arena.
+ * @param arena Arena to free.
+ */
+void path_arena_free(PathArena *arena) {
+    while (arena->head) {
+        ArenaBlock *block = arena->head;
+        arena->head = block->next;
+        free(block);
+    }
+}
+
+/**
+ * @brief Copies a string into the arena.
+ *
+ * Strings are packed into ARENA_BLOCK_SIZE blocks; a string longer than a
+ * block gets a block of its own.
+ *
+ * @param arena Path arena.
+ * @param str String to copy.
+ * @return The copy, or NULL if allocation failed.
+ */
+char *path_arena_strdup(PathArena *arena, const char *str) {
+    size_t len = strlen(str) + 1;
+    ArenaBlock *block = arena->head;
+    if (!block || block->cap - block->used < len) {
+        size_t cap = len > ARENA_BLOCK_SIZE ? len : ARENA_BLOCK_SIZE;
+        block = malloc(sizeof(ArenaBlock) + cap);
+        if (!block) {
+            fprintf(stderr, "Error: Memory allocation failed for path arena\n");
+            return NULL;
+        }
+        block->used = 0;
+        block->cap = cap;
+        block->next = arena->head;
+        arena->head = block;
+    }
+    char *copy = block->data + block->used;
+    memcpy(copy, str, len);
+    block->used += len;
+    return copy;
+}
+
+/**
+ * @brief Initializes an empty buffer pool.
+ * @param pool Pool to initialize.
+ */
+void buffer_pool_init(BufferPool *pool) {
+    memset(pool->free_lists, 0, sizeof(pool->free_lists));
+    pool->cached = 0;
+    pthread_mutex_init(&pool->lock, NULL);
+}
+
+/**
+ * @brief Frees every cached buffer of a pool. Buffers still handed out must be returned first.
+ * @param pool Pool to free.
+ */
+void buffer_pool_free(BufferPool *pool) {
+    for (int c = 0; c < POOL_CLASSES; c++) {
+        while (pool->free_lists[c]) {
+            PoolBuffer *buf = pool->free_lists[c];
+            pool->free_lists[c] = buf->next;
+            free(buf);
+        }
+    }
+    pool->cached = 0;
+    pthread_mutex_destroy(&pool->lock);
+}
+
+/**
+ * @brief Returns the size class holding buffers of at least len bytes.
+ * @param len Requested size.
+ * @return Size class, or -1 if len exceeds the largest class.
+ */
+static int pool_class(size_t len) {
+    for (int c = 0; c < POOL_CLASSES; c++) {
+        if (len <= (size_t)1 << (POOL_CLASS_MIN_LOG2 + c)) return c;
+    }
+    return -1;
+}
+
+/**
+ * @brief Hands out a buffer of at least len bytes, reusing a cached one when possible.
+ * @param pool Buffer pool.
+ * @param len Requested size.
+ * @return Buffer (contents undefined), or NULL if allocation failed.
+ */
+void *buffer_pool_get(BufferPool *pool, size_t len) {
+    int c = pool_class(len);
+    if (c >= 0) {
+        pthread_mutex_lock(&pool->lock);
+        PoolBuffer *buf = pool->free_lists[c];
+        if (buf) {
+            pool->free_lists[c] = buf->next;
+            pool->cached -= buf->cap;
+        }
+        pthread_mutex_unlock(&pool->lock);
+        if (buf) {
+            buf->len = len;
+            return buf->data;
+        }
+    }
+    size_t cap = c >= 0 ? (size_t)1 << (POOL_CLASS_MIN_LOG2 + c) : len;
+    PoolBuffer *buf = malloc(sizeof(PoolBuffer) + cap);
+    if (!buf) {
+        fprintf(stderr, "Error: Memory allocation failed for scratch buffer\n");
+        return NULL;
+    }
+    buf->cap = cap;
+    buf->len = len;
+    return buf->data;
+}
+
+/**
+ * @brief Wipes a buffer and returns it to the pool, freeing it if the cache is full.
+ *
+ * Only the requested length is wiped; the holder must not write past it.
+ *
+ * @param pool Buffer pool.
+ * @param data Buffer from buffer_pool_get (NULL is ignored).
+ */
+void buffer_pool_put(BufferPool *pool, void *data) {
+    if (!data) return;
+    PoolBuffer *buf = (PoolBuffer *)((uint8_t *)data - offsetof(PoolBuffer, data));
+    secure_zero(buf->data, buf->len);
+    int c = pool_class(buf->cap);
+    if (c >= 0 && buf->cap == (size_t)1 << (POOL_CLASS_MIN_LOG2 + c)) {
+        pthread_mutex_lock(&pool->lock);
+        if (pool->cached + buf->cap <= POOL_CACHE_MAX) {
+            buf->next = pool->free_lists[c];
+            pool->free_lists[c] = buf;
+            pool->cached += buf->cap;
+            buf = NULL;
+        }
+        pthread_mutex_unlock(&pool->lock);
+    }
+    free(buf);
+}
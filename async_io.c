@@ -0,0 +1,376 @@
+/**
+ * @file async_io.c
+ * @brief Write-behind of output buffers on a helper thread or through io_uring, two writes in flight.
+ */
+
+#define _DEFAULT_SOURCE /* syscall() in <unistd.h>, MAP_POPULATE in <sys/mman.h> */
+
+#include "seclume.h"
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#ifdef HAVE_IO_URING
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#endif
+
+/**
+ * @brief Writes a whole buffer at a file offset.
+ * @param fd Output file.
+ * @param data Data to write.
+ * @param len Length of data.
+ * @param offset File offset.
+ * @return 0 on success, the errno of the failure otherwise.
+ */
+static int write_all(int fd, const uint8_t *data, size_t len, uint64_t offset) {
+    while (len > 0) {
+        ssize_t n = pwrite(fd, data, len, offset);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return n < 0 ? errno : EIO;
+        data += n;
+        len -= n;
+        offset += n;
+    }
+    return 0;
+}
+
+/**
+ * @brief Returns the posted write that was posted first.
+ * @param wb Writer state (locked).
+ * @return Oldest busy slot, or NULL if every slot is idle.
+ */
+static WriteSlot *oldest_slot(WriteBehind *wb) {
+    WriteSlot *oldest = NULL;
+    for (int i = 0; i < WRITE_BEHIND_SLOTS; i++) {
+        if (wb->slots[i].data && (!oldest || wb->slots[i].seq < oldest->seq)) oldest = &wb->slots[i];
+    }
+    return oldest;
+}
+
+/**
+ * @brief Writer thread: writes posted buffers in post order until stopped.
+ * @param arg WriteBehind.
+ * @return NULL.
+ */
+static void *write_behind_thread(void *arg) {
+    WriteBehind *wb = arg;
+    pthread_mutex_lock(&wb->lock);
+    for (;;) {
+        WriteSlot *slot;
+        while (!(slot = oldest_slot(wb)) && !wb->stop) pthread_cond_wait(&wb->cond, &wb->lock);
+        if (!slot) break;
+        int fd = slot->fd;
+        const uint8_t *data = slot->data;
+        size_t len = slot->len;
+        uint64_t offset = slot->offset;
+        pthread_mutex_unlock(&wb->lock);
+        StageTimer timer;
+        stage_begin(&timer);
+        int error = write_all(fd, data, len, offset);
+        stage_end(&timer, STAGE_WRITE, error ? 0 : len);
+        pthread_mutex_lock(&wb->lock);
+        if (error && !wb->error) wb->error = error;
+        slot->data = NULL;
+        pthread_cond_broadcast(&wb->cond);
+    }
+    pthread_mutex_unlock(&wb->lock);
+    return NULL;
+}
+
+#ifdef HAVE_IO_URING
+/** @brief Submission queue entries of the ring (at least WRITE_BEHIND_SLOTS) */
+#define URING_ENTRIES 4
+/** @brief Largest length of one submitted write (longer posts are written in pieces) */
+#define URING_MAX_WRITE (1U << 30)
+
+/**
+ * @brief Returns a field of a mapped ring.
+ * @param ring Mapped ring.
+ * @param offset Offset of the field from the io_uring_params.
+ * @return Pointer to the field.
+ */
+static unsigned *ring_field(void *ring, unsigned offset) {
+    return (unsigned *)((uint8_t *)ring + offset);
+}
+
+/**
+ * @brief Unmaps the rings and closes the io_uring instance.
+ * @param wb Writer state.
+ */
+static void uring_free(WriteBehind *wb) {
+    if (wb->sqes && wb->sqes != MAP_FAILED) munmap(wb->sqes, wb->sqes_size);
+    if (wb->cq_ring_size && wb->cq_ring && wb->cq_ring != MAP_FAILED) munmap(wb->cq_ring, wb->cq_ring_size);
+    if (wb->sq_ring && wb->sq_ring != MAP_FAILED) munmap(wb->sq_ring, wb->sq_ring_size);
+    close(wb->ring_fd);
+}
+
+/**
+ * @brief Creates the io_uring instance and maps its rings.
+ * @param wb Writer state.
+ * @return 0 on success, the errno of the failure otherwise.
+ */
+static int uring_setup(WriteBehind *wb) {
+    struct io_uring_params p;
+    memset(&p, 0, sizeof(p));
+    wb->ring_fd = syscall(__NR_io_uring_setup, URING_ENTRIES, &p);
+    if (wb->ring_fd < 0) return errno;
+    wb->sq_ring_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    wb->cq_ring_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+        if (wb->cq_ring_size > wb->sq_ring_size) wb->sq_ring_size = wb->cq_ring_size;
+        wb->cq_ring_size = 0;
+    }
+    wb->sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+    wb->sq_ring = mmap(NULL, wb->sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                       wb->ring_fd, IORING_OFF_SQ_RING);
+    wb->cq_ring = wb->cq_ring_size ? mmap(NULL, wb->cq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                                          wb->ring_fd, IORING_OFF_CQ_RING)
+                                   : wb->sq_ring;
+    wb->sqes = mmap(NULL, wb->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, wb->ring_fd, IORING_OFF_SQES);
+    if (wb->sq_ring == MAP_FAILED || wb->cq_ring == MAP_FAILED || wb->sqes == MAP_FAILED) {
+        int error = errno;
+        uring_free(wb);
+        return error;
+    }
+    wb->sq_off[0] = p.sq_off.head;
+    wb->sq_off[1] = p.sq_off.tail;
+    wb->sq_off[2] = p.sq_off.ring_mask;
+    wb->sq_off[3] = p.sq_off.array;
+    wb->cq_off[0] = p.cq_off.head;
+    wb->cq_off[1] = p.cq_off.tail;
+    wb->cq_off[2] = p.cq_off.ring_mask;
+    wb->cqes_off = p.cq_off.cqes;
+    return 0;
+}
+
+/**
+ * @brief Submits the write of a slot to the ring, without waiting for it.
+ *
+ * If the kernel refuses the submission, the entry is taken back and the write
+ * fails.
+ *
+ * @param wb Writer state.
+ * @param slot Slot with a posted write; its index is the user data of the entry.
+ */
+static void uring_submit(WriteBehind *wb, int slot) {
+    WriteSlot *ws = &wb->slots[slot];
+    unsigned *tail = ring_field(wb->sq_ring, wb->sq_off[1]);
+    unsigned t = *tail;
+    unsigned idx = t & *ring_field(wb->sq_ring, wb->sq_off[2]);
+    struct io_uring_sqe *sqe = (struct io_uring_sqe *)wb->sqes + idx;
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = IORING_OP_WRITE;
+    sqe->fd = ws->fd;
+    sqe->addr = (uint64_t)(uintptr_t)ws->data;
+    sqe->len = ws->len < URING_MAX_WRITE ? ws->len : URING_MAX_WRITE;
+    sqe->off = ws->offset;
+    sqe->user_data = slot;
+    ring_field(wb->sq_ring, wb->sq_off[3])[idx] = idx;
+    __atomic_store_n(tail, t + 1, __ATOMIC_RELEASE);
+    int ret;
+    do {
+        ret = syscall(__NR_io_uring_enter, wb->ring_fd, 1, 0, 0, NULL, 0);
+    } while (ret < 0 && errno == EINTR);
+    if (ret < 0) {
+        if (!wb->error) wb->error = errno;
+        if (__atomic_load_n(ring_field(wb->sq_ring, wb->sq_off[0]), __ATOMIC_ACQUIRE) == t) {
+            __atomic_store_n(tail, t, __ATOMIC_RELEASE);
+        }
+        ws->data = NULL;
+    }
+}
+
+/**
+ * @brief Checks whether a slot, or any slot, still has a write in flight.
+ * @param wb Writer state.
+ * @param slot Slot to check, or -1 for all of them.
+ * @return 1 if the write is not finished, 0 otherwise.
+ */
+static int uring_busy(const WriteBehind *wb, int slot) {
+    if (slot >= 0) return wb->slots[slot].data != NULL;
+    for (int i = 0; i < WRITE_BEHIND_SLOTS; i++) {
+        if (wb->slots[i].data) return 1;
+    }
+    return 0;
+}
+
+/**
+ * @brief Reaps completions until a slot (or every slot) is idle, resubmitting short writes.
+ *
+ * Completions already in the ring are taken without a system call; the call
+ * only blocks in io_uring_enter() while the awaited write is still in flight.
+ * Completions of other slots found on the way are processed too.
+ *
+ * @param wb Writer state.
+ * @param slot Slot to wait for, or -1 for all of them.
+ */
+static void uring_complete(WriteBehind *wb, int slot) {
+    unsigned *head = ring_field(wb->cq_ring, wb->cq_off[0]);
+    unsigned mask = *ring_field(wb->cq_ring, wb->cq_off[2]);
+    uint64_t done = 0;
+    StageTimer timer;
+    stage_begin(&timer);
+    while (uring_busy(wb, slot)) {
+        unsigned h = *head;
+        if (h == __atomic_load_n(ring_field(wb->cq_ring, wb->cq_off[1]), __ATOMIC_ACQUIRE)) {
+            if (syscall(__NR_io_uring_enter, wb->ring_fd, 0, 1, IORING_ENTER_GETEVENTS, NULL, 0) < 0 &&
+                errno != EINTR) {
+                if (!wb->error) wb->error = errno;
+                /* The ring is unusable: drop the writes still in flight */
+                for (int i = 0; i < WRITE_BEHIND_SLOTS; i++) wb->slots[i].data = NULL;
+            }
+            continue;
+        }
+        struct io_uring_cqe *cqe = (struct io_uring_cqe *)((uint8_t *)wb->cq_ring + wb->cqes_off) + (h & mask);
+        int res = cqe->res;
+        uint64_t user_data = cqe->user_data;
+        __atomic_store_n(head, h + 1, __ATOMIC_RELEASE);
+        if (user_data >= WRITE_BEHIND_SLOTS || !wb->slots[user_data].data) continue;
+        WriteSlot *ws = &wb->slots[user_data];
+        if (res == -EINTR || res == -EAGAIN) {
+            uring_submit(wb, (int)user_data);
+        } else if (res <= 0) {
+            if (!wb->error) wb->error = res < 0 ? -res : EIO;
+            ws->data = NULL;
+        } else {
+            done += res;
+            ws->data += res;
+            ws->len -= res;
+            ws->offset += res;
+            if (ws->len == 0) ws->data = NULL;
+            else uring_submit(wb, (int)user_data);
+        }
+    }
+    /* Counts the time the caller waited for writes to complete */
+    if (done) stage_end(&timer, STAGE_WRITE, done);
+}
+#endif
+
+/**
+ * @brief Starts the writer.
+ *
+ * If the io_uring cannot be created (old kernel, or disabled by policy), writes
+ * fall back to the helper thread.
+ *
+ * @param wb Writer state to initialize.
+ * @param use_uring If 1, submit writes through io_uring (HAVE_IO_URING builds only).
+ * @return 0 on success, 1 on failure.
+ */
+int write_behind_start(WriteBehind *wb, int use_uring) {
+    memset(wb, 0, sizeof(*wb));
+#ifdef HAVE_IO_URING
+    if (use_uring) {
+        int error = uring_setup(wb);
+        if (error == 0) {
+            wb->uring = 1;
+            verbose_print(VERBOSE_DEBUG, "Writing output through io_uring");
+            return 0;
+        }
+        verbose_print(VERBOSE_BASIC, "io_uring is not available (%s), writing output on a helper thread", strerror(error));
+        memset(wb, 0, sizeof(*wb));
+    }
+#else
+    (void)use_uring;
+#endif
+    pthread_mutex_init(&wb->lock, NULL);
+    pthread_cond_init(&wb->cond, NULL);
+    if (pthread_create(&wb->thread, NULL, write_behind_thread, wb) != 0) {
+        fprintf(stderr, "Error: Failed to start writer thread\n");
+        pthread_cond_destroy(&wb->cond);
+        pthread_mutex_destroy(&wb->lock);
+        return 1;
+    }
+    return 0;
+}
+
+/**
+ * @brief Waits for the write posted to a slot to finish; writes in other slots stay in flight.
+ * @param wb Writer state.
+ * @param slot Slot to wait for.
+ * @return 0 if every write since the last wait succeeded, the errno of the failure otherwise.
+ */
+int write_behind_wait_slot(WriteBehind *wb, int slot) {
+#ifdef HAVE_IO_URING
+    if (wb->uring) {
+        uring_complete(wb, slot);
+        int error = wb->error;
+        wb->error = 0;
+        return error;
+    }
+#endif
+    pthread_mutex_lock(&wb->lock);
+    while (wb->slots[slot].data) pthread_cond_wait(&wb->cond, &wb->lock);
+    int error = wb->error;
+    wb->error = 0;
+    pthread_mutex_unlock(&wb->lock);
+    return error;
+}
+
+/**
+ * @brief Waits for every posted write to finish.
+ * @param wb Writer state.
+ * @return 0 if every write since the last wait succeeded, the errno of the failure otherwise.
+ */
+int write_behind_wait(WriteBehind *wb) {
+#ifdef HAVE_IO_URING
+    if (wb->uring) {
+        uring_complete(wb, -1);
+        int error = wb->error;
+        wb->error = 0;
+        return error;
+    }
+#endif
+    pthread_mutex_lock(&wb->lock);
+    while (oldest_slot(wb)) pthread_cond_wait(&wb->cond, &wb->lock);
+    int error = wb->error;
+    wb->error = 0;
+    pthread_mutex_unlock(&wb->lock);
+    return error;
+}
+
+/**
+ * @brief Posts a write to a slot; the slot must be idle (see write_behind_wait_slot()).
+ * @param wb Writer state.
+ * @param slot Slot of the caller's buffer (0 to WRITE_BEHIND_SLOTS - 1).
+ * @param fd Output file.
+ * @param data Data to write; it must stay untouched until the write finished.
+ * @param len Length of data.
+ * @param offset File offset of the write.
+ */
+void write_behind_post(WriteBehind *wb, int slot, int fd, const uint8_t *data, size_t len, uint64_t offset) {
+#ifdef HAVE_IO_URING
+    if (wb->uring) {
+        WriteSlot ws = { fd, data, len, offset, wb->posted++ };
+        wb->slots[slot] = ws;
+        uring_submit(wb, slot);
+        return;
+    }
+#endif
+    pthread_mutex_lock(&wb->lock);
+    WriteSlot ws = { fd, data, len, offset, wb->posted++ };
+    wb->slots[slot] = ws;
+    pthread_cond_broadcast(&wb->cond);
+    pthread_mutex_unlock(&wb->lock);
+}
+
+/**
+ * @brief Finishes the posted writes and stops the writer.
+ * @param wb Writer state.
+ */
+void write_behind_stop(WriteBehind *wb) {
+#ifdef HAVE_IO_URING
+    if (wb->uring) {
+        uring_complete(wb, -1);
+        uring_free(wb);
+        return;
+    }
+#endif
+    pthread_mutex_lock(&wb->lock);
+    wb->stop = 1;
+    pthread_cond_broadcast(&wb->cond);
+    pthread_mutex_unlock(&wb->lock);
+    pthread_join(wb->thread, NULL);
+    pthread_cond_destroy(&wb->cond);
+    pthread_mutex_destroy(&wb->lock);
+}
@@ -0,0 +1,150 @@
+/**
+ * @file batch.c
+ * @brief Batch mode: runs the command lines of a manifest in one process (--batch).
+ *
+ * Jobs share the start-up and OpenSSL initialisation of the process, and the
+ * keys of archives that several jobs open (for example the base of many
+ * incremental archives, or an archive that is created and then listed), which
+ * are derived once and reused from the process key cache. Archive and append
+ * jobs also share the archiving worker threads, which keep their buffers,
+ * cipher contexts and encoders between jobs (see archive_workers_retain()).
+ * Every job still parses its own line through run_command(), which resets the
+ * per-run globals, so no option leaks from one job to the next; extraction and
+ * verification set up their threads per job, and every new archive has its
+ * own salt and key derivation.
+ */
+
+#include "seclume.h"
+#include <string.h>
+#include <errno.h>
+#include <stdlib.h>
+
+/** @brief Set while a manifest runs, so manifests cannot start nested batches */
+static int batch_running = 0;
+
+/**
+ * @brief Splits a manifest line into arguments in place.
+ *
+ * Arguments are separated by spaces or tabs. Double quotes group an argument
+ * containing spaces, and a backslash takes the next character literally.
+ *
+ * @param line Line to split (modified, arguments point into it).
+ * @param args Argument array, grown as needed; args[0] is left for the program name.
+ * @param count Output number of arguments, including args[0].
+ * @param capacity Allocated size of args.
+ * @return 0 on success, 1 on failure (unterminated quote or out of memory).
+ */
+static int split_manifest_line(char *line, char ***args, int *count, int *capacity) {
+    *count = 1;
+    char *src = line;
+    while (*src) {
+        while (*src == ' ' || *src == '\t') src++;
+        if (!*src) break;
+        char *dst = src;
+        char *arg = src;
+        int quoted = 0;
+        while (*src && (quoted || (*src != ' ' && *src != '\t'))) {
+            if (*src == '"') {
+                quoted = !quoted;
+                src++;
+            } else if (*src == '\\' && src[1]) {
+                *dst++ = src[1];
+                src += 2;
+            } else {
+                *dst++ = *src++;
+            }
+        }
+        if (quoted) {
+            fprintf(stderr, "Error: Unterminated quote\n");
+            return 1;
+        }
+        if (*src) src++;
+        *dst = '\0';
+        if (*count + 1 >= *capacity) {
+            int new_capacity = *capacity * 2;
+            char **new_args = realloc(*args, new_capacity * sizeof(char *));
+            if (!new_args) {
+                fprintf(stderr, "Error: Memory allocation failed for batch arguments\n");
+                return 1;
+            }
+            *args = new_args;
+            *capacity = new_capacity;
+        }
+        (*args)[(*count)++] = arg;
+    }
+    (*args)[*count] = NULL;
+    return 0;
+}
+
+/**
+ * @brief Runs every job of a batch manifest.
+ *
+ * Each non-empty line not starting with '#' is one command line, written as
+ * it would follow the program name on the command line (options, mode,
+ * archive, password and paths). Jobs run in order; a failed job is reported
+ * and the remaining jobs still run.
+ *
+ * @param manifest Path to the manifest file ("-" for standard input).
+ * @param prog_name Program name passed to the jobs as argv[0].
+ * @return 0 if every job succeeded, 1 otherwise.
+ */
+int run_batch(const char *manifest, const char *prog_name) {
+    if (batch_running) {
+        fprintf(stderr, "Error: --batch cannot be used inside a batch manifest\n");
+        return 1;
+    }
+    FILE *in = strcmp(manifest, "-") == 0 ? stdin : fopen(manifest, "r");
+    if (!in) {
+        fprintf(stderr, "Error: Cannot open batch manifest %s: %s\n", manifest, strerror(errno));
+        return 1;
+    }
+    int capacity = 16;
+    char **args = malloc(capacity * sizeof(char *));
+    if (!args) {
+        fprintf(stderr, "Error: Memory allocation failed for batch arguments\n");
+        if (in != stdin) fclose(in);
+        return 1;
+    }
+    batch_running = 1;
+    archive_workers_retain(1);
+    char *line = NULL;
+    size_t line_size = 0;
+    ssize_t len;
+    int line_no = 0, jobs = 0, failed = 0;
+    while ((len = getline(&line, &line_size, in)) != -1) {
+        line_no++;
+        while (len > 0 && (line[len - 1] == '\n' || line[len - 1] == '\r')) line[--len] = '\0';
+        char *start = line + strspn(line, " \t");
+        if (*start == '\0' || *start == '#') continue;
+        jobs++;
+        int count;
+        if (split_manifest_line(start, &args, &count, &capacity) != 0) {
+            fprintf(stderr, "Error: Invalid batch job %d (%s line %d)\n", jobs, manifest, line_no);
+            failed++;
+            continue;
+        }
+        args[0] = (char *)prog_name;
+        verbosity = VERBOSE_BASIC;
+        verbose_print(VERBOSE_BASIC, "Batch job %d (%s line %d)", jobs, manifest, line_no);
+        if (run_command(count, args) != 0) {
+            fprintf(stderr, "Error: Batch job %d (%s line %d) failed\n", jobs, manifest, line_no);
+            failed++;
+        }
+    }
+    int read_error = ferror(in);
+    if (line) {
+        secure_zero(line, line_size);
+        free(line);
+    }
+    free(args);
+    if (in != stdin) fclose(in);
+    archive_workers_retain(0);
+    batch_running = 0;
+    verbosity = VERBOSE_BASIC;
+    if (read_error) {
+        fprintf(stderr, "Error: Failed to read batch manifest %s\n", manifest);
+        return 1;
+    }
+    verbose_print(VERBOSE_BASIC, "Batch finished: %d jobs, %d failed", jobs, failed);
+    return failed != 0;
+}
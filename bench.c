@@ -0,0 +1,407 @@
+/**
+ * @file bench.c
+ * @brief Built-in benchmark of the codec, AES-GCM and key derivation hot paths (--bench).
+ */
+
+#include "seclume.h"
+#include <string.h>
+#include <stdlib.h>
+#include <time.h>
+#include <sys/resource.h>
+#include <openssl/rand.h>
+
+/** @brief Size of the random and text corpora */
+#define BENCH_CORPUS_SIZE (4U << 20)
+/** @brief Number of files in the small-file corpus */
+#define BENCH_FILE_COUNT 2000
+/** @brief Smallest and largest file of the small-file corpus */
+#define BENCH_FILE_MIN 128
+#define BENCH_FILE_MAX (64U << 10)
+/** @brief Minimum measuring time of one throughput figure, in seconds */
+#define BENCH_MIN_TIME 0.25
+/** @brief Number of key derivations timed */
+#define BENCH_KDF_RUNS 3
+
+/**
+ * @brief Returns a monotonic timestamp.
+ * @return Seconds since an arbitrary start.
+ */
+static double bench_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/**
+ * @brief Returns the next value of a splitmix64 sequence, so every run sees the same corpora.
+ * @param state Generator state.
+ * @return Pseudo-random value.
+ */
+static uint64_t bench_rand(uint64_t *state) {
+    uint64_t z = (*state += 0x9E3779B97F4A7C15ULL);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    return z ^ (z >> 31);
+}
+
+/**
+ * @brief Fills a buffer with incompressible data.
+ * @param buf Buffer.
+ * @param len Length of buf.
+ */
+static void fill_random(uint8_t *buf, size_t len) {
+    uint64_t state = 1;
+    for (size_t i = 0; i < len; i += 8) {
+        uint64_t v = bench_rand(&state);
+        memcpy(buf + i, &v, len - i < 8 ? len - i : 8);
+    }
+}
+
+/**
+ * @brief Fills a buffer with text-like data: lines of words from a small vocabulary, skewed towards common ones.
+ * @param buf Buffer.
+ * @param len Length of buf.
+ */
+static void fill_text(uint8_t *buf, size_t len) {
+    static const char *words[] = {
+        "the", "of", "and", "to", "in", "is", "for", "that", "with", "archive", "file", "data", "key",
+        "return", "error", "buffer", "size_t", "const", "static", "int", "if", "else", "while", "struct",
+        "compressed", "encrypted", "password", "directory", "offset", "length", "index", "entry", "block",
+    };
+    const size_t word_count = sizeof(words) / sizeof(words[0]);
+    uint64_t state = 2;
+    size_t pos = 0;
+    int line = 0;
+    while (pos < len) {
+        uint64_t r = bench_rand(&state);
+        const char *w = words[(r % word_count) * (r % word_count) / word_count];
+        size_t wlen = strlen(w);
+        for (size_t i = 0; i < wlen && pos < len; i++) buf[pos++] = w[i];
+        if (pos < len) buf[pos++] = ++line % 12 == 0 ? '\n' : ' ';
+    }
+}
+
+/**
+ * @brief Compares two doubles for qsort().
+ * @param a First value.
+ * @param b Second value.
+ * @return Negative, zero or positive.
+ */
+static int compare_double(const void *a, const void *b) {
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+/**
+ * @brief Measures compression and decompression throughput of one codec and level on a corpus.
+ * @param json Report stream.
+ * @param name Corpus name (for the report).
+ * @param data Corpus.
+ * @param len Length of the corpus.
+ * @param algo Codec.
+ * @param level Compression level.
+ * @param comp Scratch buffer of compress_bound(len, algo) bytes.
+ * @param out Scratch buffer of len bytes.
+ * @param first If 1, this is the first record of the JSON array.
+ * @return 0 on success, 1 on failure.
+ */
+static int bench_codec(FILE *json, const char *name, const uint8_t *data, size_t len, CompressionAlgo algo, int level,
+                       uint8_t *comp, uint8_t *out, int first) {
+    size_t comp_max = compress_bound(len, algo);
+    size_t comp_len = 0;
+    int rounds = 0;
+    double start = bench_now(), elapsed;
+    do {
+        comp_len = compress_data(data, len, comp, comp_max, level, algo);
+        if (comp_len == 0) {
+            fprintf(stderr, "Error: Benchmark compression failed (%s level %d)\n", codec_name(algo), level);
+            return 1;
+        }
+        rounds++;
+    } while ((elapsed = bench_now() - start) < BENCH_MIN_TIME);
+    double comp_mbps = (double)len * rounds / elapsed / 1e6;
+    rounds = 0;
+    start = bench_now();
+    do {
+        if (decompress_data(comp, comp_len, out, len, algo) != len || memcmp(out, data, len) != 0) {
+            fprintf(stderr, "Error: Benchmark decompression failed (%s level %d)\n", codec_name(algo), level);
+            return 1;
+        }
+        rounds++;
+    } while ((elapsed = bench_now() - start) < BENCH_MIN_TIME);
+    double decomp_mbps = (double)len * rounds / elapsed / 1e6;
+    fprintf(json, "%s\n    {\"corpus\": \"%s\", \"codec\": \"%s\", \"level\": %d, \"bytes\": %lu, \"ratio\": %.4f, "
+            "\"compress_mbps\": %.1f, \"decompress_mbps\": %.1f}",
+            first ? "" : ",", name, codec_name(algo), level, (unsigned long)len, (double)comp_len / len, comp_mbps,
+            decomp_mbps);
+    verbose_print(VERBOSE_BASIC, "Benchmarked %s level %d on %s corpus", codec_name(algo), level, name);
+    return 0;
+}
+
+/**
+ * @brief Measures AES-256-GCM throughput at one message size, one-shot and with a reused key context.
+ * @param json Report stream.
+ * @param data Input message source (at least len bytes).
+ * @param len Message size.
+ * @param out Scratch buffer of len bytes.
+ * @param first If 1, this is the first record of the JSON array.
+ * @return 0 on success, 1 on failure.
+ */
+static int bench_gcm(FILE *json, const uint8_t *data, size_t len, uint8_t *out, int first) {
+    uint8_t key[AES_KEY_SIZE] = { 0 };
+    uint8_t nonce[AES_NONCE_SIZE] = { 0 };
+    uint8_t tag[AES_TAG_SIZE];
+    size_t out_len;
+    long rounds = 0;
+    double start = bench_now(), elapsed;
+    do {
+        if (encrypt_aes_gcm(key, nonce, data, len, out, &out_len, tag) != 0) return 1;
+        rounds++;
+    } while ((elapsed = bench_now() - start) < BENCH_MIN_TIME);
+    double oneshot_mbps = (double)len * rounds / elapsed / 1e6;
+    GcmKey gk;
+    if (gcm_key_init(&gk, key, 1) != 0) return 1;
+    rounds = 0;
+    start = bench_now();
+    do {
+        if (gcm_key_encrypt(&gk, nonce, NULL, 0, data, len, out, tag) != 0) {
+            gcm_key_free(&gk);
+            return 1;
+        }
+        rounds++;
+    } while ((elapsed = bench_now() - start) < BENCH_MIN_TIME);
+    gcm_key_free(&gk);
+    double keyed_mbps = (double)len * rounds / elapsed / 1e6;
+    fprintf(json, "%s\n    {\"bytes\": %lu, \"oneshot_mbps\": %.1f, \"keyed_mbps\": %.1f}", first ? "" : ",",
+            (unsigned long)len, oneshot_mbps, keyed_mbps);
+    return 0;
+}
+
+/**
+ * @brief Encodes and encrypts one small file the way archiving does, through reused contexts.
+ * @param cs Encoder stream (reset for the file).
+ * @param gk File key cipher context.
+ * @param src File contents.
+ * @param len Size of the file.
+ * @param comp Scratch buffer of CHUNK_SIZE bytes for the encoder output.
+ * @param rec Scratch buffer of CHUNK_SIZE + CHUNK_OVERHEAD bytes for encrypted chunks.
+ * @return 0 on success, 1 on failure.
+ */
+static int bench_file_payload(CodecStream *cs, GcmKey *gk, const uint8_t *src, size_t len, uint8_t *comp,
+                              uint8_t *rec) {
+    uint8_t base_nonce[AES_NONCE_SIZE];
+    if (codec_stream_reset(cs) != 0 || RAND_bytes(base_nonce, AES_NONCE_SIZE) != 1) return 1;
+    ChunkCipher cc;
+    chunk_cipher_init(&cc, gk, base_nonce);
+    uint8_t *comp_ptr = comp;
+    size_t comp_avail = CHUNK_SIZE;
+    for (;;) {
+        int r = codec_stream_run(cs, &src, &len, &comp_ptr, &comp_avail, 1);
+        if (r < 0) return 1;
+        if (r == 1 || comp_avail == 0) {
+            size_t rec_len;
+            if (chunk_encrypt(&cc, comp, CHUNK_SIZE - comp_avail, r == 1, rec, &rec_len) != 0) return 1;
+            comp_ptr = comp;
+            comp_avail = CHUNK_SIZE;
+            if (r == 1) return 0;
+        }
+    }
+}
+
+/**
+ * @brief Runs a small-file tree through compression and encryption, timing each file.
+ *
+ * Files are slices of the text and random corpora with log-uniform sizes, two
+ * thirds of them text. Each file goes through the same reused encoder stream,
+ * GCM key context and chunk cipher as an archived file.
+ *
+ * @param json Report stream.
+ * @param text Text corpus.
+ * @param random Random corpus.
+ * @param algo Codec.
+ * @param level Compression level.
+ * @param comp Scratch buffer of at least CHUNK_SIZE bytes.
+ * @param enc Scratch buffer of at least CHUNK_SIZE + CHUNK_OVERHEAD bytes.
+ * @param first If 1, this is the first record of the JSON array.
+ * @return 0 on success, 1 on failure.
+ */
+static int bench_files(FILE *json, const uint8_t *text, const uint8_t *random, CompressionAlgo algo, int level,
+                       uint8_t *comp, uint8_t *enc, int first) {
+    double *latency = malloc(BENCH_FILE_COUNT * sizeof(double));
+    if (!latency) {
+        fprintf(stderr, "Error: Memory allocation failed for benchmark\n");
+        return 1;
+    }
+    uint8_t key[AES_KEY_SIZE] = { 0 };
+    CodecStream cs;
+    GcmKey gk;
+    if (codec_stream_init(&cs, algo, level, 0) != 0) {
+        free(latency);
+        return 1;
+    }
+    if (gcm_key_init(&gk, key, 1) != 0) {
+        codec_stream_end(&cs);
+        free(latency);
+        return 1;
+    }
+    uint64_t state = 3;
+    uint64_t total = 0;
+    int ret = 0;
+    double start = bench_now();
+    for (int i = 0; i < BENCH_FILE_COUNT; i++) {
+        uint64_t r = bench_rand(&state);
+        /* log-uniform between BENCH_FILE_MIN and BENCH_FILE_MAX */
+        size_t len = BENCH_FILE_MIN << (r % 10);
+        len += (r >> 8) % len;
+        if (len > BENCH_FILE_MAX) len = BENCH_FILE_MAX;
+        const uint8_t *src = (i % 3 == 2 ? random : text) + (r >> 32) % (BENCH_CORPUS_SIZE - BENCH_FILE_MAX);
+        double t0 = bench_now();
+        if (bench_file_payload(&cs, &gk, src, len, comp, enc) != 0) {
+            fprintf(stderr, "Error: Benchmark failed for small file %d (%s)\n", i, codec_name(algo));
+            ret = 1;
+            break;
+        }
+        latency[i] = bench_now() - t0;
+        total += len;
+    }
+    double elapsed = bench_now() - start;
+    codec_stream_end(&cs);
+    gcm_key_free(&gk);
+    if (ret == 0) {
+        qsort(latency, BENCH_FILE_COUNT, sizeof(double), compare_double);
+        fprintf(json, "%s\n    {\"codec\": \"%s\", \"level\": %d, \"files\": %d, \"bytes\": %lu, \"files_per_s\": %.1f, "
+                "\"mbps\": %.1f, \"p50_us\": %.1f, \"p99_us\": %.1f}",
+                first ? "" : ",", codec_name(algo), level, BENCH_FILE_COUNT, (unsigned long)total,
+                BENCH_FILE_COUNT / elapsed, total / elapsed / 1e6, latency[BENCH_FILE_COUNT / 2] * 1e6,
+                latency[BENCH_FILE_COUNT * 99 / 100] * 1e6);
+        verbose_print(VERBOSE_BASIC, "Benchmarked small files with %s level %d", codec_name(algo), level);
+    }
+    free(latency);
+    return ret;
+}
+
+/**
+ * @brief Times the password-based key derivation.
+ * @param json Report stream.
+ * @return 0 on success, 1 on failure.
+ */
+static int bench_kdf(FILE *json) {
+    uint8_t salt[SALT_SIZE] = { 0 };
+    uint8_t key[AES_KEY_SIZE];
+    double runs[BENCH_KDF_RUNS];
+    for (int i = 0; i < BENCH_KDF_RUNS; i++) {
+        double t0 = bench_now();
+        if (derive_key("Benchmark-Passw0rd!", salt, key, "master key") != 0) return 1;
+        runs[i] = bench_now() - t0;
+    }
+    secure_zero(key, AES_KEY_SIZE);
+    qsort(runs, BENCH_KDF_RUNS, sizeof(double), compare_double);
+    fprintf(json, "  \"kdf\": {\"algorithm\": \"pbkdf2-sha256\", \"runs\": %d, \"p50_ms\": %.1f, \"max_ms\": %.1f},\n",
+            BENCH_KDF_RUNS, runs[BENCH_KDF_RUNS / 2] * 1e3, runs[BENCH_KDF_RUNS - 1] * 1e3);
+    verbose_print(VERBOSE_BASIC, "Benchmarked key derivation");
+    return 0;
+}
+
+/**
+ * @brief Runs the built-in benchmarks and prints the results as JSON on stdout.
+ *
+ * The corpora are generated from fixed seeds, so results of different builds
+ * and releases can be compared directly. Every codec compiled in is measured
+ * at levels 1, 6 and 9 on random and text data and at level 1 on a tree of
+ * small files; AES-256-GCM is measured from 64 bytes to 1MB messages. Progress
+ * goes to stderr. The report is printed only once every benchmark succeeded,
+ * so a failed run prints no partial JSON.
+ *
+ * @return 0 on success, 1 on failure.
+ */
+int run_benchmarks(void) {
+    static const CompressionAlgo codecs[] = { COMPRESSION_ZLIB, COMPRESSION_LZMA, COMPRESSION_ZSTD, COMPRESSION_LZ4 };
+    static const int levels[] = { 1, 6, 9 };
+    static const size_t gcm_sizes[] = { 64, 4096, 65536, CHUNK_SIZE };
+    size_t comp_max = 0;
+    for (size_t c = 0; c < sizeof(codecs) / sizeof(codecs[0]); c++) {
+        size_t bound = compress_bound(BENCH_CORPUS_SIZE, codecs[c]);
+        if (bound > comp_max) comp_max = bound;
+    }
+    uint8_t *random = malloc(BENCH_CORPUS_SIZE);
+    uint8_t *text = malloc(BENCH_CORPUS_SIZE);
+    uint8_t *comp = malloc(comp_max);
+    uint8_t *out = malloc(comp_max);
+    if (!random || !text || !comp || !out) {
+        fprintf(stderr, "Error: Memory allocation failed for benchmark corpora\n");
+        free(random);
+        free(text);
+        free(comp);
+        free(out);
+        return 1;
+    }
+    fill_random(random, BENCH_CORPUS_SIZE);
+    fill_text(text, BENCH_CORPUS_SIZE);
+    /* The report is collected in memory and printed only when every benchmark succeeded */
+    char *report = NULL;
+    size_t report_len = 0;
+    FILE *json = open_memstream(&report, &report_len);
+    if (!json) {
+        fprintf(stderr, "Error: Memory allocation failed for benchmark report\n");
+        free(random);
+        free(text);
+        free(comp);
+        free(out);
+        return 1;
+    }
+    int ret = 0;
+    int first;
+    fprintf(json, "{\n  \"seclume\": \"%s\",\n  \"archive_version\": %d,\n", SECLUME_VERSION, ARCHIVE_VERSION);
+    fprintf(json, "  \"codecs_built\": [");
+    first = 1;
+    for (size_t c = 0; c < sizeof(codecs) / sizeof(codecs[0]); c++) {
+        if (!codec_available(codecs[c])) continue;
+        fprintf(json, "%s\"%s\"", first ? "" : ", ", codec_name(codecs[c]));
+        first = 0;
+    }
+    fprintf(json, "],\n");
+    ret = bench_kdf(json);
+    if (ret == 0) fprintf(json, "  \"aes_256_gcm\": [");
+    for (size_t s = 0; ret == 0 && s < sizeof(gcm_sizes) / sizeof(gcm_sizes[0]); s++) {
+        ret = bench_gcm(json, text, gcm_sizes[s], out, s == 0);
+    }
+    if (ret == 0) {
+        verbose_print(VERBOSE_BASIC, "Benchmarked AES-256-GCM");
+        fprintf(json, "\n  ],\n  \"codecs\": [");
+    }
+    first = 1;
+    for (size_t c = 0; ret == 0 && c < sizeof(codecs) / sizeof(codecs[0]); c++) {
+        if (!codec_available(codecs[c])) continue;
+        for (size_t l = 0; ret == 0 && l < sizeof(levels) / sizeof(levels[0]); l++) {
+            ret = bench_codec(json, "random", random, BENCH_CORPUS_SIZE, codecs[c], levels[l], comp, out, first) ||
+                  bench_codec(json, "text", text, BENCH_CORPUS_SIZE, codecs[c], levels[l], comp, out, 0);
+            first = 0;
+        }
+    }
+    if (ret == 0) fprintf(json, "\n  ],\n  \"small_files\": [");
+    first = 1;
+    for (size_t c = 0; ret == 0 && c < sizeof(codecs) / sizeof(codecs[0]); c++) {
+        if (!codec_available(codecs[c])) continue;
+        ret = bench_files(json, text, random, codecs[c], 1, comp, out, first);
+        first = 0;
+    }
+    if (ret == 0) {
+        struct rusage ru;
+        getrusage(RUSAGE_SELF, &ru);
+        fprintf(json, "\n  ],\n  \"peak_rss_kb\": %ld\n}\n", ru.ru_maxrss);
+    }
+    if (fclose(json) != 0 && ret == 0) {
+        fprintf(stderr, "Error: Memory allocation failed for benchmark report\n");
+        ret = 1;
+    }
+    if (ret == 0 && (fwrite(report, 1, report_len, stdout) != report_len || fflush(stdout) != 0)) {
+        fprintf(stderr, "Error: Failed to write benchmark results\n");
+        ret = 1;
+    }
+    free(report);
+    free(random);
+    free(text);
+    free(comp);
+    free(out);
+    return ret;
+}
@@ -1,22 +1,45 @@
 /**
  * @file compression.c
- * @brief Compression and decompression functions for Seclume (zlib and LZMA).
+ * @brief Compression and decompression functions for Seclume (zlib, LZMA, and optionally zstd and LZ4).
  */
 
 #include "seclume.h"
 #include <string.h>
+#include <stdlib.h>
+#include <strings.h>
+#include <pthread.h>
 
+/** @brief Input the LZ4 encoder compresses per call, bounding its output buffer */
+#define LZ4_STAGE_INPUT (256U << 10)
+
+#ifdef HAVE_ZSTD
 /**
- * @brief Compresses data using the specified algorithm.
- * @param in Input data buffer.
- * @param in_len Size of input data.
- * @param out Output buffer for compressed data.
- * @param out_max Maximum size of output buffer.
+ * @brief Maps a compression level (0-9) to a zstd level (1-19).
+ * @param level Compression level.
+ * @return zstd compression level.
+ */
+static int zstd_level(int level) {
+    return level == 0 ? 1 : level * 2 + 1;
+}
+#endif
+
+#ifdef HAVE_LZ4
+/**
+ * @brief Fills the LZ4 frame preferences for a compression level; levels 3-9 use LZ4HC.
+ * @param prefs Preferences to fill.
  * @param level Compression level (0-9).
- * @param algo Compression algorithm (COMPRESSION_ZLIB or COMPRESSION_LZMA).
- * @return Size of compressed data, or 0 on failure.
  */
-size_t compress_data(const uint8_t *in, size_t in_len, uint8_t *out, size_t out_max, int level, CompressionAlgo algo) {
+static void lz4_prefs(LZ4F_preferences_t *prefs, int level) {
+    memset(prefs, 0, sizeof(*prefs));
+    prefs->frameInfo.blockSizeID = LZ4F_max256KB;
+    prefs->compressionLevel = level < 3 ? 0 : level + 3;
+}
+#endif
+
+/**
+ * @brief Compresses data using the specified algorithm (see compress_data()).
+ */
+static size_t compress_buffer(const uint8_t *in, size_t in_len, uint8_t *out, size_t out_max, int level, CompressionAlgo algo) {
     if (!in || !out || in_len == 0 || out_max == 0 || level < 0 || level > 9) {
         fprintf(stderr, "Error: Invalid compression parameters\n");
         return 0;
@@ -44,8 +67,16 @@ size_t compress_data(const uint8_t *in, size_t in_len, uint8_t *out, size_t out_
         verbose_print(VERBOSE_DEBUG, "Compressed %lu bytes to %lu bytes using zlib level %d", in_len, out_len, level);
         return out_len;
     } else if (algo == COMPRESSION_LZMA) {
+        lzma_options_lzma opt;
+        if (lzma_lzma_preset(&opt, level)) {
+            fprintf(stderr, "Error: Invalid LZMA preset %d\n", level);
+            return 0;
+        }
+        /* A dictionary larger than the input only costs memory, which adds up when blocks run in parallel */
+        if (opt.dict_size > in_len) opt.dict_size = in_len < LZMA_DICT_SIZE_MIN ? LZMA_DICT_SIZE_MIN : in_len;
+        lzma_filter filters[] = { { LZMA_FILTER_LZMA2, &opt }, { LZMA_VLI_UNKNOWN, NULL } };
         lzma_stream strm = LZMA_STREAM_INIT;
-        lzma_ret ret = lzma_easy_encoder(&strm, level, LZMA_CHECK_CRC64);
+        lzma_ret ret = lzma_stream_encoder(&strm, filters, LZMA_CHECK_CRC64);
         if (ret != LZMA_OK) {
             fprintf(stderr, "Error: Failed to initialize LZMA encoder: %d\n", ret);
             lzma_end(&strm);
@@ -65,21 +96,62 @@ size_t compress_data(const uint8_t *in, size_t in_len, uint8_t *out, size_t out_
         lzma_end(&strm);
         verbose_print(VERBOSE_DEBUG, "Compressed %lu bytes to %lu bytes using LZMA preset %d", in_len, out_len, level);
         return out_len;
+#ifdef HAVE_ZSTD
+    } else if (algo == COMPRESSION_ZSTD) {
+        size_t out_len = ZSTD_compress(out, out_max, in, in_len, zstd_level(level));
+        if (ZSTD_isError(out_len)) {
+            fprintf(stderr, "Error: zstd compression failed: %s\n", ZSTD_getErrorName(out_len));
+            return 0;
+        }
+        verbose_print(VERBOSE_DEBUG, "Compressed %lu bytes to %lu bytes using zstd level %d", in_len, out_len, zstd_level(level));
+        return out_len;
+#endif
+#ifdef HAVE_LZ4
+    } else if (algo == COMPRESSION_LZ4) {
+        LZ4F_preferences_t prefs;
+        lz4_prefs(&prefs, level);
+        size_t out_len = LZ4F_compressFrame(out, out_max, in, in_len, &prefs);
+        if (LZ4F_isError(out_len)) {
+            fprintf(stderr, "Error: LZ4 compression failed: %s\n", LZ4F_getErrorName(out_len));
+            return 0;
+        }
+        verbose_print(VERBOSE_DEBUG, "Compressed %lu bytes to %lu bytes using LZ4 level %d", in_len, out_len, prefs.compressionLevel);
+        return out_len;
+#endif
+    } else if (algo == COMPRESSION_STORE) {
+        if (in_len > out_max) {
+            fprintf(stderr, "Error: Output buffer too small to store %lu bytes\n", in_len);
+            return 0;
+        }
+        memcpy(out, in, in_len);
+        return in_len;
     }
     fprintf(stderr, "Error: Unknown compression algorithm\n");
     return 0;
 }
 
 /**
- * @brief Decompresses data using the specified algorithm.
- * @param in Input compressed data buffer.
- * @param in_len Size of input compressed data.
- * @param out Output buffer for decompressed data.
+ * @brief Compresses data using the specified algorithm.
+ * @param in Input data buffer.
+ * @param in_len Size of input data.
+ * @param out Output buffer for compressed data.
  * @param out_max Maximum size of output buffer.
- * @param algo Compression algorithm (COMPRESSION_ZLIB or COMPRESSION_LZMA).
- * @return Size of decompressed data, or 0 on failure.
+ * @param level Compression level (0-9).
+ * @param algo Compression algorithm (any codec except COMPRESSION_AUTO).
+ * @return Size of compressed data, or 0 on failure.
  */
-size_t decompress_data(const uint8_t *in, size_t in_len, uint8_t *out, size_t out_max, CompressionAlgo algo) {
+size_t compress_data(const uint8_t *in, size_t in_len, uint8_t *out, size_t out_max, int level, CompressionAlgo algo) {
+    StageTimer timer;
+    stage_begin(&timer);
+    size_t out_len = compress_buffer(in, in_len, out, out_max, level, algo);
+    stage_end(&timer, STAGE_COMPRESS, in_len);
+    return out_len;
+}
+
+/**
+ * @brief Decompresses data using the specified algorithm (see decompress_data()).
+ */
+static size_t decompress_buffer(const uint8_t *in, size_t in_len, uint8_t *out, size_t out_max, CompressionAlgo algo) {
     if (!in || !out || in_len == 0 || out_max == 0) {
         fprintf(stderr, "Error: Invalid decompression parameters\n");
         return 0;
@@ -128,7 +200,680 @@ size_t decompress_data(const uint8_t *in, size_t in_len, uint8_t *out, size_t ou
         lzma_end(&strm);
         verbose_print(VERBOSE_DEBUG, "Decompressed %lu bytes to %lu bytes using LZMA", in_len, out_len);
         return out_len;
+#ifdef HAVE_ZSTD
+    } else if (algo == COMPRESSION_ZSTD) {
+        size_t out_len = ZSTD_decompress(out, out_max, in, in_len);
+        if (ZSTD_isError(out_len)) {
+            fprintf(stderr, "Error: zstd decompression failed: %s\n", ZSTD_getErrorName(out_len));
+            return 0;
+        }
+        verbose_print(VERBOSE_DEBUG, "Decompressed %lu bytes to %lu bytes using zstd", in_len, out_len);
+        return out_len;
+#endif
+#ifdef HAVE_LZ4
+    } else if (algo == COMPRESSION_LZ4) {
+        LZ4F_dctx *dctx;
+        if (LZ4F_isError(LZ4F_createDecompressionContext(&dctx, LZ4F_VERSION))) {
+            fprintf(stderr, "Error: Failed to initialize LZ4 decompression\n");
+            return 0;
+        }
+        size_t out_len = 0;
+        size_t in_pos = 0;
+        size_t ret = 1;
+        while (ret != 0 && !LZ4F_isError(ret) && in_pos < in_len) {
+            size_t dst_len = out_max - out_len;
+            size_t src_len = in_len - in_pos;
+            ret = LZ4F_decompress(dctx, out + out_len, &dst_len, in + in_pos, &src_len, NULL);
+            out_len += dst_len;
+            in_pos += src_len;
+            if (dst_len == 0 && src_len == 0) break;
+        }
+        LZ4F_freeDecompressionContext(dctx);
+        if (ret != 0 || in_pos != in_len) {
+            fprintf(stderr, "Error: LZ4 decompression failed: %s\n", LZ4F_isError(ret) ? LZ4F_getErrorName(ret) : "truncated data");
+            return 0;
+        }
+        verbose_print(VERBOSE_DEBUG, "Decompressed %lu bytes to %lu bytes using LZ4", in_len, out_len);
+        return out_len;
+#endif
+    } else if (algo == COMPRESSION_STORE) {
+        if (in_len > out_max) {
+            fprintf(stderr, "Error: Stored data larger than expected (%lu bytes)\n", in_len);
+            return 0;
+        }
+        memcpy(out, in, in_len);
+        return in_len;
     }
     fprintf(stderr, "Error: Unknown compression algorithm\n");
     return 0;
-}
\ No newline at end of file
+}
+
+/**
+ * @brief Decompresses data using the specified algorithm.
+ * @param in Input compressed data buffer.
+ * @param in_len Size of input compressed data.
+ * @param out Output buffer for decompressed data.
+ * @param out_max Maximum size of output buffer.
+ * @param algo Compression algorithm (any codec except COMPRESSION_AUTO).
+ * @return Size of decompressed data, or 0 on failure.
+ */
+size_t decompress_data(const uint8_t *in, size_t in_len, uint8_t *out, size_t out_max, CompressionAlgo algo) {
+    StageTimer timer;
+    stage_begin(&timer);
+    size_t out_len = decompress_buffer(in, in_len, out, out_max, algo);
+    stage_end(&timer, STAGE_DECOMPRESS, out_len);
+    return out_len;
+}
+
+/**
+ * @brief Initializes a streaming compression or decompression context.
+ *
+ * zstd encoders at levels 8 and 9 enable long-range matching over a
+ * ZSTD_LONG_WINDOW_LOG window; decoders accept windows up to that size.
+ *
+ * @param cs Stream context to initialize.
+ * @param algo Compression algorithm (any codec except COMPRESSION_AUTO).
+ * @param level Compression level (0-9, ignored for decompression).
+ * @param decompress If 1, create a decoder; otherwise an encoder.
+ * @return 0 on success, 1 on failure.
+ */
+int codec_stream_init(CodecStream *cs, CompressionAlgo algo, int level, int decompress) {
+    if (!cs || (!decompress && (level < 0 || level > 9))) {
+        fprintf(stderr, "Error: Invalid compression stream parameters\n");
+        return 1;
+    }
+    memset(cs, 0, sizeof(*cs));
+    cs->algo = algo;
+    cs->level = level;
+    cs->decompress = decompress;
+    if (algo == COMPRESSION_ZLIB) {
+        int ret = decompress ? inflateInit(&cs->zstrm) : deflateInit(&cs->zstrm, level);
+        if (ret != Z_OK) {
+            fprintf(stderr, "Error: Failed to initialize zlib %s\n", decompress ? "decompression" : "compression");
+            return 1;
+        }
+        return 0;
+    } else if (algo == COMPRESSION_LZMA) {
+        lzma_stream init = LZMA_STREAM_INIT;
+        cs->lstrm = init;
+        lzma_ret ret = decompress ? lzma_stream_decoder(&cs->lstrm, UINT64_MAX, LZMA_CONCATENATED)
+                                  : lzma_easy_encoder(&cs->lstrm, level, LZMA_CHECK_CRC64);
+        if (ret != LZMA_OK) {
+            fprintf(stderr, "Error: Failed to initialize LZMA %s: %d\n", decompress ? "decoder" : "encoder", ret);
+            lzma_end(&cs->lstrm);
+            return 1;
+        }
+        return 0;
+#ifdef HAVE_ZSTD
+    } else if (algo == COMPRESSION_ZSTD) {
+        size_t ret;
+        if (decompress) {
+            cs->zdctx = ZSTD_createDCtx();
+            ret = cs->zdctx ? ZSTD_DCtx_setParameter(cs->zdctx, ZSTD_d_windowLogMax, ZSTD_LONG_WINDOW_LOG) : 0;
+        } else {
+            cs->zcctx = ZSTD_createCCtx();
+            ret = cs->zcctx ? ZSTD_CCtx_setParameter(cs->zcctx, ZSTD_c_compressionLevel, zstd_level(level)) : 0;
+            if (cs->zcctx && !ZSTD_isError(ret) && level >= 8) {
+                ret = ZSTD_CCtx_setParameter(cs->zcctx, ZSTD_c_enableLongDistanceMatching, 1);
+                if (!ZSTD_isError(ret)) ret = ZSTD_CCtx_setParameter(cs->zcctx, ZSTD_c_windowLog, ZSTD_LONG_WINDOW_LOG);
+            }
+        }
+        if ((!cs->zdctx && !cs->zcctx) || ZSTD_isError(ret)) {
+            fprintf(stderr, "Error: Failed to initialize zstd %s\n", decompress ? "decompression" : "compression");
+            codec_stream_end(cs);
+            return 1;
+        }
+        return 0;
+#endif
+#ifdef HAVE_LZ4
+    } else if (algo == COMPRESSION_LZ4) {
+        if (decompress) {
+            if (LZ4F_isError(LZ4F_createDecompressionContext(&cs->ldctx, LZ4F_VERSION))) {
+                fprintf(stderr, "Error: Failed to initialize LZ4 decompression\n");
+                cs->ldctx = NULL;
+                return 1;
+            }
+            return 0;
+        }
+        LZ4F_preferences_t prefs;
+        lz4_prefs(&prefs, level);
+        cs->lz4_cap = LZ4F_compressBound(LZ4_STAGE_INPUT, &prefs);
+        cs->lz4_buf = malloc(cs->lz4_cap);
+        if (!cs->lz4_buf || LZ4F_isError(LZ4F_createCompressionContext(&cs->lcctx, LZ4F_VERSION))) {
+            fprintf(stderr, "Error: Failed to initialize LZ4 compression\n");
+            cs->lcctx = NULL;
+            codec_stream_end(cs);
+            return 1;
+        }
+        if (codec_stream_reset(cs) != 0) {
+            codec_stream_end(cs);
+            return 1;
+        }
+        return 0;
+#endif
+    } else if (algo == COMPRESSION_STORE) {
+        return 0;
+    }
+    fprintf(stderr, "Error: Unknown compression algorithm\n");
+    return 1;
+}
+
+/**
+ * @brief Runs a streaming codec over the available input and output space (see codec_stream_run()).
+ */
+static int codec_stream_step(CodecStream *cs, const uint8_t **in, size_t *in_len, uint8_t **out, size_t *out_len, int finish) {
+    if (cs->algo == COMPRESSION_ZLIB) {
+        /* zlib counts in 32-bit units, so feed at most 1GB per call */
+        size_t in_avail = *in_len > (1U << 30) ? (1U << 30) : *in_len;
+        size_t out_avail = *out_len > (1U << 30) ? (1U << 30) : *out_len;
+        cs->zstrm.next_in = (uint8_t *)*in;
+        cs->zstrm.avail_in = in_avail;
+        cs->zstrm.next_out = *out;
+        cs->zstrm.avail_out = out_avail;
+        int ret;
+        if (cs->decompress) {
+            ret = inflate(&cs->zstrm, Z_NO_FLUSH);
+            /* A stream compressed with a preset dictionary asks for it after its header */
+            if (ret == Z_NEED_DICT && cs->dict && inflateSetDictionary(&cs->zstrm, cs->dict, cs->dict_len) == Z_OK) {
+                ret = inflate(&cs->zstrm, Z_NO_FLUSH);
+            }
+        } else {
+            ret = deflate(&cs->zstrm, (finish && in_avail == *in_len) ? Z_FINISH : Z_NO_FLUSH);
+        }
+        size_t used = in_avail - cs->zstrm.avail_in;
+        size_t produced = out_avail - cs->zstrm.avail_out;
+        *in += used;
+        *in_len -= used;
+        *out += produced;
+        *out_len -= produced;
+        if (ret == Z_STREAM_END) return 1;
+        if (ret == Z_OK || (ret == Z_BUF_ERROR && cs->decompress)) return 0;
+        fprintf(stderr, "Error: zlib %s failed: %d\n", cs->decompress ? "decompression" : "compression", ret);
+        return -1;
+    }
+#ifdef HAVE_ZSTD
+    if (cs->algo == COMPRESSION_ZSTD) {
+        ZSTD_inBuffer zin = { *in, *in_len, 0 };
+        ZSTD_outBuffer zout = { *out, *out_len, 0 };
+        size_t ret = cs->decompress ? ZSTD_decompressStream(cs->zdctx, &zout, &zin)
+                                    : ZSTD_compressStream2(cs->zcctx, &zout, &zin, finish ? ZSTD_e_end : ZSTD_e_continue);
+        *in += zin.pos;
+        *in_len -= zin.pos;
+        *out += zout.pos;
+        *out_len -= zout.pos;
+        if (ZSTD_isError(ret)) {
+            fprintf(stderr, "Error: zstd %s failed: %s\n", cs->decompress ? "decompression" : "compression", ZSTD_getErrorName(ret));
+            return -1;
+        }
+        return ret == 0 && (cs->decompress || finish);
+    }
+#endif
+#ifdef HAVE_LZ4
+    if (cs->algo == COMPRESSION_LZ4 && cs->decompress) {
+        size_t dst_len = *out_len;
+        size_t src_len = *in_len;
+        size_t ret = LZ4F_decompress(cs->ldctx, *out, &dst_len, *in, &src_len, NULL);
+        *in += src_len;
+        *in_len -= src_len;
+        *out += dst_len;
+        *out_len -= dst_len;
+        if (LZ4F_isError(ret)) {
+            fprintf(stderr, "Error: LZ4 decompression failed: %s\n", LZ4F_getErrorName(ret));
+            return -1;
+        }
+        return ret == 0;
+    }
+    if (cs->algo == COMPRESSION_LZ4) {
+        /* LZ4F writes whole blocks, so output goes through lz4_buf and is handed out as space allows */
+        for (;;) {
+            size_t n = cs->lz4_len - cs->lz4_pos < *out_len ? cs->lz4_len - cs->lz4_pos : *out_len;
+            memcpy(*out, cs->lz4_buf + cs->lz4_pos, n);
+            *out += n;
+            *out_len -= n;
+            cs->lz4_pos += n;
+            if (cs->lz4_pos < cs->lz4_len) return 0;
+            cs->lz4_pos = cs->lz4_len = 0;
+            if (cs->lz4_ended) return 1;
+            size_t ret;
+            if (*in_len > 0) {
+                size_t take = *in_len < LZ4_STAGE_INPUT ? *in_len : LZ4_STAGE_INPUT;
+                ret = LZ4F_compressUpdate(cs->lcctx, cs->lz4_buf, cs->lz4_cap, *in, take, NULL);
+                if (!LZ4F_isError(ret)) {
+                    *in += take;
+                    *in_len -= take;
+                }
+            } else if (finish) {
+                ret = LZ4F_compressEnd(cs->lcctx, cs->lz4_buf, cs->lz4_cap, NULL);
+                cs->lz4_ended = 1;
+            } else {
+                return 0;
+            }
+            if (LZ4F_isError(ret)) {
+                fprintf(stderr, "Error: LZ4 compression failed: %s\n", LZ4F_getErrorName(ret));
+                return -1;
+            }
+            cs->lz4_len = ret;
+        }
+    }
+#endif
+    if (cs->algo == COMPRESSION_STORE) {
+        size_t n = *in_len < *out_len ? *in_len : *out_len;
+        if (n > 0) memcpy(*out, *in, n);
+        *in += n;
+        *in_len -= n;
+        *out += n;
+        *out_len -= n;
+        return finish && *in_len == 0;
+    }
+    cs->lstrm.next_in = *in;
+    cs->lstrm.avail_in = *in_len;
+    cs->lstrm.next_out = *out;
+    cs->lstrm.avail_out = *out_len;
+    lzma_ret ret = lzma_code(&cs->lstrm, finish ? LZMA_FINISH : LZMA_RUN);
+    size_t used = *in_len - cs->lstrm.avail_in;
+    size_t produced = *out_len - cs->lstrm.avail_out;
+    *in += used;
+    *in_len -= used;
+    *out += produced;
+    *out_len -= produced;
+    if (ret == LZMA_STREAM_END) return 1;
+    if (ret == LZMA_OK || (ret == LZMA_BUF_ERROR && cs->decompress)) return 0;
+    fprintf(stderr, "Error: LZMA %s failed: %d\n", cs->decompress ? "decompression" : "compression", ret);
+    return -1;
+}
+
+/**
+ * @brief Runs a streaming codec over the available input and output space.
+ *
+ * The input and output pointers and lengths are advanced past the consumed and
+ * produced bytes. Encoders flush their trailer once finish is set; LZMA and
+ * stored decoders need finish to be set with the last input to report the end
+ * of the stream.
+ *
+ * @param cs Initialized stream context.
+ * @param in Pointer to the input pointer.
+ * @param in_len Pointer to the number of input bytes available.
+ * @param out Pointer to the output pointer.
+ * @param out_len Pointer to the free output space.
+ * @param finish If 1, no more input follows.
+ * @return 1 at the end of the stream, 0 if more calls are needed, -1 on failure.
+ */
+int codec_stream_run(CodecStream *cs, const uint8_t **in, size_t *in_len, uint8_t **out, size_t *out_len, int finish) {
+    StageTimer timer;
+    stage_begin(&timer);
+    size_t in_before = *in_len;
+    size_t out_before = *out_len;
+    int r = codec_stream_step(cs, in, in_len, out, out_len, finish);
+    /* Both directions count uncompressed bytes */
+    stage_end(&timer, cs->decompress ? STAGE_DECOMPRESS : STAGE_COMPRESS,
+              cs->decompress ? out_before - *out_len : in_before - *in_len);
+    return r;
+}
+
+/**
+ * @brief Resets a streaming codec context for the next entry, keeping its allocated state.
+ *
+ * zlib, zstd and LZ4 streams are reset in place, keeping their parameters and
+ * any preset dictionary; LZMA coders are re-initialized on the same
+ * lzma_stream, which lets liblzma reuse the existing dictionary and match
+ * finder.
+ *
+ * @param cs Stream context (initialized by codec_stream_init).
+ * @return 0 on success, 1 on failure.
+ */
+int codec_stream_reset(CodecStream *cs) {
+    if (cs->algo == COMPRESSION_ZLIB) {
+        int ret = cs->decompress ? inflateReset(&cs->zstrm) : deflateReset(&cs->zstrm);
+        /* deflateReset() drops the preset dictionary, so every stream sets it again */
+        if (ret == Z_OK && !cs->decompress && cs->dict) ret = deflateSetDictionary(&cs->zstrm, cs->dict, cs->dict_len);
+        if (ret != Z_OK) {
+            fprintf(stderr, "Error: Failed to reset zlib %s\n", cs->decompress ? "decompression" : "compression");
+            return 1;
+        }
+        return 0;
+    }
+#ifdef HAVE_ZSTD
+    if (cs->algo == COMPRESSION_ZSTD) {
+        size_t ret = cs->decompress ? ZSTD_DCtx_reset(cs->zdctx, ZSTD_reset_session_only)
+                                    : ZSTD_CCtx_reset(cs->zcctx, ZSTD_reset_session_only);
+        if (ZSTD_isError(ret)) {
+            fprintf(stderr, "Error: Failed to reset zstd %s\n", cs->decompress ? "decompression" : "compression");
+            return 1;
+        }
+        return 0;
+    }
+#endif
+#ifdef HAVE_LZ4
+    if (cs->algo == COMPRESSION_LZ4) {
+        if (cs->decompress) {
+            LZ4F_resetDecompressionContext(cs->ldctx);
+            return 0;
+        }
+        /* Starting a frame discards any unfinished one; its header is handed out first */
+        LZ4F_preferences_t prefs;
+        lz4_prefs(&prefs, cs->level);
+        size_t ret = LZ4F_compressBegin(cs->lcctx, cs->lz4_buf, cs->lz4_cap, &prefs);
+        if (LZ4F_isError(ret)) {
+            fprintf(stderr, "Error: Failed to reset LZ4 compression: %s\n", LZ4F_getErrorName(ret));
+            return 1;
+        }
+        cs->lz4_len = ret;
+        cs->lz4_pos = 0;
+        cs->lz4_ended = 0;
+        return 0;
+    }
+#endif
+    if (cs->algo == COMPRESSION_STORE) return 0;
+    lzma_ret ret = cs->decompress ? lzma_stream_decoder(&cs->lstrm, UINT64_MAX, LZMA_CONCATENATED)
+                                  : lzma_easy_encoder(&cs->lstrm, cs->level, LZMA_CHECK_CRC64);
+    if (ret != LZMA_OK) {
+        fprintf(stderr, "Error: Failed to reset LZMA %s: %d\n", cs->decompress ? "decoder" : "encoder", ret);
+        return 1;
+    }
+    return 0;
+}
+
+/**
+ * @brief Releases the resources of a streaming codec context.
+ * @param cs Stream context (initialized by codec_stream_init).
+ */
+void codec_stream_end(CodecStream *cs) {
+    if (cs->algo == COMPRESSION_ZLIB) {
+        if (cs->decompress) inflateEnd(&cs->zstrm);
+        else deflateEnd(&cs->zstrm);
+    } else if (cs->algo == COMPRESSION_LZMA) {
+        lzma_end(&cs->lstrm);
+#ifdef HAVE_ZSTD
+    } else if (cs->algo == COMPRESSION_ZSTD) {
+        ZSTD_freeCCtx(cs->zcctx);
+        ZSTD_freeDCtx(cs->zdctx);
+        cs->zcctx = NULL;
+        cs->zdctx = NULL;
+#endif
+#ifdef HAVE_LZ4
+    } else if (cs->algo == COMPRESSION_LZ4) {
+        if (cs->lcctx) LZ4F_freeCompressionContext(cs->lcctx);
+        if (cs->ldctx) LZ4F_freeDecompressionContext(cs->ldctx);
+        free(cs->lz4_buf);
+        cs->lcctx = NULL;
+        cs->ldctx = NULL;
+        cs->lz4_buf = NULL;
+#endif
+    }
+}
+
+/**
+ * @brief Lets a zstd encoder compress on worker threads of its own; other codecs ignore this.
+ *
+ * Used when files are compressed one at a time, so -j still spreads the work
+ * of a single stream. The setting survives codec_stream_reset().
+ *
+ * @param cs Stream context (initialized by codec_stream_init).
+ * @param workers Number of threads (1 or less compresses on the calling thread).
+ */
+void codec_stream_set_workers(CodecStream *cs, int workers) {
+#ifdef HAVE_ZSTD
+    if (cs->algo == COMPRESSION_ZSTD && !cs->decompress && workers > 1) {
+        size_t ret = ZSTD_CCtx_setParameter(cs->zcctx, ZSTD_c_nbWorkers, workers);
+        if (ZSTD_isError(ret)) {
+            verbose_print(VERBOSE_DEBUG, "zstd compresses on one thread: %s", ZSTD_getErrorName(ret));
+        } else {
+            verbose_print(VERBOSE_DEBUG, "zstd compresses on %d threads", workers);
+        }
+    }
+#else
+    (void)cs;
+    (void)workers;
+#endif
+}
+
+/**
+ * @brief Sets the preset dictionary a zlib or zstd stream is compressed or decompressed with.
+ *
+ * Must be called right after codec_stream_init(). The dictionary applies to
+ * every stream until codec_stream_end(); zlib keeps a reference to it, so it
+ * must stay valid until then, while zstd copies it.
+ *
+ * @param cs Stream context (initialized by codec_stream_init, zlib or zstd).
+ * @param dict Dictionary.
+ * @param dict_len Length of the dictionary.
+ * @return 0 on success, 1 on failure.
+ */
+int codec_stream_set_dict(CodecStream *cs, const uint8_t *dict, size_t dict_len) {
+    if (cs->algo == COMPRESSION_ZLIB) {
+        cs->dict = dict;
+        cs->dict_len = dict_len;
+        if (!cs->decompress && deflateSetDictionary(&cs->zstrm, dict, dict_len) != Z_OK) {
+            fprintf(stderr, "Error: Failed to set zlib dictionary\n");
+            return 1;
+        }
+        return 0;
+    }
+#ifdef HAVE_ZSTD
+    if (cs->algo == COMPRESSION_ZSTD) {
+        size_t ret = cs->decompress ? ZSTD_DCtx_loadDictionary(cs->zdctx, dict, dict_len)
+                                    : ZSTD_CCtx_loadDictionary(cs->zcctx, dict, dict_len);
+        if (ZSTD_isError(ret)) {
+            fprintf(stderr, "Error: Failed to load zstd dictionary: %s\n", ZSTD_getErrorName(ret));
+            return 1;
+        }
+        return 0;
+    }
+#endif
+    fprintf(stderr, "Error: %s streams cannot use a dictionary\n", codec_name(cs->algo));
+    return 1;
+}
+
+/**
+ * @brief Returns the worst-case compressed size of an independently compressed block.
+ * @param in_len Size of the uncompressed block.
+ * @param algo Compression algorithm.
+ * @return Maximum size of the compressed block.
+ */
+size_t compress_bound(size_t in_len, CompressionAlgo algo) {
+    if (algo == COMPRESSION_ZLIB) return compressBound(in_len);
+    if (algo == COMPRESSION_STORE) return in_len;
+#ifdef HAVE_ZSTD
+    if (algo == COMPRESSION_ZSTD) return ZSTD_compressBound(in_len);
+#endif
+#ifdef HAVE_LZ4
+    if (algo == COMPRESSION_LZ4) {
+        LZ4F_preferences_t prefs;
+        lz4_prefs(&prefs, 0);
+        return LZ4F_compressFrameBound(in_len, &prefs);
+    }
+#endif
+    if (algo == COMPRESSION_AUTO) {
+        /* Either codec an auto archive uses */
+        size_t a = compress_bound(in_len, AUTO_CODEC);
+        return a > in_len ? a : in_len;
+    }
+    return lzma_stream_buffer_bound(in_len);
+}
+
+/**
+ * @brief Returns the display name of a codec.
+ * @param algo Compression algorithm.
+ * @return Name ("zlib", "LZMA", "zstd", "LZ4", "stored" or "auto").
+ */
+const char *codec_name(CompressionAlgo algo) {
+    switch (algo) {
+    case COMPRESSION_ZLIB: return "zlib";
+    case COMPRESSION_LZMA: return "LZMA";
+    case COMPRESSION_ZSTD: return "zstd";
+    case COMPRESSION_LZ4: return "LZ4";
+    case COMPRESSION_STORE: return "stored";
+    case COMPRESSION_AUTO: return "auto";
+    }
+    return "unknown";
+}
+
+/**
+ * @brief Checks whether a codec was compiled in.
+ * @param algo Compression algorithm.
+ * @return 1 if data of this codec can be written and read, 0 otherwise.
+ */
+int codec_available(CompressionAlgo algo) {
+    switch (algo) {
+    case COMPRESSION_ZLIB:
+    case COMPRESSION_LZMA:
+    case COMPRESSION_STORE:
+    case COMPRESSION_AUTO:
+        return 1;
+    case COMPRESSION_ZSTD:
+#ifdef HAVE_ZSTD
+        return 1;
+#else
+        return 0;
+#endif
+    case COMPRESSION_LZ4:
+#ifdef HAVE_LZ4
+        return 1;
+#else
+        return 0;
+#endif
+    }
+    return 0;
+}
+
+/**
+ * @brief Extensions of formats that are already compressed.
+ */
+static const char *const precompressed_exts[] = {
+    "jpg", "jpeg", "png", "gif", "webp", "heic", "avif", "mp3", "m4a", "aac", "ogg", "opus", "flac",
+    "mp4", "m4v", "mov", "mkv", "webm", "avi", "gz", "tgz", "bz2", "xz", "txz", "zst", "lz4", "7z",
+    "zip", "rar", "jar", "apk", "docx", "xlsx", "pptx", "odt", "slm", NULL
+};
+
+/**
+ * @brief Picks the codec of one file in an auto archive.
+ *
+ * Files whose extension or leading bytes identify an already compressed format
+ * (images, audio, video, compressed archives) are stored; everything else is
+ * compressed with AUTO_CODEC.
+ *
+ * @param filename File path.
+ * @param head First bytes of the file.
+ * @param head_len Number of bytes in head (up to CODEC_SAMPLE_SIZE).
+ * @return COMPRESSION_STORE or AUTO_CODEC.
+ */
+CompressionAlgo codec_auto_select(const char *filename, const uint8_t *head, size_t head_len) {
+    const char *base = strrchr(filename, '/');
+    const char *ext = strrchr(base ? base + 1 : filename, '.');
+    if (ext) {
+        for (int i = 0; precompressed_exts[i]; i++) {
+            if (strcasecmp(ext + 1, precompressed_exts[i]) == 0) return COMPRESSION_STORE;
+        }
+    }
+    static const struct { const char *magic; size_t len; size_t offset; } signatures[] = {
+        { "\xFF\xD8\xFF", 3, 0 },             /* JPEG */
+        { "\x89PNG", 4, 0 },                   /* PNG */
+        { "GIF8", 4, 0 },                      /* GIF */
+        { "\x1F\x8B", 2, 0 },                  /* gzip */
+        { "BZh", 3, 0 },                       /* bzip2 */
+        { "\xFD" "7zXZ", 5, 0 },                /* xz */
+        { "\x28\xB5\x2F\xFD", 4, 0 },          /* zstd */
+        { "\x04\x22\x4D\x18", 4, 0 },          /* LZ4 frame */
+        { "PK\x03\x04", 4, 0 },                /* zip and its derivatives */
+        { "7z\xBC\xAF\x27\x1C", 6, 0 },        /* 7-Zip */
+        { "Rar!", 4, 0 },                      /* RAR */
+        { "ftyp", 4, 4 },                      /* MP4, MOV, HEIC */
+        { "\x1A\x45\xDF\xA3", 4, 0 },          /* Matroska, WebM */
+        { "OggS", 4, 0 },                      /* Ogg */
+        { "fLaC", 4, 0 },                      /* FLAC */
+        { "ID3", 3, 0 },                       /* MP3 */
+        { "SLM", 3, 0 },                       /* Seclume archive */
+    };
+    for (size_t i = 0; i < sizeof(signatures) / sizeof(signatures[0]); i++) {
+        if (head_len >= signatures[i].offset + signatures[i].len &&
+            memcmp(head + signatures[i].offset, signatures[i].magic, signatures[i].len) == 0) {
+            return COMPRESSION_STORE;
+        }
+    }
+    return AUTO_CODEC;
+}
+
+/**
+ * @brief Shared state of a block-parallel compression or decompression call.
+ */
+typedef struct {
+    CodecBlock *blocks;    /**< Blocks to process */
+    int count;             /**< Number of blocks */
+    int next;              /**< Next block to claim */
+    int failed;            /**< Set if any block failed */
+    int decompress;        /**< 1 to decompress, 0 to compress */
+    int level;             /**< Compression level */
+    CompressionAlgo algo;  /**< Compression algorithm */
+    pthread_mutex_t lock;  /**< Protects next and failed */
+} BlockBatch;
+
+/**
+ * @brief Worker thread: claims blocks and runs compress_data()/decompress_data() on them.
+ * @param arg BlockBatch.
+ * @return NULL.
+ */
+static void *block_worker(void *arg) {
+    BlockBatch *batch = arg;
+    for (;;) {
+        pthread_mutex_lock(&batch->lock);
+        int i = batch->failed ? batch->count : batch->next++;
+        pthread_mutex_unlock(&batch->lock);
+        if (i >= batch->count) break;
+        CodecBlock *b = &batch->blocks[i];
+        b->out_len = batch->decompress ? decompress_data(b->in, b->in_len, b->out, b->out_max, batch->algo)
+                                       : compress_data(b->in, b->in_len, b->out, b->out_max, batch->level, batch->algo);
+        if (b->out_len == 0) {
+            pthread_mutex_lock(&batch->lock);
+            batch->failed = 1;
+            pthread_mutex_unlock(&batch->lock);
+        }
+    }
+    return NULL;
+}
+
+/**
+ * @brief Compresses or decompresses independent blocks on up to threads threads.
+ * @param batch Initialized batch (lock not yet initialized).
+ * @param threads Maximum number of threads.
+ * @return 0 on success, 1 on failure.
+ */
+static int run_block_batch(BlockBatch *batch, int threads) {
+    if (threads > batch->count) threads = batch->count;
+    pthread_mutex_init(&batch->lock, NULL);
+    pthread_t tids[MAX_JOBS];
+    int started = 0;
+    for (; started < threads - 1; started++) {
+        if (pthread_create(&tids[started], NULL, block_worker, batch) != 0) break;
+    }
+    block_worker(batch);
+    for (int t = 0; t < started; t++) pthread_join(tids[t], NULL);
+    pthread_mutex_destroy(&batch->lock);
+    return batch->failed;
+}
+
+/**
+ * @brief Compresses independent blocks in parallel, each as a complete stream of the codec.
+ * @param blocks Blocks to compress (in, in_len, out, out_max set; out_len is filled in).
+ * @param count Number of blocks.
+ * @param level Compression level (0-9).
+ * @param algo Compression algorithm.
+ * @param threads Maximum number of threads (1 to MAX_JOBS).
+ * @return 0 on success, 1 on failure.
+ */
+int compress_blocks(CodecBlock *blocks, int count, int level, CompressionAlgo algo, int threads) {
+    BlockBatch batch = { .blocks = blocks, .count = count, .decompress = 0, .level = level, .algo = algo };
+    return run_block_batch(&batch, threads);
+}
+
+/**
+ * @brief Decompresses independent blocks in parallel.
+ * @param blocks Blocks to decompress (in, in_len, out, out_max set; out_len is filled in).
+ * @param count Number of blocks.
+ * @param algo Compression algorithm.
+ * @param threads Maximum number of threads (1 to MAX_JOBS).
+ * @return 0 on success, 1 on failure.
+ */
+int decompress_blocks(CodecBlock *blocks, int count, CompressionAlgo algo, int threads) {
+    BlockBatch batch = { .blocks = blocks, .count = count, .decompress = 1, .algo = algo };
+    return run_block_batch(&batch, threads);
+}
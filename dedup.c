@@ -0,0 +1,121 @@
+/**
+ * @file dedup.c
+ * @brief Content-defined chunking and the chunk store of deduplicated archives.
+ */
+
+#include "seclume.h"
+#include <string.h>
+#include <stdlib.h>
+
+/**
+ * @brief Initializes an empty chunk store and its rolling hash table.
+ *
+ * The gear table is a fixed pseudo-random sequence (splitmix64), so the same
+ * data is always cut at the same boundaries.
+ *
+ * @param store Chunk store to initialize.
+ */
+void dedup_store_init(DedupStore *store) {
+    memset(store, 0, sizeof(*store));
+    uint64_t state = 0x5eC1u;
+    for (int i = 0; i < 256; i++) {
+        uint64_t z = (state += 0x9E3779B97F4A7C15ULL);
+        z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+        z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+        store->gear[i] = z ^ (z >> 31);
+    }
+}
+
+/**
+ * @brief Frees the chunk table of a store.
+ * @param store Chunk store.
+ */
+void dedup_store_free(DedupStore *store) {
+    free(store->chunks);
+    store->chunks = NULL;
+    store->count = 0;
+    store->mask = 0;
+}
+
+/**
+ * @brief Returns the length of the next content-defined chunk.
+ *
+ * A boundary is placed after the first byte, at least DEDUP_MIN_CHUNK bytes in,
+ * where the top bits of the gear hash are all zero, and at DEDUP_MAX_CHUNK at
+ * the latest.
+ *
+ * @param store Chunk store holding the gear table.
+ * @param data Input data starting at the chunk.
+ * @param len Bytes available (at least DEDUP_MAX_CHUNK unless the input ends earlier).
+ * @return Chunk length (len if the input ends first).
+ */
+size_t dedup_chunk_length(const DedupStore *store, const uint8_t *data, size_t len) {
+    if (len <= DEDUP_MIN_CHUNK) return len;
+    size_t end = len < DEDUP_MAX_CHUNK ? len : DEDUP_MAX_CHUNK;
+    uint64_t h = 0;
+    for (size_t i = DEDUP_MIN_CHUNK - 64; i < end; i++) {
+        h = (h << 1) + store->gear[data[i]];
+        if (i >= DEDUP_MIN_CHUNK && (h & DEDUP_BOUNDARY_MASK) == 0) return i + 1;
+    }
+    return end;
+}
+
+/**
+ * @brief Returns the slot of a chunk hash in the open-addressing table.
+ * @param hash SHA-256 of the chunk.
+ * @param mask Table size minus one.
+ * @return Starting slot.
+ */
+static size_t chunk_slot(const uint8_t *hash, size_t mask) {
+    uint64_t h;
+    memcpy(&h, hash, sizeof(h));
+    return (size_t)h & mask;
+}
+
+/**
+ * @brief Looks up a chunk by its hash.
+ * @param store Chunk store.
+ * @param hash SHA-256 of the chunk.
+ * @return Reference to the stored chunk, or NULL if it is new.
+ */
+const DedupRef *dedup_store_find(const DedupStore *store, const uint8_t *hash) {
+    if (!store->chunks) return NULL;
+    for (size_t slot = chunk_slot(hash, store->mask); store->chunks[slot].ref.length != 0;
+         slot = (slot + 1) & store->mask) {
+        if (memcmp(store->chunks[slot].hash, hash, HASH_SIZE) == 0) return &store->chunks[slot].ref;
+    }
+    return NULL;
+}
+
+/**
+ * @brief Records a newly written chunk, growing the table at half load.
+ * @param store Chunk store.
+ * @param hash SHA-256 of the chunk.
+ * @param ref Location of the chunk's record.
+ * @return 0 on success, 1 on failure.
+ */
+int dedup_store_add(DedupStore *store, const uint8_t *hash, const DedupRef *ref) {
+    if (!store->chunks || (store->count + 1) * 2 > store->mask + 1) {
+        size_t slots = store->chunks ? (store->mask + 1) * 2 : 1024;
+        DedupChunk *chunks = calloc(slots, sizeof(DedupChunk));
+        if (!chunks) {
+            fprintf(stderr, "Error: Memory allocation failed for dedup chunk table\n");
+            return 1;
+        }
+        for (size_t i = 0; store->chunks && i <= store->mask; i++) {
+            if (store->chunks[i].ref.length == 0) continue;
+            size_t slot = chunk_slot(store->chunks[i].hash, slots - 1);
+            while (chunks[slot].ref.length != 0) slot = (slot + 1) & (slots - 1);
+            chunks[slot] = store->chunks[i];
+        }
+        free(store->chunks);
+        store->chunks = chunks;
+        store->mask = slots - 1;
+    }
+    size_t slot = chunk_slot(hash, store->mask);
+    while (store->chunks[slot].ref.length != 0) slot = (slot + 1) & store->mask;
+    memcpy(store->chunks[slot].hash, hash, HASH_SIZE);
+    store->chunks[slot].ref = *ref;
+    store->count++;
+    return 0;
+}
@@ -0,0 +1,301 @@
+/**
+ * @file dict.c
+ * @brief Compression dictionary training for archives of many similar small files (-dt).
+ *
+ * A sample of the small input files is read and a dictionary of the content
+ * they share is built from it. zstd archives use ZDICT_trainFromBuffer();
+ * zlib archives (and zstd ones when ZDICT gives up) use a greedy segment
+ * selection: every 8-byte string is scored by the number of sampled files it
+ * occurs in, and the segments covering the most frequent strings are copied
+ * into the dictionary, best ones last, where matches are cheapest to reach.
+ */
+
+#include "seclume.h"
+#include <string.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <sys/stat.h>
+
+/** @brief Length of the strings whose frequencies are counted */
+#define DICT_DMER 8
+/** @brief Length of one dictionary segment */
+#define DICT_SEGMENT 256
+/** @brief Distance between the starts of candidate segments */
+#define DICT_SEGMENT_STEP 64
+/** @brief Hash bits of the string frequency table (1M counters) */
+#define DICT_HASH_BITS 20
+
+/**
+ * @brief Candidate dictionary segment in the selection heap.
+ */
+typedef struct {
+    uint64_t score; /**< Score when the candidate was last evaluated */
+    size_t pos;     /**< Offset of the segment in the samples */
+    size_t len;     /**< Length of the segment */
+} DictCandidate;
+
+/**
+ * @brief State of the greedy segment selection.
+ */
+typedef struct {
+    const uint8_t *samples; /**< Concatenated samples */
+    uint32_t *freq;         /**< Number of samples containing each string hash (0 once covered) */
+    uint32_t *stamp;        /**< Last sample or segment that counted each string hash */
+    uint32_t epoch;         /**< Stamp of the current sample or segment */
+    DictCandidate *heap;    /**< Max-heap of candidates by score */
+    size_t heap_len;        /**< Candidates in the heap */
+} DictTrainer;
+
+/**
+ * @brief Hashes the string of DICT_DMER bytes at p.
+ * @param p String.
+ * @return Hash of DICT_HASH_BITS bits.
+ */
+static uint32_t dmer_hash(const uint8_t *p) {
+    uint64_t v;
+    memcpy(&v, p, sizeof(v));
+    return (uint32_t)((v * 0x9E3779B97F4A7C15ULL) >> (64 - DICT_HASH_BITS));
+}
+
+/**
+ * @brief Scores a segment: the summed frequencies of the distinct strings it holds.
+ *
+ * Segments of which less than a quarter of strings are shared with other
+ * samples (or not yet covered) score 0; hash collisions alone never reach that.
+ *
+ * @param t Trainer.
+ * @param c Candidate segment.
+ * @return Score.
+ */
+static uint64_t segment_score(DictTrainer *t, const DictCandidate *c) {
+    uint64_t score = 0;
+    size_t shared = 0;
+    t->epoch++;
+    for (size_t i = 0; i + DICT_DMER <= c->len; i++) {
+        uint32_t h = dmer_hash(t->samples + c->pos + i);
+        if (t->stamp[h] == t->epoch) continue;
+        t->stamp[h] = t->epoch;
+        /* Strings of a single sample are nothing a dictionary can share */
+        if (t->freq[h] > 1) {
+            score += t->freq[h];
+            shared++;
+        }
+    }
+    return shared * 4 < c->len ? 0 : score;
+}
+
+/**
+ * @brief Moves the candidate at slot i down the heap to its place.
+ * @param t Trainer.
+ * @param i Heap slot.
+ */
+static void heap_down(DictTrainer *t, size_t i) {
+    for (;;) {
+        size_t largest = i, l = 2 * i + 1, r = 2 * i + 2;
+        if (l < t->heap_len && t->heap[l].score > t->heap[largest].score) largest = l;
+        if (r < t->heap_len && t->heap[r].score > t->heap[largest].score) largest = r;
+        if (largest == i) return;
+        DictCandidate tmp = t->heap[i];
+        t->heap[i] = t->heap[largest];
+        t->heap[largest] = tmp;
+        i = largest;
+    }
+}
+
+/**
+ * @brief Builds a dictionary from the best segments of the samples.
+ *
+ * Candidates are taken greedily; since scores only drop once strings are
+ * covered, a candidate is re-scored when it reaches the top of the heap and
+ * accepted only if it still beats the next one.
+ *
+ * @param samples Concatenated samples.
+ * @param sizes Size of every sample.
+ * @param count Number of samples.
+ * @param dict Output buffer.
+ * @param dict_cap Size of the output buffer.
+ * @return Length of the dictionary, 0 on failure or if the samples share nothing.
+ */
+static size_t select_segments(const uint8_t *samples, const size_t *sizes, size_t count, uint8_t *dict, size_t dict_cap) {
+    size_t total = 0, candidates = 0;
+    for (size_t s = 0; s < count; s++) {
+        total += sizes[s];
+        candidates += sizes[s] / DICT_SEGMENT_STEP + 1;
+    }
+    DictTrainer t = { .samples = samples };
+    t.freq = calloc((size_t)1 << DICT_HASH_BITS, sizeof(uint32_t));
+    t.stamp = calloc((size_t)1 << DICT_HASH_BITS, sizeof(uint32_t));
+    t.heap = malloc(candidates * sizeof(DictCandidate));
+    if (!t.freq || !t.stamp || !t.heap) {
+        fprintf(stderr, "Error: Memory allocation failed for dictionary training\n");
+        free(t.freq);
+        free(t.stamp);
+        free(t.heap);
+        return 0;
+    }
+    size_t pos = 0;
+    for (size_t s = 0; s < count; pos += sizes[s], s++) {
+        t.epoch++;
+        for (size_t i = 0; i + DICT_DMER <= sizes[s]; i++) {
+            uint32_t h = dmer_hash(samples + pos + i);
+            if (t.stamp[h] == t.epoch) continue;
+            t.stamp[h] = t.epoch;
+            t.freq[h]++;
+        }
+    }
+    pos = 0;
+    for (size_t s = 0; s < count; pos += sizes[s], s++) {
+        for (size_t off = 0; off + DICT_DMER <= sizes[s]; off += DICT_SEGMENT_STEP) {
+            DictCandidate c = { .pos = pos + off, .len = sizes[s] - off < DICT_SEGMENT ? sizes[s] - off : DICT_SEGMENT };
+            c.score = segment_score(&t, &c);
+            if (c.score > 0) t.heap[t.heap_len++] = c;
+        }
+    }
+    for (size_t i = t.heap_len / 2; i-- > 0;) heap_down(&t, i);
+    /* The best segments go to the end of the dictionary, closest to the data */
+    size_t fill = 0;
+    while (fill < dict_cap && t.heap_len > 0) {
+        DictCandidate c = t.heap[0];
+        c.score = segment_score(&t, &c);
+        if (c.score == 0) {
+            t.heap[0] = t.heap[--t.heap_len];
+            heap_down(&t, 0);
+            continue;
+        }
+        uint64_t next = 0;
+        if (t.heap_len > 1) next = t.heap[1].score;
+        if (t.heap_len > 2 && t.heap[2].score > next) next = t.heap[2].score;
+        if (c.score < next) {
+            t.heap[0] = c;
+            heap_down(&t, 0);
+            continue;
+        }
+        size_t len = c.len < dict_cap - fill ? c.len : dict_cap - fill;
+        memcpy(dict + dict_cap - fill - len, samples + c.pos, len);
+        fill += len;
+        for (size_t i = 0; i + DICT_DMER <= c.len; i++) t.freq[dmer_hash(samples + c.pos + i)] = 0;
+        t.heap[0] = t.heap[--t.heap_len];
+        heap_down(&t, 0);
+    }
+    if (fill < dict_cap) memmove(dict, dict + dict_cap - fill, fill);
+    free(t.freq);
+    free(t.stamp);
+    free(t.heap);
+    verbose_print(VERBOSE_DEBUG, "Selected %lu dictionary bytes from %lu sample bytes", (unsigned long)fill,
+                  (unsigned long)total);
+    return fill;
+}
+
+/**
+ * @brief Reads a sample of the small input files.
+ *
+ * Regular files of at most DICT_SAMPLE_FILE_MAX bytes are read whole, spread
+ * evenly over the input list, until DICT_SAMPLE_MAX bytes were read.
+ *
+ * @param filenames Input files.
+ * @param file_count Number of input files.
+ * @param samples Output concatenated samples (caller frees).
+ * @param sizes Output size of every sample (caller frees).
+ * @param count Output number of samples.
+ * @return 0 on success, 1 on failure.
+ */
+static int read_samples(const char **filenames, int file_count, uint8_t **samples, size_t **sizes, size_t *count) {
+    *samples = malloc(DICT_SAMPLE_MAX);
+    *sizes = malloc((file_count + 1) * sizeof(size_t));
+    *count = 0;
+    if (!*samples || !*sizes) {
+        fprintf(stderr, "Error: Memory allocation failed for dictionary samples\n");
+        free(*samples);
+        free(*sizes);
+        return 1;
+    }
+    /* Sampled files average about a quarter of the size limit, which sets the stride */
+    int stride = file_count / (DICT_SAMPLE_MAX / (DICT_SAMPLE_FILE_MAX / 4)) + 1;
+    size_t total = 0;
+    for (int pass = 0; pass < stride && total < DICT_SAMPLE_MAX; pass++) {
+        for (int i = pass; i < file_count && total < DICT_SAMPLE_MAX; i += stride) {
+            struct stat st;
+            if (strcmp(filenames[i], "-") == 0 || stat(filenames[i], &st) != 0 || !S_ISREG(st.st_mode) ||
+                st.st_size < DICT_DMER || (uint64_t)st.st_size > DICT_SAMPLE_FILE_MAX ||
+                total + st.st_size > DICT_SAMPLE_MAX) {
+                continue;
+            }
+            FILE *fp = fopen(filenames[i], "rb");
+            if (!fp) {
+                verbose_print(VERBOSE_DEBUG, "Skipping dictionary sample %s: %s", filenames[i], strerror(errno));
+                continue;
+            }
+            size_t len = fread(*samples + total, 1, st.st_size, fp);
+            fclose(fp);
+            if (len < DICT_DMER) continue;
+            (*sizes)[(*count)++] = len;
+            total += len;
+        }
+        /* One pass over the stride gives an even sample; more passes only fill up a small input set */
+        if (*count >= DICT_MIN_SAMPLES && total >= DICT_SAMPLE_MAX / 2) break;
+    }
+    return 0;
+}
+
+/**
+ * @brief Trains a compression dictionary on a sample of the input files.
+ * @param filenames Input files.
+ * @param file_count Number of input files.
+ * @param codec Codec the dictionary is for (COMPRESSION_ZLIB or COMPRESSION_ZSTD).
+ * @param dict Output dictionary (caller frees), NULL if the inputs do not lend themselves to one.
+ * @param dict_len Output length of the dictionary (0 if none).
+ * @return 0 on success (also when no dictionary was built), 1 on failure.
+ */
+int train_dictionary(const char **filenames, int file_count, CompressionAlgo codec, uint8_t **dict, size_t *dict_len) {
+    *dict = NULL;
+    *dict_len = 0;
+    uint8_t *samples;
+    size_t *sizes;
+    size_t count;
+    if (read_samples(filenames, file_count, &samples, &sizes, &count) != 0) return 1;
+    size_t total = 0;
+    for (size_t s = 0; s < count; s++) total += sizes[s];
+    if (count < DICT_MIN_SAMPLES) {
+        verbose_print(VERBOSE_BASIC, "Only %lu files of at most %uKB to sample, archiving without a dictionary",
+                      (unsigned long)count, DICT_SAMPLE_FILE_MAX >> 10);
+        free(samples);
+        free(sizes);
+        return 0;
+    }
+    size_t cap = codec == COMPRESSION_ZLIB ? DICT_ZLIB_SIZE : DICT_MAX_SIZE;
+    /* A dictionary much larger than what it was learned from only repeats the samples */
+    if (cap > total / 4) cap = total / 4 < DICT_SEGMENT ? DICT_SEGMENT : total / 4;
+    uint8_t *buf = malloc(cap);
+    if (!buf) {
+        fprintf(stderr, "Error: Memory allocation failed for dictionary\n");
+        free(samples);
+        free(sizes);
+        return 1;
+    }
+    size_t len = 0;
+#ifdef HAVE_ZSTD
+    if (codec == COMPRESSION_ZSTD) {
+        size_t ret = ZDICT_trainFromBuffer(buf, cap, samples, sizes, (unsigned)count);
+        if (ZDICT_isError(ret)) {
+            verbose_print(VERBOSE_DEBUG, "zstd dictionary training failed (%s), selecting segments instead",
+                          ZDICT_getErrorName(ret));
+        } else {
+            len = ret;
+        }
+    }
+#endif
+    if (len == 0) len = select_segments(samples, sizes, count, buf, cap);
+    secure_zero(samples, total);
+    free(samples);
+    free(sizes);
+    if (len == 0) {
+        verbose_print(VERBOSE_BASIC, "Sampled files share no content, archiving without a dictionary");
+        free(buf);
+        return 0;
+    }
+    verbose_print(VERBOSE_BASIC, "Trained a %lu-byte %s dictionary on %lu files (%lu bytes)", (unsigned long)len,
+                  codec_name(codec), (unsigned long)count, (unsigned long)total);
+    *dict = buf;
+    *dict_len = len;
+    return 0;
+}
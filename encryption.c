@@ -4,6 +4,7 @@
  */
 
 #include "seclume.h"
+#include <string.h>
 
 /**
  * @brief Encrypts data using AES-256-GCM.
@@ -104,3 +105,271 @@ int decrypt_aes_gcm(const uint8_t *key, const uint8_t *nonce, const uint8_t *in,
     EVP_CIPHER_CTX_free(ctx);
     return 0;
 }
+
+/**
+ * @brief Creates a reusable AES-256-GCM context with the key schedule loaded once.
+ *
+ * Each call to gcm_key_encrypt() or gcm_key_decrypt() only sets a new nonce, so
+ * the cipher lookup, allocation and key expansion are not repeated per message.
+ *
+ * @param gk Context to initialize.
+ * @param key AES-256 key (32 bytes).
+ * @param encrypt 1 for an encryption context, 0 for decryption.
+ * @return 0 on success, 1 on failure.
+ */
+int gcm_key_init(GcmKey *gk, const uint8_t *key, int encrypt) {
+    gk->encrypt = encrypt;
+    gk->ctx = EVP_CIPHER_CTX_new();
+    if (!gk->ctx) {
+        fprintf(stderr, "Error: EVP_CIPHER_CTX_new failed\n");
+        return 1;
+    }
+    if (EVP_CipherInit_ex(gk->ctx, EVP_aes_256_gcm(), NULL, key, NULL, encrypt) != 1) {
+        fprintf(stderr, "Error: AES-GCM key setup failed\n");
+        gcm_key_free(gk);
+        return 1;
+    }
+    return 0;
+}
+
+/**
+ * @brief Loads another key into a reusable AES-256-GCM context.
+ *
+ * The context and cipher are kept, so only the key expansion is redone.
+ *
+ * @param gk Context initialized by gcm_key_init().
+ * @param key AES-256 key (32 bytes).
+ * @return 0 on success, 1 on failure.
+ */
+int gcm_key_rekey(GcmKey *gk, const uint8_t *key) {
+    if (EVP_CipherInit_ex(gk->ctx, NULL, NULL, key, NULL, gk->encrypt) != 1) {
+        fprintf(stderr, "Error: AES-GCM key setup failed\n");
+        return 1;
+    }
+    return 0;
+}
+
+/**
+ * @brief Releases a reusable AES-256-GCM context (wiping the key schedule).
+ * @param gk Context to free.
+ */
+void gcm_key_free(GcmKey *gk) {
+    EVP_CIPHER_CTX_free(gk->ctx);
+    gk->ctx = NULL;
+}
+
+/**
+ * @brief Encrypts one message with a reusable AES-256-GCM context.
+ * @param gk Encryption context.
+ * @param nonce Nonce for GCM (12 bytes, unique per message).
+ * @param aad Additional authenticated data (may be NULL if aad_len is 0).
+ * @param aad_len Length of additional data.
+ * @param in Plaintext.
+ * @param in_len Length of plaintext.
+ * @param out Output buffer for the ciphertext (in_len bytes).
+ * @param tag Output authentication tag (16 bytes).
+ * @return 0 on success, 1 on failure.
+ */
+int gcm_key_encrypt(GcmKey *gk, const uint8_t *nonce, const uint8_t *aad, size_t aad_len,
+                    const uint8_t *in, size_t in_len, uint8_t *out, uint8_t *tag) {
+    int len;
+    StageTimer timer;
+    stage_begin(&timer);
+    if (!gk->encrypt ||
+        EVP_EncryptInit_ex(gk->ctx, NULL, NULL, NULL, nonce) != 1 ||
+        (aad_len > 0 && EVP_EncryptUpdate(gk->ctx, NULL, &len, aad, aad_len) != 1) ||
+        (in_len > 0 && EVP_EncryptUpdate(gk->ctx, out, &len, in, in_len) != 1) ||
+        EVP_EncryptFinal_ex(gk->ctx, out + in_len, &len) != 1 ||
+        EVP_CIPHER_CTX_ctrl(gk->ctx, EVP_CTRL_GCM_GET_TAG, AES_TAG_SIZE, tag) != 1) {
+        fprintf(stderr, "Error: AES-GCM encryption failed\n");
+        return 1;
+    }
+    stage_end(&timer, STAGE_ENCRYPT, in_len);
+    return 0;
+}
+
+/**
+ * @brief Decrypts and authenticates one message with a reusable AES-256-GCM context.
+ * @param gk Decryption context.
+ * @param nonce Nonce for GCM (12 bytes).
+ * @param aad Additional authenticated data (may be NULL if aad_len is 0).
+ * @param aad_len Length of additional data.
+ * @param in Ciphertext.
+ * @param in_len Length of ciphertext.
+ * @param tag Authentication tag (16 bytes).
+ * @param out Output buffer for the plaintext (in_len bytes).
+ * @return 0 on success, 1 on failure (including authentication failure, which is not reported here).
+ */
+int gcm_key_decrypt(GcmKey *gk, const uint8_t *nonce, const uint8_t *aad, size_t aad_len,
+                    const uint8_t *in, size_t in_len, const uint8_t *tag, uint8_t *out) {
+    int len;
+    StageTimer timer;
+    stage_begin(&timer);
+    if (gk->encrypt ||
+        EVP_DecryptInit_ex(gk->ctx, NULL, NULL, NULL, nonce) != 1 ||
+        (aad_len > 0 && EVP_DecryptUpdate(gk->ctx, NULL, &len, aad, aad_len) != 1) ||
+        (in_len > 0 && EVP_DecryptUpdate(gk->ctx, out, &len, in, in_len) != 1) ||
+        EVP_CIPHER_CTX_ctrl(gk->ctx, EVP_CTRL_GCM_SET_TAG, AES_TAG_SIZE, (void *)tag) != 1) {
+        fprintf(stderr, "Error: AES-GCM decryption failed\n");
+        return 1;
+    }
+    int ret = EVP_DecryptFinal_ex(gk->ctx, out + in_len, &len) <= 0;
+    stage_end(&timer, STAGE_DECRYPT, in_len);
+    return ret;
+}
+
+/**
+ * @brief Initializes a chunked payload cipher context.
+ * @param cc Context to initialize.
+ * @param gk Reusable AES-256-GCM context for the payload key (must outlive the context).
+ * @param base_nonce Random base nonce of the payload (12 bytes).
+ */
+void chunk_cipher_init(ChunkCipher *cc, GcmKey *gk, const uint8_t *base_nonce) {
+    cc->gk = gk;
+    memcpy(cc->base_nonce, base_nonce, AES_NONCE_SIZE);
+    cc->index = 0;
+    cc->finished = 0;
+}
+
+/**
+ * @brief Computes the nonce of the next chunk (base nonce XOR big-endian chunk index).
+ * @param cc Chunk cipher context.
+ * @param nonce Output nonce (12 bytes).
+ */
+static void chunk_nonce(const ChunkCipher *cc, uint8_t *nonce) {
+    memcpy(nonce, cc->base_nonce, AES_NONCE_SIZE);
+    for (int i = 0; i < 8; i++) {
+        nonce[AES_NONCE_SIZE - 1 - i] ^= (uint8_t)(cc->index >> (8 * i));
+    }
+}
+
+/**
+ * @brief Encrypts one payload chunk, producing its on-disk record.
+ * @param cc Chunk cipher context (with an encryption GcmKey).
+ * @param in Chunk plaintext.
+ * @param in_len Length of plaintext (at most CHUNK_MAX_LEN, may be 0 for the final chunk).
+ * @param final If 1, this is the last chunk of the payload.
+ * @param out Output record buffer (at least in_len + CHUNK_OVERHEAD bytes).
+ * @param out_len Pointer to store the record length.
+ * @return 0 on success, 1 on failure.
+ */
+int chunk_encrypt(ChunkCipher *cc, const uint8_t *in, size_t in_len, int final, uint8_t *out, size_t *out_len) {
+    if (!cc || (!in && in_len > 0) || !out || !out_len || in_len > CHUNK_MAX_LEN || cc->finished) {
+        fprintf(stderr, "Error: Invalid chunk encryption parameters\n");
+        return 1;
+    }
+    uint32_t header = (uint32_t)in_len | (final ? CHUNK_FINAL : 0);
+    memcpy(out, &header, sizeof(header));
+    uint8_t nonce[AES_NONCE_SIZE];
+    chunk_nonce(cc, nonce);
+    uint8_t *ct = out + sizeof(header);
+    if (gcm_key_encrypt(cc->gk, nonce, out, sizeof(header), in, in_len, ct, ct + in_len) != 0) {
+        fprintf(stderr, "Error: AES-GCM chunk encryption failed\n");
+        return 1;
+    }
+    *out_len = in_len + CHUNK_OVERHEAD;
+    cc->index++;
+    cc->finished = final;
+    return 0;
+}
+
+/**
+ * @brief Decrypts and authenticates one payload chunk.
+ * @param cc Chunk cipher context (with a decryption GcmKey).
+ * @param header Chunk header as read from the archive (length and CHUNK_FINAL flag).
+ * @param in Chunk ciphertext (header & ~CHUNK_FINAL bytes).
+ * @param tag Authentication tag of the chunk (16 bytes).
+ * @param out Output buffer for the plaintext (same length as the ciphertext).
+ * @return 0 on success, 1 on failure.
+ */
+int chunk_decrypt(ChunkCipher *cc, uint32_t header, const uint8_t *in, const uint8_t *tag, uint8_t *out) {
+    size_t in_len = header & ~CHUNK_FINAL;
+    if (!cc || (!in && in_len > 0) || !tag || !out || in_len > CHUNK_MAX_LEN || cc->finished) {
+        fprintf(stderr, "Error: Invalid chunk decryption parameters\n");
+        return 1;
+    }
+    uint8_t nonce[AES_NONCE_SIZE];
+    chunk_nonce(cc, nonce);
+    if (gcm_key_decrypt(cc->gk, nonce, (const uint8_t *)&header, sizeof(header), in, in_len, tag, out) != 0) {
+        fprintf(stderr, "Error: AES-GCM authentication failed for chunk %lu (wrong password or corrupted data?)\n",
+                (unsigned long)cc->index);
+        return 1;
+    }
+    cc->index++;
+    cc->finished = (header & CHUNK_FINAL) != 0;
+    return 0;
+}
+
+/**
+ * @brief Starts an incremental AES-256-GCM decryption.
+ * @param gs Stream context to initialize.
+ * @param key AES-256 key (32 bytes).
+ * @param nonce Nonce for GCM (12 bytes).
+ * @return 0 on success, 1 on failure.
+ */
+int gcm_stream_init(GcmStream *gs, const uint8_t *key, const uint8_t *nonce) {
+    gs->ctx = EVP_CIPHER_CTX_new();
+    if (!gs->ctx) {
+        fprintf(stderr, "Error: EVP_CIPHER_CTX_new failed\n");
+        return 1;
+    }
+    if (EVP_DecryptInit_ex(gs->ctx, EVP_aes_256_gcm(), NULL, NULL, NULL) != 1 ||
+        EVP_DecryptInit_ex(gs->ctx, NULL, NULL, key, nonce) != 1) {
+        fprintf(stderr, "Error: AES-GCM decryption init failed\n");
+        gcm_stream_free(gs);
+        return 1;
+    }
+    return 0;
+}
+
+/**
+ * @brief Decrypts the next part of an incremental AES-256-GCM stream.
+ *
+ * The output is not authenticated until gcm_stream_final() succeeds.
+ *
+ * @param gs Stream context.
+ * @param in Encrypted input data.
+ * @param in_len Length of input data.
+ * @param out Output buffer (at least in_len bytes).
+ * @return 0 on success, 1 on failure.
+ */
+int gcm_stream_update(GcmStream *gs, const uint8_t *in, size_t in_len, uint8_t *out) {
+    int len;
+    StageTimer timer;
+    stage_begin(&timer);
+    if (EVP_DecryptUpdate(gs->ctx, out, &len, in, in_len) != 1 || (size_t)len != in_len) {
+        fprintf(stderr, "Error: AES-GCM decryption update failed\n");
+        return 1;
+    }
+    stage_end(&timer, STAGE_DECRYPT, in_len);
+    return 0;
+}
+
+/**
+ * @brief Verifies the authentication tag of an incremental AES-256-GCM stream.
+ * @param gs Stream context.
+ * @param tag Authentication tag (16 bytes).
+ * @return 0 if the data is authentic, 1 otherwise.
+ */
+int gcm_stream_final(GcmStream *gs, const uint8_t *tag) {
+    uint8_t dummy[AES_TAG_SIZE];
+    int len;
+    if (EVP_CIPHER_CTX_ctrl(gs->ctx, EVP_CTRL_GCM_SET_TAG, AES_TAG_SIZE, (void *)tag) != 1) {
+        fprintf(stderr, "Error: AES-GCM tag setting failed\n");
+        return 1;
+    }
+    if (EVP_DecryptFinal_ex(gs->ctx, dummy, &len) <= 0) {
+        fprintf(stderr, "Error: AES-GCM decryption final failed (wrong password or corrupted data?)\n");
+        return 1;
+    }
+    return 0;
+}
+
+/**
+ * @brief Releases an incremental AES-256-GCM context.
+ * @param gs Stream context.
+ */
+void gcm_stream_free(GcmStream *gs) {
+    EVP_CIPHER_CTX_free(gs->ctx);
+    gs->ctx = NULL;
+}
@@ -0,0 +1,630 @@
+/**
+ * @file exclude.c
+ * @brief Exclusion patterns compiled once into a combined matcher.
+ *
+ * Patterns are fnmatch() globs matched against entry names. Literal names and
+ * prefixes ("build", "cache*") go into a trie walked forwards, literal
+ * suffixes ("*.o") into a trie walked backwards, and every other pattern into
+ * DFAs built from their combined NFA (split into groups when one automaton
+ * would outgrow EXCLUDE_DFA_MAX_STATES states), so matching a name costs time
+ * in proportion to its length rather than to the number of patterns. Patterns
+ * the compiler cannot model exactly (unterminated brackets, a trailing
+ * backslash, collating elements) are matched one by one instead.
+ */
+
+#include "seclume.h"
+#include <string.h>
+#include <stdlib.h>
+
+/**
+ * @brief One element of a parsed glob.
+ */
+typedef struct {
+    uint8_t set[32]; /**< Bytes the token matches (bit b % 8 of set[b / 8]) */
+    int star;        /**< Set for '*', which matches any run of bytes */
+} GlobToken;
+
+/**
+ * @brief A general pattern waiting to be compiled into the DFA.
+ */
+typedef struct {
+    GlobToken tokens[MAX_PATTERN_LEN]; /**< Parsed pattern */
+    int count;                         /**< Number of tokens */
+    int index;                         /**< Index of the source pattern */
+    int dir_only;                      /**< Set if the pattern only matches directories */
+} GlobPattern;
+
+/**
+ * @brief Returns the bit of a byte in a token set.
+ * @param set Token set.
+ * @param b Byte.
+ * @return Nonzero if the set holds the byte.
+ */
+static int set_has(const uint8_t *set, unsigned b) {
+    return set[b >> 3] & (1U << (b & 7));
+}
+
+/**
+ * @brief Finds the ']' closing a bracket expression.
+ * @param p Pattern.
+ * @param len Length of the pattern.
+ * @param i Offset of the opening '['.
+ * @return Offset of the closing ']', or 0 if the bracket is not terminated or too unusual to compile.
+ */
+static size_t bracket_end(const char *p, size_t len, size_t i) {
+    size_t j = i + 1;
+    if (j < len && (p[j] == '!' || p[j] == '^')) j++;
+    if (j < len && p[j] == ']') j++;
+    while (j < len && p[j] != ']') {
+        if (p[j] == '[' && j + 1 < len && (p[j + 1] == '=' || p[j + 1] == '.')) {
+            return 0;
+        } else if (p[j] == '[' && j + 1 < len && p[j + 1] == ':') {
+            /* Only plain class names are compiled; anything odder is left to fnmatch() */
+            size_t k = j + 2;
+            while (k < len && k - j < 16 && p[k] >= 'a' && p[k] <= 'z') k++;
+            if (k + 1 >= len || p[k] != ':' || p[k + 1] != ']') return 0;
+            j = k + 2;
+        } else if (p[j] == '\\' && j + 1 < len) {
+            j += 2;
+        } else {
+            j++;
+        }
+    }
+    return j < len ? j : 0;
+}
+
+/**
+ * @brief Parses a glob into tokens, collapsing runs of '*'.
+ *
+ * Bracket expressions are evaluated by matches_glob_pattern() for every byte, so classes
+ * and ranges mean exactly what they mean there. Names never contain '/' or
+ * NUL, so no token matches them.
+ *
+ * @param pattern Pattern (without the trailing '/' of a directory pattern).
+ * @param len Length of the pattern.
+ * @param tokens Output tokens (at least len slots).
+ * @param count Output number of tokens.
+ * @return 0 on success, 1 if the pattern can never match a name, -1 if it must be matched on its own.
+ */
+static int parse_glob(const char *pattern, size_t len, GlobToken *tokens, int *count) {
+    int n = 0;
+    for (size_t i = 0; i < len;) {
+        GlobToken *t = &tokens[n];
+        memset(t, 0, sizeof(*t));
+        unsigned char c = pattern[i];
+        if (c == '*') {
+            i++;
+            if (n > 0 && tokens[n - 1].star) continue;
+            t->star = 1;
+            n++;
+            continue;
+        }
+        if (c == '?') {
+            memset(t->set, 0xFF, sizeof(t->set));
+            i++;
+        } else if (c == '[') {
+            size_t end = bracket_end(pattern, len, i);
+            if (end == 0) return -1;
+            char text[MAX_PATTERN_LEN + 1];
+            memcpy(text, pattern + i, end - i + 1);
+            text[end - i + 1] = '\0';
+            for (unsigned b = 1; b < 256; b++) {
+                char s[2] = { (char)b, '\0' };
+                if (matches_glob_pattern(s, text)) t->set[b >> 3] |= 1U << (b & 7);
+            }
+            i = end + 1;
+        } else {
+            if (c == '\\') {
+                if (i + 1 == len) return -1;
+                c = pattern[++i];
+            }
+            if (c == '/') return 1;
+            t->set[c >> 3] |= 1U << (c & 7);
+            i++;
+        }
+        t->set[0] &= ~1U;
+        t->set['/' >> 3] &= ~(1U << ('/' & 7));
+        n++;
+    }
+    *count = n;
+    return 0;
+}
+
+/**
+ * @brief Returns the single byte a token matches.
+ * @param t Token.
+ * @return The byte, or -1 if the token is '*' or matches another number of bytes.
+ */
+static int token_literal(const GlobToken *t) {
+    if (t->star) return -1;
+    int literal = -1;
+    for (unsigned b = 1; b < 256; b++) {
+        if (!set_has(t->set, b)) continue;
+        if (literal != -1) return -1;
+        literal = b;
+    }
+    return literal;
+}
+
+/**
+ * @brief Looks up the child of a trie node for a byte.
+ * @param trie Trie.
+ * @param parent Parent node.
+ * @param byte Edge byte.
+ * @return Child node, or 0 if there is none.
+ */
+static uint32_t trie_find(const GlobTrie *trie, uint32_t parent, uint8_t byte) {
+    for (uint32_t n = trie->nodes[parent].child; n; n = trie->nodes[n].sibling) {
+        if (trie->nodes[n].byte == byte) return n;
+    }
+    return 0;
+}
+
+/**
+ * @brief Returns the child of a trie node for a byte, adding it if it is missing.
+ * @param trie Trie.
+ * @param parent Parent node.
+ * @param byte Edge byte.
+ * @return Child node, or 0 on allocation failure.
+ */
+static uint32_t trie_child(GlobTrie *trie, uint32_t parent, uint8_t byte) {
+    uint32_t n = trie_find(trie, parent, byte);
+    if (n) return n;
+    if (trie->count == trie->cap) {
+        uint32_t cap = trie->cap * 2;
+        GlobTrieNode *nodes = realloc(trie->nodes, cap * sizeof(GlobTrieNode));
+        if (!nodes) return 0;
+        trie->nodes = nodes;
+        trie->cap = cap;
+    }
+    n = trie->count++;
+    GlobTrieNode node = { .child = 0, .sibling = trie->nodes[parent].child, .whole = { -1, -1 }, .part = { -1, -1 },
+                          .byte = byte };
+    trie->nodes[n] = node;
+    trie->nodes[parent].child = n;
+    return n;
+}
+
+/**
+ * @brief Adds the literal tokens of a pattern to a trie.
+ * @param trie Trie.
+ * @param tokens Literal tokens, in the order the trie is walked.
+ * @param count Number of tokens.
+ * @param step 1 to add the tokens in order, -1 to add them backwards (suffix trie).
+ * @param index Pattern index.
+ * @param dir_only Set if the pattern only matches directories.
+ * @param whole 1 if the name must end with the last token, 0 if it may continue.
+ * @return 0 on success, 1 on failure.
+ */
+static int trie_add(GlobTrie *trie, const GlobToken *tokens, int count, int step, int index, int dir_only, int whole) {
+    uint32_t node = 0;
+    for (int k = 0; k < count; k++) {
+        node = trie_child(trie, node, (uint8_t)token_literal(&tokens[step > 0 ? k : count - 1 - k]));
+        if (node == 0) {
+            fprintf(stderr, "Error: Memory allocation failed for exclude patterns\n");
+            return 1;
+        }
+    }
+    int32_t *slot = whole ? &trie->nodes[node].whole[dir_only] : &trie->nodes[node].part[dir_only];
+    if (*slot < 0) *slot = index;
+    return 0;
+}
+
+/**
+ * @brief Lowers a match to the pattern in a slot pair if it applies to the entry.
+ * @param best Lowest matching pattern so far, -1 if none.
+ * @param slot Lowest patterns for any entry and for directories only.
+ * @param is_dir Set if the entry is a directory.
+ * @return The new lowest matching pattern.
+ */
+static int lower_match(int best, const int32_t *slot, int is_dir) {
+    for (int k = 0; k <= is_dir; k++) {
+        if (slot[k] >= 0 && (best < 0 || slot[k] < best)) best = slot[k];
+    }
+    return best;
+}
+
+/**
+ * @brief Hashes a DFA state set (FNV-1a over its words, folded).
+ * @param set NFA position set.
+ * @param words Words in the set.
+ * @return Hash value.
+ */
+static uint64_t set_hash(const uint64_t *set, size_t words) {
+    uint64_t h = 14695981039346656037ULL;
+    for (size_t w = 0; w < words; w++) {
+        h ^= set[w];
+        h *= 1099511628211ULL;
+        h ^= h >> 32; /* The product's low bits only see the low bits of the word */
+    }
+    return h;
+}
+
+/**
+ * @brief Combined NFA of the general patterns and the DFA built from it.
+ */
+typedef struct {
+    const GlobToken **tokens; /**< Token at every NFA position, NULL at the end of a pattern */
+    const GlobPattern **owner; /**< Pattern of every NFA position */
+    size_t positions;         /**< Number of NFA positions */
+    size_t words;             /**< Words of one position set */
+    uint64_t *sets;           /**< Position set of every DFA state */
+    int32_t *slots;           /**< Open-addressing table of DFA states by set (EXCLUDE_DFA_MAX_STATES * 2 slots) */
+} DfaBuilder;
+
+/**
+ * @brief Adds the positions reachable without input to a position set.
+ * @param b DFA builder.
+ * @param set Position set.
+ */
+static void nfa_closure(const DfaBuilder *b, uint64_t *set) {
+    /* Runs of '*' are collapsed, so one pass in position order reaches everything */
+    for (size_t w = 0; w < b->words; w++) {
+        for (uint64_t bits = set[w]; bits; bits &= bits - 1) {
+            size_t p = w * 64 + __builtin_ctzll(bits);
+            if (b->tokens[p] && b->tokens[p]->star) {
+                set[(p + 1) >> 6] |= 1ULL << ((p + 1) & 63);
+                if (((p + 1) >> 6) == w) bits |= 1ULL << ((p + 1) & 63);
+            }
+        }
+    }
+}
+
+/**
+ * @brief Returns the DFA state of a position set, adding it if it is new.
+ * @param dfa Automaton being built.
+ * @param b DFA builder.
+ * @param states Position set of the state.
+ * @return State number, or -1 if the DFA is full.
+ */
+static int dfa_state(ExcludeDfa *dfa, DfaBuilder *b, const uint64_t *states) {
+    size_t mask = EXCLUDE_DFA_MAX_STATES * 2 - 1;
+    size_t slot = set_hash(states, b->words) & mask;
+    for (; b->slots[slot] >= 0; slot = (slot + 1) & mask) {
+        if (memcmp(b->sets + (size_t)b->slots[slot] * b->words, states, b->words * sizeof(uint64_t)) == 0)
+            return b->slots[slot];
+    }
+    if (dfa->state_count == EXCLUDE_DFA_MAX_STATES) return -1;
+    int s = dfa->state_count++;
+    memcpy(b->sets + (size_t)s * b->words, states, b->words * sizeof(uint64_t));
+    b->slots[slot] = s;
+    int32_t *accept = &dfa->accept[s * 2];
+    accept[0] = accept[1] = -1;
+    int empty = 1;
+    for (size_t w = 0; w < b->words; w++) {
+        for (uint64_t bits = states[w]; bits; bits &= bits - 1) {
+            size_t p = w * 64 + __builtin_ctzll(bits);
+            empty = 0;
+            if (b->tokens[p]) continue;
+            int32_t *a = &accept[b->owner[p]->dir_only];
+            if (*a < 0 || b->owner[p]->index < *a) *a = b->owner[p]->index;
+        }
+    }
+    if (empty) dfa->dead = s;
+    return s;
+}
+
+/**
+ * @brief Runs the subset construction over an allocated builder.
+ *
+ * Bytes that every token treats alike share an input class, so the
+ * transition table has one column per class rather than per byte.
+ *
+ * @param dfa Automaton being built.
+ * @param b DFA builder with its NFA filled in.
+ * @param general General patterns.
+ * @param count Number of general patterns.
+ * @param next_set Scratch position set.
+ * @return 0 on success, 1 if the DFA grew beyond EXCLUDE_DFA_MAX_STATES states, -1 on allocation failure.
+ */
+static int construct_dfa(ExcludeDfa *dfa, DfaBuilder *b, const GlobPattern *general, int count, uint64_t *next_set) {
+    /* Split the bytes into classes, refining them with every token set; NUL and
+     * '/' start in classes of their own since '*' does not match them */
+    memset(dfa->byte_class, 0, sizeof(dfa->byte_class));
+    dfa->byte_class[0] = 1;
+    dfa->byte_class['/'] = 2;
+    dfa->class_count = 3;
+    for (size_t p = 0; p < b->positions; p++) {
+        if (!b->tokens[p] || b->tokens[p]->star) continue;
+        int split[256 * 2];
+        memset(split, 0xFF, sizeof(split));
+        int classes = 0;
+        for (unsigned c = 0; c < 256; c++) {
+            int *id = &split[dfa->byte_class[c] * 2 + (set_has(b->tokens[p]->set, c) != 0)];
+            if (*id < 0) *id = classes++;
+            dfa->byte_class[c] = *id;
+        }
+        dfa->class_count = classes;
+    }
+    uint8_t rep[256];
+    for (int c = 255; c >= 0; c--) rep[dfa->byte_class[c]] = c;
+    dfa->next = malloc((size_t)EXCLUDE_DFA_MAX_STATES * dfa->class_count * sizeof(int32_t));
+    dfa->accept = malloc(EXCLUDE_DFA_MAX_STATES * 2 * sizeof(int32_t));
+    if (!dfa->next || !dfa->accept) return -1;
+    dfa->dead = -1;
+    memset(next_set, 0, b->words * sizeof(uint64_t));
+    size_t start = 0;
+    for (int g = 0; g < count; g++) {
+        next_set[start >> 6] |= 1ULL << (start & 63);
+        start += general[g].count + 1;
+    }
+    nfa_closure(b, next_set);
+    dfa_state(dfa, b, next_set);
+    for (int s = 0; s < dfa->state_count; s++) {
+        for (int c = 0; c < dfa->class_count; c++) {
+            const uint64_t *cur = b->sets + (size_t)s * b->words;
+            memset(next_set, 0, b->words * sizeof(uint64_t));
+            for (size_t w = 0; w < b->words; w++) {
+                for (uint64_t bits = cur[w]; bits; bits &= bits - 1) {
+                    size_t p = w * 64 + __builtin_ctzll(bits);
+                    if (!b->tokens[p]) continue;
+                    if (b->tokens[p]->star) {
+                        if (rep[c] != 0 && rep[c] != '/') next_set[w] |= 1ULL << (p & 63);
+                    } else if (set_has(b->tokens[p]->set, rep[c])) {
+                        next_set[(p + 1) >> 6] |= 1ULL << ((p + 1) & 63);
+                    }
+                }
+            }
+            nfa_closure(b, next_set);
+            int t = dfa_state(dfa, b, next_set);
+            if (t < 0) return 1;
+            dfa->next[(size_t)s * dfa->class_count + c] = t;
+        }
+    }
+    return 0;
+}
+
+/**
+ * @brief Builds one DFA matching a group of general patterns.
+ * @param dfa Output automaton.
+ * @param general General patterns.
+ * @param count Number of general patterns.
+ * @return 0 on success, 1 if the group is too large for one DFA, -1 on allocation failure.
+ */
+static int build_dfa(ExcludeDfa *dfa, const GlobPattern *general, int count) {
+    DfaBuilder b;
+    memset(&b, 0, sizeof(b));
+    for (int g = 0; g < count; g++) b.positions += general[g].count + 1;
+    if (b.positions > EXCLUDE_DFA_MAX_POSITIONS) return 1;
+    b.words = (b.positions + 63) / 64;
+    b.tokens = malloc(b.positions * sizeof(*b.tokens));
+    b.owner = malloc(b.positions * sizeof(*b.owner));
+    b.sets = malloc((size_t)EXCLUDE_DFA_MAX_STATES * b.words * sizeof(uint64_t));
+    b.slots = malloc(EXCLUDE_DFA_MAX_STATES * 2 * sizeof(int32_t));
+    uint64_t *next_set = malloc(b.words * sizeof(uint64_t));
+    int ret = -1;
+    if (b.tokens && b.owner && b.sets && b.slots && next_set) {
+        memset(b.slots, 0xFF, EXCLUDE_DFA_MAX_STATES * 2 * sizeof(int32_t));
+        size_t p = 0;
+        for (int g = 0; g < count; g++) {
+            for (int k = 0; k <= general[g].count; k++, p++) {
+                b.tokens[p] = k < general[g].count ? &general[g].tokens[k] : NULL;
+                b.owner[p] = &general[g];
+            }
+        }
+        ret = construct_dfa(dfa, &b, general, count, next_set);
+    }
+    if (ret == 0) {
+        /* Give back the unused tail of the tables */
+        int32_t *next = realloc(dfa->next, (size_t)dfa->state_count * dfa->class_count * sizeof(int32_t));
+        int32_t *accept = realloc(dfa->accept, (size_t)dfa->state_count * 2 * sizeof(int32_t));
+        if (next) dfa->next = next;
+        if (accept) dfa->accept = accept;
+    }
+    if (ret == -1) fprintf(stderr, "Error: Memory allocation failed for exclude patterns\n");
+    if (ret != 0) {
+        free(dfa->next);
+        free(dfa->accept);
+        dfa->next = NULL;
+        dfa->accept = NULL;
+        dfa->state_count = 0;
+        dfa->class_count = 0;
+    }
+    free(b.tokens);
+    free(b.owner);
+    free(b.sets);
+    free(b.slots);
+    free(next_set);
+    return ret;
+}
+
+/**
+ * @brief Compiles general patterns into as few automata as fit.
+ *
+ * Globs with several '*' multiply each other's states when combined, so a
+ * group whose DFA would be too large is split in half and each half compiled
+ * on its own. A single pattern that is still too large is matched on its own.
+ *
+ * @param set Exclude set being compiled.
+ * @param general General patterns.
+ * @param count Number of general patterns.
+ * @return 0 on success, 1 on failure.
+ */
+static int compile_dfas(ExcludeSet *set, const GlobPattern *general, int count) {
+    ExcludeDfa *dfa = &set->dfas[set->dfa_count];
+    memset(dfa, 0, sizeof(*dfa));
+    int ret = build_dfa(dfa, general, count);
+    if (ret == -1) return 1;
+    if (ret == 0) {
+        set->dfa_count++;
+        return 0;
+    }
+    if (count == 1) {
+        set->fallback[set->fallback_count++] = general[0].index;
+        return 0;
+    }
+    if (compile_dfas(set, general, count / 2) != 0) return 1;
+    return compile_dfas(set, general + count / 2, count - count / 2);
+}
+
+/**
+ * @brief Compiles exclusion patterns into a matcher.
+ *
+ * A pattern ending in '/' matches directories only (the '/' is not part of
+ * the glob). The compiled set is read-only, so walker threads may share it.
+ *
+ * @param set Output exclude set (freed with exclude_set_free()).
+ * @param patterns Patterns (kept by reference for messages and fallback matching).
+ * @param count Number of patterns.
+ * @return 0 on success, 1 on failure.
+ */
+int exclude_set_compile(ExcludeSet *set, const char **patterns, int count) {
+    memset(set, 0, sizeof(*set));
+    set->patterns = patterns;
+    set->count = count;
+    if (count == 0) return 0;
+    GlobTrie *tries[2] = { &set->prefixes, &set->suffixes };
+    for (int k = 0; k < 2; k++) {
+        tries[k]->cap = 64;
+        tries[k]->count = 1;
+        tries[k]->nodes = malloc(tries[k]->cap * sizeof(GlobTrieNode));
+        if (!tries[k]->nodes) {
+            fprintf(stderr, "Error: Memory allocation failed for exclude patterns\n");
+            exclude_set_free(set);
+            return 1;
+        }
+        GlobTrieNode root = { .child = 0, .sibling = 0, .whole = { -1, -1 }, .part = { -1, -1 }, .byte = 0 };
+        tries[k]->nodes[0] = root;
+    }
+    set->fallback = malloc(count * sizeof(int));
+    GlobPattern *general = malloc(count * sizeof(GlobPattern));
+    if (!set->fallback || !general) {
+        fprintf(stderr, "Error: Memory allocation failed for exclude patterns\n");
+        free(general);
+        exclude_set_free(set);
+        return 1;
+    }
+    int general_count = 0, literal_count = 0, never = 0, fallback_parse = 0;
+    for (int i = 0; i < count; i++) {
+        size_t len = strlen(patterns[i]);
+        GlobPattern *g = &general[general_count];
+        g->index = i;
+        g->dir_only = len > 0 && patterns[i][len - 1] == '/';
+        if (g->dir_only) len--;
+        int parsed = len < MAX_PATTERN_LEN ? parse_glob(patterns[i], len, g->tokens, &g->count) : -1;
+        if (parsed == 1) {
+            never++;
+            continue;
+        }
+        if (parsed == -1) {
+            set->fallback[set->fallback_count++] = i;
+            fallback_parse++;
+            continue;
+        }
+        /* Leading and trailing literal runs decide which table fits */
+        int lead = 0, trail = 0;
+        while (lead < g->count && token_literal(&g->tokens[lead]) >= 0) lead++;
+        while (trail < g->count && token_literal(&g->tokens[g->count - 1 - trail]) >= 0) trail++;
+        int added = 0, ret = 0;
+        if (lead == g->count) {
+            ret = trie_add(&set->prefixes, g->tokens, g->count, 1, i, g->dir_only, 1);
+            added = 1;
+        } else if (lead == g->count - 1 && g->tokens[lead].star) {
+            ret = trie_add(&set->prefixes, g->tokens, lead, 1, i, g->dir_only, 0);
+            added = 1;
+        } else if (trail == g->count - 1 && g->tokens[0].star) {
+            ret = trie_add(&set->suffixes, g->tokens + 1, trail, -1, i, g->dir_only, 0);
+            added = 1;
+        }
+        if (ret != 0) {
+            free(general);
+            exclude_set_free(set);
+            return 1;
+        }
+        if (added) {
+            literal_count++;
+        } else {
+            general_count++;
+        }
+    }
+    if (general_count > 0) {
+        set->dfas = malloc(general_count * sizeof(ExcludeDfa));
+        if (!set->dfas) fprintf(stderr, "Error: Memory allocation failed for exclude patterns\n");
+        if (!set->dfas || compile_dfas(set, general, general_count) != 0) {
+            free(general);
+            exclude_set_free(set);
+            return 1;
+        }
+    }
+    free(general);
+    /* Fallback patterns are tried in order, so the first match is the lowest */
+    for (int a = 1; a < set->fallback_count; a++) {
+        int v = set->fallback[a], b = a;
+        for (; b > 0 && set->fallback[b - 1] > v; b--) set->fallback[b] = set->fallback[b - 1];
+        set->fallback[b] = v;
+    }
+    int states = 0;
+    for (int d = 0; d < set->dfa_count; d++) states += set->dfas[d].state_count;
+    verbose_print(VERBOSE_DEBUG,
+                  "Compiled %d exclude patterns: %d literal, %d in automata (%d DFAs, %d states), %d individual, %d never match",
+                  count, literal_count, general_count - set->fallback_count + fallback_parse, set->dfa_count, states,
+                  set->fallback_count, never);
+    return 0;
+}
+
+/**
+ * @brief Matches an entry name against a compiled exclude set.
+ * @param set Compiled exclude set.
+ * @param name Entry name (a single path component).
+ * @param is_dir Set if the entry is a directory.
+ * @return Index of the first pattern that matches, or -1 if none does.
+ */
+int exclude_set_match(const ExcludeSet *set, const char *name, int is_dir) {
+    if (set->count == 0) return -1;
+    int best = -1;
+    size_t len = strlen(name);
+    const GlobTrie *trie = &set->prefixes;
+    uint32_t node = 0;
+    best = lower_match(best, trie->nodes[0].part, is_dir);
+    for (size_t i = 0; i < len && (node = trie_find(trie, node, (uint8_t)name[i])) != 0; i++) {
+        best = lower_match(best, trie->nodes[node].part, is_dir);
+        if (i + 1 == len) best = lower_match(best, trie->nodes[node].whole, is_dir);
+    }
+    trie = &set->suffixes;
+    node = 0;
+    best = lower_match(best, trie->nodes[0].part, is_dir);
+    for (size_t i = len; i > 0 && (node = trie_find(trie, node, (uint8_t)name[i - 1])) != 0; i--) {
+        best = lower_match(best, trie->nodes[node].part, is_dir);
+    }
+    for (int d = 0; d < set->dfa_count; d++) {
+        const ExcludeDfa *dfa = &set->dfas[d];
+        int s = 0;
+        for (size_t i = 0; i < len && s != dfa->dead; i++) {
+            s = dfa->next[(size_t)s * dfa->class_count + dfa->byte_class[(uint8_t)name[i]]];
+        }
+        best = lower_match(best, &dfa->accept[s * 2], is_dir);
+    }
+    for (int f = 0; f < set->fallback_count; f++) {
+        int i = set->fallback[f];
+        if (best >= 0 && i > best) break;
+        size_t plen = strlen(set->patterns[i]);
+        int dir_only = plen > 0 && set->patterns[i][plen - 1] == '/';
+        if (dir_only && !is_dir) continue;
+        char glob[MAX_PATTERN_LEN + 1];
+        if (dir_only) {
+            memcpy(glob, set->patterns[i], plen - 1);
+            glob[plen - 1] = '\0';
+        }
+        if (matches_glob_pattern(name, dir_only ? glob : set->patterns[i])) {
+            best = i;
+            break;
+        }
+    }
+    return best;
+}
+
+/**
+ * @brief Frees a compiled exclude set.
+ * @param set Exclude set.
+ */
+void exclude_set_free(ExcludeSet *set) {
+    free(set->prefixes.nodes);
+    free(set->suffixes.nodes);
+    for (int d = 0; d < set->dfa_count; d++) {
+        free(set->dfas[d].next);
+        free(set->dfas[d].accept);
+    }
+    free(set->dfas);
+    free(set->fallback);
+    memset(set, 0, sizeof(*set));
+}
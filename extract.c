@@ -3,6 +3,8 @@
  * @brief Extraction function for Seclume.
  */
 
+#define _GNU_SOURCE /* O_DIRECT in <fcntl.h> */
+
 #include "seclume.h"
 #include <string.h>
 #include <stdlib.h>
@@ -10,78 +12,1655 @@
 #include <sys/types.h>
 #include <unistd.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+
+/**
+ * @brief Scratch buffers reused for every entry of an extraction run.
+ */
+typedef struct {
+    uint8_t *rec;       /**< Encrypted chunk data and tag (rec_size bytes) */
+    uint8_t *comp;      /**< Decrypted compressed data (slots * comp_size bytes) */
+    uint8_t *out;       /**< Decompressed file data awaiting write (two halves of slots * out_size bytes) */
+    size_t rec_size;    /**< Size of rec */
+    size_t comp_size;   /**< Size of one compressed slot (largest accepted chunk) */
+    size_t out_size;    /**< Size of one output slot */
+    CodecBlock *blocks; /**< Block descriptors (block-parallel archives only) */
+    int slots;          /**< Number of blocks decompressed at once */
+} StreamBuffers;
+
+/**
+ * @brief State of one entry being decompressed and written to disk.
+ */
+typedef struct {
+    CodecStream *cs;    /**< Decoder stream (shared by the entries of a run) */
+    WriteBehind *wb;    /**< Writer of the output data (shared by the entries of a run) */
+    int fd;             /**< Output file, -1 to discard the data (verify runs) */
+    int direct;         /**< Set while fd is open with O_DIRECT */
+    const char *path;   /**< Output file path (for messages) */
+    uint8_t *out_buf;   /**< Output buffer being filled (CHUNK_SIZE bytes, slots blocks in block-parallel archives) */
+    uint8_t *spare_buf; /**< Output buffer being written by wb */
+    int out_slot;       /**< Writer slot of out_buf (spare_buf has the other one) */
+    size_t out_fill;    /**< Bytes pending in out_buf */
+    uint64_t written;   /**< Bytes written to the output file so far */
+    uint64_t expected;  /**< Original file size from the metadata (MAX_FILE_SIZE while the size is not known yet), or the
+                             data bytes of a sparse file once its extent map was read */
+    int ended;          /**< Set once the compressed stream ended */
+    SparseExtent *extents; /**< Extent map of a sparse file (the data is written at the extents' offsets), NULL otherwise */
+    size_t extent_count;   /**< Number of extents, SIZE_MAX until the map chunk was read */
+    size_t extent;         /**< Extent holding the next byte written */
+    uint64_t extent_pos;   /**< Data bytes in the extents before extent */
+} OutputStream;
+
+/**
+ * @brief Allocates the scratch buffers of an extraction run.
+ * @param bufs Buffers to allocate.
+ * @param block_size Block size of a block-parallel archive, 0 for streamed payloads.
+ * @param algo Compression algorithm of the archive.
+ * @param slots Number of blocks to decompress at once (block-parallel archives only).
+ * @return 0 on success, 1 on failure.
+ */
+static int alloc_stream_buffers(StreamBuffers *bufs, size_t block_size, CompressionAlgo algo, int slots) {
+    memset(bufs, 0, sizeof(*bufs));
+    bufs->slots = 1;
+    bufs->comp_size = CHUNK_SIZE;
+    bufs->out_size = CHUNK_SIZE;
+    if (block_size) {
+        bufs->slots = slots;
+        bufs->comp_size = compress_bound(block_size, algo);
+        bufs->out_size = block_size;
+        bufs->blocks = calloc(slots, sizeof(CodecBlock));
+    }
+    bufs->rec_size = bufs->comp_size + AES_TAG_SIZE;
+    bufs->rec = malloc(bufs->rec_size);
+    bufs->comp = malloc(bufs->slots * bufs->comp_size);
+    /* Aligned for O_DIRECT; every buffer handed to the writer starts at a multiple of out_size */
+    if (posix_memalign((void **)&bufs->out, DIRECT_IO_ALIGN, 2 * bufs->slots * bufs->out_size) != 0) bufs->out = NULL;
+    if (!bufs->rec || !bufs->comp || !bufs->out || (block_size && !bufs->blocks)) {
+        fprintf(stderr, "Error: Memory allocation failed for stream buffers\n");
+        free(bufs->rec);
+        free(bufs->comp);
+        free(bufs->out);
+        free(bufs->blocks);
+        return 1;
+    }
+    return 0;
+}
+
+/**
+ * @brief Wipes and frees the scratch buffers of an extraction run.
+ * @param bufs Buffers to free.
+ */
+static void free_stream_buffers(StreamBuffers *bufs) {
+    secure_zero(bufs->comp, bufs->slots * bufs->comp_size);
+    secure_zero(bufs->out, 2 * bufs->slots * bufs->out_size);
+    free(bufs->rec);
+    free(bufs->comp);
+    free(bufs->out);
+    free(bufs->blocks);
+}
+
+/**
+ * @brief Reads encrypted payload data from the archive.
+ * @param buf Output buffer.
+ * @param len Number of bytes to read.
+ * @param in Archive file.
+ * @return Number of bytes read (less than len on EOF or error).
+ */
+static size_t read_payload(uint8_t *buf, size_t len, FILE *in) {
+    StageTimer timer;
+    stage_begin(&timer);
+    size_t got = fread(buf, 1, len, in);
+    stage_end(&timer, STAGE_READ, got);
+    return got;
+}
+
+/**
+ * @brief Posts the data bytes of a sparse file at the offsets of its extents.
+ *
+ * A buffer spanning several extents is written piece by piece in the slot of
+ * out_buf; only the last piece overlaps with decoding. The holes between
+ * extents are never written.
+ *
+ * @param os Output stream state of a sparse file, with the slot of out_buf idle.
+ * @param len Number of bytes of out_buf to write.
+ * @return 0 on success, 1 if a write failed.
+ */
+static int output_post_extents(OutputStream *os, size_t len) {
+    size_t done = 0;
+    while (done < len) {
+        const SparseExtent *ext = &os->extents[os->extent];
+        uint64_t skip = os->written + done - os->extent_pos;
+        if (skip == ext->length) {
+            os->extent_pos += ext->length;
+            os->extent++;
+            continue;
+        }
+        size_t piece = ext->length - skip < len - done ? ext->length - skip : len - done;
+        write_behind_post(os->wb, os->out_slot, os->fd, os->out_buf + done, piece, ext->offset + skip);
+        done += piece;
+        int error = done < len ? write_behind_wait_slot(os->wb, os->out_slot) : 0;
+        if (error) {
+            fprintf(stderr, "Error: Failed to write output file %s: %s\n", os->path, strerror(error));
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/**
+ * @brief Hands the filled output buffer to the writer and switches to the other one.
+ *
+ * The filled buffer is posted first, so both buffers can be in flight; only
+ * then does the call wait for the earlier write of the other buffer, which is
+ * decoded into next. Without an output file (verify runs) the data is only
+ * counted.
+ *
+ * @param os Output stream state.
+ * @param len Number of bytes of out_buf to write.
+ * @return 0 on success, 1 if a write failed.
+ */
+static int output_write(OutputStream *os, size_t len) {
+    if (os->fd == -1) {
+        os->written += len;
+        return 0;
+    }
+    if (os->direct && (os->extents || len % DIRECT_IO_ALIGN != 0 || os->written % DIRECT_IO_ALIGN != 0)) {
+        /* O_DIRECT needs aligned lengths and offsets; the rest of the file (and sparse files) goes through the page cache */
+        int flags = fcntl(os->fd, F_GETFL);
+        if (flags == -1 || fcntl(os->fd, F_SETFL, flags & ~O_DIRECT) == -1) {
+            fprintf(stderr, "Error: Failed to switch %s to buffered I/O: %s\n", os->path, strerror(errno));
+            return 1;
+        }
+        os->direct = 0;
+    }
+    if (os->extents) {
+        if (output_post_extents(os, len) != 0) return 1;
+    } else {
+        write_behind_post(os->wb, os->out_slot, os->fd, os->out_buf, len, os->written);
+    }
+    uint8_t *filled = os->out_buf;
+    os->out_buf = os->spare_buf;
+    os->spare_buf = filled;
+    os->out_slot = 1 - os->out_slot;
+    os->written += len;
+    int error = write_behind_wait_slot(os->wb, os->out_slot);
+    if (error) {
+        fprintf(stderr, "Error: Failed to write output file %s: %s\n", os->path, strerror(error));
+        return 1;
+    }
+    return 0;
+}
+
+/**
+ * @brief Feeds decrypted compressed data to the decoder and writes out full buffers.
+ * @param os Output stream state.
+ * @param in Compressed data.
+ * @param in_len Length of compressed data.
+ * @param finish If 1, this is the last compressed data of the entry.
+ * @return 0 on success, 1 on failure.
+ */
+static int output_stream_feed(OutputStream *os, const uint8_t *in, size_t in_len, int finish) {
+    while (in_len > 0 || (finish && !os->ended)) {
+        if (os->ended) {
+            fprintf(stderr, "Error: Trailing data after compressed stream for %s\n", os->path);
+            return 1;
+        }
+        uint8_t *out_ptr = os->out_buf + os->out_fill;
+        size_t out_avail = CHUNK_SIZE - os->out_fill;
+        size_t in_before = in_len;
+        int r = codec_stream_run(os->cs, &in, &in_len, &out_ptr, &out_avail, finish);
+        if (r < 0) return 1;
+        size_t produced = CHUNK_SIZE - os->out_fill - out_avail;
+        os->out_fill += produced;
+        if (r == 1) os->ended = 1;
+        if (os->written + os->out_fill > os->expected) {
+            fprintf(stderr, "Error: Decompressed data for %s is larger than expected (%lu bytes)\n", os->path, os->expected);
+            return 1;
+        }
+        if (os->out_fill == CHUNK_SIZE || (os->ended && os->out_fill > 0)) {
+            if (output_write(os, os->out_fill) != 0) return 1;
+            os->out_fill = 0;
+        } else if (r == 0 && in_len == in_before && produced == 0) {
+            fprintf(stderr, "Error: Incomplete compressed stream for %s\n", os->path);
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/**
+ * @brief Loads the extent map of a sparse file from the first chunk of its payload.
+ *
+ * The extents must be non-empty, in file order and within the file; the data
+ * of the extents becomes the expected output.
+ *
+ * @param os Output stream state of a sparse file (expected holds the file size).
+ * @param data Decrypted map chunk.
+ * @param len Length of the chunk.
+ * @return 0 on success, 1 if the map is invalid.
+ */
+static int load_extent_map(OutputStream *os, const uint8_t *data, size_t len) {
+    if (len % sizeof(SparseExtent) != 0 || len > SPARSE_MAX_EXTENTS * sizeof(SparseExtent)) return 1;
+    memcpy(os->extents, data, len);
+    size_t count = len / sizeof(SparseExtent);
+    uint64_t end = 0;
+    uint64_t data_size = 0;
+    for (size_t i = 0; i < count; i++) {
+        const SparseExtent *ext = &os->extents[i];
+        if (ext->offset < end || ext->offset > os->expected || ext->length == 0 || ext->length > os->expected - ext->offset)
+            return 1;
+        end = ext->offset + ext->length;
+        data_size += ext->length;
+    }
+    os->extent_count = count;
+    os->expected = data_size;
+    verbose_print(VERBOSE_DEBUG, "Sparse file %s: %lu data bytes in %lu extents", os->path, (unsigned long)data_size,
+                  (unsigned long)count);
+    return 0;
+}
+
+/**
+ * @brief Streams a single-block payload (versions 4-6) from the archive to the output file.
+ *
+ * The payload carries one tag for all of its data, so the output is only known to
+ * be authentic once the whole entry was processed; the caller removes the output
+ * file if this fails. Without an output stream the data is only authenticated.
+ *
+ * @param in Archive file, positioned after the FileEntry.
+ * @param index Entry index (for messages).
+ * @param compressed_size Size of the encrypted data.
+ * @param file_key File encryption key.
+ * @param bufs Scratch buffers.
+ * @param os Output stream state, NULL to only authenticate the data.
+ * @return 0 on success, 1 on failure.
+ */
+static int decode_legacy_payload(FILE *in, uint32_t index, uint64_t compressed_size, const uint8_t *file_key,
+                                 StreamBuffers *bufs, OutputStream *os) {
+    uint8_t file_nonce[AES_NONCE_SIZE];
+    uint8_t file_tag[AES_TAG_SIZE];
+    if (fread(file_nonce, AES_NONCE_SIZE, 1, in) != 1 || fread(file_tag, AES_TAG_SIZE, 1, in) != 1) {
+        fprintf(stderr, "Error: Failed to read nonce or tag for file %u\n", index);
+        return 1;
+    }
+    GcmStream gs;
+    if (gcm_stream_init(&gs, file_key, file_nonce) != 0) return 1;
+    uint64_t remaining = compressed_size;
+    while (remaining > 0) {
+        size_t want = remaining < CHUNK_SIZE ? remaining : CHUNK_SIZE;
+        if (read_payload(bufs->rec, want, in) != want) {
+            fprintf(stderr, "Error: Failed to read encrypted data for file %u: %s\n", index,
+                    feof(in) ? "unexpected EOF" : strerror(errno));
+            gcm_stream_free(&gs);
+            return 1;
+        }
+        remaining -= want;
+        if (gcm_stream_update(&gs, bufs->rec, want, bufs->comp) != 0 ||
+            (os && output_stream_feed(os, bufs->comp, want, remaining == 0) != 0)) {
+            gcm_stream_free(&gs);
+            return 1;
+        }
+    }
+    int ret = gcm_stream_final(&gs, file_tag);
+    gcm_stream_free(&gs);
+    if (ret == 0) verbose_print(VERBOSE_DEBUG, "Decrypted %lu bytes", compressed_size);
+    return ret;
+}
+
+/**
+ * @brief Streams a chunked payload (version 7+) from the archive to the output file.
+ *
+ * Every chunk is authenticated before its data reaches the decoder. Without an
+ * output stream the chunks are only authenticated, which also walks
+ * block-parallel and dedup payloads (verify runs). The first chunk of a sparse
+ * file holds its extent map.
+ *
+ * @param in Archive file, positioned after the FileEntry.
+ * @param index Entry index (for messages).
+ * @param compressed_size Total size of the payload chunks, or UINT64_MAX if it is not known yet (streamed
+ *                        archives read front to back, where the payload ends with its final chunk).
+ * @param file_gk File key cipher context.
+ * @param bufs Scratch buffers.
+ * @param os Output stream state, NULL to only authenticate the chunks.
+ * @param consumed Output size of the payload chunks read, NULL if not needed.
+ * @return 0 on success, 1 on failure.
+ */
+static int decode_chunked_payload(FILE *in, uint32_t index, uint64_t compressed_size, GcmKey *file_gk,
+                                  StreamBuffers *bufs, OutputStream *os, uint64_t *consumed) {
+    uint8_t base_nonce[AES_NONCE_SIZE];
+    if (fread(base_nonce, AES_NONCE_SIZE, 1, in) != 1) {
+        fprintf(stderr, "Error: Failed to read nonce for file %u\n", index);
+        return 1;
+    }
+    ChunkCipher cc;
+    chunk_cipher_init(&cc, file_gk, base_nonce);
+    uint64_t remaining = compressed_size;
+    while (!cc.finished) {
+        uint32_t chunk_header;
+        if (remaining < CHUNK_OVERHEAD || fread(&chunk_header, sizeof(chunk_header), 1, in) != 1) {
+            fprintf(stderr, "Error: Truncated data for file %u\n", index);
+            return 1;
+        }
+        size_t len = chunk_header & ~CHUNK_FINAL;
+        if (len > bufs->comp_size || len + CHUNK_OVERHEAD > remaining) {
+            fprintf(stderr, "Error: Invalid chunk in data for file %u\n", index);
+            return 1;
+        }
+        if (read_payload(bufs->rec, len + AES_TAG_SIZE, in) != len + AES_TAG_SIZE) {
+            fprintf(stderr, "Error: Failed to read encrypted data for file %u: %s\n", index,
+                    feof(in) ? "unexpected EOF" : strerror(errno));
+            return 1;
+        }
+        remaining -= len + CHUNK_OVERHEAD;
+        if (chunk_decrypt(&cc, chunk_header, bufs->rec, bufs->rec + len, bufs->comp) != 0) return 1;
+        if (os && os->extent_count == SIZE_MAX) {
+            if (cc.finished || load_extent_map(os, bufs->comp, len) != 0) {
+                fprintf(stderr, "Error: Invalid extent map in data for file %u\n", index);
+                return 1;
+            }
+        } else if (os && output_stream_feed(os, bufs->comp, len, cc.finished) != 0) {
+            return 1;
+        }
+    }
+    if (remaining != 0 && compressed_size != UINT64_MAX) {
+        fprintf(stderr, "Error: Unexpected data after final chunk for file %u\n", index);
+        return 1;
+    }
+    if (consumed) *consumed = compressed_size - remaining;
+    verbose_print(VERBOSE_DEBUG, os ? "Decrypted and decompressed %lu chunks" : "Authenticated %lu chunks",
+                  (unsigned long)cc.index);
+    return 0;
+}
+
+/**
+ * @brief Decodes a block-parallel payload (version 7+ with ARCHIVE_FLAG_BLOCKS) to the output file.
+ *
+ * Every chunk holds one independently compressed block of block_size bytes (the
+ * last one may be shorter). Up to bufs->slots blocks are authenticated, then
+ * decompressed in parallel and written in order.
+ *
+ * @param in Archive file, positioned after the FileEntry.
+ * @param index Entry index (for messages).
+ * @param compressed_size Total size of the payload chunks.
+ * @param file_gk File key cipher context.
+ * @param algo Compression algorithm.
+ * @param bufs Scratch buffers.
+ * @param os Output stream state (its decoder stream is unused).
+ * @return 0 on success, 1 on failure.
+ */
+static int decode_block_payload(FILE *in, uint32_t index, uint64_t compressed_size, GcmKey *file_gk,
+                                CompressionAlgo algo, StreamBuffers *bufs, OutputStream *os) {
+    uint8_t base_nonce[AES_NONCE_SIZE];
+    if (fread(base_nonce, AES_NONCE_SIZE, 1, in) != 1) {
+        fprintf(stderr, "Error: Failed to read nonce for file %u\n", index);
+        return 1;
+    }
+    ChunkCipher cc;
+    chunk_cipher_init(&cc, file_gk, base_nonce);
+    uint64_t remaining = compressed_size;
+    uint64_t planned = os->written;
+    while (!cc.finished) {
+        int count = 0;
+        for (; count < bufs->slots && !cc.finished; count++) {
+            uint32_t chunk_header;
+            if (remaining < CHUNK_OVERHEAD || fread(&chunk_header, sizeof(chunk_header), 1, in) != 1) {
+                fprintf(stderr, "Error: Truncated data for file %u\n", index);
+                return 1;
+            }
+            size_t len = chunk_header & ~CHUNK_FINAL;
+            size_t want = os->expected - planned < bufs->out_size ? os->expected - planned : bufs->out_size;
+            if (len == 0 || len > bufs->comp_size || len + CHUNK_OVERHEAD > remaining || want == 0) {
+                fprintf(stderr, "Error: Invalid chunk in data for file %u\n", index);
+                return 1;
+            }
+            if (read_payload(bufs->rec, len + AES_TAG_SIZE, in) != len + AES_TAG_SIZE) {
+                fprintf(stderr, "Error: Failed to read encrypted data for file %u: %s\n", index,
+                        feof(in) ? "unexpected EOF" : strerror(errno));
+                return 1;
+            }
+            remaining -= len + CHUNK_OVERHEAD;
+            uint8_t *comp = bufs->comp + count * bufs->comp_size;
+            if (chunk_decrypt(&cc, chunk_header, bufs->rec, bufs->rec + len, comp) != 0) return 1;
+            CodecBlock block = { comp, len, os->out_buf + count * bufs->out_size, want, 0 };
+            bufs->blocks[count] = block;
+            planned += want;
+        }
+        if (decompress_blocks(bufs->blocks, count, algo, count) != 0) {
+            fprintf(stderr, "Error: Block decompression failed for %s\n", os->path);
+            return 1;
+        }
+        /* Only the last block of a file is short, so the blocks of a batch are contiguous */
+        size_t batch_len = 0;
+        for (int b = 0; b < count; b++) {
+            if (bufs->blocks[b].out_len != bufs->blocks[b].out_max) {
+                fprintf(stderr, "Error: Decompressed block size mismatch for %s\n", os->path);
+                return 1;
+            }
+            batch_len += bufs->blocks[b].out_len;
+        }
+        if (output_write(os, batch_len) != 0) return 1;
+    }
+    if (remaining != 0) {
+        fprintf(stderr, "Error: Unexpected data after final chunk for file %u\n", index);
+        return 1;
+    }
+    verbose_print(VERBOSE_DEBUG, "Decrypted and decompressed %lu blocks", (unsigned long)cc.index);
+    return 0;
+}
+
+/**
+ * @brief Read position in the solid block whose members are being extracted.
+ */
+typedef struct {
+    uint64_t offset;      /**< Archive offset of the open block payload, 0 if none is open */
+    uint64_t remaining;   /**< Payload bytes not read yet */
+    uint64_t pos;         /**< Uncompressed bytes of the block decoded so far */
+    ChunkCipher cc;       /**< Chunk cipher of the block */
+    const uint8_t *avail; /**< Decrypted compressed data not yet decoded (in the scratch buffers) */
+    size_t avail_len;     /**< Bytes at avail */
+    int ended;            /**< Set once the compressed stream ended */
+} SolidReader;
+
+/**
+ * @brief Settings and totals of a verify run, shared by every extracting thread.
+ */
+typedef struct {
+    int auth_only;  /**< If 1, only authenticate payloads without decompressing them */
+    uint64_t files; /**< Entries verified (updated atomically) */
+    uint64_t bytes; /**< Original size of the verified entries (updated atomically) */
+} VerifyRun;
+
+/**
+ * @brief State shared by every entry of an extraction run.
+ */
+typedef struct {
+    FILE *in;                /**< Archive file */
+    uint8_t version;         /**< Archive format version */
+    CompressionAlgo algo;    /**< Compression algorithm of the header */
+    CompressionAlgo codec;   /**< Codec of the entry being extracted */
+    size_t block_size;       /**< Block size of a block-parallel archive, 0 otherwise */
+    int dedup;               /**< Set for deduplicated archives (file_gk then uses the chunk key) */
+    int streamed;            /**< Set for streamed archives, whose lead entries carry no sizes */
+    int trailing_sizes;      /**< Set while a streamed archive is read front to back: sizes follow each payload */
+    int piped;               /**< Set when the archive is read from standard input, which cannot seek */
+    const uint8_t *file_key; /**< File encryption key (legacy payloads) */
+    GcmKey file_gk;          /**< File key cipher context */
+    GcmKey meta_gk;          /**< Metadata key cipher context */
+    CodecStream cs;          /**< Decoder reused by streamed entries */
+    WriteBehind wb;          /**< Writer of the output files */
+    int direct_io;           /**< If 1, open output files with O_DIRECT */
+    int use_uring;           /**< If 1, write output files through io_uring */
+    int cs_ready;            /**< Set once cs was initialized */
+    const char *extract_dir; /**< Output directory */
+    char *path;              /**< Output path buffer reused by every entry */
+    size_t path_size;        /**< Size of path (fits extract_dir plus any entry name) */
+    int force;               /**< If 1, overwrite existing output files */
+    StreamBuffers bufs;      /**< Scratch buffers */
+    SolidReader solid;       /**< Open solid block (solid archives only; it owns cs while open) */
+    VerifyRun *verify;       /**< Verify run (nothing is written), NULL when extracting */
+    uint64_t verified_block; /**< Offset of the solid block last authenticated without decoding, 0 if none */
+    SparseExtent *extents;   /**< Extent map of the sparse file being extracted (SPARSE_MAX_EXTENTS, allocated on first use) */
+    const uint8_t *dict;     /**< Dictionary of the zlib and zstd entries (in the central index), NULL if none */
+    size_t dict_len;         /**< Length of dict */
+} ExtractContext;
+
+/**
+ * @brief Prepares the shared decoder for a stream of the given codec.
+ *
+ * The decoder is reset when the previous stream used the same codec and
+ * recreated otherwise; a new zlib or zstd decoder gets the archive's
+ * dictionary, if any.
+ *
+ * @param ctx Extraction state.
+ * @param codec Codec of the stream.
+ * @return 0 on success, 1 on failure.
+ */
+static int start_decoder(ExtractContext *ctx, CompressionAlgo codec) {
+    if (ctx->cs_ready && ctx->cs.algo != codec) {
+        codec_stream_end(&ctx->cs);
+        ctx->cs_ready = 0;
+    }
+    int cs_ret = ctx->cs_ready ? codec_stream_reset(&ctx->cs) : codec_stream_init(&ctx->cs, codec, 0, 1);
+    if (cs_ret != 0) return 1;
+    if (!ctx->cs_ready && ctx->dict && (codec == COMPRESSION_ZLIB || codec == COMPRESSION_ZSTD) &&
+        codec_stream_set_dict(&ctx->cs, ctx->dict, ctx->dict_len) != 0) {
+        codec_stream_end(&ctx->cs);
+        return 1;
+    }
+    ctx->cs_ready = 1;
+    return 0;
+}
+
+/**
+ * @brief Decodes the next bytes of the open solid block.
+ * @param ctx Extraction state with an open solid block.
+ * @param index Entry index (for messages).
+ * @param out Output buffer.
+ * @param want Number of bytes to decode; the block must hold at least that many more.
+ * @return 0 on success, 1 on failure.
+ */
+static int solid_read(ExtractContext *ctx, uint32_t index, uint8_t *out, size_t want) {
+    SolidReader *sr = &ctx->solid;
+    while (want > 0) {
+        if (sr->ended) {
+            fprintf(stderr, "Error: Solid block ends before the data of file %u\n", index);
+            return 1;
+        }
+        if (sr->avail_len == 0 && !sr->cc.finished) {
+            uint32_t chunk_header;
+            if (sr->remaining < CHUNK_OVERHEAD || fread(&chunk_header, sizeof(chunk_header), 1, ctx->in) != 1) {
+                fprintf(stderr, "Error: Truncated solid block for file %u\n", index);
+                return 1;
+            }
+            size_t len = chunk_header & ~CHUNK_FINAL;
+            if (len > CHUNK_SIZE || len + CHUNK_OVERHEAD > sr->remaining) {
+                fprintf(stderr, "Error: Invalid chunk in solid block for file %u\n", index);
+                return 1;
+            }
+            if (read_payload(ctx->bufs.rec, len + AES_TAG_SIZE, ctx->in) != len + AES_TAG_SIZE) {
+                fprintf(stderr, "Error: Failed to read solid block for file %u: %s\n", index,
+                        feof(ctx->in) ? "unexpected EOF" : strerror(errno));
+                return 1;
+            }
+            sr->remaining -= len + CHUNK_OVERHEAD;
+            if (chunk_decrypt(&sr->cc, chunk_header, ctx->bufs.rec, ctx->bufs.rec + len, ctx->bufs.comp) != 0) return 1;
+            if (sr->cc.finished && sr->remaining != 0) {
+                fprintf(stderr, "Error: Unexpected data after final chunk of solid block for file %u\n", index);
+                return 1;
+            }
+            sr->avail = ctx->bufs.comp;
+            sr->avail_len = len;
+        }
+        size_t in_before = sr->avail_len;
+        size_t out_before = want;
+        int r = codec_stream_run(&ctx->cs, &sr->avail, &sr->avail_len, &out, &want, sr->cc.finished);
+        if (r < 0) return 1;
+        sr->pos += out_before - want;
+        if (r == 1) {
+            sr->ended = 1;
+        } else if (want == out_before && sr->avail_len == in_before && (sr->avail_len > 0 || sr->cc.finished)) {
+            fprintf(stderr, "Error: Incomplete compressed stream in solid block for file %u\n", index);
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/**
+ * @brief Decodes one member of a solid block to the output file.
+ *
+ * Members are read in archive order, so a full extraction decodes each block
+ * once; a member before the current read position reopens its block, and data
+ * up to the member is decoded and discarded.
+ *
+ * @param ctx Extraction state.
+ * @param index Entry index (for messages).
+ * @param entry Index record with INDEX_FLAG_SOLID.
+ * @param os Output stream state (its decoder stream is unused).
+ * @return 0 on success, 1 on failure.
+ */
+static int decode_solid_member(ExtractContext *ctx, uint32_t index, const IndexEntry *entry, OutputStream *os) {
+    SolidReader *sr = &ctx->solid;
+    if (sr->offset != entry->entry_offset || entry->solid_offset < sr->pos) {
+        uint8_t base_nonce[AES_NONCE_SIZE];
+        sr->offset = 0;
+        if (fseek(ctx->in, entry->entry_offset, SEEK_SET) != 0 || fread(base_nonce, AES_NONCE_SIZE, 1, ctx->in) != 1) {
+            fprintf(stderr, "Error: Failed to read solid block for file %u\n", index);
+            return 1;
+        }
+        if (start_decoder(ctx, ctx->codec) != 0) return 1;
+        chunk_cipher_init(&sr->cc, &ctx->file_gk, base_nonce);
+        sr->offset = entry->entry_offset;
+        sr->remaining = entry->plain.compressed_size;
+        sr->pos = 0;
+        sr->avail_len = 0;
+        sr->ended = 0;
+        verbose_print(VERBOSE_DEBUG, "Opened solid block at offset %lu", (unsigned long)entry->entry_offset);
+    }
+    while (sr->pos < entry->solid_offset) {
+        uint64_t skip = entry->solid_offset - sr->pos;
+        if (solid_read(ctx, index, os->out_buf, skip < CHUNK_SIZE ? skip : CHUNK_SIZE) != 0) {
+            sr->offset = 0;
+            return 1;
+        }
+    }
+    while (os->written < os->expected) {
+        size_t want = os->expected - os->written < CHUNK_SIZE ? os->expected - os->written : CHUNK_SIZE;
+        if (solid_read(ctx, index, os->out_buf, want) != 0) {
+            sr->offset = 0;
+            return 1;
+        }
+        if (output_write(os, want) != 0) return 1;
+    }
+    verbose_print(VERBOSE_DEBUG, "Decoded %lu bytes at offset %lu of solid block", (unsigned long)os->written,
+                  (unsigned long)entry->solid_offset);
+    return 0;
+}
+
+/**
+ * @brief Decompresses one dedup data segment and writes it to the output file.
+ * @param seg Segment plaintext (type byte and compressed chunk).
+ * @param seg_len Length of the segment.
+ * @param length Expected uncompressed length, or 0 to accept any length the entry has room for.
+ * @param codec Codec of the chunk.
+ * @param os Output stream state.
+ * @return 0 on success, 1 on failure.
+ */
+static int write_dedup_data(const uint8_t *seg, size_t seg_len, size_t length, CompressionAlgo codec,
+                            OutputStream *os) {
+    uint64_t room = os->expected - os->written;
+    size_t out_max = room < DEDUP_MAX_CHUNK ? room : DEDUP_MAX_CHUNK;
+    if (seg_len < 2 || seg[0] != DEDUP_SEGMENT_DATA || out_max == 0 || length > out_max) {
+        fprintf(stderr, "Error: Invalid deduplicated chunk in %s\n", os->path);
+        return 1;
+    }
+    size_t out_len = decompress_data(seg + 1, seg_len - 1, os->out_buf, out_max, codec);
+    if (out_len == 0 || (length && out_len != length)) {
+        fprintf(stderr, "Error: Decompression failed for chunk of %s\n", os->path);
+        return 1;
+    }
+    return output_write(os, out_len);
+}
+
+/**
+ * @brief Reads, decrypts and writes the chunk a dedup reference points to, then returns to the current position.
+ * @param ctx Extraction state.
+ * @param ref Reference from the payload.
+ * @param os Output stream state.
+ * @return 0 on success, 1 on failure.
+ */
+static int write_dedup_ref(ExtractContext *ctx, const DedupRef *ref, OutputStream *os) {
+    long pos = ftell(ctx->in);
+    uint32_t chunk_header;
+    if (pos == -1 || ref->length == 0 || ref->length > DEDUP_MAX_CHUNK ||
+        fseek(ctx->in, ref->offset, SEEK_SET) != 0 || fread(&chunk_header, sizeof(chunk_header), 1, ctx->in) != 1) {
+        fprintf(stderr, "Error: Invalid chunk reference in %s\n", os->path);
+        return 1;
+    }
+    size_t len = chunk_header & ~CHUNK_FINAL;
+    if (len < 2 || len > ctx->bufs.comp_size || read_payload(ctx->bufs.rec, len + AES_TAG_SIZE, ctx->in) != len + AES_TAG_SIZE) {
+        fprintf(stderr, "Error: Invalid chunk reference in %s\n", os->path);
+        return 1;
+    }
+    ChunkCipher cc;
+    chunk_cipher_init(&cc, &ctx->file_gk, ref->base_nonce);
+    cc.index = ref->index;
+    if (chunk_decrypt(&cc, chunk_header, ctx->bufs.rec, ctx->bufs.rec + len, ctx->bufs.comp) != 0 ||
+        write_dedup_data(ctx->bufs.comp, len, ref->length,
+                         ctx->version >= ARCHIVE_VERSION_CODECS ? (CompressionAlgo)ref->codec : ctx->algo, os) != 0) {
+        return 1;
+    }
+    if (fseek(ctx->in, pos, SEEK_SET) != 0) {
+        fprintf(stderr, "Error: Failed to seek in archive: %s\n", strerror(errno));
+        return 1;
+    }
+    return 0;
+}
+
+/**
+ * @brief Decrypts a deduplicated payload, resolving references to chunks stored by earlier entries.
+ * @param ctx Extraction state, positioned at the payload.
+ * @param index Entry index (for messages).
+ * @param compressed_size Total size of the payload chunks.
+ * @param os Output stream state (its decoder stream is unused).
+ * @return 0 on success, 1 on failure.
+ */
+static int decode_dedup_payload(ExtractContext *ctx, uint32_t index, uint64_t compressed_size, OutputStream *os) {
+    uint8_t base_nonce[AES_NONCE_SIZE];
+    if (fread(base_nonce, AES_NONCE_SIZE, 1, ctx->in) != 1) {
+        fprintf(stderr, "Error: Failed to read nonce for file %u\n", index);
+        return 1;
+    }
+    ChunkCipher cc;
+    chunk_cipher_init(&cc, &ctx->file_gk, base_nonce);
+    uint64_t remaining = compressed_size;
+    uint64_t refs = 0;
+    while (!cc.finished) {
+        uint32_t chunk_header;
+        if (remaining < CHUNK_OVERHEAD || fread(&chunk_header, sizeof(chunk_header), 1, ctx->in) != 1) {
+            fprintf(stderr, "Error: Truncated data for file %u\n", index);
+            return 1;
+        }
+        size_t len = chunk_header & ~CHUNK_FINAL;
+        if (len == 0 || len > ctx->bufs.comp_size || len + CHUNK_OVERHEAD > remaining) {
+            fprintf(stderr, "Error: Invalid chunk in data for file %u\n", index);
+            return 1;
+        }
+        if (read_payload(ctx->bufs.rec, len + AES_TAG_SIZE, ctx->in) != len + AES_TAG_SIZE) {
+            fprintf(stderr, "Error: Failed to read encrypted data for file %u: %s\n", index,
+                    feof(ctx->in) ? "unexpected EOF" : strerror(errno));
+            return 1;
+        }
+        remaining -= len + CHUNK_OVERHEAD;
+        if (chunk_decrypt(&cc, chunk_header, ctx->bufs.rec, ctx->bufs.rec + len, ctx->bufs.comp) != 0) return 1;
+        if (ctx->bufs.comp[0] == DEDUP_SEGMENT_REF && len == sizeof(DedupRef)) {
+            DedupRef ref;
+            memcpy(&ref, ctx->bufs.comp, sizeof(ref));
+            if (write_dedup_ref(ctx, &ref, os) != 0) return 1;
+            refs++;
+        } else if (write_dedup_data(ctx->bufs.comp, len, 0, ctx->codec, os) != 0) {
+            return 1;
+        }
+    }
+    if (remaining != 0) {
+        fprintf(stderr, "Error: Unexpected data after final chunk for file %u\n", index);
+        return 1;
+    }
+    verbose_print(VERBOSE_DEBUG, "Decrypted %lu chunks (%lu stored earlier in the archive)",
+                  (unsigned long)cc.index, (unsigned long)refs);
+    return 0;
+}
+
+/**
+ * @brief Creates the cipher contexts and the output path buffer of an extraction run.
+ * @param ctx Extraction state (extract_dir must be set).
+ * @param file_key File encryption key.
+ * @param meta_key Metadata encryption key.
+ * @return 0 on success, 1 on failure.
+ */
+static int init_extract_contexts(ExtractContext *ctx, const uint8_t *file_key, const uint8_t *meta_key) {
+    ctx->path_size = strlen(ctx->extract_dir) + MAX_FILENAME + 1;
+    ctx->path = malloc(ctx->path_size);
+    if (!ctx->path) {
+        fprintf(stderr, "Error: Memory allocation failed for file path\n");
+        return 1;
+    }
+    if (gcm_key_init(&ctx->file_gk, file_key, 0) != 0) {
+        free(ctx->path);
+        return 1;
+    }
+    if (gcm_key_init(&ctx->meta_gk, meta_key, 0) != 0) {
+        gcm_key_free(&ctx->file_gk);
+        free(ctx->path);
+        return 1;
+    }
+    if (write_behind_start(&ctx->wb, ctx->use_uring) != 0) {
+        gcm_key_free(&ctx->meta_gk);
+        gcm_key_free(&ctx->file_gk);
+        free(ctx->path);
+        return 1;
+    }
+    return 0;
+}
+
+/**
+ * @brief Frees the cipher and decoder contexts, the path buffer and the extent map of an extraction run.
+ * @param ctx Extraction state.
+ */
+static void free_extract_contexts(ExtractContext *ctx) {
+    write_behind_stop(&ctx->wb);
+    free(ctx->path);
+    gcm_key_free(&ctx->file_gk);
+    gcm_key_free(&ctx->meta_gk);
+    if (ctx->cs_ready) codec_stream_end(&ctx->cs);
+    free(ctx->extents);
+}
+
+/**
+ * @brief Restores the permissions of an extracted file.
+ * @param path Output file path.
+ * @param mode POSIX permissions from the metadata.
+ */
+static void restore_mode(const char *path, uint32_t mode) {
+#ifndef _WIN32
+    if (chmod(path, mode) != 0) {
+        fprintf(stderr, "Warning: Failed to set permissions on %s: %s\n", path, strerror(errno));
+    } else {
+        verbose_print(VERBOSE_DEBUG, "Restored permissions on %s: 0%o", path, mode);
+    }
+#endif
+}
+
+/**
+ * @brief Reads and decrypts the FileEntry at the current archive position.
+ * @param ctx Extraction state.
+ * @param i Entry index (for messages).
+ * @param plain_entry Output entry metadata.
+ * @return 0 on success, 1 on failure.
+ */
+static int read_entry_metadata(ExtractContext *ctx, uint32_t i, FileEntryPlain *plain_entry) {
+    FileEntry entry;
+    if (fread(&entry, sizeof(entry), 1, ctx->in) != 1) {
+        fprintf(stderr, "Error: Failed to read file entry %u\n", i);
+        return 1;
+    }
+    if (gcm_key_decrypt(&ctx->meta_gk, entry.nonce, NULL, 0, entry.encrypted_data, sizeof(entry.encrypted_data),
+                        entry.tag, (uint8_t *)plain_entry) != 0) {
+        fprintf(stderr, "Error: Failed to decrypt metadata for file entry %u (wrong password or corrupted data?)\n", i);
+        return 1;
+    }
+    return 0;
+}
+
+/**
+ * @brief Skips archive bytes, reading them when the archive cannot seek.
+ * @param ctx Extraction state.
+ * @param len Number of bytes to skip.
+ * @return 0 on success, 1 on failure.
+ */
+static int skip_archive_bytes(ExtractContext *ctx, uint64_t len) {
+    if (!ctx->piped) return fseek(ctx->in, len, SEEK_CUR) != 0;
+    while (len > 0) {
+        size_t want = len < ctx->bufs.rec_size ? len : ctx->bufs.rec_size;
+        if (read_payload(ctx->bufs.rec, want, ctx->in) != want) return 1;
+        len -= want;
+    }
+    return 0;
+}
+
+/**
+ * @brief Skips the payload and size entry of a streamed archive entry read front to back.
+ *
+ * Only the chunk headers are read, so skipped payloads are not authenticated;
+ * the size entry is decrypted and must belong to the same file.
+ *
+ * @param ctx Extraction state, positioned after the lead entry.
+ * @param index Entry index (for messages).
+ * @param lead Lead entry metadata.
+ * @return 0 on success, 1 on failure.
+ */
+static int skip_stream_entry(ExtractContext *ctx, uint32_t index, const FileEntryPlain *lead) {
+    uint32_t chunk_header = 0;
+    if (skip_archive_bytes(ctx, AES_NONCE_SIZE) != 0) {
+        fprintf(stderr, "Error: Failed to skip data for entry %u (%s)\n", index, lead->filename);
+        return 1;
+    }
+    while (!(chunk_header & CHUNK_FINAL)) {
+        if (fread(&chunk_header, sizeof(chunk_header), 1, ctx->in) != 1 || (chunk_header & ~CHUNK_FINAL) > CHUNK_SIZE ||
+            skip_archive_bytes(ctx, (chunk_header & ~CHUNK_FINAL) + AES_TAG_SIZE) != 0) {
+            fprintf(stderr, "Error: Failed to skip data for entry %u (%s)\n", index, lead->filename);
+            return 1;
+        }
+    }
+    FileEntryPlain sizes;
+    if (read_entry_metadata(ctx, index, &sizes) != 0) return 1;
+    if (strncmp(sizes.filename, lead->filename, MAX_FILENAME) != 0) {
+        fprintf(stderr, "Error: Sizes recorded after file entry %u belong to another file (%s)\n", index, lead->filename);
+        return 1;
+    }
+    return 0;
+}
+
+/**
+ * @brief Selects the codec of an entry and checks that this build supports it.
+ * @param ctx Extraction state; ctx->codec is set to the codec of the entry.
+ * @param plain_entry Verified entry metadata.
+ * @param name Output path or entry name (for messages).
+ * @return 0 on success, 1 on failure.
+ */
+static int select_entry_codec(ExtractContext *ctx, const FileEntryPlain *plain_entry, const char *name) {
+    uint32_t codec_bits = ctx->version >= ARCHIVE_VERSION_CODECS ? plain_entry->codec : (uint32_t)ctx->algo;
+    CompressionAlgo codec = codec_bits & ~ENTRY_CODEC_SPARSE;
+    /* Only plain chunked payloads of version 15+ carry extent maps */
+    if ((codec_bits & ENTRY_CODEC_SPARSE) &&
+        (ctx->version < ARCHIVE_VERSION_SPARSE || ctx->block_size || ctx->dedup || ctx->streamed)) {
+        fprintf(stderr, "Error: Invalid sparse file entry %s\n", name);
+        return 1;
+    }
+    if (codec > COMPRESSION_STORE || !codec_available(codec)) {
+        fprintf(stderr, "Error: File %s uses codec %s, which this build does not support\n", name,
+                codec > COMPRESSION_STORE ? "unknown" : codec_name(codec));
+        return 1;
+    }
+    ctx->codec = codec;
+    return 0;
+}
+
+/**
+ * @brief Prepares the output stream of a sparse file for the extent map at the start of its payload.
+ * @param ctx Extraction state.
+ * @param plain_entry Entry metadata, accepted by select_entry_codec().
+ * @param os Output stream state; left unchanged for other entries.
+ * @return 0 on success, 1 on failure.
+ */
+static int prepare_sparse_output(ExtractContext *ctx, const FileEntryPlain *plain_entry, OutputStream *os) {
+    if (ctx->version < ARCHIVE_VERSION_SPARSE || !(plain_entry->codec & ENTRY_CODEC_SPARSE)) return 0;
+    if (!ctx->extents && !(ctx->extents = malloc(SPARSE_MAX_EXTENTS * sizeof(SparseExtent)))) {
+        fprintf(stderr, "Error: Memory allocation failed for extent map\n");
+        return 1;
+    }
+    os->extents = ctx->extents;
+    os->extent_count = SIZE_MAX;
+    return 0;
+}
+
+/**
+ * @brief Reads the size entry that follows a streamed payload and checks it against the lead entry.
+ * @param ctx Extraction state, positioned after the payload.
+ * @param index Entry index (for messages).
+ * @param lead Lead entry metadata.
+ * @param payload_size Size of the payload chunks read.
+ * @param name Output path or entry name (for messages).
+ * @param sizes Output size entry; the caller checks its original size against the data.
+ * @return 0 on success, 1 on failure.
+ */
+static int read_size_entry(ExtractContext *ctx, uint32_t index, const FileEntryPlain *lead, uint64_t payload_size,
+                           const char *name, FileEntryPlain *sizes) {
+    if (read_entry_metadata(ctx, index, sizes) != 0) return 1;
+    if (strncmp(sizes->filename, lead->filename, MAX_FILENAME) != 0 || sizes->mode != lead->mode ||
+        sizes->codec != lead->codec || sizes->compressed_size != payload_size || sizes->original_size > MAX_FILE_SIZE) {
+        fprintf(stderr, "Error: Sizes recorded after file entry %u do not match its data (%s)\n", index, name);
+        return 1;
+    }
+    return 0;
+}
+
+/**
+ * @brief Decodes the payload of an entry, or a solid block member, into an output stream.
+ *
+ * While a streamed archive is read front to back, plain_entry is the lead entry
+ * without sizes: the payload is decoded up to its final chunk, and the size
+ * entry that follows must match the data and the lead entry. A sparse file is
+ * extended to its original size once its data was written.
+ *
+ * @param ctx Extraction state, with ctx->codec selected for the entry.
+ * @param index Entry index (for messages).
+ * @param plain_entry Verified entry metadata.
+ * @param solid Index record of a solid block member, NULL for an entry with its own payload.
+ * @param os Output stream state.
+ * @return 0 on success, 1 on failure.
+ */
+static int decode_entry(ExtractContext *ctx, uint32_t index, const FileEntryPlain *plain_entry,
+                        const IndexEntry *solid, OutputStream *os) {
+    int trailing = ctx->trailing_sizes && !solid;
+    if (!ctx->block_size && !ctx->dedup && !solid) {
+        if (start_decoder(ctx, ctx->codec) != 0) return 1;
+        ctx->solid.offset = 0;
+    }
+    int decode_ret;
+    uint64_t payload_size = 0;
+    if (solid) {
+        decode_ret = decode_solid_member(ctx, index, solid, os);
+    } else if (ctx->dedup) {
+        decode_ret = decode_dedup_payload(ctx, index, plain_entry->compressed_size, os);
+    } else if (ctx->block_size) {
+        decode_ret = decode_block_payload(ctx->in, index, plain_entry->compressed_size, &ctx->file_gk, ctx->codec,
+                                          &ctx->bufs, os);
+    } else {
+        decode_ret = ctx->version >= 7
+            ? decode_chunked_payload(ctx->in, index, trailing ? UINT64_MAX : plain_entry->compressed_size,
+                                     &ctx->file_gk, &ctx->bufs, os, &payload_size)
+            : decode_legacy_payload(ctx->in, index, plain_entry->compressed_size, ctx->file_key, &ctx->bufs, os);
+    }
+    if (decode_ret != 0) return 1;
+    if (trailing) {
+        FileEntryPlain sizes;
+        if (read_size_entry(ctx, index, plain_entry, payload_size, os->path, &sizes) != 0) return 1;
+        if (sizes.original_size != os->written) {
+            fprintf(stderr, "Error: Sizes recorded after file entry %u do not match its data (%s)\n", index, os->path);
+            return 1;
+        }
+    } else if (os->written != (os->extents ? os->expected : plain_entry->original_size)) {
+        fprintf(stderr, "Error: Decompression failed for file %s (expected %lu bytes, got %lu)\n",
+                os->path, os->extents ? os->expected : plain_entry->original_size, os->written);
+        return 1;
+    }
+    /* The holes after the last extent only exist once the file has its full size */
+    if (os->extents && os->fd != -1 && ftruncate(os->fd, plain_entry->original_size) != 0) {
+        fprintf(stderr, "Error: Failed to set size of output file %s: %s\n", os->path, strerror(errno));
+        return 1;
+    }
+    return 0;
+}
+
+/**
+ * @brief Verifies one entry, or a solid block member, without writing anything.
+ *
+ * Every chunk of the payload is authenticated. Unless only authentication was
+ * requested, the data is also decompressed into a discard sink and its size
+ * checked; otherwise decompression is skipped, and a solid block is
+ * authenticated once for all of its members. References of a dedup payload
+ * point to chunks that are authenticated with the entries storing them.
+ *
+ * @param ctx Extraction state of a verify run.
+ * @param index Entry index (for messages).
+ * @param plain_entry Verified entry metadata.
+ * @param solid Index record of a solid block member, NULL for an entry with its own payload.
+ * @return 0 on success, 1 on failure.
+ */
+static int verify_entry(ExtractContext *ctx, uint32_t index, const FileEntryPlain *plain_entry,
+                        const IndexEntry *solid) {
+    int trailing = ctx->trailing_sizes && !solid;
+    uint64_t size = plain_entry->original_size;
+    if (size == 0 && !trailing) {
+        verbose_print(VERBOSE_DEBUG, "Empty file, no data to verify: %s", plain_entry->filename);
+    } else if (select_entry_codec(ctx, plain_entry, plain_entry->filename) != 0) {
+        return 1;
+    } else if (!ctx->verify->auth_only) {
+        OutputStream os = { .cs = &ctx->cs, .wb = &ctx->wb, .fd = -1, .path = plain_entry->filename,
+                            .out_buf = ctx->bufs.out, .spare_buf = ctx->bufs.out + ctx->bufs.slots * ctx->bufs.out_size,
+                            .expected = trailing ? MAX_FILE_SIZE : size };
+        if (prepare_sparse_output(ctx, plain_entry, &os) != 0 || decode_entry(ctx, index, plain_entry, solid, &os) != 0)
+            return 1;
+        if (trailing) size = os.written;
+    } else if (solid) {
+        if (ctx->verified_block != solid->entry_offset) {
+            if (fseek(ctx->in, solid->entry_offset, SEEK_SET) != 0) {
+                fprintf(stderr, "Error: Failed to read solid block for file %u\n", index);
+                return 1;
+            }
+            if (decode_chunked_payload(ctx->in, index, solid->plain.compressed_size, &ctx->file_gk, &ctx->bufs,
+                                       NULL, NULL) != 0) {
+                return 1;
+            }
+            ctx->verified_block = solid->entry_offset;
+        }
+    } else if (ctx->version < 7) {
+        if (decode_legacy_payload(ctx->in, index, plain_entry->compressed_size, ctx->file_key, &ctx->bufs, NULL) != 0)
+            return 1;
+    } else {
+        uint64_t payload_size = 0;
+        if (decode_chunked_payload(ctx->in, index, trailing ? UINT64_MAX : plain_entry->compressed_size,
+                                   &ctx->file_gk, &ctx->bufs, NULL, &payload_size) != 0) {
+            return 1;
+        }
+        if (trailing) {
+            FileEntryPlain sizes;
+            if (read_size_entry(ctx, index, plain_entry, payload_size, plain_entry->filename, &sizes) != 0) return 1;
+            size = sizes.original_size;
+        }
+    }
+    __atomic_fetch_add(&ctx->verify->files, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&ctx->verify->bytes, size, __ATOMIC_RELAXED);
+    verbose_print(VERBOSE_BASIC, "Verified file: %s", plain_entry->filename);
+    return 0;
+}
+
+/**
+ * @brief Extracts one entry whose payload starts at the current archive position, or a solid block member.
+ *
+ * Verify runs hand the entry to verify_entry() instead.
+ *
+ * @param ctx Extraction state.
+ * @param index Entry index (for messages).
+ * @param plain_entry Verified entry metadata.
+ * @param solid Index record of a solid block member, NULL for an entry with its own payload.
+ * @return 0 on success, 1 on failure.
+ */
+static int extract_entry(ExtractContext *ctx, uint32_t index, const FileEntryPlain *plain_entry,
+                         const IndexEntry *solid) {
+    if (ctx->verify) return verify_entry(ctx, index, plain_entry, solid);
+    char *full_path = ctx->path;
+    snprintf(full_path, ctx->path_size, "%s/%s", ctx->extract_dir, plain_entry->filename);
+    if (!ctx->force && access(full_path, F_OK) == 0) {
+        fprintf(stderr, "Error: Output file %s exists. Use -f to overwrite.\n", full_path);
+        return 1;
+    }
+    if (create_parent_dirs(full_path) != 0) return 1;
+    int trailing = ctx->trailing_sizes && !solid;
+    if (plain_entry->original_size == 0 && !trailing) {
+        verbose_print(VERBOSE_BASIC, "Extracting empty file: %s", full_path);
+        FILE *out = fopen(full_path, "wb");
+        if (!out) {
+            fprintf(stderr, "Error: Cannot open output file %s: %s\n", full_path, strerror(errno));
+            return 1;
+        }
+        fclose(out);
+        restore_mode(full_path, plain_entry->mode);
+        verbose_print(VERBOSE_BASIC, "Extracted empty file: %s", full_path);
+        return 0;
+    }
+    if (select_entry_codec(ctx, plain_entry, full_path) != 0) return 1;
+    OutputStream os = { .cs = &ctx->cs, .wb = &ctx->wb, .path = full_path, .out_buf = ctx->bufs.out,
+                        .spare_buf = ctx->bufs.out + ctx->bufs.slots * ctx->bufs.out_size,
+                        .expected = trailing ? MAX_FILE_SIZE : plain_entry->original_size };
+    if (prepare_sparse_output(ctx, plain_entry, &os) != 0) return 1;
+    int open_flags = O_WRONLY | O_CREAT | O_TRUNC;
+    os.fd = open(full_path, open_flags | (ctx->direct_io ? O_DIRECT : 0), 0666);
+    if (os.fd != -1) {
+        os.direct = ctx->direct_io;
+    } else if (ctx->direct_io && errno == EINVAL) {
+        verbose_print(VERBOSE_DEBUG, "%s does not support O_DIRECT, writing through the page cache", full_path);
+        os.fd = open(full_path, open_flags, 0666);
+    }
+    if (os.fd == -1) {
+        fprintf(stderr, "Error: Cannot open output file %s: %s\n", full_path, strerror(errno));
+        return 1;
+    }
+    int decode_ret = decode_entry(ctx, index, plain_entry, solid, &os);
+    int write_error = write_behind_wait(&ctx->wb);
+    if (write_error && decode_ret == 0) {
+        fprintf(stderr, "Error: Failed to write output file %s: %s\n", full_path, strerror(write_error));
+        decode_ret = 1;
+    }
+    if (close(os.fd) != 0 && decode_ret == 0) {
+        fprintf(stderr, "Error: Failed to write output file %s: %s\n", full_path, strerror(errno));
+        decode_ret = 1;
+    }
+    if (decode_ret != 0) {
+        /* Never leave partial or unauthenticated data behind */
+        unlink(full_path);
+        return 1;
+    }
+    verbose_print(VERBOSE_DEBUG, "Decompressed to %lu bytes", os.written);
+    restore_mode(full_path, plain_entry->mode);
+    verbose_print(VERBOSE_BASIC, "Extracted file: %s", full_path);
+    return 0;
+}
+
+/**
+ * @brief Entries requested on the command line.
+ */
+typedef struct {
+    const char **paths;    /**< Exact entry paths; a directory selects everything below it */
+    int path_count;        /**< Number of paths */
+    const char **patterns; /**< Include glob patterns */
+    int pattern_count;     /**< Number of include patterns */
+    int *found;            /**< One flag per path, then per pattern, set once it selected an entry */
+    int exact;             /**< If 1, paths are exact entry names looked up in the index (base archives) */
+} EntrySelection;
+
+/**
+ * @brief Entries of an incremental archive that are stored in its base archive.
+ */
+typedef struct {
+    FileList names;          /**< Names to extract from the base archive */
+    char *path;              /**< Base archive path from the index */
+    uint8_t salt[SALT_SIZE]; /**< Salt of the base archive */
+} BaseRequest;
+
+/**
+ * @brief Checks whether an entry was requested on the command line.
+ *
+ * A path selects the entry with exactly that name and, if it names a directory,
+ * every entry below it. An include pattern selects entries whose filename or
+ * full path matches it. With neither, every entry is selected.
+ *
+ * @param filename Entry filename.
+ * @param sel Requested entries; matching paths and patterns are marked in sel->found.
+ * @return 1 if the entry should be extracted, 0 otherwise.
+ */
+static int entry_selected(const char *filename, const EntrySelection *sel) {
+    if (sel->path_count == 0 && sel->pattern_count == 0) return 1;
+    int selected = 0;
+    for (int p = 0; p < sel->path_count; p++) {
+        size_t len = strlen(sel->paths[p]);
+        while (len > 1 && sel->paths[p][len - 1] == '/') len--;
+        if (strncmp(filename, sel->paths[p], len) == 0 && (filename[len] == '\0' || filename[len] == '/')) {
+            sel->found[p] = 1;
+            selected = 1;
+        }
+    }
+    const char *basename = strrchr(filename, '/');
+    basename = basename ? basename + 1 : filename;
+    for (int p = 0; p < sel->pattern_count; p++) {
+        if (matches_glob_pattern(basename, sel->patterns[p]) || matches_glob_pattern(filename, sel->patterns[p])) {
+            sel->found[sel->path_count + p] = 1;
+            selected = 1;
+        }
+    }
+    return selected;
+}
+
+/**
+ * @brief Extracts the selected entries by reading the archive from front to back.
+ *
+ * Entries that were not requested are skipped with a single seek over their
+ * payload (or by reading it from a pipe; streamed archives also walk its chunk
+ * headers, as their lead entries carry no sizes).
+ *
+ * @param ctx Extraction state, positioned after the archive header.
+ * @param file_count Number of entries.
+ * @param sel Requested entries (none extracts everything).
+ * @return 0 on success, 1 on failure.
+ */
+static int extract_sequential(ExtractContext *ctx, uint32_t file_count, const EntrySelection *sel) {
+    for (uint32_t i = 0; i < file_count; i++) {
+        FileEntryPlain plain_entry;
+        if (read_entry_metadata(ctx, i, &plain_entry) != 0) return 1;
+        if (plain_entry.filename[MAX_FILENAME - 1] != '\0' ||
+            has_path_traversal(plain_entry.filename) || (plain_entry.compressed_size > 0 && plain_entry.original_size == 0) ||
+            plain_entry.original_size > ENTRY_MAX_SIZE(ctx->version >= ARCHIVE_VERSION_SPARSE ? plain_entry.codec : 0)) {
+            fprintf(stderr, "Error: Invalid or unsafe metadata in file entry %u\n", i);
+            return 1;
+        }
+        if (!entry_selected(plain_entry.filename, sel)) {
+            verbose_print(VERBOSE_DEBUG, "Skipping file: %s", plain_entry.filename);
+            if (ctx->trailing_sizes) {
+                if (skip_stream_entry(ctx, i, &plain_entry) != 0) return 1;
+            } else if (plain_entry.compressed_size > 0 &&
+                       skip_archive_bytes(ctx, entry_payload_size(ctx->version, plain_entry.compressed_size)) != 0) {
+                fprintf(stderr, "Error: Failed to skip data for entry %u (%s): %s\n", i, plain_entry.filename,
+                        feof(ctx->in) ? "unexpected EOF" : strerror(errno));
+                return 1;
+            }
+            continue;
+        }
+        if (extract_entry(ctx, i, &plain_entry, NULL) != 0) return 1;
+    }
+    return 0;
+}
+
+/**
+ * @brief Reads a piped archive to its end and checks that no files were appended to it.
+ *
+ * The entries of an append follow the first trailer, and only the last
+ * trailer counts them, so they are found once the whole stream was read.
+ *
+ * @param ctx Extraction state, positioned after the entries the header counts.
+ * @param header Verified archive header (version 17+).
+ * @return 0 on success, 1 on failure.
+ */
+static int check_piped_trailer(ExtractContext *ctx, const ArchiveHeader *header) {
+    ArchiveTrailer trailer;
+    uint8_t *buf = ctx->bufs.rec;
+    size_t have = 0;
+    size_t got;
+    do {
+        got = fread(buf + have, 1, ctx->bufs.rec_size - have, ctx->in);
+        have += got;
+        if (have > sizeof(trailer)) {
+            memmove(buf, buf + have - sizeof(trailer), sizeof(trailer));
+            have = sizeof(trailer);
+        }
+    } while (got > 0);
+    if (ferror(ctx->in)) {
+        fprintf(stderr, "Error: Failed to read archive index: %s\n", strerror(errno));
+        return 1;
+    }
+    memcpy(&trailer, buf, sizeof(trailer));
+    if (have < sizeof(trailer) || strncmp(trailer.magic, TRAILER_MAGIC, sizeof(trailer.magic)) != 0 ||
+        trailer.entry_count < header->file_count) {
+        fprintf(stderr, "Error: Invalid archive trailer\n");
+        return 1;
+    }
+    if (trailer.entry_count != header->file_count) {
+        fprintf(stderr, "Error: %u files were appended to the archive, which cannot be read from standard input\n",
+                trailer.entry_count - header->file_count);
+        return 1;
+    }
+    return 0;
+}
 
 /**
- * @brief Extracts and decrypts files from a .slm archive.
+ * @brief Entries of an indexed extraction, handed out to the extracting threads.
+ */
+typedef struct {
+    ArchiveIndex index;         /**< Central index */
+    const EntrySelection *sel;  /**< Requested entries */
+    BaseRequest *base;          /**< Entries stored in the base archive */
+    size_t pos;                 /**< Read position in the index */
+    uint32_t next;              /**< Number of records (exact paths for base archives) looked at so far */
+    int abort;                  /**< Set when the run failed */
+    pthread_mutex_t lock;       /**< Protects all fields above */
+    const char *archive;        /**< Archive path, opened again by each worker */
+    const ExtractContext *ctx;  /**< Settings of the run, copied into each worker's context */
+    const uint8_t *payload_key; /**< Key of ctx->file_gk */
+    const uint8_t *meta_key;    /**< Metadata key */
+} EntryQueue;
+
+/**
+ * @brief Hands out the next selected entry whose data is in this archive.
+ *
+ * Entries stored in the base archive are collected in queue->base on the way.
+ *
+ * @param queue Entry queue.
+ * @param entry Output index record.
+ * @param i Output entry index (for messages).
+ * @return 1 if an entry was handed out, 0 if none is left or the run was aborted.
+ */
+static int next_queued_entry(EntryQueue *queue, IndexEntry *entry, uint32_t *i) {
+    int ret = 0;
+    pthread_mutex_lock(&queue->lock);
+    while (!queue->abort) {
+        if (queue->sel->exact) {
+            if (queue->next >= (uint32_t)queue->sel->path_count) break;
+            if (!archive_index_find(&queue->index, queue->sel->paths[queue->next], entry)) {
+                fprintf(stderr, "Error: %s not found in base archive\n", queue->sel->paths[queue->next]);
+                queue->abort = 1;
+                break;
+            }
+        } else {
+            if (archive_index_next(&queue->index, &queue->pos, entry) != 1) break;
+            if (!entry_selected(entry->plain.filename, queue->sel)) {
+                queue->next++;
+                continue;
+            }
+        }
+        *i = queue->next++;
+        if (entry->flags & INDEX_FLAG_IN_BASE) {
+            verbose_print(VERBOSE_DEBUG, "Deferring file to base archive: %s", entry->plain.filename);
+            if (file_list_add(&queue->base->names, entry->plain.filename) != 0) queue->abort = 1;
+            continue;
+        }
+        ret = 1;
+        break;
+    }
+    pthread_mutex_unlock(&queue->lock);
+    return ret;
+}
+
+/**
+ * @brief Extracts queued entries until none is left or the run failed.
+ *
+ * The FileEntry in front of each payload is decrypted and must agree with the
+ * index record. Members of a solid block are decoded from the block instead of
+ * an entry payload.
+ *
+ * @param ctx Extraction state of the calling thread.
+ * @param queue Entry queue.
+ */
+static void extract_queued(ExtractContext *ctx, EntryQueue *queue) {
+    IndexEntry entry;
+    FileEntryPlain plain_entry;
+    uint32_t i;
+    while (next_queued_entry(queue, &entry, &i) == 1) {
+        int ret;
+        if (entry.flags & INDEX_FLAG_SOLID) {
+            ret = extract_entry(ctx, i, &entry.plain, &entry);
+        } else if (fseek(ctx->in, entry.entry_offset, SEEK_SET) != 0) {
+            fprintf(stderr, "Error: Failed to seek to entry %u (%s): %s\n", i, entry.plain.filename, strerror(errno));
+            ret = 1;
+        } else if (read_entry_metadata(ctx, i, &plain_entry) != 0) {
+            ret = 1;
+        } else if (strcmp(plain_entry.filename, entry.plain.filename) != 0 ||
+                   plain_entry.compressed_size != (ctx->streamed ? 0 : entry.plain.compressed_size) ||
+                   plain_entry.original_size != (ctx->streamed ? 0 : entry.plain.original_size)) {
+            fprintf(stderr, "Error: File entry %u does not match its index record (%s)\n", i, entry.plain.filename);
+            ret = 1;
+        } else {
+            ret = extract_entry(ctx, i, &entry.plain, NULL);
+        }
+        if (ret != 0) {
+            pthread_mutex_lock(&queue->lock);
+            queue->abort = 1;
+            pthread_mutex_unlock(&queue->lock);
+            break;
+        }
+    }
+}
+
+/**
+ * @brief Worker thread: extracts queued entries with its own archive handle, ciphers, decoder and writer.
+ * @param arg EntryQueue.
+ * @return NULL.
+ */
+static void *extract_worker(void *arg) {
+    EntryQueue *queue = arg;
+    const ExtractContext *main = queue->ctx;
+    ExtractContext ctx = { .version = main->version, .algo = main->algo, .dedup = main->dedup, .streamed = main->streamed,
+                           .verify = main->verify, .dict = main->dict, .dict_len = main->dict_len,
+                           .file_key = main->file_key, .extract_dir = main->extract_dir, .force = main->force,
+                           .direct_io = main->direct_io, .use_uring = main->use_uring };
+    ctx.in = fopen(queue->archive, "rb");
+    if (!ctx.in) {
+        fprintf(stderr, "Error: Cannot open archive %s: %s\n", queue->archive, strerror(errno));
+    } else if (init_extract_contexts(&ctx, queue->payload_key, queue->meta_key) != 0) {
+        fclose(ctx.in);
+        ctx.in = NULL;
+    } else if (alloc_stream_buffers(&ctx.bufs, 0, ctx.algo, 1) != 0) {
+        free_extract_contexts(&ctx);
+        fclose(ctx.in);
+        ctx.in = NULL;
+    }
+    if (!ctx.in) {
+        pthread_mutex_lock(&queue->lock);
+        queue->abort = 1;
+        pthread_mutex_unlock(&queue->lock);
+        return NULL;
+    }
+    extract_queued(&ctx, queue);
+    free_extract_contexts(&ctx);
+    free_stream_buffers(&ctx.bufs);
+    fclose(ctx.in);
+    return NULL;
+}
+
+/**
+ * @brief Extracts the selected entries of a version 9+ archive by seeking to them through the central index.
+ *
+ * With more than one worker, entries are extracted in parallel: each worker
+ * opens the archive again and claims the next selected entry from the index,
+ * so every thread reads, decrypts, decompresses and writes its own output
+ * files. Entries of an incremental archive that are unchanged since its base
+ * are collected in base for the caller to extract from the base archive.
+ *
+ * @param ctx Extraction state.
+ * @param header Verified archive header.
+ * @param sel Requested entries.
+ * @param base Output entries stored in the base archive.
+ * @param archive Archive path (opened again by the workers).
+ * @param payload_key Key of ctx->file_gk.
+ * @param meta_key Metadata key.
+ * @param workers Number of entries extracted in parallel (1 extracts on the calling thread).
+ * @return 0 on success, 1 on failure.
+ */
+static int extract_indexed(ExtractContext *ctx, const ArchiveHeader *header, const EntrySelection *sel,
+                           BaseRequest *base, const char *archive, const uint8_t *payload_key,
+                           const uint8_t *meta_key, int workers) {
+    EntryQueue queue = { .sel = sel, .base = base, .archive = archive, .ctx = ctx, .payload_key = payload_key,
+                         .meta_key = meta_key };
+    if (read_archive_index(ctx->in, header, &ctx->meta_gk, &queue.index) != 0) return 1;
+    if (sel->exact && archive_index_build_lookup(&queue.index) != 0) {
+        archive_index_free(&queue.index);
+        return 1;
+    }
+    if (queue.index.dict_len > 0) {
+        ctx->dict = queue.index.data + queue.index.dict_offset;
+        ctx->dict_len = queue.index.dict_len;
+        verbose_print(VERBOSE_DEBUG, "Compression dictionary: %lu bytes", (unsigned long)ctx->dict_len);
+    }
+    pthread_mutex_init(&queue.lock, NULL);
+    if (workers > 1) {
+        pthread_t *threads = calloc(workers, sizeof(pthread_t));
+        int started = 0;
+        if (!threads) {
+            fprintf(stderr, "Error: Memory allocation failed for worker threads\n");
+            queue.abort = 1;
+        }
+        for (; threads && started < workers; started++) {
+            if (pthread_create(&threads[started], NULL, extract_worker, &queue) != 0) {
+                fprintf(stderr, "Error: Failed to start worker thread\n");
+                pthread_mutex_lock(&queue.lock);
+                queue.abort = 1;
+                pthread_mutex_unlock(&queue.lock);
+                break;
+            }
+        }
+        verbose_print(VERBOSE_DEBUG, "Started %d extraction threads", started);
+        for (int t = 0; t < started; t++) pthread_join(threads[t], NULL);
+        free(threads);
+    } else {
+        extract_queued(ctx, &queue);
+    }
+    pthread_mutex_destroy(&queue.lock);
+    int ret = queue.abort;
+    if (ret == 0 && base->names.count > 0) {
+        base->path = strdup(queue.index.base_path);
+        if (!base->path) {
+            fprintf(stderr, "Error: Memory allocation failed for base archive path\n");
+            ret = 1;
+        }
+        memcpy(base->salt, queue.index.base_salt, SALT_SIZE);
+    }
+    /* A zlib decoder refers to the dictionary, which goes with the index */
+    if (ctx->dict && ctx->cs_ready) {
+        codec_stream_end(&ctx->cs);
+        ctx->cs_ready = 0;
+    }
+    ctx->dict = NULL;
+    ctx->dict_len = 0;
+    archive_index_free(&queue.index);
+    return ret;
+}
+
+/**
+ * @brief Resolves the base archive path recorded in an incremental archive.
+ *
+ * Relative paths are relative to the directory of the incremental archive.
+ *
+ * @param archive Path to the incremental archive.
+ * @param base_path Recorded base archive path.
+ * @return Resolved path (caller frees), or NULL on failure.
+ */
+static char *resolve_base_path(const char *archive, const char *base_path) {
+    const char *slash = strrchr(archive, '/');
+    size_t dir_len = base_path[0] == '/' || !slash ? 0 : (size_t)(slash - archive) + 1;
+    char *path = malloc(dir_len + strlen(base_path) + 1);
+    if (!path) {
+        fprintf(stderr, "Error: Memory allocation failed for base archive path\n");
+        return NULL;
+    }
+    memcpy(path, archive, dir_len);
+    strcpy(path + dir_len, base_path);
+    return path;
+}
+
+/**
+ * @brief Authenticates the comment of an archive header.
+ * @param header Verified archive header.
+ * @param meta_key Metadata key.
+ * @return 0 on success, 1 on failure.
+ */
+static int verify_comment(const ArchiveHeader *header, const uint8_t *meta_key) {
+    if (header->comment_len == 0) return 0;
+    if (header->comment_len > MAX_COMMENT - AES_NONCE_SIZE - AES_TAG_SIZE) {
+        fprintf(stderr, "Error: Invalid comment length (%u)\n", header->comment_len);
+        return 1;
+    }
+    uint8_t *dec_comment = malloc(header->comment_len);
+    if (!dec_comment) {
+        fprintf(stderr, "Error: Memory allocation failed for comment\n");
+        return 1;
+    }
+    const uint8_t *comment_nonce = header->comment + header->comment_len;
+    const uint8_t *comment_tag = comment_nonce + AES_NONCE_SIZE;
+    size_t dec_len;
+    int ret = decrypt_aes_gcm(meta_key, comment_nonce, header->comment, header->comment_len, comment_tag,
+                              dec_comment, &dec_len) != 0 || dec_len != header->comment_len;
+    free(dec_comment);
+    if (ret) {
+        fprintf(stderr, "Error: Failed to decrypt comment (corrupted data?)\n");
+        return 1;
+    }
+    verbose_print(VERBOSE_DEBUG, "Verified archive comment");
+    return 0;
+}
+
+/**
+ * @brief Extracts the selected entries of one archive, then those it defers to its base archive.
+ *
+ * Verify runs read the same entries without writing anything; they also
+ * authenticate the archive comment and the whole index.
+ *
  * @param archive Path to the input archive file (.slm).
  * @param password Password for decryption.
- * @param outdir User-specified output directory (NULL to use archive's outdir or current directory).
+ * @param outdir Output directory (NULL to use archive's outdir or current directory).
  * @param force If 1, overwrite existing output files.
+ * @param jobs Number of entries extracted in parallel (blocks decompressed in parallel for block-parallel archives).
+ * @param direct_io If 1, write output files with O_DIRECT.
+ * @param use_uring If 1, write output files through io_uring.
+ * @param sel Requested entries.
+ * @param expected_salt Salt the archive must have when it is extracted as a base archive, NULL otherwise.
+ * @param depth Number of incremental archives above this one.
+ * @param verify Verify run, NULL to extract.
  * @return 0 on success, 1 on failure.
  */
-int extract_files(const char *archive, const char *password, const char *outdir, int force) {
-    if (!archive || !password) {
-        fprintf(stderr, "Error: Invalid extract parameters\n");
-        return 1;
-    }
-    FILE *in = fopen(archive, "rb");
-    if (!in) {
-        fprintf(stderr, "Error: Cannot open archive file %s: %s\n", archive, strerror(errno));
+static int extract_archive(const char *archive, const char *password, const char *outdir, int force, int jobs,
+                           int direct_io, int use_uring, const EntrySelection *sel, const uint8_t *expected_salt,
+                           int depth, VerifyRun *verify) {
+    if (depth > MAX_BASE_CHAIN) {
+        fprintf(stderr, "Error: Chain of base archives is longer than %d archives\n", MAX_BASE_CHAIN);
         return 1;
     }
     ArchiveHeader header;
-    if (fread(&header, sizeof(header), 1, in) != 1) {
-        fprintf(stderr, "Error: Failed to read archive header\n");
+    uint8_t file_key[AES_KEY_SIZE];
+    uint8_t meta_key[AES_KEY_SIZE];
+    FILE *in = open_archive(archive, password, &header, file_key, meta_key);
+    if (!in) return 1;
+    /* Entries are mostly read front to back, so let the kernel read ahead further while they are decoded */
+    posix_fadvise(fileno(in), 0, 0, POSIX_FADV_SEQUENTIAL);
+    if (expected_salt && (header.version < ARCHIVE_VERSION_INCREMENTAL || memcmp(header.salt, expected_salt, SALT_SIZE) != 0)) {
+        fprintf(stderr, "Error: %s is not the base archive the incremental archive was created from\n", archive);
+        secure_zero(file_key, AES_KEY_SIZE);
+        secure_zero(meta_key, AES_KEY_SIZE);
         fclose(in);
         return 1;
     }
-    CompressionAlgo algo;
-    if (strncmp(header.magic, "SLM", 4) != 0 || (header.version < 4 || header.version > 6)) {
-        fprintf(stderr, "Error: Invalid archive format or version (expected 4 to 6, got %d)\n", header.version);
+    if (verify && verify_comment(&header, meta_key) != 0) {
+        secure_zero(file_key, AES_KEY_SIZE);
+        secure_zero(meta_key, AES_KEY_SIZE);
         fclose(in);
         return 1;
     }
+    CompressionAlgo algo;
     if (header.version == 4) {
         algo = COMPRESSION_LZMA; // Version 4 is always LZMA
     } else {
         algo = header.compression_algo;
-        if (algo != COMPRESSION_ZLIB && algo != COMPRESSION_LZMA) {
+        int known = algo == COMPRESSION_ZLIB || algo == COMPRESSION_LZMA ||
+                    (header.version >= ARCHIVE_VERSION_CODECS &&
+                     (algo == COMPRESSION_ZSTD || algo == COMPRESSION_LZ4 || algo == COMPRESSION_AUTO));
+        if (!known) {
             fprintf(stderr, "Error: Invalid compression algorithm in header (%d)\n", algo);
+            secure_zero(file_key, AES_KEY_SIZE);
+            secure_zero(meta_key, AES_KEY_SIZE);
             fclose(in);
             return 1;
         }
     }
-    if (header.file_count > MAX_FILES) {
-        fprintf(stderr, "Error: Too many files in archive (%u > %d)\n", header.file_count, MAX_FILES);
-        fclose(in);
-        return 1;
-    }
-    verbose_print(VERBOSE_BASIC, "Read archive header, version %d, %u files, compression %s level %d",
-                  header.version, header.file_count, algo == COMPRESSION_ZLIB ? "zlib" : "LZMA", header.compression_level);
-    uint8_t file_key[AES_KEY_SIZE];
-    uint8_t meta_key[AES_KEY_SIZE];
-    if (derive_key(password, header.salt, file_key, "file encryption") != 0 ||
-        derive_key(password, header.salt, meta_key, "metadata encryption") != 0) {
-        fclose(in);
-        return 1;
+    size_t block_size = 0;
+    int incremental = 0;
+    int dedup = 0;
+    int solid = 0;
+    int streamed = 0;
+    int has_dict = 0;
+    int appended = 0;
+    if (header.version >= 7 && header.reserved[0] != 0) {
+        uint8_t known = ARCHIVE_FLAG_BLOCKS;
+        if (header.version >= ARCHIVE_VERSION_INCREMENTAL) known |= ARCHIVE_FLAG_INCREMENTAL;
+        if (header.version >= ARCHIVE_VERSION_DEDUP) known |= ARCHIVE_FLAG_DEDUP;
+        if (header.version >= ARCHIVE_VERSION_SOLID) known |= ARCHIVE_FLAG_SOLID;
+        if (header.version >= ARCHIVE_VERSION_STREAM) known |= ARCHIVE_FLAG_STREAM;
+        if (header.version >= ARCHIVE_VERSION_DICT) known |= ARCHIVE_FLAG_DICT;
+        if ((header.reserved[0] & ~known) ||
+            ((header.reserved[0] & ARCHIVE_FLAG_DICT) &&
+             (header.reserved[0] & (ARCHIVE_FLAG_BLOCKS | ARCHIVE_FLAG_DEDUP | ARCHIVE_FLAG_SOLID | ARCHIVE_FLAG_STREAM))) ||
+            ((header.reserved[0] & ARCHIVE_FLAG_STREAM) &&
+             (header.reserved[0] & (ARCHIVE_FLAG_BLOCKS | ARCHIVE_FLAG_DEDUP | ARCHIVE_FLAG_SOLID))) ||
+            ((header.reserved[0] & ARCHIVE_FLAG_DEDUP) && (header.reserved[0] & ARCHIVE_FLAG_BLOCKS)) ||
+            ((header.reserved[0] & ARCHIVE_FLAG_SOLID) && (header.reserved[0] & (ARCHIVE_FLAG_BLOCKS | ARCHIVE_FLAG_DEDUP))) ||
+            ((header.reserved[0] & ARCHIVE_FLAG_BLOCKS) &&
+             (header.reserved[1] < BLOCK_SIZE_LOG2_MIN || header.reserved[1] > BLOCK_SIZE_LOG2_MAX))) {
+            fprintf(stderr, "Error: Unsupported archive flags in header (0x%02x, block size %u)\n",
+                    header.reserved[0], header.reserved[1]);
+            secure_zero(file_key, AES_KEY_SIZE);
+            secure_zero(meta_key, AES_KEY_SIZE);
+            fclose(in);
+            return 1;
+        }
+        if (header.reserved[0] & ARCHIVE_FLAG_BLOCKS) block_size = (size_t)1 << header.reserved[1];
+        incremental = (header.reserved[0] & ARCHIVE_FLAG_INCREMENTAL) != 0;
+        dedup = (header.reserved[0] & ARCHIVE_FLAG_DEDUP) != 0;
+        solid = (header.reserved[0] & ARCHIVE_FLAG_SOLID) != 0;
+        streamed = (header.reserved[0] & ARCHIVE_FLAG_STREAM) != 0;
+        has_dict = (header.reserved[0] & ARCHIVE_FLAG_DICT) != 0;
     }
-    verbose_print(VERBOSE_DEBUG, "Derived encryption keys");
-    size_t hmac_size = offsetof(ArchiveHeader, hmac);
-    uint8_t computed_hmac[HMAC_SIZE];
-    if (compute_hmac(file_key, (uint8_t *)&header, hmac_size, computed_hmac) != 0) {
+    int piped = strcmp(archive, "-") == 0;
+    /* A trailer counting more files than the header commits an append */
+    long header_end = piped ? 0 : ftell(in);
+    ArchiveTrailer trailer;
+    if (!piped && header.version >= ARCHIVE_VERSION_APPEND &&
+        (header_end == -1 || read_archive_trailer(in, &header, &trailer) != 0 || fseek(in, header_end, SEEK_SET) != 0)) {
         secure_zero(file_key, AES_KEY_SIZE);
         secure_zero(meta_key, AES_KEY_SIZE);
         fclose(in);
         return 1;
     }
-    if (memcmp(computed_hmac, header.hmac, HMAC_SIZE) != 0) {
-        fprintf(stderr, "Error: Header HMAC verification failed\n");
+    appended = !piped && header.version >= ARCHIVE_VERSION_APPEND && trailer.entry_count != header.file_count;
+    if (piped && (incremental || dedup || solid || has_dict)) {
+        fprintf(stderr, "Error: Incremental, dedup, solid and dictionary archives cannot be extracted from standard input\n");
         secure_zero(file_key, AES_KEY_SIZE);
         secure_zero(meta_key, AES_KEY_SIZE);
         fclose(in);
         return 1;
     }
-    verbose_print(VERBOSE_DEBUG, "Verified header HMAC");
+    verbose_print(VERBOSE_BASIC, "Read archive header, version %d, %u files, compression %s level %d",
+                  header.version, header.file_count, codec_name(algo), header.compression_level);
+    if (block_size) {
+        verbose_print(VERBOSE_BASIC, "Block-parallel archive: %luMB blocks, decompressing on %d threads",
+                      (unsigned long)(block_size >> 20), jobs);
+    }
     char *extract_dir = NULL;
     if (outdir) {
         extract_dir = strdup(outdir);
@@ -149,7 +1728,7 @@ int extract_files(const char *archive, const char *password, const char *outdir,
         }
     }
     struct stat st;
-    if (stat(extract_dir, &st) != 0 || !S_ISDIR(st.st_mode)) {
+    if (!verify && (stat(extract_dir, &st) != 0 || !S_ISDIR(st.st_mode))) {
         verbose_print(VERBOSE_BASIC, "Output directory %s does not exist, falling back to current directory", extract_dir);
         free(extract_dir);
         extract_dir = strdup(".");
@@ -169,219 +1748,183 @@ int extract_files(const char *archive, const char *password, const char *outdir,
             return 1;
         }
     }
-    verbose_print(VERBOSE_BASIC, "Extracting to directory: %s", extract_dir);
-    for (uint32_t i = 0; i < header.file_count; i++) {
-        FileEntry entry;
-        if (fread(&entry, sizeof(entry), 1, in) != 1) {
-            fprintf(stderr, "Error: Failed to read file entry %u\n", i);
-            free(extract_dir);
-            secure_zero(file_key, AES_KEY_SIZE);
-            secure_zero(meta_key, AES_KEY_SIZE);
-            fclose(in);
-            return 1;
-        }
-        FileEntryPlain plain_entry;
-        size_t meta_dec_size;
-        if (decrypt_aes_gcm(meta_key, entry.nonce, entry.encrypted_data, sizeof(entry.encrypted_data),
-                            entry.tag, (uint8_t *)&plain_entry, &meta_dec_size) != 0) {
-            free(extract_dir);
-            secure_zero(file_key, AES_KEY_SIZE);
-            secure_zero(meta_key, AES_KEY_SIZE);
-            fclose(in);
-            return 1;
-        }
-        if (meta_dec_size != sizeof(FileEntryPlain) || plain_entry.filename[MAX_FILENAME - 1] != '\0' ||
-            has_path_traversal(plain_entry.filename) || (plain_entry.compressed_size > 0 && plain_entry.original_size == 0) ||
-            plain_entry.original_size > MAX_FILE_SIZE) {
-            fprintf(stderr, "Error: Invalid or unsafe metadata in file entry %u\n", i);
-            free(extract_dir);
-            secure_zero(file_key, AES_KEY_SIZE);
-            secure_zero(meta_key, AES_KEY_SIZE);
-            fclose(in);
-            return 1;
-        }
-        size_t full_path_len = strlen(extract_dir) + strlen(plain_entry.filename) + 2;
-        char *full_path = malloc(full_path_len);
-        if (!full_path) {
-            fprintf(stderr, "Error: Memory allocation failed for file path\n");
-            free(extract_dir);
-            secure_zero(file_key, AES_KEY_SIZE);
-            secure_zero(meta_key, AES_KEY_SIZE);
-            fclose(in);
-            return 1;
-        }
-        snprintf(full_path, full_path_len, "%s/%s", extract_dir, plain_entry.filename);
-        if (!force && access(full_path, F_OK) == 0) {
-            fprintf(stderr, "Error: Output file %s exists. Use -f to overwrite.\n", full_path);
-            free(full_path);
-            free(extract_dir);
-            secure_zero(file_key, AES_KEY_SIZE);
-            secure_zero(meta_key, AES_KEY_SIZE);
-            fclose(in);
-            return 1;
-        }
-        if (create_parent_dirs(full_path) != 0) {
-            free(full_path);
-            free(extract_dir);
-            secure_zero(file_key, AES_KEY_SIZE);
-            secure_zero(meta_key, AES_KEY_SIZE);
-            fclose(in);
-            return 1;
-        }
-        if (plain_entry.original_size == 0) {
-            verbose_print(VERBOSE_BASIC, "Extracting empty file: %s", full_path);
-            FILE *out = fopen(full_path, "wb");
-            if (!out) {
-                fprintf(stderr, "Error: Cannot open output file %s: %s\n", full_path, strerror(errno));
-                free(full_path);
-                free(extract_dir);
-                secure_zero(file_key, AES_KEY_SIZE);
-                secure_zero(meta_key, AES_KEY_SIZE);
-                fclose(in);
-                return 1;
-            }
-            fclose(out);
-#ifndef _WIN32
-            if (chmod(full_path, plain_entry.mode) != 0) {
-                fprintf(stderr, "Warning: Failed to set permissions on %s: %s\n", full_path, strerror(errno));
-            } else {
-                verbose_print(VERBOSE_DEBUG, "Restored permissions on %s: 0%o", full_path, plain_entry.mode);
-            }
-#endif
-            verbose_print(VERBOSE_BASIC, "Extracted empty file: %s", full_path);
-            free(full_path);
-            continue;
-        }
-        uint8_t file_nonce[AES_NONCE_SIZE];
-        uint8_t file_tag[AES_TAG_SIZE];
-        if (fread(file_nonce, AES_NONCE_SIZE, 1, in) != 1 || fread(file_tag, AES_TAG_SIZE, 1, in) != 1) {
-            fprintf(stderr, "Error: Failed to read nonce or tag for file %u\n", i);
-            free(full_path);
-            free(extract_dir);
-            secure_zero(file_key, AES_KEY_SIZE);
-            secure_zero(meta_key, AES_KEY_SIZE);
-            fclose(in);
-            return 1;
-        }
-        uint8_t *enc_buf = malloc(plain_entry.compressed_size);
-        if (!enc_buf) {
-            fprintf(stderr, "Error: Memory allocation failed for encrypted data\n");
-            free(full_path);
-            free(extract_dir);
-            secure_zero(file_key, AES_KEY_SIZE);
-            secure_zero(meta_key, AES_KEY_SIZE);
-            fclose(in);
-            return 1;
-        }
-        size_t read_size = 0;
-        while (read_size < plain_entry.compressed_size) {
-            size_t chunk = fread(enc_buf + read_size, 1, plain_entry.compressed_size - read_size, in);
-            if (chunk == 0) {
-                fprintf(stderr, "Error: Failed to read encrypted data for file %u: %s\n", i, strerror(errno));
-                free(enc_buf);
-                free(full_path);
-                free(extract_dir);
-                secure_zero(file_key, AES_KEY_SIZE);
-                secure_zero(meta_key, AES_KEY_SIZE);
-                fclose(in);
-                return 1;
-            }
-            read_size += chunk;
-        }
-        uint8_t *comp_buf = malloc(plain_entry.compressed_size);
-        if (!comp_buf) {
-            fprintf(stderr, "Error: Memory allocation failed for compressed data\n");
-            free(enc_buf);
-            free(full_path);
-            free(extract_dir);
-            secure_zero(file_key, AES_KEY_SIZE);
-            secure_zero(meta_key, AES_KEY_SIZE);
-            fclose(in);
-            return 1;
-        }
-        size_t comp_size;
-        if (decrypt_aes_gcm(file_key, file_nonce, enc_buf, plain_entry.compressed_size, file_tag, comp_buf, &comp_size) != 0) {
-            free(enc_buf);
-            free(comp_buf);
-            free(full_path);
-            free(extract_dir);
-            secure_zero(file_key, AES_KEY_SIZE);
-            secure_zero(meta_key, AES_KEY_SIZE);
-            fclose(in);
-            return 1;
-        }
-        verbose_print(VERBOSE_DEBUG, "Decrypted %lu bytes", comp_size);
-        uint8_t *out_buf = malloc(plain_entry.original_size);
-        if (!out_buf) {
-            fprintf(stderr, "Error: Memory allocation failed for decompressed data\n");
-            free(enc_buf);
-            free(comp_buf);
-            free(full_path);
-            free(extract_dir);
-            secure_zero(file_key, AES_KEY_SIZE);
-            secure_zero(meta_key, AES_KEY_SIZE);
-            fclose(in);
-            return 1;
-        }
-        size_t out_size = decompress_data(comp_buf, comp_size, out_buf, plain_entry.original_size, algo);
-        if (out_size != plain_entry.original_size) {
-            fprintf(stderr, "Error: Decompression failed for file %s (expected %lu bytes, got %lu)\n",
-                    full_path, plain_entry.original_size, out_size);
-            free(enc_buf);
-            free(comp_buf);
-            free(out_buf);
-            free(full_path);
-            free(extract_dir);
-            secure_zero(file_key, AES_KEY_SIZE);
-            secure_zero(meta_key, AES_KEY_SIZE);
-            fclose(in);
-            return 1;
-        }
-        verbose_print(VERBOSE_DEBUG, "Decompressed to %lu bytes", out_size);
-        FILE *out = fopen(full_path, "wb");
-        if (!out) {
-            fprintf(stderr, "Error: Cannot open output file %s: %s\n", full_path, strerror(errno));
-            free(enc_buf);
-            free(comp_buf);
-            free(out_buf);
-            free(full_path);
-            free(extract_dir);
-            secure_zero(file_key, AES_KEY_SIZE);
-            secure_zero(meta_key, AES_KEY_SIZE);
-            fclose(in);
-            return 1;
-        }
-        if (fwrite(out_buf, 1, out_size, out) != out_size) {
-            fprintf(stderr, "Error: Failed to write output file %s: %s\n", full_path, strerror(errno));
-            free(enc_buf);
-            free(comp_buf);
-            free(out_buf);
-            free(full_path);
-            fclose(out);
-            free(extract_dir);
-            secure_zero(file_key, AES_KEY_SIZE);
-            secure_zero(meta_key, AES_KEY_SIZE);
-            fclose(in);
-            return 1;
-        }
-        fclose(out);
-#ifndef _WIN32
-        if (chmod(full_path, plain_entry.mode) != 0) {
-            fprintf(stderr, "Warning: Failed to set permissions on %s: %s\n", full_path, strerror(errno));
-        } else {
-            verbose_print(VERBOSE_DEBUG, "Restored permissions on %s: 0%o", full_path, plain_entry.mode);
+    if (!verify) verbose_print(VERBOSE_BASIC, "Extracting to directory: %s", extract_dir);
+    ExtractContext ctx = { .in = in, .version = header.version, .algo = algo, .block_size = block_size,
+                           .dedup = dedup, .streamed = streamed, .piped = piped, .file_key = file_key, .extract_dir = extract_dir, .force = force,
+                           .direct_io = direct_io, .use_uring = use_uring, .verify = verify };
+    uint8_t chunk_key[AES_KEY_SIZE];
+    if ((dedup && hkdf_expand_key(file_key, chunk_key, "dedup chunks") != 0) ||
+        init_extract_contexts(&ctx, dedup ? chunk_key : file_key, meta_key) != 0) {
+        secure_zero(chunk_key, AES_KEY_SIZE);
+        free(extract_dir);
+        secure_zero(file_key, AES_KEY_SIZE);
+        secure_zero(meta_key, AES_KEY_SIZE);
+        fclose(in);
+        return 1;
+    }
+    if (alloc_stream_buffers(&ctx.bufs, block_size, algo, jobs) != 0) {
+        free_extract_contexts(&ctx);
+        secure_zero(chunk_key, AES_KEY_SIZE);
+        free(extract_dir);
+        secure_zero(file_key, AES_KEY_SIZE);
+        secure_zero(meta_key, AES_KEY_SIZE);
+        fclose(in);
+        return 1;
+    }
+    BaseRequest base = { .path = NULL };
+    file_list_init(&base.names);
+    int ret;
+    /* Blocks of block-parallel archives already use the jobs; members of a solid block share its decoder;
+     * standard input can be read only once, from front to back */
+    int workers = block_size || solid || piped ? 1 : jobs;
+    /* Solid block members have no entry of their own, so solid archives are only readable through the index,
+     * as are dictionary archives, whose dictionary is in it, and appended archives, whose entries are not
+     * contiguous; verify runs read the index of seekable archives, and streamed ones front to back to check
+     * every size entry */
+    if (!piped && (sel->exact || incremental || solid || has_dict || appended ||
+                   ((sel->path_count + sel->pattern_count > 0 || workers > 1 || (verify && !streamed)) &&
+                    header.version >= ARCHIVE_VERSION_INDEX))) {
+        ret = extract_indexed(&ctx, &header, sel, &base, archive, dedup ? chunk_key : file_key, meta_key, workers);
+    } else {
+        ctx.trailing_sizes = streamed;
+        ret = extract_sequential(&ctx, header.file_count, sel);
+        if (ret == 0 && verify && streamed && !piped) {
+            ArchiveIndex index;
+            ret = read_archive_index(in, &header, &ctx.meta_gk, &index);
+            archive_index_free(&index);
+        } else if (ret == 0 && piped && header.version >= ARCHIVE_VERSION_APPEND) {
+            ret = check_piped_trailer(&ctx, &header);
         }
-#endif
-        verbose_print(VERBOSE_BASIC, "Extracted file: %s", full_path);
-        free(enc_buf);
-        free(comp_buf);
-        free(out_buf);
-        free(full_path);
     }
-    free(extract_dir);
+    secure_zero(chunk_key, AES_KEY_SIZE);
+    free_extract_contexts(&ctx);
+    free_stream_buffers(&ctx.bufs);
     secure_zero(file_key, AES_KEY_SIZE);
     secure_zero(meta_key, AES_KEY_SIZE);
     fclose(in);
-    verbose_print(VERBOSE_BASIC, "Extraction completed: %s", archive);
+    if (ret == 0 && base.names.count > 0) {
+        char *base_archive = resolve_base_path(archive, base.path);
+        verbose_print(VERBOSE_BASIC, verify ? "Verifying %d unchanged files in base archive %s"
+                                            : "Extracting %d unchanged files from base archive %s",
+                      base.names.count, base_archive ? base_archive : base.path);
+        EntrySelection base_sel = { (const char **)base.names.paths, base.names.count, NULL, 0, NULL, 1 };
+        ret = !base_archive ||
+              extract_archive(base_archive, password, extract_dir, force, jobs, direct_io, use_uring, &base_sel,
+                              base.salt, depth + 1, verify) != 0;
+        free(base_archive);
+    }
+    file_list_free(&base.names);
+    free(base.path);
+    free(extract_dir);
+    if (ret != 0) return 1;
+    verbose_print(VERBOSE_BASIC, verify ? "Verification completed: %s" : "Extraction completed: %s",
+                  piped ? "standard input" : archive);
+    return 0;
+}
+
+/**
+ * @brief Extracts or verifies the requested entries and checks that every path and pattern selected one.
+ * @param archive Path to the input archive file (.slm), or "-" for standard input.
+ * @param password Password for decryption.
+ * @param outdir Output directory (NULL to use archive's outdir or current directory).
+ * @param force If 1, overwrite existing output files.
+ * @param jobs Number of entries read in parallel.
+ * @param sel Requested entries (found is allocated here).
+ * @param direct_io If 1, write output files with O_DIRECT.
+ * @param use_uring If 1, write output files through io_uring.
+ * @param verify Verify run, NULL to extract.
+ * @return 0 on success, 1 on failure.
+ */
+static int run_selection(const char *archive, const char *password, const char *outdir, int force, int jobs,
+                         EntrySelection *sel, int direct_io, int use_uring, VerifyRun *verify) {
+    int selectors = sel->path_count + sel->pattern_count;
+    sel->found = selectors > 0 ? calloc(selectors, sizeof(int)) : NULL;
+    if (selectors > 0 && !sel->found) {
+        fprintf(stderr, "Error: Memory allocation failed for path list\n");
+        return 1;
+    }
+    int ret = extract_archive(archive, password, outdir, force, jobs, direct_io, use_uring, sel, NULL, 0, verify);
+    for (int p = 0; p < selectors && ret == 0; p++) {
+        if (!sel->found[p]) {
+            if (p < sel->path_count) fprintf(stderr, "Error: %s not found in archive\n", sel->paths[p]);
+            else fprintf(stderr, "Error: No entries match include pattern %s\n", sel->patterns[p - sel->path_count]);
+            ret = 1;
+        }
+    }
+    free(sel->found);
+    return ret;
+}
+
+/**
+ * @brief Extracts and decrypts files from a .slm archive.
+ *
+ * Entries of an incremental archive that are unchanged since its base are
+ * extracted from the base archive, following the chain of bases.
+ *
+ * @param archive Path to the input archive file (.slm), or "-" to read the archive from standard input
+ *                (front to back; not for incremental, dedup or solid archives).
+ * @param password Password for decryption.
+ * @param outdir User-specified output directory (NULL to use archive's outdir or current directory).
+ * @param force If 1, overwrite existing output files.
+ * @param jobs Number of entries extracted in parallel (blocks decompressed in parallel for block-parallel archives).
+ * @param paths Entry paths to extract; a directory selects everything below it (none extracts everything).
+ * @param path_count Number of paths.
+ * @param include_patterns Glob patterns selecting entries by filename or full path (e.g., "*.conf").
+ * @param include_pattern_count Number of include patterns.
+ * @param direct_io If 1, write output files with O_DIRECT (aligned writes bypass the page cache).
+ * @param use_uring If 1, submit output writes through io_uring (HAVE_IO_URING builds).
+ * @return 0 on success, 1 on failure.
+ */
+int extract_files(const char *archive, const char *password, const char *outdir, int force, int jobs,
+                  const char **paths, int path_count, const char **include_patterns, int include_pattern_count,
+                  int direct_io, int use_uring) {
+    if (!archive || !password || jobs < 1 || (path_count > 0 && !paths) ||
+        (include_pattern_count > 0 && !include_patterns)) {
+        fprintf(stderr, "Error: Invalid extract parameters\n");
+        return 1;
+    }
+    EntrySelection sel = { paths, path_count, include_patterns, include_pattern_count, NULL, 0 };
+    return run_selection(archive, password, outdir, force, jobs, &sel, direct_io, use_uring, NULL);
+}
+
+/**
+ * @brief Verifies the integrity of a .slm archive without writing anything.
+ *
+ * The header HMAC, the comment, the index and the metadata and data GCM tags
+ * of every selected entry are checked, and the data is decompressed into a
+ * discard sink so corrupt compressed streams are found too. Entries are
+ * verified in parallel like an extraction, following incremental archives to
+ * their bases. Throughput is reported at the end.
+ *
+ * @param archive Path to the archive file (.slm), or "-" to read the archive from standard input.
+ * @param password Password for decryption.
+ * @param jobs Number of entries verified in parallel (blocks decompressed in parallel for block-parallel archives).
+ * @param paths Entry paths to verify; a directory selects everything below it (none verifies everything).
+ * @param path_count Number of paths.
+ * @param include_patterns Glob patterns selecting entries by filename or full path.
+ * @param include_pattern_count Number of include patterns.
+ * @param auth_only If 1, only authenticate the data and skip decompression.
+ * @return 0 if the archive verified, 1 otherwise.
+ */
+int verify_files(const char *archive, const char *password, int jobs, const char **paths, int path_count,
+                 const char **include_patterns, int include_pattern_count, int auth_only) {
+    if (!archive || !password || jobs < 1 || (path_count > 0 && !paths) ||
+        (include_pattern_count > 0 && !include_patterns)) {
+        fprintf(stderr, "Error: Invalid verify parameters\n");
+        return 1;
+    }
+    EntrySelection sel = { paths, path_count, include_patterns, include_pattern_count, NULL, 0 };
+    VerifyRun verify = { .auth_only = auth_only };
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    if (run_selection(archive, password, NULL, 0, jobs, &sel, 0, 0, &verify) != 0) {
+        fprintf(stderr, "Error: Verification of %s failed\n", strcmp(archive, "-") == 0 ? "standard input" : archive);
+        return 1;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    double seconds = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+    double mb = verify.bytes / (1024.0 * 1024.0);
+    printf("Verified %lu files (%.1f MB of file data%s) in %.2f s, %.1f MB/s\n", (unsigned long)verify.files, mb,
+           auth_only ? ", authenticated only" : "", seconds, seconds > 0 ? mb / seconds : 0.0);
     return 0;
 }
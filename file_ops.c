@@ -3,14 +3,18 @@
  * @brief File operation utilities for Seclume.
  */
 
+#define _DEFAULT_SOURCE /* d_type and DT_* in <dirent.h> */
+
 #include "seclume.h"
 #include <string.h>
 #include <stdlib.h>
 #include <dirent.h>
+#include <fcntl.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <unistd.h>
 #include <errno.h>
+#include <pthread.h>
 
 /**
  * @brief Creates parent directories for a given file path.
@@ -44,8 +48,9 @@ int create_parent_dirs(const char *filepath) {
             free(path);
             return 1;
         }
-        if (mkdir(path, 0755) != 0 && errno != EEXIST) {
-            fprintf(stderr, "Error: Cannot create directory %s: %s\n", path, strerror(errno));
+        /* Another extraction thread may create the same directory first; that is fine as long as it is one */
+        if (mkdir(path, 0755) != 0 && (errno != EEXIST || stat(path, &st) != 0 || !S_ISDIR(st.st_mode))) {
+            fprintf(stderr, "Error: Cannot create directory %s: %s\n", path, errno == EEXIST ? "exists but is not a directory" : strerror(errno));
             free(path);
             return 1;
         }
@@ -56,63 +61,384 @@ int create_parent_dirs(const char *filepath) {
 }
 
 /**
- * @brief Recursively collects regular files from a directory, excluding specified patterns.
+ * @brief Initializes an empty file list.
+ * @param list List to initialize.
+ */
+void file_list_init(FileList *list) {
+    list->paths = NULL;
+    list->count = 0;
+    list->cap = 0;
+    path_arena_init(&list->arena);
+}
+
+/**
+ * @brief Frees a file list and every path in it.
+ * @param list List to free.
+ */
+void file_list_free(FileList *list) {
+    free(list->paths);
+    path_arena_free(&list->arena);
+    file_list_init(list);
+}
+
+/**
+ * @brief Appends a copy of a path (stored in the list's arena) to a file list, doubling its capacity when full.
+ * @param list File list.
+ * @param path Path to add.
+ * @return 0 on success, 1 on failure.
+ */
+int file_list_add(FileList *list, const char *path) {
+    if (list->count == list->cap) {
+        if (list->cap >= MAX_FILES / 2 + 1) {
+            fprintf(stderr, "Error: Too many files (max %d)\n", MAX_FILES);
+            return 1;
+        }
+        int cap = list->cap ? list->cap * 2 : 256;
+        char **paths = realloc(list->paths, cap * sizeof(char *));
+        if (!paths) {
+            fprintf(stderr, "Error: Memory allocation failed for file list\n");
+            return 1;
+        }
+        list->paths = paths;
+        list->cap = cap;
+    }
+    list->paths[list->count] = path_arena_strdup(&list->arena, path);
+    if (!list->paths[list->count]) return 1;
+    list->count++;
+    return 0;
+}
+
+/**
+ * @brief Directories waiting to be read by one walker thread.
+ *
+ * The owner pushes and pops at the tail (depth first); idle threads steal
+ * from the head, which holds the shallowest and usually largest subtrees.
+ */
+typedef struct {
+    char **dirs;    /**< Queued directory paths (malloc'd) */
+    size_t head;    /**< First queued entry */
+    size_t tail;    /**< One past the last queued entry */
+    size_t cap;     /**< Allocated slots in dirs */
+} WalkDeque;
+
+/**
+ * @brief Shared state of a parallel directory walk.
+ */
+typedef struct {
+    WalkDeque *deques;            /**< One deque per thread */
+    int threads;                  /**< Number of walker threads */
+    const ExcludeSet *exclude;    /**< Compiled exclusion patterns */
+    size_t pending;               /**< Directories queued or being read */
+    size_t queued;                /**< Directories queued */
+    int abort;                    /**< Set when the walk failed */
+    pthread_mutex_t lock;         /**< Protects all fields above and the deques */
+    pthread_cond_t cond;          /**< Signals idle threads that work was queued or the walk ended */
+} Walker;
+
+/**
+ * @brief Per-thread state of a directory walk.
+ */
+typedef struct {
+    Walker *walker; /**< Shared walk state */
+    int id;         /**< Index of this thread's deque */
+    FileList files; /**< Files found by this thread */
+    char *path;     /**< Scratch buffer for child paths */
+    size_t path_cap; /**< Size of path */
+} WalkThread;
+
+/**
+ * @brief Queues a directory on a thread's deque.
+ * @param wt Walker thread.
+ * @param dir Directory path (ownership passes to the walker).
+ * @return 0 on success, 1 on failure.
+ */
+static int walk_push(WalkThread *wt, char *dir) {
+    Walker *w = wt->walker;
+    pthread_mutex_lock(&w->lock);
+    WalkDeque *dq = &w->deques[wt->id];
+    if (dq->tail == dq->cap) {
+        if (dq->head > 0) {
+            memmove(dq->dirs, dq->dirs + dq->head, (dq->tail - dq->head) * sizeof(char *));
+            dq->tail -= dq->head;
+            dq->head = 0;
+        } else {
+            size_t cap = dq->cap ? dq->cap * 2 : 64;
+            char **dirs = realloc(dq->dirs, cap * sizeof(char *));
+            if (!dirs) {
+                pthread_mutex_unlock(&w->lock);
+                fprintf(stderr, "Error: Memory allocation failed for directory queue\n");
+                free(dir);
+                return 1;
+            }
+            dq->dirs = dirs;
+            dq->cap = cap;
+        }
+    }
+    dq->dirs[dq->tail++] = dir;
+    w->pending++;
+    w->queued++;
+    pthread_cond_signal(&w->cond);
+    pthread_mutex_unlock(&w->lock);
+    return 0;
+}
+
+/**
+ * @brief Takes the next directory for a thread: its own newest, else the oldest of another thread.
+ * @param wt Walker thread.
+ * @return Directory path to read, or NULL once the walk is complete or aborted.
+ */
+static char *walk_take(WalkThread *wt) {
+    Walker *w = wt->walker;
+    pthread_mutex_lock(&w->lock);
+    for (;;) {
+        if (w->abort || w->pending == 0) {
+            pthread_mutex_unlock(&w->lock);
+            return NULL;
+        }
+        WalkDeque *own = &w->deques[wt->id];
+        char *dir = NULL;
+        if (own->tail > own->head) {
+            dir = own->dirs[--own->tail];
+        } else {
+            for (int k = 1; k < w->threads && !dir; k++) {
+                WalkDeque *victim = &w->deques[(wt->id + k) % w->threads];
+                if (victim->tail > victim->head) dir = victim->dirs[victim->head++];
+            }
+        }
+        if (dir) {
+            w->queued--;
+            pthread_mutex_unlock(&w->lock);
+            return dir;
+        }
+        pthread_cond_wait(&w->cond, &w->lock);
+    }
+}
+
+/**
+ * @brief Marks a directory as read and wakes idle threads if the walk is over.
+ * @param wt Walker thread.
+ * @param failed 1 if reading the directory failed.
+ */
+static void walk_done(WalkThread *wt, int failed) {
+    Walker *w = wt->walker;
+    pthread_mutex_lock(&w->lock);
+    w->pending--;
+    if (failed) w->abort = 1;
+    if (failed || w->pending == 0) pthread_cond_broadcast(&w->cond);
+    pthread_mutex_unlock(&w->lock);
+}
+
+/**
+ * @brief Checks a directory entry name against the exclusion patterns.
+ * @param w Walker.
+ * @param name Entry name.
+ * @param path Entry path (for messages).
+ * @param is_dir Set if the entry is a directory.
+ * @return 1 if the entry is excluded, 0 otherwise.
+ */
+static int walk_excluded(const Walker *w, const char *name, const char *path, int is_dir) {
+    int match = exclude_set_match(w->exclude, name, is_dir);
+    if (match < 0) return 0;
+    verbose_print(VERBOSE_BASIC, "Excluding %s (matches pattern %s)", path, w->exclude->patterns[match]);
+    return 1;
+}
+
+/**
+ * @brief Reads one directory, collecting its files and queueing its subdirectories.
+ *
+ * Entries are classified by d_type; fstatat() relative to the directory
+ * descriptor is only needed for symlinks and file systems that report
+ * DT_UNKNOWN. Excluded subdirectories are never opened.
+ *
+ * @param wt Walker thread.
+ * @param dir_path Directory path.
+ * @return 0 on success, 1 on failure.
+ */
+static int walk_directory(WalkThread *wt, const char *dir_path) {
+    int fd = open(dir_path, O_RDONLY | O_DIRECTORY);
+    DIR *dir = fd >= 0 ? fdopendir(fd) : NULL;
+    if (!dir) {
+        fprintf(stderr, "Error: Cannot open directory %s: %s\n", dir_path, strerror(errno));
+        if (fd >= 0) close(fd);
+        return 1;
+    }
+    size_t dir_len = strlen(dir_path);
+    struct dirent *entry;
+    while ((entry = readdir(dir))) {
+        if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0) {
+            continue;
+        }
+        size_t path_len = dir_len + 1 + strlen(entry->d_name);
+        if (path_len + 1 > wt->path_cap) {
+            size_t cap = (path_len + 1) * 2;
+            char *path = realloc(wt->path, cap);
+            if (!path) {
+                fprintf(stderr, "Error: Memory allocation failed for file path\n");
+                closedir(dir);
+                return 1;
+            }
+            wt->path = path;
+            wt->path_cap = cap;
+        }
+        memcpy(wt->path, dir_path, dir_len);
+        wt->path[dir_len] = '/';
+        strcpy(wt->path + dir_len + 1, entry->d_name);
+        int is_dir = entry->d_type == DT_DIR;
+        int is_reg = entry->d_type == DT_REG;
+        if (entry->d_type == DT_UNKNOWN || entry->d_type == DT_LNK) {
+            struct stat st;
+            if (fstatat(dirfd(dir), entry->d_name, &st, 0) != 0) {
+                fprintf(stderr, "Error: Cannot stat %s: %s\n", wt->path, strerror(errno));
+                closedir(dir);
+                return 1;
+            }
+            is_dir = S_ISDIR(st.st_mode);
+            is_reg = S_ISREG(st.st_mode);
+        }
+        if (!is_dir && !is_reg) {
+            fprintf(stderr, "Error: %s is not a regular file or directory\n", wt->path);
+            closedir(dir);
+            return 1;
+        }
+        if (walk_excluded(wt->walker, entry->d_name, wt->path, is_dir)) continue;
+        if (is_reg) {
+            if (file_list_add(&wt->files, wt->path) != 0) {
+                closedir(dir);
+                return 1;
+            }
+            verbose_print(VERBOSE_DEBUG, "Collected file: %s", wt->path);
+            continue;
+        }
+        char *sub = strdup(wt->path);
+        if (!sub) {
+            fprintf(stderr, "Error: Memory allocation failed for file path\n");
+            closedir(dir);
+            return 1;
+        }
+        if (walk_push(wt, sub) != 0) {
+            closedir(dir);
+            return 1;
+        }
+    }
+    closedir(dir);
+    return 0;
+}
+
+/**
+ * @brief Walker thread: reads directories until the walk is complete or aborted.
+ * @param arg WalkThread.
+ * @return NULL.
+ */
+static void *walk_thread(void *arg) {
+    WalkThread *wt = arg;
+    char *dir;
+    while ((dir = walk_take(wt))) {
+        StageTimer timer;
+        stage_begin(&timer);
+        int ret = walk_directory(wt, dir);
+        stage_end(&timer, STAGE_WALK, 0);
+        free(dir);
+        walk_done(wt, ret);
+    }
+    return NULL;
+}
+
+/**
+ * @brief Orders collected paths so the archive layout does not depend on thread scheduling.
+ * @param a First path.
+ * @param b Second path.
+ * @return strcmp() result.
+ */
+static int compare_paths(const void *a, const void *b) {
+    return strcmp(*(char * const *)a, *(char * const *)b);
+}
+
+/**
+ * @brief Collects regular files from a file or directory tree, excluding specified patterns.
+ *
+ * Directory trees are walked on up to jobs threads with work stealing. An
+ * exclusion pattern that matches a directory name prunes the whole subtree.
+ * Files found in a tree are appended in sorted path order.
+ *
  * @param path The directory or file path to process.
- * @param file_list Pointer to an array of file paths (allocated by caller).
- * @param file_count Pointer to the number of files in file_list.
- * @param max_files Maximum number of files allowed.
- * @param exclude_patterns Array of exclusion patterns (e.g., "*.log").
- * @param exclude_pattern_count Number of exclusion patterns.
+ * @param list File list to append to.
+ * @param exclude Compiled exclusion patterns (e.g., "*.log", "node_modules/").
+ * @param jobs Number of walker threads.
  * @return 0 on success, 1 on failure.
  */
-int collect_files(const char *path, char ***file_list, int *file_count, int max_files, const char **exclude_patterns, int exclude_pattern_count) {
+int collect_files(const char *path, FileList *list, const ExcludeSet *exclude, int jobs) {
     struct stat st;
     if (stat(path, &st) != 0) {
         fprintf(stderr, "Error: Cannot stat %s: %s\n", path, strerror(errno));
         return 1;
     }
     if (S_ISREG(st.st_mode)) {
-        if (*file_count >= max_files) {
-            fprintf(stderr, "Error: Too many files (max %d)\n", max_files);
-            return 1;
-        }
         const char *filename = strrchr(path, '/');
         filename = filename ? filename + 1 : path;
-        for (int i = 0; i < exclude_pattern_count; i++) {
-            if (matches_glob_pattern(filename, exclude_patterns[i])) {
-                verbose_print(VERBOSE_BASIC, "Excluding file: %s (matches pattern %s)", path, exclude_patterns[i]);
-                return 0;
-            }
-        }
-        (*file_list)[*file_count] = strdup(path);
-        if (!(*file_list)[*file_count]) {
-            fprintf(stderr, "Error: Memory allocation failed for file path\n");
-            return 1;
+        int match = exclude_set_match(exclude, filename, 0);
+        if (match >= 0) {
+            verbose_print(VERBOSE_BASIC, "Excluding file: %s (matches pattern %s)", path, exclude->patterns[match]);
+            return 0;
         }
-        (*file_count)++;
+        if (file_list_add(list, path) != 0) return 1;
         verbose_print(VERBOSE_DEBUG, "Collected file: %s", path);
         return 0;
-    } else if (S_ISDIR(st.st_mode)) {
-        DIR *dir = opendir(path);
-        if (!dir) {
-            fprintf(stderr, "Error: Cannot open directory %s: %s\n", path, strerror(errno));
-            return 1;
+    } else if (!S_ISDIR(st.st_mode)) {
+        fprintf(stderr, "Error: %s is not a regular file or directory\n", path);
+        return 1;
+    }
+    Walker w = { .threads = jobs, .exclude = exclude };
+    w.deques = calloc(jobs, sizeof(WalkDeque));
+    WalkThread *wts = calloc(jobs, sizeof(WalkThread));
+    pthread_t *threads = calloc(jobs, sizeof(pthread_t));
+    char *root = strdup(path);
+    if (!w.deques || !wts || !threads || !root) {
+        fprintf(stderr, "Error: Memory allocation failed for directory walker\n");
+        free(w.deques);
+        free(wts);
+        free(threads);
+        free(root);
+        return 1;
+    }
+    pthread_mutex_init(&w.lock, NULL);
+    pthread_cond_init(&w.cond, NULL);
+    for (int t = 0; t < jobs; t++) {
+        wts[t].walker = &w;
+        wts[t].id = t;
+        file_list_init(&wts[t].files);
+    }
+    int ret = walk_push(&wts[0], root);
+    int started = 0;
+    for (; ret == 0 && started < jobs - 1; started++) {
+        if (pthread_create(&threads[started], NULL, walk_thread, &wts[started + 1]) != 0) {
+            fprintf(stderr, "Error: Failed to start directory walker thread\n");
+            pthread_mutex_lock(&w.lock);
+            w.abort = 1;
+            pthread_cond_broadcast(&w.cond);
+            pthread_mutex_unlock(&w.lock);
+            break;
         }
-        struct dirent *entry;
-        char subpath[1024];
-        while ((entry = readdir(dir))) {
-            if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0) {
-                continue;
-            }
-            snprintf(subpath, sizeof(subpath), "%s/%s", path, entry->d_name);
-            if (collect_files(subpath, file_list, file_count, max_files, exclude_patterns, exclude_pattern_count) != 0) {
-                closedir(dir);
-                return 1;
-            }
+    }
+    if (ret == 0) walk_thread(&wts[0]);
+    for (int t = 0; t < started; t++) pthread_join(threads[t], NULL);
+    if (w.abort) ret = 1;
+    int first = list->count;
+    for (int t = 0; t < jobs; t++) {
+        for (int i = 0; ret == 0 && i < wts[t].files.count; i++) {
+            if (file_list_add(list, wts[t].files.paths[i]) != 0) ret = 1;
         }
-        closedir(dir);
-        return 0;
+        file_list_free(&wts[t].files);
+        free(wts[t].path);
+        WalkDeque *dq = &w.deques[t];
+        for (size_t i = dq->head; i < dq->tail; i++) free(dq->dirs[i]);
+        free(dq->dirs);
     }
-    fprintf(stderr, "Error: %s is not a regular file or directory\n", path);
-    return 1;
-}
\ No newline at end of file
+    if (ret == 0) qsort(list->paths + first, list->count - first, sizeof(char *), compare_paths);
+    pthread_cond_destroy(&w.cond);
+    pthread_mutex_destroy(&w.lock);
+    free(w.deques);
+    free(wts);
+    free(threads);
+    if (ret == 0) verbose_print(VERBOSE_DEBUG, "Walked %s on %d threads (%d files)", path, jobs, list->count - first);
+    return ret;
+}
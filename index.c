@@ -0,0 +1,448 @@
+/**
+ * @file index.c
+ * @brief Encrypted central index (table of contents) of a Seclume archive.
+ */
+
+#include "seclume.h"
+#include <string.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <errno.h>
+#include <unistd.h>
+#include <openssl/rand.h>
+
+/**
+ * @brief Initializes an empty central index.
+ * @param index Index to initialize.
+ */
+void archive_index_init(ArchiveIndex *index) {
+    memset(index, 0, sizeof(*index));
+    index->record_size = sizeof(IndexRecord);
+    index->known_flags = INDEX_FLAG_IN_BASE | INDEX_FLAG_SOLID | INDEX_FLAG_SPARSE | INDEX_CODEC_MASK;
+}
+
+/**
+ * @brief Wipes and frees a central index.
+ * @param index Index to free.
+ */
+void archive_index_free(ArchiveIndex *index) {
+    if (index->data) secure_zero(index->data, index->cap);
+    free(index->data);
+    free(index->base_path);
+    free(index->lookup);
+    archive_index_init(index);
+}
+
+/**
+ * @brief Reserves space for len more bytes in the index buffer.
+ * @param index Central index.
+ * @param len Number of bytes needed.
+ * @return 0 on success, 1 on failure.
+ */
+static int archive_index_reserve(ArchiveIndex *index, size_t len) {
+    if (index->len + len <= index->cap) return 0;
+    size_t cap = index->cap ? index->cap : 4096;
+    while (cap < index->len + len) cap *= 2;
+    if (cap > MAX_INDEX_SIZE) {
+        fprintf(stderr, "Error: Archive index too large\n");
+        return 1;
+    }
+    uint8_t *data = malloc(cap);
+    if (!data) {
+        fprintf(stderr, "Error: Memory allocation failed for archive index\n");
+        return 1;
+    }
+    if (index->data) {
+        memcpy(data, index->data, index->len);
+        secure_zero(index->data, index->cap);
+        free(index->data);
+    }
+    index->data = data;
+    index->cap = cap;
+    return 0;
+}
+
+/**
+ * @brief Records the base archive of an incremental archive. Must be called before any record is added.
+ * @param index Central index.
+ * @param salt Salt of the base archive.
+ * @param path Base archive path to store.
+ * @return 0 on success, 1 on failure.
+ */
+int archive_index_set_base(ArchiveIndex *index, const uint8_t *salt, const char *path) {
+    size_t path_len = strlen(path);
+    if (index->len != 0 || path_len == 0 || path_len >= MAX_BASE_PATH) {
+        fprintf(stderr, "Error: Invalid base archive path: %s\n", path);
+        return 1;
+    }
+    index->base_path = strdup(path);
+    if (!index->base_path || archive_index_reserve(index, sizeof(IndexBase) + path_len) != 0) {
+        fprintf(stderr, "Error: Memory allocation failed for archive index\n");
+        return 1;
+    }
+    IndexBase base = { .path_len = path_len };
+    memcpy(base.salt, salt, SALT_SIZE);
+    memcpy(index->data, &base, sizeof(base));
+    memcpy(index->data + sizeof(base), path, path_len);
+    index->len = index->records_start = sizeof(base) + path_len;
+    memcpy(index->base_salt, salt, SALT_SIZE);
+    index->has_base = 1;
+    return 0;
+}
+
+/**
+ * @brief Stores the compression dictionary of the archive. Must be called after any
+ *        archive_index_set_base() and before any record is added.
+ * @param index Central index.
+ * @param dict Dictionary.
+ * @param dict_len Length of the dictionary (1 to DICT_MAX_SIZE).
+ * @return 0 on success, 1 on failure.
+ */
+int archive_index_set_dict(ArchiveIndex *index, const uint8_t *dict, size_t dict_len) {
+    if (index->len != index->records_start || dict_len == 0 || dict_len > DICT_MAX_SIZE) {
+        fprintf(stderr, "Error: Invalid compression dictionary\n");
+        return 1;
+    }
+    if (archive_index_reserve(index, sizeof(IndexDict) + dict_len) != 0) return 1;
+    IndexDict hdr = { .dict_len = (uint32_t)dict_len };
+    memcpy(index->data + index->len, &hdr, sizeof(hdr));
+    memcpy(index->data + index->len + sizeof(hdr), dict, dict_len);
+    index->dict_offset = index->len + sizeof(hdr);
+    index->dict_len = dict_len;
+    index->len = index->records_start = index->dict_offset + dict_len;
+    return 0;
+}
+
+/**
+ * @brief Appends the record of one archived file to the central index.
+ * @param index Central index.
+ * @param entry_offset Archive offset of the file's FileEntry (0 if it is stored in the base archive).
+ * @param plain File metadata.
+ * @param mtime Modification time of the input file.
+ * @param hash SHA-256 of the file contents.
+ * @param flags INDEX_FLAG_* bits (the codec bits and INDEX_FLAG_SPARSE are taken from plain->codec).
+ * @param solid_offset Offset of the file's data in its solid block (INDEX_FLAG_SOLID records, 0 otherwise).
+ * @return 0 on success, 1 on failure.
+ */
+int archive_index_add(ArchiveIndex *index, uint64_t entry_offset, const FileEntryPlain *plain, int64_t mtime,
+                      const uint8_t *hash, uint16_t flags, uint64_t solid_offset) {
+    size_t name_len = strnlen(plain->filename, MAX_FILENAME);
+    if (plain->codec & ENTRY_CODEC_SPARSE) flags |= INDEX_FLAG_SPARSE;
+    if (name_len >= MAX_FILENAME || archive_index_reserve(index, sizeof(IndexRecord) + name_len) != 0) return 1;
+    IndexRecord rec = { .entry_offset = entry_offset, .compressed_size = plain->compressed_size,
+                        .original_size = plain->original_size, .mode = plain->mode, .name_len = name_len,
+                        .flags = flags | (((plain->codec & ENTRY_CODEC_MASK) << INDEX_CODEC_SHIFT) & INDEX_CODEC_MASK), .mtime = mtime, .solid_offset = solid_offset };
+    memcpy(rec.hash, hash, HASH_SIZE);
+    memcpy(index->data + index->len, &rec, sizeof(rec));
+    memcpy(index->data + index->len + sizeof(rec), plain->filename, name_len);
+    index->len += sizeof(rec) + name_len;
+    index->count++;
+    return 0;
+}
+
+/**
+ * @brief Decodes the record at *pos and advances *pos past it.
+ * @param index Central index.
+ * @param pos Read position, 0 for the first record.
+ * @param entry Output record.
+ * @return 1 if a record was decoded, 0 at the end of the index, -1 if the record is invalid or unsafe.
+ */
+int archive_index_next(const ArchiveIndex *index, size_t *pos, IndexEntry *entry) {
+    if (*pos < index->records_start) *pos = index->records_start;
+    if (*pos == index->len) return 0;
+    IndexRecord rec;
+    size_t rec_size = index->record_size;
+    memset(&rec, 0, sizeof(rec));
+    if (index->len - *pos < rec_size) return -1;
+    memcpy(&rec, index->data + *pos, rec_size);
+    if (rec.name_len == 0 || rec.name_len >= MAX_FILENAME || index->len - *pos - rec_size < rec.name_len) return -1;
+    memset(entry, 0, sizeof(*entry));
+    memcpy(entry->plain.filename, index->data + *pos + rec_size, rec.name_len);
+    entry->entry_offset = rec.entry_offset;
+    entry->plain.compressed_size = rec.compressed_size;
+    entry->plain.original_size = rec.original_size;
+    entry->plain.mode = rec.mode;
+    entry->flags = rec.flags & ~INDEX_CODEC_MASK;
+    entry->plain.codec = (rec.flags & INDEX_CODEC_MASK) >> INDEX_CODEC_SHIFT;
+    if (rec.flags & INDEX_FLAG_SPARSE) entry->plain.codec |= ENTRY_CODEC_SPARSE;
+    entry->mtime = rec.mtime;
+    memcpy(entry->hash, rec.hash, HASH_SIZE);
+    entry->solid_offset = rec.solid_offset;
+    *pos += rec_size + rec.name_len;
+    if (strlen(entry->plain.filename) != rec.name_len || has_path_traversal(entry->plain.filename) ||
+        (rec.compressed_size > 0 && rec.original_size == 0) || rec.original_size > ENTRY_MAX_SIZE(entry->plain.codec) ||
+        (rec.flags & ~index->known_flags) || (entry->plain.codec & ENTRY_CODEC_MASK) > COMPRESSION_STORE || ((rec.flags & INDEX_FLAG_IN_BASE) && !index->has_base) ||
+        ((rec.flags & INDEX_FLAG_SOLID) && (rec_size < sizeof(IndexRecord) || (rec.flags & (INDEX_FLAG_IN_BASE | INDEX_FLAG_SPARSE)) ||
+                                             rec.solid_offset > UINT64_MAX - rec.original_size))) {
+        return -1;
+    }
+    return 1;
+}
+
+/**
+ * @brief Hashes a filename for the lookup table (FNV-1a).
+ * @param filename Filename.
+ * @return Hash value.
+ */
+static size_t filename_hash(const char *filename) {
+    uint64_t h = 14695981039346656037ULL;
+    for (const unsigned char *p = (const unsigned char *)filename; *p; p++) {
+        h ^= *p;
+        h *= 1099511628211ULL;
+    }
+    return (size_t)h;
+}
+
+/**
+ * @brief Builds the filename lookup table of a validated index.
+ * @param index Central index.
+ * @return 0 on success, 1 on failure.
+ */
+int archive_index_build_lookup(ArchiveIndex *index) {
+    size_t slots = 16;
+    while (slots < (size_t)index->count * 2) slots *= 2;
+    index->lookup = calloc(slots, sizeof(size_t));
+    if (!index->lookup) {
+        fprintf(stderr, "Error: Memory allocation failed for archive index lookup\n");
+        return 1;
+    }
+    index->lookup_mask = slots - 1;
+    size_t pos = index->records_start;
+    IndexEntry entry;
+    for (;;) {
+        size_t start = pos;
+        if (archive_index_next(index, &pos, &entry) != 1) break;
+        size_t slot = filename_hash(entry.plain.filename) & index->lookup_mask;
+        while (index->lookup[slot]) slot = (slot + 1) & index->lookup_mask;
+        index->lookup[slot] = start + 1;
+    }
+    return 0;
+}
+
+/**
+ * @brief Finds the record of a filename through the lookup table.
+ * @param index Central index with a built lookup table.
+ * @param filename Filename to find.
+ * @param entry Output record.
+ * @return 1 if found, 0 otherwise.
+ */
+int archive_index_find(const ArchiveIndex *index, const char *filename, IndexEntry *entry) {
+    size_t slot = filename_hash(filename) & index->lookup_mask;
+    while (index->lookup[slot]) {
+        size_t pos = index->lookup[slot] - 1;
+        if (archive_index_next(index, &pos, entry) == 1 && strcmp(entry->plain.filename, filename) == 0) return 1;
+        slot = (slot + 1) & index->lookup_mask;
+    }
+    return 0;
+}
+
+/**
+ * @brief Encrypts the central index and appends it and the trailer to the archive.
+ * @param out Archive file, positioned after the last file entry.
+ * @param index_offset Archive offset of the index, or -1 to take it from the file position
+ *                     (streamed archives count their bytes instead).
+ * @param index Central index.
+ * @param meta_gk Metadata key cipher context.
+ * @param sync If 1, everything written so far is synced to disk before the trailer, and the trailer after it,
+ *             so a valid trailer only ever points at data on disk (the commit point of an append).
+ * @return 0 on success, 1 on failure.
+ */
+int write_archive_index(FILE *out, long index_offset, const ArchiveIndex *index, GcmKey *meta_gk, int sync) {
+    if (index_offset == -1) index_offset = ftell(out);
+    if (index_offset == -1) {
+        fprintf(stderr, "Error: Failed to get archive position for index: %s\n", strerror(errno));
+        return 1;
+    }
+    uint8_t base_nonce[AES_NONCE_SIZE];
+    if (RAND_bytes(base_nonce, AES_NONCE_SIZE) != 1) {
+        fprintf(stderr, "Error: Random number generation failed for index nonce\n");
+        return 1;
+    }
+    uint8_t *rec = malloc(CHUNK_SIZE + CHUNK_OVERHEAD);
+    if (!rec) {
+        fprintf(stderr, "Error: Memory allocation failed for archive index\n");
+        return 1;
+    }
+    if (fwrite(base_nonce, AES_NONCE_SIZE, 1, out) != 1) {
+        fprintf(stderr, "Error: Failed to write archive index\n");
+        free(rec);
+        return 1;
+    }
+    ChunkCipher cc;
+    chunk_cipher_init(&cc, meta_gk, base_nonce);
+    uint64_t index_size = AES_NONCE_SIZE;
+    size_t pos = 0;
+    do {
+        size_t len = index->len - pos < CHUNK_SIZE ? index->len - pos : CHUNK_SIZE;
+        size_t rec_len;
+        if (chunk_encrypt(&cc, index->data + pos, len, pos + len == index->len, rec, &rec_len) != 0 ||
+            fwrite(rec, 1, rec_len, out) != rec_len) {
+            fprintf(stderr, "Error: Failed to write archive index\n");
+            free(rec);
+            return 1;
+        }
+        pos += len;
+        index_size += rec_len;
+    } while (pos < index->len);
+    free(rec);
+    ArchiveTrailer trailer = { .index_offset = index_offset, .index_size = index_size,
+                               .entry_count = index->count, .magic = TRAILER_MAGIC };
+    if ((sync && (fflush(out) != 0 || fsync(fileno(out)) != 0)) || fwrite(&trailer, sizeof(trailer), 1, out) != 1 ||
+        (sync && (fflush(out) != 0 || fsync(fileno(out)) != 0))) {
+        fprintf(stderr, "Error: Failed to write archive trailer: %s\n", strerror(errno));
+        return 1;
+    }
+    verbose_print(VERBOSE_DEBUG, "Wrote archive index (%u entries, %lu bytes)", index->count, (unsigned long)index_size);
+    return 0;
+}
+
+/**
+ * @brief Reads and checks the trailer at the end of a version 9+ archive.
+ *
+ * The trailer commits an append: before version 17 it counts exactly the
+ * files of the header, and from then on at least as many, the header keeping
+ * the count the archive was created with.
+ *
+ * @param in Archive file.
+ * @param header Verified archive header.
+ * @param trailer Output trailer.
+ * @return 0 on success, 1 on failure.
+ */
+int read_archive_trailer(FILE *in, const ArchiveHeader *header, ArchiveTrailer *trailer) {
+    struct stat st;
+    if (fstat(fileno(in), &st) != 0 || (uint64_t)st.st_size < sizeof(ArchiveHeader) + sizeof(ArchiveTrailer)) {
+        fprintf(stderr, "Error: Archive too short for index trailer\n");
+        return 1;
+    }
+    if (fseek(in, st.st_size - (long)sizeof(*trailer), SEEK_SET) != 0 || fread(trailer, sizeof(*trailer), 1, in) != 1) {
+        fprintf(stderr, "Error: Failed to read archive trailer\n");
+        return 1;
+    }
+    int count_ok = header->version >= ARCHIVE_VERSION_APPEND
+                       ? trailer->entry_count >= header->file_count && trailer->entry_count <= MAX_FILES
+                       : trailer->entry_count == header->file_count;
+    if (strncmp(trailer->magic, TRAILER_MAGIC, sizeof(trailer->magic)) != 0 || !count_ok ||
+        trailer->index_offset < sizeof(ArchiveHeader) || trailer->index_size < AES_NONCE_SIZE + CHUNK_OVERHEAD ||
+        trailer->index_size > MAX_INDEX_SIZE ||
+        trailer->index_offset + trailer->index_size + sizeof(*trailer) != (uint64_t)st.st_size) {
+        fprintf(stderr, "Error: Invalid archive trailer\n");
+        return 1;
+    }
+    return 0;
+}
+
+/**
+ * @brief Reads and decrypts the central index of a version 9+ archive.
+ *
+ * Only the trailer and the index payload are read. The file position is left
+ * undefined; callers seek to the entries they need.
+ *
+ * @param in Archive file.
+ * @param header Verified archive header.
+ * @param meta_gk Metadata key cipher context.
+ * @param index Output index (initialized by this function, freed by the caller).
+ * @return 0 on success, 1 on failure.
+ */
+int read_archive_index(FILE *in, const ArchiveHeader *header, GcmKey *meta_gk, ArchiveIndex *index) {
+    archive_index_init(index);
+    if (header->version < ARCHIVE_VERSION_INCREMENTAL) index->record_size = INDEX_RECORD_V9_SIZE;
+    else if (header->version < ARCHIVE_VERSION_SOLID) index->record_size = INDEX_RECORD_V10_SIZE;
+    if (header->version < ARCHIVE_VERSION_CODECS) index->known_flags = INDEX_FLAG_IN_BASE | INDEX_FLAG_SOLID;
+    else if (header->version < ARCHIVE_VERSION_SPARSE) index->known_flags &= ~INDEX_FLAG_SPARSE;
+    ArchiveTrailer trailer;
+    if (read_archive_trailer(in, header, &trailer) != 0) return 1;
+    uint8_t base_nonce[AES_NONCE_SIZE];
+    if (fseek(in, trailer.index_offset, SEEK_SET) != 0 || fread(base_nonce, AES_NONCE_SIZE, 1, in) != 1) {
+        fprintf(stderr, "Error: Failed to read archive index\n");
+        return 1;
+    }
+    uint8_t *rec = malloc(CHUNK_SIZE + AES_TAG_SIZE);
+    if (!rec) {
+        fprintf(stderr, "Error: Memory allocation failed for archive index\n");
+        return 1;
+    }
+    ChunkCipher cc;
+    chunk_cipher_init(&cc, meta_gk, base_nonce);
+    uint64_t remaining = trailer.index_size - AES_NONCE_SIZE;
+    while (!cc.finished) {
+        uint32_t chunk_header;
+        if (remaining < CHUNK_OVERHEAD || fread(&chunk_header, sizeof(chunk_header), 1, in) != 1) {
+            fprintf(stderr, "Error: Truncated archive index\n");
+            free(rec);
+            archive_index_free(index);
+            return 1;
+        }
+        size_t len = chunk_header & ~CHUNK_FINAL;
+        if (len > CHUNK_SIZE || len + CHUNK_OVERHEAD > remaining || archive_index_reserve(index, len) != 0 ||
+            fread(rec, 1, len + AES_TAG_SIZE, in) != len + AES_TAG_SIZE) {
+            fprintf(stderr, "Error: Invalid archive index\n");
+            free(rec);
+            archive_index_free(index);
+            return 1;
+        }
+        remaining -= len + CHUNK_OVERHEAD;
+        if (chunk_decrypt(&cc, chunk_header, rec, rec + len, index->data + index->len) != 0) {
+            fprintf(stderr, "Error: Failed to decrypt archive index (wrong password or corrupted data?)\n");
+            free(rec);
+            archive_index_free(index);
+            return 1;
+        }
+        index->len += len;
+    }
+    free(rec);
+    if (remaining != 0) {
+        fprintf(stderr, "Error: Unexpected data after archive index\n");
+        archive_index_free(index);
+        return 1;
+    }
+    if (header->version >= ARCHIVE_VERSION_INCREMENTAL && (header->reserved[0] & ARCHIVE_FLAG_INCREMENTAL)) {
+        IndexBase base;
+        if (index->len < sizeof(base)) {
+            fprintf(stderr, "Error: Invalid base archive reference in archive index\n");
+            archive_index_free(index);
+            return 1;
+        }
+        memcpy(&base, index->data, sizeof(base));
+        if (base.path_len == 0 || base.path_len >= MAX_BASE_PATH || index->len - sizeof(base) < base.path_len ||
+            memchr(index->data + sizeof(base), '\0', base.path_len) || !(index->base_path = malloc(base.path_len + 1))) {
+            fprintf(stderr, "Error: Invalid base archive reference in archive index\n");
+            archive_index_free(index);
+            return 1;
+        }
+        memcpy(index->base_path, index->data + sizeof(base), base.path_len);
+        index->base_path[base.path_len] = '\0';
+        memcpy(index->base_salt, base.salt, SALT_SIZE);
+        index->records_start = sizeof(base) + base.path_len;
+        index->has_base = 1;
+    }
+    if (header->version >= ARCHIVE_VERSION_DICT && (header->reserved[0] & ARCHIVE_FLAG_DICT)) {
+        IndexDict hdr;
+        if (index->len - index->records_start < sizeof(hdr)) {
+            fprintf(stderr, "Error: Invalid compression dictionary in archive index\n");
+            archive_index_free(index);
+            return 1;
+        }
+        memcpy(&hdr, index->data + index->records_start, sizeof(hdr));
+        if (hdr.dict_len == 0 || hdr.dict_len > DICT_MAX_SIZE ||
+            index->len - index->records_start - sizeof(hdr) < hdr.dict_len) {
+            fprintf(stderr, "Error: Invalid compression dictionary in archive index\n");
+            archive_index_free(index);
+            return 1;
+        }
+        index->dict_offset = index->records_start + sizeof(hdr);
+        index->dict_len = hdr.dict_len;
+        index->records_start = index->dict_offset + hdr.dict_len;
+    }
+    size_t pos = 0;
+    IndexEntry entry;
+    int r;
+    while ((r = archive_index_next(index, &pos, &entry)) == 1) index->count++;
+    secure_zero(&entry, sizeof(entry));
+    if (r < 0 || index->count != trailer.entry_count) {
+        fprintf(stderr, "Error: Invalid or unsafe record in archive index\n");
+        archive_index_free(index);
+        return 1;
+    }
+    verbose_print(VERBOSE_DEBUG, "Read archive index (%u entries)", index->count);
+    return 0;
+}
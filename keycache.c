@@ -0,0 +1,259 @@
+/**
+ * @file keycache.c
+ * @brief Key caches: derived archive keys reused within a process and, with -kc,
+ *        kept in the kernel keyring for a limited time.
+ *
+ * Every process remembers the verified keys of the archives it opened in a
+ * small locked table, so a run or batch that opens an archive again (-vc,
+ * incremental bases shared by batch jobs) derives its keys once.
+ *
+ * With -kc, keys are also stored as a "user" key in the session keyring (or
+ * the user's session keyring when the process has none) named after the
+ * archive salt and format version. Keyring payloads live in kernel memory,
+ * which is never swapped out, and can only be read by processes that possess
+ * the keyring; the kernel drops the entry when its timeout expires.
+ *
+ * Keys are cached only after the archive header HMAC verified them. The
+ * process table also holds an HMAC of the password under the metadata key, so
+ * a job given another password derives its keys as usual. Keyring entries
+ * hold the two keys and nothing derived from the password, which would let
+ * anyone reading them test password guesses far faster than PBKDF2: they are
+ * found by salt alone, and the header HMAC the caller checks verifies them.
+ */
+
+#define _DEFAULT_SOURCE /* syscall() in <unistd.h> */
+#include "seclume.h"
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <sys/mman.h>
+#include <pthread.h>
+#if defined(SYS_add_key) && defined(SYS_keyctl)
+#include <linux/keyctl.h>
+#define HAVE_KEYRING
+#endif
+
+/** @brief Number of archives whose keys a process remembers */
+#define KEY_MEMO_SLOTS 16
+
+/** @brief Lifetime in seconds of keys cached in the keyring (-kc); 0 disables the keyring cache */
+unsigned int key_cache_ttl = 0;
+
+/**
+ * @brief Payload of a key cache entry.
+ */
+typedef struct {
+    uint8_t file_key[AES_KEY_SIZE]; /**< File encryption key */
+    uint8_t meta_key[AES_KEY_SIZE]; /**< Metadata encryption key */
+} KeyCacheEntry;
+
+/**
+ * @brief Keys of one archive remembered by the process.
+ */
+typedef struct {
+    int used;                 /**< Set when the slot holds keys */
+    uint8_t version;          /**< Archive format version */
+    uint8_t salt[SALT_SIZE];  /**< Salt from the archive header */
+    KeyCacheEntry entry;      /**< Keys */
+    uint8_t check[HMAC_SIZE]; /**< HMAC-SHA256 of the password under entry.meta_key */
+} KeyMemoSlot;
+
+/** @brief Keys remembered by the process, locked into memory on first use */
+static KeyMemoSlot key_memo[KEY_MEMO_SLOTS];
+/** @brief Slot the next new archive replaces */
+static int key_memo_next = 0;
+/** @brief Set once key_memo was locked (or locking failed) */
+static int key_memo_locked = 0;
+/** @brief Protects key_memo */
+static pthread_mutex_t key_memo_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/**
+ * @brief Computes the password check of a cache entry.
+ * @param meta_key Metadata encryption key.
+ * @param password Password string.
+ * @param check Output check value (HMAC_SIZE bytes).
+ * @return 0 on success, 1 on failure.
+ */
+static int key_cache_check(const uint8_t *meta_key, const char *password, uint8_t *check) {
+    return compute_hmac(meta_key, (const uint8_t *)password, strlen(password), check);
+}
+
+/**
+ * @brief Copies the keys of a cache entry.
+ * @param entry Cache entry.
+ * @param file_key Output file encryption key (AES_KEY_SIZE bytes).
+ * @param meta_key Output metadata encryption key (AES_KEY_SIZE bytes).
+ */
+static void key_cache_take(const KeyCacheEntry *entry, uint8_t *file_key, uint8_t *meta_key) {
+    memcpy(file_key, entry->file_key, AES_KEY_SIZE);
+    memcpy(meta_key, entry->meta_key, AES_KEY_SIZE);
+}
+
+#ifdef HAVE_KEYRING
+/**
+ * @brief Builds the keyring description of an archive's cache entry.
+ * @param salt Salt from the archive header.
+ * @param version Archive format version.
+ * @param desc Output description (at least 16 + 2 * SALT_SIZE bytes).
+ */
+static void key_cache_name(const uint8_t *salt, uint8_t version, char *desc) {
+    int len = sprintf(desc, "seclume:v%u:", version);
+    for (int i = 0; i < SALT_SIZE; i++) len += sprintf(desc + len, "%02x", salt[i]);
+}
+#endif
+
+/**
+ * @brief Looks up the keys of an archive remembered by the process.
+ * @param password Password string.
+ * @param salt Salt from the archive header.
+ * @param version Archive format version.
+ * @param file_key Output file encryption key (AES_KEY_SIZE bytes).
+ * @param meta_key Output metadata encryption key (AES_KEY_SIZE bytes).
+ * @return 1 if the keys were found for this password, 0 otherwise.
+ */
+static int key_memo_lookup(const char *password, const uint8_t *salt, uint8_t version, uint8_t *file_key, uint8_t *meta_key) {
+    int found = 0;
+    pthread_mutex_lock(&key_memo_lock);
+    for (int i = 0; i < KEY_MEMO_SLOTS && !found; i++) {
+        const KeyMemoSlot *slot = &key_memo[i];
+        if (!slot->used || slot->version != version || memcmp(slot->salt, salt, SALT_SIZE) != 0) continue;
+        uint8_t check[HMAC_SIZE];
+        found = key_cache_check(slot->entry.meta_key, password, check) == 0 && memcmp(check, slot->check, HMAC_SIZE) == 0;
+        secure_zero(check, sizeof(check));
+        if (found) key_cache_take(&slot->entry, file_key, meta_key);
+    }
+    pthread_mutex_unlock(&key_memo_lock);
+    return found;
+}
+
+/**
+ * @brief Remembers the keys of an archive in the process, replacing the oldest archive when full.
+ * @param salt Salt from the archive header.
+ * @param version Archive format version.
+ * @param entry Keys.
+ * @param check HMAC of the password under the metadata key (HMAC_SIZE bytes).
+ */
+static void key_memo_store(const uint8_t *salt, uint8_t version, const KeyCacheEntry *entry, const uint8_t *check) {
+    pthread_mutex_lock(&key_memo_lock);
+    if (!key_memo_locked) {
+        if (mlock(key_memo, sizeof(key_memo)) != 0)
+            verbose_print(VERBOSE_DEBUG, "Cannot lock the key cache into memory: %s", strerror(errno));
+        key_memo_locked = 1;
+    }
+    KeyMemoSlot *slot = NULL;
+    for (int i = 0; i < KEY_MEMO_SLOTS && !slot; i++) {
+        if (key_memo[i].used && key_memo[i].version == version && memcmp(key_memo[i].salt, salt, SALT_SIZE) == 0)
+            slot = &key_memo[i];
+    }
+    if (!slot) {
+        slot = &key_memo[key_memo_next];
+        key_memo_next = (key_memo_next + 1) % KEY_MEMO_SLOTS;
+    }
+    slot->used = 1;
+    slot->version = version;
+    memcpy(slot->salt, salt, SALT_SIZE);
+    slot->entry = *entry;
+    memcpy(slot->check, check, HMAC_SIZE);
+    pthread_mutex_unlock(&key_memo_lock);
+}
+
+/**
+ * @brief Looks up the cached keys of an archive, in the process first and then in the keyring (-kc).
+ *
+ * Keys from the process table belong to the password; keys from the keyring
+ * belong to the salt, and the caller must verify them against the archive
+ * header HMAC.
+ *
+ * @param password Password string.
+ * @param salt Salt from the archive header.
+ * @param version Archive format version.
+ * @param file_key Output file encryption key (AES_KEY_SIZE bytes).
+ * @param meta_key Output metadata encryption key (AES_KEY_SIZE bytes).
+ * @return 1 if keys were found, 0 otherwise.
+ */
+int key_cache_lookup(const char *password, const uint8_t *salt, uint8_t version, uint8_t *file_key, uint8_t *meta_key) {
+    if (key_memo_lookup(password, salt, version, file_key, meta_key)) {
+        verbose_print(VERBOSE_DEBUG, "Reusing keys derived earlier in this run");
+        return 1;
+    }
+#ifdef HAVE_KEYRING
+    if (key_cache_ttl == 0) return 0;
+    char desc[16 + 2 * SALT_SIZE];
+    key_cache_name(salt, version, desc);
+    long id = syscall(SYS_keyctl, KEYCTL_SEARCH, KEY_SPEC_SESSION_KEYRING, "user", desc, 0);
+    if (id < 0) {
+        verbose_print(VERBOSE_DEBUG, "No cached keys for %s", desc);
+        return 0;
+    }
+    KeyCacheEntry entry;
+    int found = syscall(SYS_keyctl, KEYCTL_READ, id, &entry, sizeof(entry)) == (long)sizeof(entry);
+    if (found) key_cache_take(&entry, file_key, meta_key);
+    secure_zero(&entry, sizeof(entry));
+    if (found) {
+        verbose_print(VERBOSE_DEBUG, "Using cached keys from %s", desc);
+    } else {
+        verbose_print(VERBOSE_DEBUG, "Cached keys in %s have an unknown layout, deriving them", desc);
+    }
+    return found;
+#else
+    return 0;
+#endif
+}
+
+/**
+ * @brief Caches the verified keys of an archive in the process and, with -kc, for key_cache_ttl seconds in the keyring.
+ *
+ * Call only with keys the archive header HMAC has verified. Failures only
+ * disable caching; the keys are still used.
+ *
+ * @param password Password string.
+ * @param salt Salt from the archive header.
+ * @param version Archive format version.
+ * @param file_key File encryption key (AES_KEY_SIZE bytes).
+ * @param meta_key Metadata encryption key (AES_KEY_SIZE bytes).
+ */
+void key_cache_store(const char *password, const uint8_t *salt, uint8_t version, const uint8_t *file_key, const uint8_t *meta_key) {
+    KeyCacheEntry entry;
+    uint8_t check[HMAC_SIZE];
+    if (key_cache_check(meta_key, password, check) != 0) return;
+    memcpy(entry.file_key, file_key, AES_KEY_SIZE);
+    memcpy(entry.meta_key, meta_key, AES_KEY_SIZE);
+    key_memo_store(salt, version, &entry, check);
+    secure_zero(check, sizeof(check));
+#ifdef HAVE_KEYRING
+    if (key_cache_ttl == 0) {
+        secure_zero(&entry, sizeof(entry));
+        return;
+    }
+    char desc[16 + 2 * SALT_SIZE];
+    key_cache_name(salt, version, desc);
+    /* Resolved without creating: add_key() on KEY_SPEC_SESSION_KEYRING would give a
+     * process without a session keyring a new one that dies with it */
+    long keyring = syscall(SYS_keyctl, KEYCTL_GET_KEYRING_ID, KEY_SPEC_SESSION_KEYRING, 0);
+    long id = keyring < 0 ? keyring : syscall(SYS_add_key, "user", desc, &entry, sizeof(entry), keyring);
+    secure_zero(&entry, sizeof(entry));
+    if (id < 0) {
+        verbose_print(VERBOSE_DEBUG, "Cannot cache keys in the session keyring: %s", strerror(errno));
+        return;
+    }
+    if (syscall(SYS_keyctl, KEYCTL_SET_TIMEOUT, id, key_cache_ttl) < 0) {
+        verbose_print(VERBOSE_DEBUG, "Cannot set timeout of cached keys, dropping them: %s", strerror(errno));
+        syscall(SYS_keyctl, KEYCTL_INVALIDATE, id);
+        return;
+    }
+    verbose_print(VERBOSE_DEBUG, "Cached keys in %s for %u seconds", desc, key_cache_ttl);
+#else
+    secure_zero(&entry, sizeof(entry));
+#endif
+}
+
+/**
+ * @brief Wipes the keys remembered by the process; call before exiting.
+ */
+void key_cache_clear(void) {
+    pthread_mutex_lock(&key_memo_lock);
+    secure_zero(key_memo, sizeof(key_memo));
+    key_memo_next = 0;
+    pthread_mutex_unlock(&key_memo_lock);
+}
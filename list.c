@@ -11,8 +11,24 @@
 #include <unistd.h>
 #include <errno.h>
 
+/**
+ * @brief Prints one row of the contents table.
+ * @param plain_entry Entry metadata.
+ * @param in_base If 1, the entry is stored in the base archive of an incremental archive.
+ */
+static void print_entry(const FileEntryPlain *plain_entry, int in_base) {
+    char mode_str[11];
+    mode_to_string(plain_entry->mode, mode_str);
+    printf("%-11s %12lu %s%s\n", mode_str, plain_entry->original_size, plain_entry->filename,
+           in_base ? " (in base archive)" : "");
+}
+
 /**
  * @brief Lists the contents of a .slm archive.
+ *
+ * Version 9+ archives are listed from the central index alone; older archives
+ * are walked entry by entry.
+ *
  * @param archive Path to the input archive file (.slm).
  * @param password Password for decryption.
  * @return 0 on success, 1 on failure.
@@ -34,8 +50,8 @@ int list_files(const char *archive, const char *password) {
         fclose(in);
         return 1;
     }
-    if (strncmp(header.magic, "SLM", 4) != 0 || (header.version < 4 || header.version > 6)) {
-        fprintf(stderr, "Error: Invalid archive format or version (expected 4 to 6, got %d)\n", header.version);
+    if (strncmp(header.magic, "SLM", 4) != 0 || (header.version < 4 || header.version > ARCHIVE_VERSION)) {
+        fprintf(stderr, "Error: Invalid archive format or version (expected 4 to %d, got %d)\n", ARCHIVE_VERSION, header.version);
         fclose(in);
         return 1;
     }
@@ -45,13 +61,12 @@ int list_files(const char *archive, const char *password) {
         return 1;
     }
     verbose_print(VERBOSE_BASIC, "Read archive header, version %d, %u files, compression %s level %d",
-                  header.version, header.file_count, header.compression_algo == COMPRESSION_ZLIB ? "zlib" : "LZMA", header.compression_level);
+                  header.version, header.file_count, codec_name(header.compression_algo), header.compression_level);
     uint8_t file_key[AES_KEY_SIZE];
     uint8_t meta_key[AES_KEY_SIZE];
     memset(file_key, 0, AES_KEY_SIZE);
     memset(meta_key, 0, AES_KEY_SIZE);
-    if (derive_key(password, header.salt, file_key, "file encryption") != 0 ||
-        derive_key(password, header.salt, meta_key, "metadata encryption") != 0) {
+    if (derive_archive_keys(password, header.salt, header.version, file_key, meta_key) != 0) {
         secure_zero(file_key, AES_KEY_SIZE);
         secure_zero(meta_key, AES_KEY_SIZE);
         fclose(in);
@@ -74,6 +89,33 @@ int list_files(const char *archive, const char *password) {
         return 1;
     }
     verbose_print(VERBOSE_DEBUG, "Verified header HMAC");
+    key_cache_store(password, header.salt, header.version, file_key, meta_key);
+    GcmKey meta_gk;
+    if (gcm_key_init(&meta_gk, meta_key, 0) != 0) {
+        secure_zero(file_key, AES_KEY_SIZE);
+        secure_zero(meta_key, AES_KEY_SIZE);
+        fclose(in);
+        return 1;
+    }
+    if (header.version >= ARCHIVE_VERSION_INDEX) {
+        ArchiveIndex index;
+        int ret = read_archive_index(in, &header, &meta_gk, &index);
+        secure_zero(file_key, AES_KEY_SIZE);
+        secure_zero(meta_key, AES_KEY_SIZE);
+        gcm_key_free(&meta_gk);
+        fclose(in);
+        if (ret != 0) return 1;
+        if (index.has_base) printf("Incremental archive on top of %s\n", index.base_path);
+        if (index.dict_len > 0) printf("Compression dictionary: %lu bytes\n", (unsigned long)index.dict_len);
+        printf("Contents of %s:\n", archive);
+        printf("%-11s %-12s %s\n", "Permissions", "Size", "Filename");
+        printf("%-11s %-12s %s\n", "-----------", "------------", "--------");
+        size_t pos = 0;
+        IndexEntry entry;
+        while (archive_index_next(&index, &pos, &entry) == 1) print_entry(&entry.plain, (entry.flags & INDEX_FLAG_IN_BASE) != 0);
+        archive_index_free(&index);
+        return 0;
+    }
     printf("Contents of %s:\n", archive);
     printf("%-11s %-12s %s\n", "Permissions", "Size", "Filename");
     printf("%-11s %-12s %s\n", "-----------", "------------", "--------");
@@ -84,6 +126,7 @@ int list_files(const char *archive, const char *password) {
             fprintf(stderr, "Error: Failed to get file position for entry %u: %s\n", i, strerror(errno));
             secure_zero(file_key, AES_KEY_SIZE);
             secure_zero(meta_key, AES_KEY_SIZE);
+            gcm_key_free(&meta_gk);
             fclose(in);
             return 1;
         }
@@ -95,14 +138,14 @@ int list_files(const char *archive, const char *password) {
                     i, file_pos, feof(in) ? "unexpected EOF" : strerror(errno), read_bytes, sizeof(entry));
             secure_zero(file_key, AES_KEY_SIZE);
             secure_zero(meta_key, AES_KEY_SIZE);
+            gcm_key_free(&meta_gk);
             fclose(in);
             return 1;
         }
         FileEntryPlain plain_entry;
         memset(&plain_entry, 0, sizeof(plain_entry));
-        size_t meta_dec_size;
-        if (decrypt_aes_gcm(meta_key, entry.nonce, entry.encrypted_data, sizeof(entry.encrypted_data),
-                            entry.tag, (uint8_t *)&plain_entry, &meta_dec_size) != 0) {
+        if (gcm_key_decrypt(&meta_gk, entry.nonce, NULL, 0, entry.encrypted_data, sizeof(entry.encrypted_data),
+                            entry.tag, (uint8_t *)&plain_entry) != 0) {
             fprintf(stderr, "Error: AES-GCM decryption failed for file entry %u at offset %ld (wrong password or corrupted data?)\n", i, file_pos);
             errors++;
             long skip_pos = ftell(in);
@@ -110,6 +153,7 @@ int list_files(const char *archive, const char *password) {
                 fprintf(stderr, "Error: Failed to get file position after decryption failure for entry %u: %s\n", i, strerror(errno));
                 secure_zero(file_key, AES_KEY_SIZE);
                 secure_zero(meta_key, AES_KEY_SIZE);
+                gcm_key_free(&meta_gk);
                 fclose(in);
                 return 1;
             }
@@ -119,15 +163,16 @@ int list_files(const char *archive, const char *password) {
                 fprintf(stderr, "Warning: Cannot skip data for entry %u due to unknown size; stopping\n", i);
                 secure_zero(file_key, AES_KEY_SIZE);
                 secure_zero(meta_key, AES_KEY_SIZE);
+                gcm_key_free(&meta_gk);
                 fclose(in);
                 return 1;
             }
             fseek(in, skip_pos, SEEK_SET);
             continue;
         }
-        if (meta_dec_size != sizeof(FileEntryPlain) || plain_entry.filename[MAX_FILENAME - 1] != '\0' ||
+        if (plain_entry.filename[MAX_FILENAME - 1] != '\0' ||
             has_path_traversal(plain_entry.filename) || (plain_entry.compressed_size > 0 && plain_entry.original_size == 0) ||
-            plain_entry.original_size > MAX_FILE_SIZE) {
+            plain_entry.original_size > ENTRY_MAX_SIZE(header.version >= ARCHIVE_VERSION_SPARSE ? plain_entry.codec : 0)) {
             fprintf(stderr, "Error: Invalid or unsafe metadata in file entry %u at offset %ld\n", i, file_pos);
             errors++;
             if (plain_entry.compressed_size > 0) {
@@ -136,35 +181,37 @@ int list_files(const char *archive, const char *password) {
                     fprintf(stderr, "Error: Failed to get file position for skipping data in entry %u: %s\n", i, strerror(errno));
                     secure_zero(file_key, AES_KEY_SIZE);
                     secure_zero(meta_key, AES_KEY_SIZE);
+                    gcm_key_free(&meta_gk);
                     fclose(in);
                     return 1;
                 }
-                if (fseek(in, plain_entry.compressed_size + AES_NONCE_SIZE + AES_TAG_SIZE, SEEK_CUR) != 0) {
+                if (fseek(in, entry_payload_size(header.version, plain_entry.compressed_size), SEEK_CUR) != 0) {
                     fprintf(stderr, "Error: Failed to skip data for entry %u: %s\n", i, strerror(errno));
                     secure_zero(file_key, AES_KEY_SIZE);
                     secure_zero(meta_key, AES_KEY_SIZE);
+                    gcm_key_free(&meta_gk);
                     fclose(in);
                     return 1;
                 }
             }
             continue;
         }
-        char mode_str[11];
-        mode_to_string(plain_entry.mode, mode_str);
-        printf("%-11s %12lu %s\n", mode_str, plain_entry.original_size, plain_entry.filename);
+        print_entry(&plain_entry, 0);
         if (plain_entry.compressed_size > 0) {
             long skip_pos = ftell(in);
             if (skip_pos == -1) {
                 fprintf(stderr, "Error: Failed to get file position for skipping data in entry %u: %s\n", i, strerror(errno));
                 secure_zero(file_key, AES_KEY_SIZE);
                 secure_zero(meta_key, AES_KEY_SIZE);
+                gcm_key_free(&meta_gk);
                 fclose(in);
                 return 1;
             }
-            if (fseek(in, plain_entry.compressed_size + AES_NONCE_SIZE + AES_TAG_SIZE, SEEK_CUR) != 0) {
+            if (fseek(in, entry_payload_size(header.version, plain_entry.compressed_size), SEEK_CUR) != 0) {
                 fprintf(stderr, "Error: Failed to skip data for entry %u (%s): %s\n", i, plain_entry.filename, strerror(errno));
                 secure_zero(file_key, AES_KEY_SIZE);
                 secure_zero(meta_key, AES_KEY_SIZE);
+                gcm_key_free(&meta_gk);
                 fclose(in);
                 return 1;
             }
@@ -172,6 +219,7 @@ int list_files(const char *archive, const char *password) {
     }
     secure_zero(file_key, AES_KEY_SIZE);
     secure_zero(meta_key, AES_KEY_SIZE);
+    gcm_key_free(&meta_gk);
     fclose(in);
     if (errors > 0) {
         fprintf(stderr, "Warning: %d file entries could not be processed\n", errors);
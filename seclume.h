@@ -10,12 +10,21 @@
 
 #include <stdio.h>
 #include <stdint.h>
+#include <stddef.h>
 #include <zlib.h>
 #include <lzma.h>
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#include <zdict.h>
+#endif
+#ifdef HAVE_LZ4
+#include <lz4frame.h>
+#endif
 #include <openssl/evp.h>
+#include <pthread.h>
 
-/** @brief Maximum number of files in an archive */
-#define MAX_FILES 1000
+/** @brief Maximum number of files in an archive (the on-disk counts are 32-bit and the archiving side counts in int) */
+#define MAX_FILES 0x7FFFFFFF
 /** @brief Maximum length of a filename (including null terminator) */
 #define MAX_FILENAME 256
 /** @brief Maximum file size (10GB) */
@@ -34,29 +43,180 @@
 #define MAX_COMMENT 512
 /** @brief Maximum length of output directory path (including encryption overhead) */
 #define MAX_OUTDIR 256
-/** @brief Maximum number of exclusion patterns */
-#define MAX_EXCLUDE_PATTERNS 32
+/** @brief Maximum number of exclusion (and inclusion) patterns */
+#define MAX_EXCLUDE_PATTERNS 4096
 /** @brief Maximum length of an exclusion pattern (including null terminator) */
 #define MAX_PATTERN_LEN 64
+/** @brief Maximum number of states of the combined exclusion automaton */
+#define EXCLUDE_DFA_MAX_STATES 4096
+/** @brief Maximum number of glob positions compiled into the exclusion automaton */
+#define EXCLUDE_DFA_MAX_POSITIONS 4096
+/** @brief Input files of at least this size are mapped instead of read (256KB) */
+#define MMAP_MIN_SIZE (256U << 10)
+/** @brief Size of one path arena block (64KB) */
+#define ARENA_BLOCK_SIZE (64U << 10)
+/** @brief Smallest buffer pool size class (log2, 4KB) */
+#define POOL_CLASS_MIN_LOG2 12
+/** @brief Number of buffer pool size classes (4KB to 128MB) */
+#define POOL_CLASSES 16
+/** @brief Maximum bytes a buffer pool keeps cached for reuse (64MB) */
+#define POOL_CACHE_MAX (64U << 20)
+/** @brief Maximum number of worker threads (-j) */
+#define MAX_JOBS 256
+/** @brief Longest lifetime of cached keys (-kc), in seconds */
+#define MAX_KEY_CACHE_TTL 86400
+/** @brief Default filename of the entry archived from standard input ('-') */
+#define STDIN_ENTRY_NAME "stdin"
+/** @brief Seclume release */
+#define SECLUME_VERSION "1.0.5"
+/** @brief Archive format version written by archive_files() */
+#define ARCHIVE_VERSION 17
+/** @brief First archive version deriving both keys from one PBKDF2 run via HKDF */
+#define ARCHIVE_VERSION_HKDF 8
+/** @brief First archive version ending with an encrypted central index and trailer */
+#define ARCHIVE_VERSION_INDEX 9
+/** @brief First archive version whose index records carry mtime and content hash and may refer to a base archive */
+#define ARCHIVE_VERSION_INCREMENTAL 10
+/** @brief First archive version that may store deduplicated payloads */
+#define ARCHIVE_VERSION_DEDUP 11
+/** @brief First archive version that may pack small files into solid blocks */
+#define ARCHIVE_VERSION_SOLID 12
+/** @brief First archive version recording the codec of every entry (zstd, LZ4, stored and auto archives) */
+#define ARCHIVE_VERSION_CODECS 13
+/** @brief First archive version that may be written as a stream, with each entry's sizes following its payload */
+#define ARCHIVE_VERSION_STREAM 14
+/** @brief First archive version that may store sparse files as a map of their data extents */
+#define ARCHIVE_VERSION_SPARSE 15
+/** @brief First archive version that may compress its entries with a trained dictionary stored in the index */
+#define ARCHIVE_VERSION_DICT 16
+/** @brief First archive version whose trailer may count more files than the header (files appended after creation) */
+#define ARCHIVE_VERSION_APPEND 17
+/** @brief Magic string identifying an ArchiveTrailer */
+#define TRAILER_MAGIC "SLMIDX"
+/** @brief Maximum size of the encrypted central index (1GB) */
+#define MAX_INDEX_SIZE (1ULL << 30)
+/** @brief Maximum plaintext size of one encrypted payload chunk (1MB, version 7+) */
+#define CHUNK_SIZE (1U << 20)
+/** @brief Flag set in a chunk header when the chunk is the last one of a payload */
+#define CHUNK_FINAL 0x80000000U
+/** @brief On-disk overhead of one payload chunk (length header and authentication tag) */
+#define CHUNK_OVERHEAD (sizeof(uint32_t) + AES_TAG_SIZE)
+/** @brief ArchiveHeader.reserved[0] flag: payloads are independently compressed blocks (version 7+) */
+#define ARCHIVE_FLAG_BLOCKS 0x01
+/** @brief ArchiveHeader.reserved[0] flag: the index starts with an IndexBase and may hold records stored in the base archive (version 10+) */
+#define ARCHIVE_FLAG_INCREMENTAL 0x02
+/** @brief ArchiveHeader.reserved[0] flag: payloads are sequences of deduplicated chunk segments (version 11+) */
+#define ARCHIVE_FLAG_DEDUP 0x04
+/** @brief ArchiveHeader.reserved[0] flag: small files are packed into solid blocks reachable only through the index (version 12+) */
+#define ARCHIVE_FLAG_SOLID 0x08
+/** @brief ArchiveHeader.reserved[0] flag: every entry is a lead FileEntry without sizes, its payload and a FileEntry with the sizes (version 14+) */
+#define ARCHIVE_FLAG_STREAM 0x10
+/** @brief ArchiveHeader.reserved[0] flag: the index starts with an IndexDict, and zlib and zstd entries are compressed with it (version 16+) */
+#define ARCHIVE_FLAG_DICT 0x20
+/** @brief Largest trained compression dictionary (110KB, the zstd default) */
+#define DICT_MAX_SIZE (110U << 10)
+/** @brief Size of a dictionary trained for zlib, whose window cannot reach further back (32KB) */
+#define DICT_ZLIB_SIZE (32U << 10)
+/** @brief Files up to this size are sampled for dictionary training (128KB) */
+#define DICT_SAMPLE_FILE_MAX (128U << 10)
+/** @brief Maximum bytes of sampled files a dictionary is trained on (8MB) */
+#define DICT_SAMPLE_MAX (8U << 20)
+/** @brief Fewest sampled files a dictionary is trained on; with fewer the archive gets none */
+#define DICT_MIN_SAMPLES 8
+/** @brief Files smaller than this are packed into solid blocks in solid mode (1MB) */
+#define SOLID_FILE_MAX (1U << 20)
+/** @brief Uncompressed size after which a solid block is closed (16MB) */
+#define SOLID_BLOCK_SIZE (16U << 20)
+/** @brief Maximum number of files packed into one solid block */
+#define SOLID_MAX_FILES 16384
+/** @brief Smallest content-defined chunk in dedup mode (16KB) */
+#define DEDUP_MIN_CHUNK (16U << 10)
+/** @brief Largest content-defined chunk in dedup mode (256KB) */
+#define DEDUP_MAX_CHUNK (256U << 10)
+/** @brief Gear hash bits that must be zero at a chunk boundary (16 bits, about 64KB past the minimum) */
+#define DEDUP_BOUNDARY_MASK 0xFFFF000000000000ULL
+/** @brief Dedup segment type: compressed chunk data follows */
+#define DEDUP_SEGMENT_DATA 0
+/** @brief Dedup segment type: a DedupRef to an earlier chunk */
+#define DEDUP_SEGMENT_REF 1
+/** @brief IndexRecord.flags bit: the file is unchanged and stored in the base archive, not in this one */
+#define INDEX_FLAG_IN_BASE 0x0001
+/** @brief IndexRecord.flags bit: the file's data is packed into the solid block whose payload starts at entry_offset */
+#define INDEX_FLAG_SOLID 0x0002
+/** @brief IndexRecord.flags bit: the entry is a sparse file (ENTRY_CODEC_SPARSE, version 15+) */
+#define INDEX_FLAG_SPARSE 0x0004
+/** @brief IndexRecord.flags bits holding the CompressionAlgo of the entry's data (version 13+) */
+#define INDEX_CODEC_MASK 0x0F00
+/** @brief Shift of the codec in IndexRecord.flags */
+#define INDEX_CODEC_SHIFT 8
+/** @brief FileEntryPlain.codec bits holding the CompressionAlgo */
+#define ENTRY_CODEC_MASK 0xFF
+/** @brief FileEntryPlain.codec bit: the payload is a chunk holding the SparseExtent map, then the extents' data (version 15+) */
+#define ENTRY_CODEC_SPARSE 0x100
+/** @brief Largest number of data extents recorded for a sparse file; the rest of the file is stored as data */
+#define SPARSE_MAX_EXTENTS (CHUNK_SIZE / sizeof(SparseExtent))
+/** @brief Maximum apparent size of a sparse file, whose data extents may hold up to MAX_FILE_SIZE bytes (16TB) */
+#define MAX_SPARSE_FILE_SIZE (16ULL << 40)
+/** @brief Maximum original size of an entry with the given FileEntryPlain.codec */
+#define ENTRY_MAX_SIZE(codec) (((codec) & ENTRY_CODEC_SPARSE) ? MAX_SPARSE_FILE_SIZE : MAX_FILE_SIZE)
+/** @brief Size of the SHA-256 content hash stored in index records */
+#define HASH_SIZE 32
+/** @brief Maximum length of the base archive path stored in an incremental archive */
+#define MAX_BASE_PATH 4096
+/** @brief Maximum number of base archives an extraction follows */
+#define MAX_BASE_CHAIN 64
+/** @brief Default log2 of the block size in block-parallel mode (4MB) */
+#define BLOCK_SIZE_LOG2 22
+/** @brief Smallest accepted log2 block size in block-parallel archives (1MB) */
+#define BLOCK_SIZE_LOG2_MIN 20
+/** @brief Largest accepted log2 block size in block-parallel archives (64MB) */
+#define BLOCK_SIZE_LOG2_MAX 26
+/** @brief Maximum ciphertext length of one chunk (a compressed block of the largest block size, with slack) */
+#define CHUNK_MAX_LEN ((1U << BLOCK_SIZE_LOG2_MAX) + (1U << 20))
+/** @brief Bytes sampled from the start of a file to recognize compressed formats in auto mode */
+#define CODEC_SAMPLE_SIZE 16
+/** @brief Files at least this large are probed for compressibility before they are compressed (64KB) */
+#define PROBE_MIN_SIZE (64 * 1024)
+/** @brief Length of one probe window; windows are spread evenly over the file (64KB) */
+#define PROBE_WINDOW (64 * 1024)
+/** @brief Number of probe windows (at most 256KB of a file is probed) */
+#define PROBE_WINDOWS 4
+/** @brief A probe that saves less than 1/PROBE_MIN_GAIN of its input makes the file stored */
+#define PROBE_MIN_GAIN 32
+/** @brief zstd window of long-range matching at compression levels 8 and 9 (log2, 128MB) */
+#define ZSTD_LONG_WINDOW_LOG 27
+/** @brief Alignment of buffers, offsets and lengths of O_DIRECT writes */
+#define DIRECT_IO_ALIGN 4096
 
 /**
  * @brief Compression algorithm types.
  */
 typedef enum {
-    COMPRESSION_ZLIB = 0, /**< zlib compression */
-    COMPRESSION_LZMA = 1  /**< LZMA compression */
+    COMPRESSION_ZLIB = 0,  /**< zlib compression */
+    COMPRESSION_LZMA = 1,  /**< LZMA compression */
+    COMPRESSION_ZSTD = 2,  /**< Zstandard compression (version 13+, builds with HAVE_ZSTD) */
+    COMPRESSION_LZ4 = 3,   /**< LZ4 frame compression (version 13+, builds with HAVE_LZ4) */
+    COMPRESSION_STORE = 4, /**< Data stored without compression (per-entry codec only, version 13+) */
+    COMPRESSION_AUTO = 5   /**< Per-file choice between AUTO_CODEC and storing (archive header only, version 13+) */
 } CompressionAlgo;
 
+/** @brief Codec of the files an auto archive compresses */
+#ifdef HAVE_ZSTD
+#define AUTO_CODEC COMPRESSION_ZSTD
+#else
+#define AUTO_CODEC COMPRESSION_ZLIB
+#endif
+
 /**
  * @brief Archive header structure stored at the beginning of a .slm file.
  */
 typedef struct {
     char magic[8];           /**< Magic string "SLM" identifying the archive format */
-    uint8_t version;         /**< Archive format version (4 for LZMA, 5 for zlib/LZMA with algo field, 6 for output directory) */
-    uint32_t file_count;     /**< Number of files in the archive */
+    uint8_t version;         /**< Archive format version (4 for LZMA, 5 for zlib/LZMA with algo field, 6 for output directory, 7 for chunked payloads, 8 for HKDF key derivation, 9 for central index, 10 for incremental archives, 11 for dedup, 12 for solid blocks, 13 for entry codecs, 14 for streamed archives, 15 for sparse files, 16 for compression dictionaries, 17 for appends committed by the trailer) */
+    uint32_t file_count;     /**< Number of files in the archive (version 17+: files it was created with; the trailer also counts appended ones) */
     uint8_t compression_level; /**< Compression level (0-9) */
-    uint8_t compression_algo; /**< Compression algorithm (0 = zlib, 1 = LZMA) */
-    uint8_t reserved[2];     /**< Reserved for future use (zeroed) */
+    uint8_t compression_algo; /**< Compression algorithm (CompressionAlgo; zstd, LZ4 and auto in version 13+) */
+    uint8_t reserved[2];     /**< Version 7+: reserved[0] holds ARCHIVE_FLAG_* bits, reserved[1] the log2 block size in block mode (zeroed otherwise) */
     uint32_t comment_len;    /**< Length of encrypted comment */
     uint8_t salt[SALT_SIZE]; /**< Random salt for PBKDF2 key derivation */
     uint8_t comment[MAX_COMMENT]; /**< Encrypted comment (includes nonce and tag) */
@@ -70,12 +230,20 @@ typedef struct {
  */
 typedef struct {
     char filename[MAX_FILENAME]; /**< Filename (null-terminated) */
-    uint64_t compressed_size;   /**< Size of compressed and encrypted file data */
+    uint64_t compressed_size;   /**< Size of compressed and encrypted file data (version 7+: total size of all payload chunks) */
     uint64_t original_size;     /**< Original file size before compression */
     uint32_t mode;              /**< File permissions (POSIX st_mode) */
-    uint32_t reserved;          /**< Reserved for future use (zeroed) */
+    uint32_t codec;             /**< Version 13+: CompressionAlgo of the entry's data (reserved and zeroed before), and ENTRY_CODEC_SPARSE in version 15+ */
 } FileEntryPlain;
 
+/**
+ * @brief One data extent of a sparse file; the bytes between extents are holes that read as zeros.
+ */
+typedef struct {
+    uint64_t offset; /**< File offset of the extent */
+    uint64_t length; /**< Length of the extent in bytes */
+} SparseExtent;
+
 /**
  * @brief Encrypted file entry structure as stored in the archive.
  */
@@ -85,6 +253,290 @@ typedef struct {
     uint8_t encrypted_data[sizeof(FileEntryPlain)]; /**< Encrypted filename and sizes */
 } FileEntry;
 
+/**
+ * @brief Fixed part of one central index record, followed by name_len filename bytes (version 9+).
+ *
+ * Version 9 records end after flags (INDEX_RECORD_V9_SIZE bytes), version 10
+ * and 11 records after hash (INDEX_RECORD_V10_SIZE bytes).
+ */
+typedef struct {
+    uint64_t entry_offset;    /**< Archive offset of the entry's FileEntry (0 for INDEX_FLAG_IN_BASE records), or of
+                                   the solid block payload (nonce) for INDEX_FLAG_SOLID records */
+    uint64_t compressed_size; /**< Total size of the payload chunks (of the whole block for INDEX_FLAG_SOLID records) */
+    uint64_t original_size;   /**< Original file size before compression */
+    uint32_t mode;            /**< File permissions (POSIX st_mode) */
+    uint16_t name_len;        /**< Length of the filename (without terminator) */
+    uint16_t flags;           /**< INDEX_FLAG_* bits and, in version 13+, the entry codec (zero in version 9) */
+    int64_t mtime;            /**< Version 10+: modification time of the input file (seconds since the epoch) */
+    uint8_t hash[HASH_SIZE];  /**< Version 10+: SHA-256 of the file contents */
+    uint64_t solid_offset;    /**< Version 12+: offset of the file's data in its decompressed solid block */
+} IndexRecord;
+
+/** @brief Size of a version 9 index record */
+#define INDEX_RECORD_V9_SIZE offsetof(IndexRecord, mtime)
+/** @brief Size of a version 10 and 11 index record */
+#define INDEX_RECORD_V10_SIZE offsetof(IndexRecord, solid_offset)
+
+/**
+ * @brief Plaintext of a dedup segment referring to a chunk stored earlier in the archive.
+ *
+ * In dedup archives every payload chunk holds one segment: DEDUP_SEGMENT_DATA
+ * followed by one compressed content-defined chunk, or this reference.
+ */
+typedef struct {
+    uint8_t type;                       /**< DEDUP_SEGMENT_REF */
+    uint8_t codec;                      /**< Version 13+: CompressionAlgo of the referenced chunk (zero before) */
+    uint8_t reserved[6];                /**< Reserved for future use (zeroed) */
+    uint64_t offset;                    /**< Archive offset of the referenced chunk record (its length header) */
+    uint64_t index;                     /**< Index of that chunk within its payload */
+    uint8_t base_nonce[AES_NONCE_SIZE]; /**< Base nonce of the payload holding the chunk */
+    uint32_t length;                    /**< Uncompressed length of the chunk */
+} DedupRef;
+
+/**
+ * @brief One chunk of the dedup chunk store.
+ */
+typedef struct {
+    uint8_t hash[HASH_SIZE]; /**< SHA-256 of the uncompressed chunk */
+    DedupRef ref;            /**< Location of the chunk (length 0 marks a free slot) */
+} DedupChunk;
+
+/**
+ * @brief Chunks written so far in a dedup archive, keyed by content hash.
+ */
+typedef struct {
+    uint64_t gear[256];    /**< Rolling hash table of the chunker */
+    DedupChunk *chunks;    /**< Open-addressing table of stored chunks */
+    size_t count;          /**< Number of stored chunks */
+    size_t mask;           /**< Table size minus one */
+    uint64_t unique_bytes; /**< Input bytes stored as new chunks */
+    uint64_t dup_bytes;    /**< Input bytes replaced by references */
+} DedupStore;
+
+/**
+ * @brief Reference to the base archive at the start of an incremental archive's index, followed by path_len path bytes.
+ *
+ * A relative path is resolved against the directory of the incremental archive.
+ */
+typedef struct {
+    uint8_t salt[SALT_SIZE]; /**< Salt of the base archive, identifying it */
+    uint16_t path_len;       /**< Length of the base archive path */
+    uint16_t reserved;       /**< Reserved for future use (zeroed) */
+} IndexBase;
+
+/**
+ * @brief Compression dictionary at the start of the central index of a dictionary archive (after any IndexBase), followed by dict_len bytes (version 16+).
+ */
+typedef struct {
+    uint32_t dict_len; /**< Length of the dictionary (1 to DICT_MAX_SIZE) */
+    uint32_t reserved; /**< Reserved for future use (zeroed) */
+} IndexDict;
+
+/**
+ * @brief Trailer stored at the very end of an archive, pointing to the central index (version 9+).
+ *
+ * The index is a chunked payload (base nonce and chunks) encrypted with the
+ * metadata key whose plaintext is the sequence of IndexRecords.
+ */
+typedef struct {
+    uint64_t index_offset; /**< Archive offset of the index payload */
+    uint64_t index_size;   /**< Size of the index payload (nonce and chunks) */
+    uint32_t entry_count;  /**< Number of index records (the header file count, or more in an appended version 17+ archive) */
+    uint32_t reserved;     /**< Reserved for future use (zeroed) */
+    char magic[8];         /**< TRAILER_MAGIC */
+} ArchiveTrailer;
+
+/**
+ * @brief In-memory central index: an optional IndexBase, an optional IndexDict and serialized IndexRecords with their filenames.
+ */
+typedef struct {
+    uint8_t *data;          /**< Serialized base reference and records */
+    size_t len;             /**< Bytes used in data */
+    size_t cap;             /**< Bytes allocated for data */
+    uint32_t count;         /**< Number of records */
+    size_t record_size;     /**< Size of the fixed part of each record (depends on the version) */
+    size_t records_start;   /**< Offset of the first record (after the IndexBase and IndexDict, if any) */
+    uint16_t known_flags;   /**< IndexRecord.flags bits valid in this version */
+    int has_base;           /**< Set for incremental archives */
+    uint8_t base_salt[SALT_SIZE]; /**< Salt of the base archive */
+    char *base_path;        /**< Base archive path as stored (NULL if none) */
+    size_t dict_offset;     /**< Offset of the compression dictionary in data */
+    size_t dict_len;        /**< Length of the compression dictionary, 0 if none */
+    size_t *lookup;         /**< Open-addressing table of record offsets by filename (NULL until built) */
+    size_t lookup_mask;     /**< Number of lookup slots minus one */
+} ArchiveIndex;
+
+/**
+ * @brief Block of a path arena.
+ */
+typedef struct ArenaBlock {
+    struct ArenaBlock *next; /**< Previously filled block */
+    size_t used;             /**< Bytes handed out from data */
+    size_t cap;              /**< Size of data */
+    char data[];             /**< String storage */
+} ArenaBlock;
+
+/**
+ * @brief Run-scoped allocator for path strings, freed all at once.
+ */
+typedef struct {
+    ArenaBlock *head; /**< Block currently being filled */
+} PathArena;
+
+/**
+ * @brief Header of a buffer handed out by a BufferPool.
+ */
+typedef struct PoolBuffer {
+    struct PoolBuffer *next; /**< Next cached buffer of the same size class */
+    size_t cap;              /**< Usable size of data */
+    size_t len;              /**< Size requested by the current holder (wiped on return) */
+    uint8_t data[];          /**< Buffer memory */
+} PoolBuffer;
+
+/**
+ * @brief Thread-safe cache of power-of-two scratch buffers that are wiped when returned.
+ */
+typedef struct {
+    PoolBuffer *free_lists[POOL_CLASSES]; /**< Cached buffers per size class */
+    size_t cached;                        /**< Total bytes currently cached */
+    pthread_mutex_t lock;                 /**< Protects all fields above */
+} BufferPool;
+
+/** @brief Writes a WriteBehind keeps in flight at once: one per half of a double buffer */
+#define WRITE_BEHIND_SLOTS 2
+
+/**
+ * @brief One write posted to a WriteBehind.
+ */
+typedef struct {
+    int fd;               /**< Output file */
+    const uint8_t *data;  /**< Data not written yet, NULL when the slot is idle */
+    size_t len;           /**< Length of data */
+    uint64_t offset;      /**< File offset of data */
+    uint64_t seq;         /**< Post order (the thread backend writes the oldest slot first) */
+} WriteSlot;
+
+/**
+ * @brief Writer that completes the writes of filled buffers while the caller fills the next one.
+ *
+ * Each buffer of the caller has a slot, and a slot holds one write, so both
+ * halves of a double buffer can be in flight at once. Writes are done with
+ * pwrite() on a helper thread, in post order, or submitted to an io_uring
+ * when built with HAVE_IO_URING and requested.
+ */
+typedef struct {
+    pthread_t thread;     /**< Writer thread (thread backend) */
+    pthread_mutex_t lock; /**< Protects the fields below (thread backend) */
+    pthread_cond_t cond;  /**< Signals a posted write, its completion, or stop */
+    WriteSlot slots[WRITE_BEHIND_SLOTS]; /**< Posted writes */
+    uint64_t posted;      /**< Number of writes posted so far (next WriteSlot.seq) */
+    int error;            /**< errno of a failed write, reported once by write_behind_wait() or write_behind_wait_slot() */
+    int stop;             /**< Set to end the thread */
+    int uring;            /**< Set when writes go through the io_uring below */
+#ifdef HAVE_IO_URING
+    int ring_fd;          /**< io_uring instance */
+    void *sq_ring;        /**< Mapped submission ring */
+    void *cq_ring;        /**< Mapped completion ring (may equal sq_ring) */
+    size_t sq_ring_size;  /**< Size of the sq_ring mapping */
+    size_t cq_ring_size;  /**< Size of the cq_ring mapping (0 if shared) */
+    void *sqes;           /**< Mapped submission queue entries */
+    size_t sqes_size;     /**< Size of the sqes mapping */
+    unsigned sq_off[4];   /**< Offsets of the sq head, tail, mask and array */
+    unsigned cq_off[3];   /**< Offsets of the cq head, tail and mask */
+    unsigned cqes_off;    /**< Offset of the completion entries */
+#endif
+} WriteBehind;
+
+/**
+ * @brief Growable list of input file paths collected for archiving.
+ */
+typedef struct {
+    char **paths;    /**< Collected paths (stored in arena) */
+    int count;       /**< Number of collected paths */
+    int cap;         /**< Allocated slots in paths */
+    PathArena arena; /**< Storage of the path strings */
+} FileList;
+
+/**
+ * @brief One decoded central index record.
+ */
+typedef struct {
+    uint64_t entry_offset; /**< Archive offset of the entry's FileEntry */
+    FileEntryPlain plain;  /**< Entry metadata */
+    uint16_t flags;        /**< INDEX_FLAG_* bits */
+    int64_t mtime;         /**< Modification time (0 before version 10) */
+    uint8_t hash[HASH_SIZE]; /**< SHA-256 of the contents (zero before version 10) */
+    uint64_t solid_offset;   /**< Offset in the decompressed solid block (INDEX_FLAG_SOLID records) */
+} IndexEntry;
+
+/**
+ * @brief Streaming compression or decompression context.
+ */
+typedef struct {
+    CompressionAlgo algo; /**< Compression algorithm of the stream */
+    int level;            /**< Compression level (encoders only) */
+    int decompress;       /**< 1 for a decoder, 0 for an encoder */
+    z_stream zstrm;       /**< zlib stream state */
+    lzma_stream lstrm;    /**< LZMA stream state */
+    const uint8_t *dict;  /**< Preset dictionary of zlib streams (set by codec_stream_set_dict), NULL if none */
+    size_t dict_len;      /**< Length of dict */
+#ifdef HAVE_ZSTD
+    ZSTD_CCtx *zcctx;     /**< zstd encoder */
+    ZSTD_DCtx *zdctx;     /**< zstd decoder */
+#endif
+#ifdef HAVE_LZ4
+    LZ4F_cctx *lcctx;     /**< LZ4 frame encoder */
+    LZ4F_dctx *ldctx;     /**< LZ4 frame decoder */
+    uint8_t *lz4_buf;     /**< Encoder output not yet handed out (LZ4F needs room for a whole block) */
+    size_t lz4_cap;       /**< Size of lz4_buf */
+    size_t lz4_len;       /**< Bytes held in lz4_buf */
+    size_t lz4_pos;       /**< Bytes of lz4_buf already handed out */
+    int lz4_ended;        /**< Set once the frame end was written to lz4_buf */
+#endif
+} CodecStream;
+
+/**
+ * @brief One independently compressed block for compress_blocks() and decompress_blocks().
+ */
+typedef struct {
+    const uint8_t *in; /**< Input data */
+    size_t in_len;     /**< Size of input data */
+    uint8_t *out;      /**< Output buffer */
+    size_t out_max;    /**< Size of output buffer */
+    size_t out_len;    /**< Size of output data (0 on failure) */
+} CodecBlock;
+
+/**
+ * @brief Reusable AES-256-GCM context holding an expanded key, created once per thread and key.
+ */
+typedef struct {
+    EVP_CIPHER_CTX *ctx; /**< OpenSSL cipher context with the key loaded */
+    int encrypt;         /**< 1 for encryption, 0 for decryption */
+} GcmKey;
+
+/**
+ * @brief Chunked AES-256-GCM payload context (version 7+).
+ *
+ * A payload is a sequence of chunks, each stored as a 32-bit header holding the
+ * ciphertext length (with CHUNK_FINAL on the last chunk), the ciphertext and a
+ * 16-byte tag. The nonce of chunk i is the base nonce with i XORed into its last
+ * 8 bytes, and the header is authenticated as additional data, so chunks cannot
+ * be reordered, truncated or extended without detection.
+ */
+typedef struct {
+    GcmKey *gk;                        /**< Cipher context of the payload key */
+    uint8_t base_nonce[AES_NONCE_SIZE]; /**< Per-payload random base nonce */
+    uint64_t index;                    /**< Index of the next chunk */
+    int finished;                      /**< Set once the final chunk was processed */
+} ChunkCipher;
+
+/**
+ * @brief Incremental AES-256-GCM decryption context for single-tag payloads (versions 4-6).
+ */
+typedef struct {
+    EVP_CIPHER_CTX *ctx; /**< OpenSSL cipher context */
+} GcmStream;
+
 /**
  * @brief Verbosity levels for logging.
  */
@@ -94,38 +546,197 @@ typedef enum {
     VERBOSE_DEBUG = 2  /**< Detailed debug output */
 } VerbosityLevel;
 
+/**
+ * @brief Stages of a run timed by the statistics (see stats.c).
+ */
+typedef enum {
+    STAGE_KDF,        /**< Password-based key derivation */
+    STAGE_WALK,       /**< Directory scanning */
+    STAGE_READ,       /**< Reading input files (copying mapped ones out of their mapping) or the archive */
+    STAGE_HASH,       /**< SHA-256 of input files */
+    STAGE_COMPRESS,   /**< Compression */
+    STAGE_ENCRYPT,    /**< AES-GCM encryption */
+    STAGE_DECRYPT,    /**< AES-GCM decryption */
+    STAGE_DECOMPRESS, /**< Decompression */
+    STAGE_WRITE,      /**< Writing the archive or extracted files */
+    STAGE_COUNT       /**< Number of stages */
+} Stage;
+
+/**
+ * @brief Start of one timed stage on the calling thread.
+ */
+typedef struct {
+    uint64_t wall_ns; /**< Wall clock at stage_begin() */
+    uint64_t cpu_ns;  /**< Thread CPU time at stage_begin() */
+} StageTimer;
+
+/**
+ * @brief Node of a literal exclusion pattern trie.
+ *
+ * Index [0] of whole and part holds patterns matching any entry, [1] patterns
+ * ending in '/' that only match directories; -1 means no pattern.
+ */
+typedef struct {
+    uint32_t child;   /**< First child node, 0 if none */
+    uint32_t sibling; /**< Next child of the same parent, 0 if none */
+    int32_t whole[2]; /**< Lowest pattern matching when the name ends at this node */
+    int32_t part[2];  /**< Lowest pattern matching whatever follows this node (prefix or suffix patterns) */
+    uint8_t byte;     /**< Byte on the edge from the parent */
+} GlobTrieNode;
+
+/**
+ * @brief Trie of literal exclusion patterns (node 0 is the root).
+ */
+typedef struct {
+    GlobTrieNode *nodes; /**< Nodes */
+    uint32_t count;      /**< Nodes in use */
+    uint32_t cap;        /**< Allocated nodes */
+} GlobTrie;
+
+/**
+ * @brief Automaton matching a group of exclusion globs.
+ */
+typedef struct {
+    uint8_t byte_class[256]; /**< Input class of every byte */
+    int class_count;         /**< Number of input classes */
+    int state_count;         /**< Number of states (state 0 is the start) */
+    int32_t *next;           /**< Transitions, state_count x class_count */
+    int32_t *accept;         /**< Lowest accepting pattern of every state, for any entry and for directories */
+    int dead;                /**< State that accepts nothing whatever follows, -1 if none */
+} ExcludeDfa;
+
+/**
+ * @brief Exclusion patterns compiled into one matcher (exclude.c).
+ */
+typedef struct {
+    const char **patterns; /**< Source patterns, referenced for messages and fallback matching */
+    int count;             /**< Number of source patterns */
+    GlobTrie prefixes;     /**< Literal names and "prefix*" patterns, walked forwards */
+    GlobTrie suffixes;     /**< "*suffix" patterns, walked backwards */
+    ExcludeDfa *dfas;      /**< Automata of the other patterns */
+    int dfa_count;         /**< Number of automata */
+    int *fallback;         /**< Patterns matched one by one, in order */
+    int fallback_count;    /**< Number of fallback patterns */
+} ExcludeSet;
+
 /* Function prototypes from utils.c */
 extern VerbosityLevel verbosity;
 void mode_to_string(uint32_t mode, char *str);
 void verbose_print(VerbosityLevel level, const char *fmt, ...);
 void secure_zero(void *ptr, size_t len);
 int derive_key(const char *password, const uint8_t *salt, uint8_t *key, const char *context);
+int hkdf_expand_key(const uint8_t *master, uint8_t *key, const char *context);
+int derive_archive_keys(const char *password, const uint8_t *salt, uint8_t version, uint8_t *file_key, uint8_t *meta_key);
+FILE *open_archive(const char *path, const char *password, ArchiveHeader *header, uint8_t *file_key, uint8_t *meta_key);
 int compute_hmac(const uint8_t *key, const uint8_t *data, size_t data_len, uint8_t *hmac);
 int has_path_traversal(const char *path);
 int check_password_strength(const char *password, int weak_password);
 int matches_glob_pattern(const char *filename, const char *pattern);
+uint64_t entry_payload_size(uint8_t version, uint64_t compressed_size);
 
 /* Function prototypes from compression.c */
 size_t compress_data(const uint8_t *in, size_t in_len, uint8_t *out, size_t out_max, int level, CompressionAlgo algo);
 size_t decompress_data(const uint8_t *in, size_t in_len, uint8_t *out, size_t out_max, CompressionAlgo algo);
+int codec_stream_init(CodecStream *cs, CompressionAlgo algo, int level, int decompress);
+int codec_stream_run(CodecStream *cs, const uint8_t **in, size_t *in_len, uint8_t **out, size_t *out_len, int finish);
+int codec_stream_reset(CodecStream *cs);
+void codec_stream_end(CodecStream *cs);
+size_t compress_bound(size_t in_len, CompressionAlgo algo);
+void codec_stream_set_workers(CodecStream *cs, int workers);
+int codec_stream_set_dict(CodecStream *cs, const uint8_t *dict, size_t dict_len);
+const char *codec_name(CompressionAlgo algo);
+int codec_available(CompressionAlgo algo);
+CompressionAlgo codec_auto_select(const char *filename, const uint8_t *head, size_t head_len);
+int compress_blocks(CodecBlock *blocks, int count, int level, CompressionAlgo algo, int threads);
+int decompress_blocks(CodecBlock *blocks, int count, CompressionAlgo algo, int threads);
 
 /* Function prototypes from encryption.c */
 int encrypt_aes_gcm(const uint8_t *key, const uint8_t *nonce, const uint8_t *in, size_t in_len,
                     uint8_t *out, size_t *out_len, uint8_t *tag);
 int decrypt_aes_gcm(const uint8_t *key, const uint8_t *nonce, const uint8_t *in, size_t in_len,
                     const uint8_t *tag, uint8_t *out, size_t *out_len);
+int gcm_key_init(GcmKey *gk, const uint8_t *key, int encrypt);
+int gcm_key_rekey(GcmKey *gk, const uint8_t *key);
+void gcm_key_free(GcmKey *gk);
+int gcm_key_encrypt(GcmKey *gk, const uint8_t *nonce, const uint8_t *aad, size_t aad_len,
+                    const uint8_t *in, size_t in_len, uint8_t *out, uint8_t *tag);
+int gcm_key_decrypt(GcmKey *gk, const uint8_t *nonce, const uint8_t *aad, size_t aad_len,
+                    const uint8_t *in, size_t in_len, const uint8_t *tag, uint8_t *out);
+void chunk_cipher_init(ChunkCipher *cc, GcmKey *gk, const uint8_t *base_nonce);
+int chunk_encrypt(ChunkCipher *cc, const uint8_t *in, size_t in_len, int final, uint8_t *out, size_t *out_len);
+int chunk_decrypt(ChunkCipher *cc, uint32_t header, const uint8_t *in, const uint8_t *tag, uint8_t *out);
+int gcm_stream_init(GcmStream *gs, const uint8_t *key, const uint8_t *nonce);
+int gcm_stream_update(GcmStream *gs, const uint8_t *in, size_t in_len, uint8_t *out);
+int gcm_stream_final(GcmStream *gs, const uint8_t *tag);
+void gcm_stream_free(GcmStream *gs);
+
+/* Function prototypes from index.c */
+void archive_index_init(ArchiveIndex *index);
+void archive_index_free(ArchiveIndex *index);
+int archive_index_set_base(ArchiveIndex *index, const uint8_t *salt, const char *path);
+int archive_index_set_dict(ArchiveIndex *index, const uint8_t *dict, size_t dict_len);
+int archive_index_add(ArchiveIndex *index, uint64_t entry_offset, const FileEntryPlain *plain, int64_t mtime,
+                      const uint8_t *hash, uint16_t flags, uint64_t solid_offset);
+int archive_index_next(const ArchiveIndex *index, size_t *pos, IndexEntry *entry);
+int archive_index_build_lookup(ArchiveIndex *index);
+int archive_index_find(const ArchiveIndex *index, const char *filename, IndexEntry *entry);
+int write_archive_index(FILE *out, long index_offset, const ArchiveIndex *index, GcmKey *meta_gk, int sync);
+int read_archive_trailer(FILE *in, const ArchiveHeader *header, ArchiveTrailer *trailer);
+int read_archive_index(FILE *in, const ArchiveHeader *header, GcmKey *meta_gk, ArchiveIndex *index);
+
+/* Function prototypes from arena.c */
+void path_arena_init(PathArena *arena);
+void path_arena_free(PathArena *arena);
+char *path_arena_strdup(PathArena *arena, const char *str);
+void buffer_pool_init(BufferPool *pool);
+void buffer_pool_free(BufferPool *pool);
+void *buffer_pool_get(BufferPool *pool, size_t len);
+void buffer_pool_put(BufferPool *pool, void *data);
+
+/* Function prototypes from async_io.c */
+int write_behind_start(WriteBehind *wb, int use_uring);
+void write_behind_post(WriteBehind *wb, int slot, int fd, const uint8_t *data, size_t len, uint64_t offset);
+int write_behind_wait_slot(WriteBehind *wb, int slot);
+int write_behind_wait(WriteBehind *wb);
+void write_behind_stop(WriteBehind *wb);
+
+/* Function prototypes from dedup.c */
+void dedup_store_init(DedupStore *store);
+void dedup_store_free(DedupStore *store);
+size_t dedup_chunk_length(const DedupStore *store, const uint8_t *data, size_t len);
+const DedupRef *dedup_store_find(const DedupStore *store, const uint8_t *hash);
+int dedup_store_add(DedupStore *store, const uint8_t *hash, const DedupRef *ref);
+
+/* Function prototypes from dict.c */
+int train_dictionary(const char **filenames, int file_count, CompressionAlgo codec, uint8_t **dict, size_t *dict_len);
+
+/* Function prototypes from exclude.c */
+int exclude_set_compile(ExcludeSet *set, const char **patterns, int count);
+int exclude_set_match(const ExcludeSet *set, const char *name, int is_dir);
+void exclude_set_free(ExcludeSet *set);
 
 /* Function prototypes from file_ops.c */
 int create_parent_dirs(const char *filepath);
-int collect_files(const char *path, char ***file_list, int *file_count, int max_files, const char **exclude_patterns, int exclude_pattern_count);
+void file_list_init(FileList *list);
+void file_list_free(FileList *list);
+int file_list_add(FileList *list, const char *path);
+int collect_files(const char *path, FileList *list, const ExcludeSet *exclude, int jobs);
 
 /* Function prototypes from archive.c */
 int archive_files(const char *output, const char **filenames, int file_count, const char *password,
                  int force, int compression_level, CompressionAlgo compression_algo, const char *comment,
-                 const char *outdir, int dry_run, int weak_password, const char **exclude_patterns, int exclude_pattern_count);
+                 const char *outdir, int dry_run, int weak_password, int jobs, int block_parallel, int dedup,
+                 int solid, int train_dict, const char *base_archive, const char *stdin_name, int use_uring);
+int append_files(const char *archive, const char **filenames, int file_count, const char *password, int jobs,
+                 const char *stdin_name, int use_uring);
+void archive_workers_retain(int retain);
 
 /* Function prototypes from extract.c */
-int extract_files(const char *archive, const char *password, const char *outdir, int force);
+int extract_files(const char *archive, const char *password, const char *outdir, int force, int jobs,
+                  const char **paths, int path_count, const char **include_patterns, int include_pattern_count,
+                  int direct_io, int use_uring);
+int verify_files(const char *archive, const char *password, int jobs, const char **paths, int path_count,
+                 const char **include_patterns, int include_pattern_count, int auth_only);
 
 /* Function prototypes from list.c */
 int list_files(const char *archive, const char *password);
@@ -133,7 +744,27 @@ int list_files(const char *archive, const char *password);
 /* Function prototypes from view_comment.c */
 int view_comment(const char *archive, const char *password);
 
-/* Function prototype from seclume_main.c */
+/* Function prototypes from bench.c */
+int run_benchmarks(void);
+
+/* Function prototypes from keycache.c */
+extern unsigned int key_cache_ttl;
+int key_cache_lookup(const char *password, const uint8_t *salt, uint8_t version, uint8_t *file_key, uint8_t *meta_key);
+void key_cache_store(const char *password, const uint8_t *salt, uint8_t version, const uint8_t *file_key, const uint8_t *meta_key);
+void key_cache_clear(void);
+
+/* Function prototypes from stats.c */
+extern int stats_enabled;
+void stats_start(void);
+void stage_begin(StageTimer *timer);
+void stage_end(const StageTimer *timer, Stage stage, uint64_t bytes);
+int stats_report(const char *mode, int status, const char *json_path);
+
+/* Function prototypes from batch.c */
+int run_batch(const char *manifest, const char *prog_name);
+
+/* Function prototypes from seclume_main.c */
 void print_help(const char *prog_name);
+int run_command(int argc, char *argv[]);
 
 #endif /* SECLUME_H */
\ No newline at end of file
@@ -16,66 +16,145 @@
  */
 void print_help(const char *prog_name) {
     printf("Seclume: File Archiving Tool for Paranoidsz\n");
-    printf("Version: 1.0.5\n\n");
-    printf("Usage: %s [options] <mode> <archive.slm> <password> [files...]\n\n", prog_name);
+    printf("Version: %s\n\n", SECLUME_VERSION);
+    printf("Usage: %s [options] <mode> <archive.slm> <password> [files...]\n", prog_name);
+    printf("       %s [options] extract <archive.slm> <password> [paths...]\n", prog_name);
+    printf("       %s [options] verify <archive.slm> <password> [paths...]\n", prog_name);
+    printf("       %s [options] append <archive.slm> <password> <files...>\n", prog_name);
+    printf("       %s --batch <manifest>\n", prog_name);
+    printf("       %s --bench\n\n", prog_name);
     printf("Modes:\n");
     printf("  archive       Create an encrypted archive from files or directories\n");
-    printf("  extract       Extract files from an encrypted archive\n");
+    printf("  append        Add files or directories to an existing archive without rewriting its entries\n");
+    printf("  extract       Extract files from an encrypted archive (all, or only the given paths)\n");
+    printf("  verify        Check every header, metadata and data tag of an archive (all, or only the given paths) without writing files\n");
     printf("  list          List contents of an encrypted archive\n\n");
     printf("Options:\n");
     printf("  -h, --help              Display this help message and exit\n");
+    printf("  --batch <manifest>      Run every command line of the manifest (one per line, without the program name) in one process;\n");
+    printf("                           jobs share start-up, the archiving worker threads and their contexts, and the keys of archives several jobs open\n");
+    printf("  --bench                 Benchmark the codecs, AES-GCM and key derivation and print the results as JSON\n");
     printf("  -vv                     Enable debug output (detailed logging)\n");
     printf("  -f                      Force overwrite of existing files\n");
     printf("  -c, --comment <text>    Add a comment to the archive (archive mode only)\n");
     printf("  -d, --dry-run           Simulate archiving without writing to disk (archive mode only)\n");
     printf("  -vc, --view-comment     Display the archive comment before mode execution\n");
     printf("  -cl, --compression-level <0-9>  Set compression level (0 = no compression, 9 = max, default = 1)\n");
-    printf("  -ca, --compression-algo <zlib|lzma>  Set compression algorithm (default = lzma)\n");
+    printf("  -ca, --compression-algo <zlib|lzma|zstd|lz4|auto>  Set compression algorithm (default = lzma);\n");
+    printf("                           auto stores already compressed files and compresses the rest with %s\n",
+           codec_name(AUTO_CODEC));
     printf("  -wk, --weak-password    Allow weak passwords in archive mode (NOT RECOMMENDED)\n");
     printf("  -o, --output-dir <dir>  Specify output directory for extraction (archive/extract modes)\n");
-    printf("  -x, --exclude <patterns>  Comma-separated file patterns to exclude during archiving (e.g., *.log,*.txt)\n\n");
+    printf("  -x, --exclude <patterns>  Comma-separated file patterns to exclude during archiving (e.g., *.log,*.txt) (archive/append modes)\n");
+    printf("  -i, --include <patterns>  Comma-separated file or path patterns to extract, skipping all others (extract/verify modes)\n");
+    printf("  -j, --jobs <N>          Use N threads: directory scan and files in parallel when archiving, entries (or blocks of -bp archives) when extracting or verifying (archive/append/extract/verify modes, default = 1)\n");
+    printf("  -bp, --block-parallel   Split each file into independently compressed 4MB blocks spread over the -j threads (archive mode only)\n");
+    printf("  -dd, --dedup            Store identical content-defined chunks (16KB-256KB) once; files are compressed one at a time (archive mode only)\n");
+    printf("  -so, --solid            Pack files under 1MB into shared compressed 16MB blocks; files are compressed one at a time (archive mode only)\n");
+    printf("  -dt, --dict             Train a compression dictionary on the small input files and compress every file with it; for many similar small files with -ca zlib, zstd or auto (archive mode only)\n");
+    printf("  -inc, --incremental <base.slm>  Store only files changed since the base archive; the rest is extracted from it (archive mode only)\n");
+    printf("  -dio, --direct-io       Write extracted files with O_DIRECT, bypassing the page cache (extract mode only)\n");
+    printf("  -ur, --io-uring         Submit output writes through io_uring: extracted files, and archive entries written by the worker pool; needs a build with make URING=1 (archive/append/extract modes)\n");
+    printf("  -ao, --auth-only        Only authenticate the data, skipping decompression (verify mode only)\n");
+    printf("  -kc, --key-cache <seconds>  Keep derived keys in the session keyring for the given time, so later -kc runs on the same archive skip key derivation\n");
+    printf("  --stats-json <file>     Write per-stage times and byte counts of the run to a JSON file (-vv prints them)\n");
+    printf("  --stdin-name <name>     Filename recorded for standard input when a file argument is '-' (archive/append modes, default = %s)\n\n",
+           STDIN_ENTRY_NAME);
     printf("Examples:\n");
     printf("  Archive with zlib: %s -ca zlib archive output.slm MyPass123! file1.txt dir/\n", prog_name);
     printf("  High compression: %s -ca lzma -cl 9 archive output.slm MyPass123! dir/\n", prog_name);
+    printf("  Mixed media: %s -ca auto archive output.slm MyPass123! photos/ src/\n", prog_name);
     printf("  Add comment:       %s -c 'My archive' archive output.slm MyPass123! dir/\n", prog_name);
     printf("  Weak password:     %s -wk archive output.slm weakpass file1.txt\n", prog_name);
     printf("  Dry run:          %s -d archive output.slm MyPass123! dir/\n", prog_name);
     printf("  View comment:      %s -vc list output.slm MyPass123!\n", prog_name);
     printf("  Extract archive:   %s -o /path/to/output extract output.slm MyPass123!\n", prog_name);
+    printf("  Extract one file:  %s extract output.slm MyPass123! dir/config.ini\n", prog_name);
+    printf("  Extract by glob:   %s -i '*.conf,etc/*' extract output.slm MyPass123!\n", prog_name);
     printf("  Exclude files:     %s -x '*.log,*.txt' archive output.slm MyPass123! dir/\n", prog_name);
+    printf("  Parallel archive:  %s -j 8 -cl 9 archive output.slm MyPass123! dir/\n", prog_name);
+    printf("  Large file:        %s -j 8 -bp archive dump.slm MyPass123! dump.sql\n", prog_name);
+    printf("  Deduplicate:       %s -dd archive images.slm MyPass123! vm/\n", prog_name);
+    printf("  Many small files:  %s -so archive src.slm MyPass123! project/\n", prog_name);
+    printf("  Incremental:       %s -inc full.slm archive monday.slm MyPass123! dir/\n", prog_name);
+    printf("  Append new logs:   %s append logs.slm MyPass123! /var/log/app/2026-10-14.log\n", prog_name);
+    printf("  Pipe in and out:   tar c dir | %s --stdin-name dir.tar archive - MyPass123! - > dir.slm\n", prog_name);
+    printf("  Extract a stream:  %s extract - MyPass123! < dir.slm\n", prog_name);
+    printf("  Verify archive:    %s -j 4 verify output.slm MyPass123!\n", prog_name);
     printf("  List contents:     %s list output.slm MyPass123!\n", prog_name);
     printf("  Force overwrite:   %s -f extract output.slm MyPass123!\n", prog_name);
     printf("\nSecurity Features:\n");
     printf("  - Encryption: AES-256-GCM for file data, metadata, and comments\n");
-    printf("  - Key Derivation: PBKDF2 with SHA256 and 1,000,000 iterations\n");
+    printf("  - Key Derivation: PBKDF2 with SHA256 and 1,000,000 iterations, expanded into per-purpose keys with HKDF\n");
     printf("  - Header Protection: HMAC-SHA256 to prevent tampering\n");
-    printf("  - Compression: zlib or LZMA with customizable levels (0-9)\n");
+    printf("  - Compression: zlib, LZMA, zstd or LZ4 with customizable levels (0-9)\n");
     printf("  - Secure Random: Cryptographically secure salt and nonces\n");
     printf("  - Permissions: Preserves and restores POSIX file permissions (Unix-like systems)\n");
     printf("\nNotes:\n");
     printf("  - Basic progress output is enabled by default\n");
     printf("  - Supports recursive directory archiving\n");
-    printf("  - Maximum file size: 10GB per file\n");
-    printf("  - Maximum files: %d per archive\n", MAX_FILES);
+    printf("  - Maximum file size: 10GB per file; sparse files up to 16TB with up to 10GB of data\n");
+    printf("  - Holes of sparse files are skipped when archiving and recreated on extraction (except in -bp, -dd and streamed archives)\n");
+    printf("  - Maximum files: %d per archive; the format counts entries in 32 bits, and wider counts are not supported\n", MAX_FILES);
     printf("  - Maximum comment length: %d bytes\n", MAX_COMMENT - AES_NONCE_SIZE - AES_TAG_SIZE);
     printf("  - Maximum output directory length: %d bytes\n", MAX_OUTDIR - AES_NONCE_SIZE - AES_TAG_SIZE);
     printf("  - Maximum exclude patterns: %d, each up to %d bytes\n", MAX_EXCLUDE_PATTERNS, MAX_PATTERN_LEN - 1);
-    printf("  - Archiving or extracting large files requires significant memory (e.g., 11GB+ for a 10GB file)\n");
+    printf("  - Archiving and extraction stream files in 1MB chunks, so memory use does not depend on file size\n");
+    printf("  - An archive of '-' is written to standard output or, in extract and verify modes, read from standard input\n");
     printf("  - Passwords must be strong (8+ characters, mixed case, digits, symbols) unless -wk/--weak-password is used\n");
     printf("  - Using -wk/--weak-password is not recommended for security\n");
     printf("  - If the specified output directory does not exist during extraction, the current directory is used\n");
-    printf("  - Exclude patterns apply to filenames only (e.g., *.log excludes mydir/file.log)\n");
+    printf("  - Exclude patterns apply to file and directory names (e.g., *.log excludes mydir/file.log, build skips every build/ subtree)\n");
+    printf("  - An exclude pattern ending in '/' matches directories only (e.g., node_modules/); -x may be repeated\n");
+    printf("  - Directories are scanned on the -j threads; files of each directory argument are archived in sorted path order\n");
     printf("\nReport bugs to: lone_kuroshiro@protonmail.com\n");
 }
 
 /**
- * @brief Main function for the Seclume tool.
+ * @brief -x or -i patterns of one command line, pointing into argv.
+ *
+ * Grown as the options are parsed, so a command line (and every batch job)
+ * only holds as many pointers as it has patterns.
+ */
+typedef struct {
+    const char **items; /**< Patterns */
+    int count;          /**< Number of patterns */
+    int cap;            /**< Allocated slots in items */
+} PatternList;
+
+/**
+ * @brief Adds a pattern to a list, growing it as needed.
+ * @param list Pattern list.
+ * @param pattern Pattern (not copied).
+ * @return 0 on success, 1 on failure.
+ */
+static int pattern_list_add(PatternList *list, const char *pattern) {
+    if (list->count == list->cap) {
+        int cap = list->cap ? list->cap * 2 : 16;
+        const char **items = realloc(list->items, cap * sizeof(*items));
+        if (!items) {
+            fprintf(stderr, "Error: Memory allocation failed for patterns\n");
+            return 1;
+        }
+        list->items = items;
+        list->cap = cap;
+    }
+    list->items[list->count++] = pattern;
+    return 0;
+}
+
+/**
+ * @brief Parses a command line and runs its mode; see run_command().
  * @param argc Number of command-line arguments.
- * @param argv Array of command-line arguments.
+ * @param argv Array of command-line arguments (argv[0] is the program name).
+ * @param excludes Output -x patterns (empty on entry, freed by the caller).
+ * @param includes Output -i patterns (empty on entry, freed by the caller).
  * @return 0 on success, 1 on failure.
  */
-int main(int argc, char *argv[]) {
-    OPENSSL_init_crypto(OPENSSL_INIT_LOAD_CRYPTO_STRINGS | OPENSSL_INIT_ADD_ALL_CIPHERS | OPENSSL_INIT_ADD_ALL_DIGESTS, NULL);
+static int parse_and_run(int argc, char *argv[], PatternList *excludes, PatternList *includes) {
+    verbosity = VERBOSE_BASIC;
+    key_cache_ttl = 0;
+    stats_enabled = 0;
     int optind = 1;
     int force = 0;
     const char *comment = NULL;
@@ -85,12 +164,30 @@ int main(int argc, char *argv[]) {
     CompressionAlgo compression_algo = COMPRESSION_LZMA;
     int weak_password = 0;
     const char *outdir = NULL;
-    const char *exclude_patterns[MAX_EXCLUDE_PATTERNS];
-    int exclude_pattern_count = 0;
+    int jobs = 1;
+    int block_parallel = 0;
+    int dedup = 0;
+    int solid = 0;
+    int train_dict = 0;
+    int direct_io = 0;
+    int use_uring = 0;
+    int auth_only = 0;
+    const char *base_archive = NULL;
+    const char *stats_path = NULL;
+    const char *stdin_name = NULL;
     while (optind < argc && argv[optind][0] == '-') {
         if (strcmp(argv[optind], "-h") == 0 || strcmp(argv[optind], "--help") == 0) {
             print_help(argv[0]);
             return 0;
+        } else if (strcmp(argv[optind], "--bench") == 0) {
+            return run_benchmarks();
+        } else if (strcmp(argv[optind], "--batch") == 0) {
+            if (optind + 1 >= argc) {
+                fprintf(stderr, "Error: --batch requires a manifest file\n");
+                print_help(argv[0]);
+                return 1;
+            }
+            return run_batch(argv[optind + 1], argv[0]);
         } else if (strcmp(argv[optind], "-vv") == 0) {
             verbosity = VERBOSE_DEBUG;
         } else if (strcmp(argv[optind], "-f") == 0) {
@@ -121,7 +218,7 @@ int main(int argc, char *argv[]) {
             }
         } else if (strcmp(argv[optind], "-ca") == 0 || strcmp(argv[optind], "--compression-algo") == 0) {
             if (optind + 1 >= argc) {
-                fprintf(stderr, "Error: -ca/--compression-algo requires a value (zlib or lzma)\n");
+                fprintf(stderr, "Error: -ca/--compression-algo requires a value (zlib, lzma, zstd, lz4 or auto)\n");
                 print_help(argv[0]);
                 return 1;
             }
@@ -130,8 +227,20 @@ int main(int argc, char *argv[]) {
                 compression_algo = COMPRESSION_ZLIB;
             } else if (strcmp(argv[optind], "lzma") == 0) {
                 compression_algo = COMPRESSION_LZMA;
+            } else if (strcmp(argv[optind], "zstd") == 0) {
+                compression_algo = COMPRESSION_ZSTD;
+            } else if (strcmp(argv[optind], "lz4") == 0) {
+                compression_algo = COMPRESSION_LZ4;
+            } else if (strcmp(argv[optind], "auto") == 0) {
+                compression_algo = COMPRESSION_AUTO;
             } else {
-                fprintf(stderr, "Error: Invalid compression algorithm (must be zlib or lzma)\n");
+                fprintf(stderr, "Error: Invalid compression algorithm (must be zlib, lzma, zstd, lz4 or auto)\n");
+                print_help(argv[0]);
+                return 1;
+            }
+            if (!codec_available(compression_algo)) {
+                fprintf(stderr, "Error: %s support is not compiled in (rebuild with make %s=1)\n",
+                        codec_name(compression_algo), compression_algo == COMPRESSION_ZSTD ? "ZSTD" : "LZ4");
                 print_help(argv[0]);
                 return 1;
             }
@@ -156,7 +265,7 @@ int main(int argc, char *argv[]) {
             }
             char *patterns = argv[++optind];
             char *pattern = strtok(patterns, ",");
-            while (pattern && exclude_pattern_count < MAX_EXCLUDE_PATTERNS) {
+            while (pattern && excludes->count < MAX_EXCLUDE_PATTERNS) {
                 if (strlen(pattern) >= MAX_PATTERN_LEN) {
                     fprintf(stderr, "Error: Exclude pattern too long (max %d bytes): %s\n", MAX_PATTERN_LEN - 1, pattern);
                     return 1;
@@ -165,13 +274,99 @@ int main(int argc, char *argv[]) {
                     fprintf(stderr, "Error: Exclude pattern contains path traversal: %s\n", pattern);
                     return 1;
                 }
-                exclude_patterns[exclude_pattern_count++] = pattern;
+                if (pattern_list_add(excludes, pattern) != 0) return 1;
                 pattern = strtok(NULL, ",");
             }
             if (pattern) {
                 fprintf(stderr, "Error: Too many exclude patterns (max %d)\n", MAX_EXCLUDE_PATTERNS);
                 return 1;
             }
+        } else if (strcmp(argv[optind], "-i") == 0 || strcmp(argv[optind], "--include") == 0) {
+            if (optind + 1 >= argc) {
+                fprintf(stderr, "Error: -i/--include requires a comma-separated list of patterns\n");
+                print_help(argv[0]);
+                return 1;
+            }
+            char *patterns = argv[++optind];
+            char *pattern = strtok(patterns, ",");
+            while (pattern && includes->count < MAX_EXCLUDE_PATTERNS) {
+                if (strlen(pattern) >= MAX_PATTERN_LEN) {
+                    fprintf(stderr, "Error: Include pattern too long (max %d bytes): %s\n", MAX_PATTERN_LEN - 1, pattern);
+                    return 1;
+                }
+                if (pattern_list_add(includes, pattern) != 0) return 1;
+                pattern = strtok(NULL, ",");
+            }
+            if (pattern) {
+                fprintf(stderr, "Error: Too many include patterns (max %d)\n", MAX_EXCLUDE_PATTERNS);
+                return 1;
+            }
+        } else if (strcmp(argv[optind], "-j") == 0 || strcmp(argv[optind], "--jobs") == 0) {
+            if (optind + 1 >= argc) {
+                fprintf(stderr, "Error: -j/--jobs requires a number of threads\n");
+                print_help(argv[0]);
+                return 1;
+            }
+            char *endptr;
+            jobs = strtol(argv[++optind], &endptr, 10);
+            if (*endptr != '\0' || jobs < 1 || jobs > MAX_JOBS) {
+                fprintf(stderr, "Error: Invalid number of jobs (must be 1-%d)\n", MAX_JOBS);
+                print_help(argv[0]);
+                return 1;
+            }
+        } else if (strcmp(argv[optind], "-bp") == 0 || strcmp(argv[optind], "--block-parallel") == 0) {
+            block_parallel = 1;
+        } else if (strcmp(argv[optind], "-dd") == 0 || strcmp(argv[optind], "--dedup") == 0) {
+            dedup = 1;
+        } else if (strcmp(argv[optind], "-so") == 0 || strcmp(argv[optind], "--solid") == 0) {
+            solid = 1;
+        } else if (strcmp(argv[optind], "-dt") == 0 || strcmp(argv[optind], "--dict") == 0) {
+            train_dict = 1;
+        } else if (strcmp(argv[optind], "-dio") == 0 || strcmp(argv[optind], "--direct-io") == 0) {
+            direct_io = 1;
+        } else if (strcmp(argv[optind], "-ur") == 0 || strcmp(argv[optind], "--io-uring") == 0) {
+#ifndef HAVE_IO_URING
+            fprintf(stderr, "Error: io_uring support is not compiled in (rebuild with make URING=1)\n");
+            return 1;
+#endif
+            use_uring = 1;
+        } else if (strcmp(argv[optind], "-ao") == 0 || strcmp(argv[optind], "--auth-only") == 0) {
+            auth_only = 1;
+        } else if (strcmp(argv[optind], "-inc") == 0 || strcmp(argv[optind], "--incremental") == 0) {
+            if (optind + 1 >= argc) {
+                fprintf(stderr, "Error: -inc/--incremental requires a base archive\n");
+                print_help(argv[0]);
+                return 1;
+            }
+            base_archive = argv[++optind];
+        } else if (strcmp(argv[optind], "-kc") == 0 || strcmp(argv[optind], "--key-cache") == 0) {
+            if (optind + 1 >= argc) {
+                fprintf(stderr, "Error: -kc/--key-cache requires a lifetime in seconds\n");
+                print_help(argv[0]);
+                return 1;
+            }
+            char *endptr;
+            long ttl = strtol(argv[++optind], &endptr, 10);
+            if (*endptr != '\0' || ttl < 1 || ttl > MAX_KEY_CACHE_TTL) {
+                fprintf(stderr, "Error: Invalid key cache lifetime (must be 1-%d seconds)\n", MAX_KEY_CACHE_TTL);
+                print_help(argv[0]);
+                return 1;
+            }
+            key_cache_ttl = (unsigned int)ttl;
+        } else if (strcmp(argv[optind], "--stats-json") == 0) {
+            if (optind + 1 >= argc) {
+                fprintf(stderr, "Error: --stats-json requires an output file\n");
+                print_help(argv[0]);
+                return 1;
+            }
+            stats_path = argv[++optind];
+        } else if (strcmp(argv[optind], "--stdin-name") == 0) {
+            if (optind + 1 >= argc) {
+                fprintf(stderr, "Error: --stdin-name requires a filename\n");
+                print_help(argv[0]);
+                return 1;
+            }
+            stdin_name = argv[++optind];
         } else {
             fprintf(stderr, "Error: Unknown option %s\n", argv[optind]);
             print_help(argv[0]);
@@ -187,8 +382,9 @@ int main(int argc, char *argv[]) {
     const char *mode = argv[optind];
     const char *archive = argv[optind + 1];
     const char *password = argv[optind + 2];
-    if (strcmp(mode, "archive") != 0 && strcmp(mode, "extract") != 0 && strcmp(mode, "list") != 0) {
-        fprintf(stderr, "Error: Invalid mode. Use 'archive', 'extract', or 'list'\n");
+    int adding = strcmp(mode, "archive") == 0 || strcmp(mode, "append") == 0;
+    if (!adding && strcmp(mode, "extract") != 0 && strcmp(mode, "verify") != 0 && strcmp(mode, "list") != 0) {
+        fprintf(stderr, "Error: Invalid mode. Use 'archive', 'append', 'extract', 'verify', or 'list'\n");
         print_help(argv[0]);
         return 1;
     }
@@ -217,96 +413,207 @@ int main(int argc, char *argv[]) {
         print_help(argv[0]);
         return 1;
     }
-    if (strcmp(mode, "list") == 0 && outdir) {
-        fprintf(stderr, "Error: -o/--output-dir is not valid in list mode\n");
+    if ((strcmp(mode, "list") == 0 || strcmp(mode, "verify") == 0 || strcmp(mode, "append") == 0) && outdir) {
+        fprintf(stderr, "Error: -o/--output-dir is not valid in %s mode\n", mode);
+        print_help(argv[0]);
+        return 1;
+    }
+    if (!adding && excludes->count > 0) {
+        fprintf(stderr, "Error: -x/--exclude is only valid in archive and append modes\n");
         print_help(argv[0]);
         return 1;
     }
-    if (strcmp(mode, "archive") != 0 && exclude_pattern_count > 0) {
-        fprintf(stderr, "Error: -x/--exclude is only valid in archive mode\n");
+    if (strcmp(mode, "extract") != 0 && strcmp(mode, "verify") != 0 && includes->count > 0) {
+        fprintf(stderr, "Error: -i/--include is only valid in extract and verify modes\n");
         print_help(argv[0]);
         return 1;
     }
-    if (strcmp(mode, "archive") == 0) {
+    if (strcmp(mode, "list") == 0 && jobs != 1) {
+        fprintf(stderr, "Error: -j/--jobs is not valid in list mode\n");
+        print_help(argv[0]);
+        return 1;
+    }
+    if (strcmp(mode, "archive") != 0 && block_parallel) {
+        fprintf(stderr, "Error: -bp/--block-parallel is only valid in archive mode\n");
+        print_help(argv[0]);
+        return 1;
+    }
+    if (strcmp(mode, "archive") != 0 && dedup) {
+        fprintf(stderr, "Error: -dd/--dedup is only valid in archive mode\n");
+        print_help(argv[0]);
+        return 1;
+    }
+    if (dedup && block_parallel) {
+        fprintf(stderr, "Error: -dd/--dedup cannot be combined with -bp/--block-parallel\n");
+        print_help(argv[0]);
+        return 1;
+    }
+    if (strcmp(mode, "archive") != 0 && solid) {
+        fprintf(stderr, "Error: -so/--solid is only valid in archive mode\n");
+        print_help(argv[0]);
+        return 1;
+    }
+    if (solid && (block_parallel || dedup)) {
+        fprintf(stderr, "Error: -so/--solid cannot be combined with -bp/--block-parallel or -dd/--dedup\n");
+        print_help(argv[0]);
+        return 1;
+    }
+    if (strcmp(mode, "archive") != 0 && train_dict) {
+        fprintf(stderr, "Error: -dt/--dict is only valid in archive mode\n");
+        print_help(argv[0]);
+        return 1;
+    }
+    if (train_dict && (block_parallel || dedup || solid)) {
+        fprintf(stderr, "Error: -dt/--dict cannot be combined with -bp/--block-parallel, -dd/--dedup or -so/--solid\n");
+        print_help(argv[0]);
+        return 1;
+    }
+    if (train_dict && compression_algo != COMPRESSION_ZLIB && compression_algo != COMPRESSION_ZSTD &&
+        compression_algo != COMPRESSION_AUTO) {
+        fprintf(stderr, "Error: -dt/--dict needs -ca zlib, zstd or auto\n");
+        print_help(argv[0]);
+        return 1;
+    }
+    if (strcmp(mode, "archive") != 0 && base_archive) {
+        fprintf(stderr, "Error: -inc/--incremental is only valid in archive mode\n");
+        print_help(argv[0]);
+        return 1;
+    }
+    if (strcmp(mode, "extract") != 0 && direct_io) {
+        fprintf(stderr, "Error: -dio/--direct-io is only valid in extract mode\n");
+        print_help(argv[0]);
+        return 1;
+    }
+    if (strcmp(mode, "extract") != 0 && strcmp(mode, "archive") != 0 && strcmp(mode, "append") != 0 && use_uring) {
+        fprintf(stderr, "Error: -ur/--io-uring is only valid in archive, append and extract modes\n");
+        print_help(argv[0]);
+        return 1;
+    }
+    if (strcmp(mode, "verify") != 0 && auth_only) {
+        fprintf(stderr, "Error: -ao/--auth-only is only valid in verify mode\n");
+        print_help(argv[0]);
+        return 1;
+    }
+    if (!adding && stdin_name) {
+        fprintf(stderr, "Error: --stdin-name is only valid in archive and append modes\n");
+        print_help(argv[0]);
+        return 1;
+    }
+    if (strcmp(mode, "list") == 0 && strcmp(archive, "-") == 0) {
+        fprintf(stderr, "Error: list mode needs a seekable archive; extract reads archives from standard input\n");
+        return 1;
+    }
+    if ((strcmp(mode, "extract") == 0 || strcmp(mode, "verify") == 0) && view_comment_flag && strcmp(archive, "-") == 0) {
+        fprintf(stderr, "Error: -vc/--view-comment cannot be used with an archive read from standard input\n");
+        return 1;
+    }
+    if (stats_path || verbosity >= VERBOSE_DEBUG) stats_start();
+    int result = 1;
+    if (adding) {
         if (argc - optind < 4) {
             fprintf(stderr, "Error: Need at least one file or directory to archive\n");
             return 1;
         }
-        char **file_list = calloc(MAX_FILES, sizeof(char *));
-        if (!file_list) {
-            fprintf(stderr, "Error: Memory allocation failed for file list\n");
-            return 1;
-        }
-        int file_count = 0;
+        ExcludeSet exclude;
+        if (exclude_set_compile(&exclude, excludes->items, excludes->count) != 0) return 1;
+        FileList file_list;
+        file_list_init(&file_list);
         for (int i = optind + 3; i < argc; i++) {
             struct stat st;
+            if (strcmp(argv[i], "-") == 0) {
+                if (file_list_add(&file_list, argv[i]) != 0) {
+                    file_list_free(&file_list);
+                    exclude_set_free(&exclude);
+                    return 1;
+                }
+                continue;
+            }
             if (stat(argv[i], &st) != 0) {
                 fprintf(stderr, "Error: Cannot stat %s: %s\n", argv[i], strerror(errno));
-                for (int j = 0; j < file_count; j++) free(file_list[j]);
-                free(file_list);
+                file_list_free(&file_list);
+                exclude_set_free(&exclude);
                 return 1;
             }
             if (S_ISDIR(st.st_mode)) {
-                if (collect_files(argv[i], &file_list, &file_count, MAX_FILES, exclude_patterns, exclude_pattern_count) != 0) {
-                    for (int j = 0; j < file_count; j++) free(file_list[j]);
-                    free(file_list);
+                if (collect_files(argv[i], &file_list, &exclude, jobs) != 0) {
+                    file_list_free(&file_list);
+                    exclude_set_free(&exclude);
                     return 1;
                 }
             } else if (S_ISREG(st.st_mode)) {
-                if (file_count >= MAX_FILES) {
-                    fprintf(stderr, "Error: Too many files (max %d)\n", MAX_FILES);
-                    for (int j = 0; j < file_count; j++) free(file_list[j]);
-                    free(file_list);
-                    return 1;
+                const char *filename = strrchr(argv[i], '/');
+                filename = filename ? filename + 1 : argv[i];
+                int match = exclude_set_match(&exclude, filename, 0);
+                if (match >= 0) {
+                    verbose_print(VERBOSE_BASIC, "Excluding file: %s (matches pattern %s)", argv[i], excludes->items[match]);
+                    continue;
                 }
-                if (exclude_pattern_count > 0) {
-                    const char *filename = strrchr(argv[i], '/');
-                    filename = filename ? filename + 1 : argv[i];
-                    int exclude = 0;
-                    for (int j = 0; j < exclude_pattern_count; j++) {
-                        if (matches_glob_pattern(filename, exclude_patterns[j])) {
-                            verbose_print(VERBOSE_BASIC, "Excluding file: %s (matches pattern %s)", argv[i], exclude_patterns[j]);
-                            exclude = 1;
-                            break;
-                        }
-                    }
-                    if (exclude) continue;
-                }
-                file_list[file_count] = strdup(argv[i]);
-                if (!file_list[file_count]) {
-                    fprintf(stderr, "Error: Memory allocation failed for file path\n");
-                    for (int j = 0; j < file_count; j++) free(file_list[j]);
-                    free(file_list);
+                if (file_list_add(&file_list, argv[i]) != 0) {
+                    file_list_free(&file_list);
+                    exclude_set_free(&exclude);
                     return 1;
                 }
-                file_count++;
                 verbose_print(VERBOSE_DEBUG, "Added file: %s", argv[i]);
             } else {
                 fprintf(stderr, "Error: %s is not a regular file or directory\n", argv[i]);
-                for (int j = 0; j < file_count; j++) free(file_list[j]);
-                free(file_list);
+                file_list_free(&file_list);
+                exclude_set_free(&exclude);
                 return 1;
             }
         }
-        if (file_count == 0) {
+        exclude_set_free(&exclude);
+        if (file_list.count == 0) {
             fprintf(stderr, "Error: No files to archive after exclusions\n");
-            free(file_list);
+            file_list_free(&file_list);
             return 1;
         }
-        int result = archive_files(archive, (const char **)file_list, file_count, password, force, compression_level, compression_algo, comment, outdir, dry_run, weak_password, exclude_patterns, exclude_pattern_count);
-        for (int i = 0; i < file_count; i++) free(file_list[i]);
-        free(file_list);
-        return result;
-    } else if (strcmp(mode, "extract") == 0) {
-        if (view_comment_flag && view_comment(archive, password) != 0) {
-            return 1;
+        if (strcmp(mode, "append") == 0) {
+            result = append_files(archive, (const char **)file_list.paths, file_list.count, password, jobs,
+                                  stdin_name ? stdin_name : STDIN_ENTRY_NAME, use_uring);
+        } else {
+            result = archive_files(archive, (const char **)file_list.paths, file_list.count, password, force, compression_level, compression_algo, comment, outdir, dry_run, weak_password, jobs, block_parallel, dedup, solid, train_dict, base_archive, stdin_name ? stdin_name : STDIN_ENTRY_NAME, use_uring);
         }
-        return extract_files(archive, password, outdir, force);
+        file_list_free(&file_list);
+    } else if (strcmp(mode, "extract") == 0) {
+        result = (view_comment_flag && view_comment(archive, password) != 0) ||
+                 extract_files(archive, password, outdir, force, jobs, (const char **)argv + optind + 3, argc - optind - 3,
+                               includes->items, includes->count, direct_io, use_uring) != 0;
+    } else if (strcmp(mode, "verify") == 0) {
+        result = (view_comment_flag && view_comment(archive, password) != 0) ||
+                 verify_files(archive, password, jobs, (const char **)argv + optind + 3, argc - optind - 3,
+                              includes->items, includes->count, auth_only) != 0;
     } else if (strcmp(mode, "list") == 0) {
-        if (view_comment_flag && view_comment(archive, password) != 0) {
-            return 1;
-        }
-        return list_files(archive, password);
+        result = (view_comment_flag && view_comment(archive, password) != 0) || list_files(archive, password) != 0;
     }
-    return 1;
+    if (stats_enabled && stats_report(mode, result, stats_path) != 0) result = 1;
+    return result;
+}
+
+/**
+ * @brief Parses a command line and runs its mode; used for the program's own
+ *        arguments and for every job of a batch manifest.
+ * @param argc Number of command-line arguments.
+ * @param argv Array of command-line arguments (argv[0] is the program name).
+ * @return 0 on success, 1 on failure.
+ */
+int run_command(int argc, char *argv[]) {
+    PatternList excludes = { NULL, 0, 0 };
+    PatternList includes = { NULL, 0, 0 };
+    int result = parse_and_run(argc, argv, &excludes, &includes);
+    free(excludes.items);
+    free(includes.items);
+    return result;
+}
+
+/**
+ * @brief Main function for the Seclume tool.
+ * @param argc Number of command-line arguments.
+ * @param argv Array of command-line arguments.
+ * @return 0 on success, 1 on failure.
+ */
+int main(int argc, char *argv[]) {
+    OPENSSL_init_crypto(OPENSSL_INIT_LOAD_CRYPTO_STRINGS | OPENSSL_INIT_ADD_ALL_CIPHERS | OPENSSL_INIT_ADD_ALL_DIGESTS, NULL);
+    int result = run_command(argc, argv);
+    key_cache_clear();
+    return result;
 }
\ No newline at end of file
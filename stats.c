@@ -0,0 +1,125 @@
+/**
+ * @file stats.c
+ * @brief Per-stage timers and byte counters of a run, reported with -vv and --stats-json.
+ */
+
+#include "seclume.h"
+#include <string.h>
+#include <time.h>
+
+/** @brief Set when stage timers are collected (stats_start() was called) */
+int stats_enabled = 0;
+
+/**
+ * @brief Totals of one stage, summed over every thread of the run.
+ */
+typedef struct {
+    uint64_t wall_ns; /**< Wall-clock time spent in the stage */
+    uint64_t cpu_ns;  /**< CPU time of the threads while in the stage */
+    uint64_t bytes;   /**< Bytes processed */
+    uint64_t calls;   /**< Number of timed calls */
+} StageTotal;
+
+/** @brief Stage totals of the run */
+static StageTotal stage_totals[STAGE_COUNT];
+/** @brief Start of the run (wall clock and process CPU) */
+static StageTimer run_timer;
+
+/** @brief Stage names in reports, indexed by Stage */
+static const char *const stage_names[STAGE_COUNT] = {
+    "kdf", "walk", "read", "hash", "compress", "encrypt", "decrypt", "decompress", "write",
+};
+
+/**
+ * @brief Reads a clock in nanoseconds.
+ * @param clock Clock to read.
+ * @return Current time of the clock.
+ */
+static uint64_t clock_ns(clockid_t clock) {
+    struct timespec ts;
+    clock_gettime(clock, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/**
+ * @brief Enables the stage timers and marks the start of the run; call before any worker thread starts.
+ */
+void stats_start(void) {
+    memset(stage_totals, 0, sizeof(stage_totals));
+    stats_enabled = 1;
+    run_timer.wall_ns = clock_ns(CLOCK_MONOTONIC);
+    run_timer.cpu_ns = clock_ns(CLOCK_PROCESS_CPUTIME_ID);
+}
+
+/**
+ * @brief Starts timing a stage on the calling thread.
+ * @param timer Timer to start.
+ */
+void stage_begin(StageTimer *timer) {
+    if (!stats_enabled) return;
+    timer->wall_ns = clock_ns(CLOCK_MONOTONIC);
+    timer->cpu_ns = clock_ns(CLOCK_THREAD_CPUTIME_ID);
+}
+
+/**
+ * @brief Adds the time since stage_begin() and the bytes processed to a stage's totals.
+ * @param timer Timer started by the calling thread.
+ * @param stage Stage the time was spent in.
+ * @param bytes Bytes processed.
+ */
+void stage_end(const StageTimer *timer, Stage stage, uint64_t bytes) {
+    if (!stats_enabled) return;
+    StageTotal *total = &stage_totals[stage];
+    __atomic_fetch_add(&total->wall_ns, clock_ns(CLOCK_MONOTONIC) - timer->wall_ns, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&total->cpu_ns, clock_ns(CLOCK_THREAD_CPUTIME_ID) - timer->cpu_ns, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&total->bytes, bytes, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&total->calls, 1, __ATOMIC_RELAXED);
+}
+
+/**
+ * @brief Prints the stage totals (-vv) and writes them as JSON.
+ *
+ * Stage times are summed over threads, so with -j they can exceed the wall
+ * time of the run. Stages that were never entered are left out.
+ *
+ * @param mode Mode of the run (archive, extract or list).
+ * @param status Exit status of the run.
+ * @param json_path File to write the JSON report to, or NULL.
+ * @return 0 on success, 1 if the report could not be written.
+ */
+int stats_report(const char *mode, int status, const char *json_path) {
+    double wall = (clock_ns(CLOCK_MONOTONIC) - run_timer.wall_ns) / 1e9;
+    double cpu = (clock_ns(CLOCK_PROCESS_CPUTIME_ID) - run_timer.cpu_ns) / 1e9;
+    verbose_print(VERBOSE_DEBUG, "Run statistics (%s): %.3fs wall, %.3fs CPU", mode, wall, cpu);
+    for (int s = 0; s < STAGE_COUNT; s++) {
+        const StageTotal *t = &stage_totals[s];
+        if (t->calls == 0) continue;
+        verbose_print(VERBOSE_DEBUG, "  %-10s %9.3fs wall %9.3fs CPU %14lu bytes %9lu calls %10.1f MB/s", stage_names[s],
+                      t->wall_ns / 1e9, t->cpu_ns / 1e9, (unsigned long)t->bytes, (unsigned long)t->calls,
+                      t->wall_ns ? t->bytes * 1e3 / t->wall_ns : 0.0);
+    }
+    if (!json_path) return 0;
+    FILE *out = fopen(json_path, "w");
+    if (!out) {
+        fprintf(stderr, "Error: Cannot open statistics file %s\n", json_path);
+        return 1;
+    }
+    fprintf(out, "{\n  \"mode\": \"%s\",\n  \"status\": %d,\n  \"wall_s\": %.6f,\n  \"cpu_s\": %.6f,\n  \"stages\": {",
+            mode, status, wall, cpu);
+    int first = 1;
+    for (int s = 0; s < STAGE_COUNT; s++) {
+        const StageTotal *t = &stage_totals[s];
+        if (t->calls == 0) continue;
+        fprintf(out, "%s\n    \"%s\": {\"wall_s\": %.6f, \"cpu_s\": %.6f, \"bytes\": %lu, \"calls\": %lu, \"mbps\": %.1f}",
+                first ? "" : ",", stage_names[s], t->wall_ns / 1e9, t->cpu_ns / 1e9, (unsigned long)t->bytes,
+                (unsigned long)t->calls, t->wall_ns ? t->bytes * 1e3 / t->wall_ns : 0.0);
+        first = 0;
+    }
+    fprintf(out, "\n  }\n}\n");
+    if (fclose(out) != 0) {
+        fprintf(stderr, "Error: Failed to write statistics file %s\n", json_path);
+        return 1;
+    }
+    verbose_print(VERBOSE_DEBUG, "Wrote statistics to %s", json_path);
+    return 0;
+}
@@ -0,0 +1,72 @@
+#!/bin/bash
+# Append test: adds files and standard input to an archive and extracts the
+# result, and checks that names already in the archive or given twice in one
+# run are refused without changing the archive, that a second append works
+# and an appended archive cannot be extracted from standard input, and that
+# an append killed midway leaves the old archive intact in front of the
+# partial one, with no valid trailer until it is truncated back.
+# Usage: tests/append.sh <seclume binary>
+set -u
+B=$(realpath "$1")
+PW='Passw0rd!x'
+T=$(mktemp -d)
+trap 'rm -rf "$T"' EXIT
+fail=0
+cd "$T" || exit 1
+mkdir -p d/sub
+for i in 1 2 3 4; do seq "$i" 20000 > "d/$i"; done
+head -c 400000 /dev/urandom > d/sub/rand.bin
+echo "from stdin" > stdin.in
+for algo in zlib lzma; do
+    a="a_$algo.slm"
+    "$B" -ca "$algo" archive "$a" "$PW" d/1 d/2 >/dev/null 2>log || { echo "FAIL: archive ($algo)"; cat log; fail=1; continue; }
+    "$B" --stdin-name piped.txt append "$a" "$PW" d/3 d/sub - < stdin.in >/dev/null 2>log ||
+        { echo "FAIL: append ($algo)"; cat log; fail=1; continue; }
+    cp "$a" before.slm
+    "$B" append "$a" "$PW" d/2 >/dev/null 2>log && { echo "FAIL: name already in the archive accepted ($algo)"; fail=1; }
+    grep -q "Error: d/2 is already in archive" log || { echo "FAIL: no error for a name in the archive ($algo)"; cat log; fail=1; }
+    "$B" append "$a" "$PW" d/4 d/4 >/dev/null 2>log && { echo "FAIL: name given twice accepted ($algo)"; fail=1; }
+    grep -q "Error: d/4 is already in archive" log || { echo "FAIL: no error for a name given twice ($algo)"; cat log; fail=1; }
+    cmp -s before.slm "$a" || { echo "FAIL: refused append changed the archive ($algo)"; fail=1; }
+    [ "$("$B" list "$a" "$PW" 2>/dev/null | grep -c ' d/\| piped.txt')" = 5 ] || { echo "FAIL: list after append ($algo)"; fail=1; }
+    "$B" verify "$a" "$PW" >/dev/null 2>log || { echo "FAIL: verify after append ($algo)"; cat log; fail=1; }
+    # Serial extraction goes through the index too, past the superseded one
+    for j in 1 2; do
+        rm -rf out && mkdir out
+        if "$B" -j "$j" -o out extract "$a" "$PW" >/dev/null 2>log; then
+            for f in d/1 d/2 d/3 d/sub/rand.bin; do
+                cmp -s "$f" "out/$f" || { echo "FAIL: $f differs ($algo, -j $j)"; fail=1; }
+            done
+            cmp -s stdin.in out/piped.txt || { echo "FAIL: appended standard input differs ($algo, -j $j)"; fail=1; }
+            [ -e out/d/4 ] && { echo "FAIL: refused file extracted ($algo, -j $j)"; fail=1; }
+        else
+            echo "FAIL: extract after append ($algo, -j $j)"; cat log; fail=1
+        fi
+    done
+    "$B" append "$a" "$PW" d/4 >/dev/null 2>log || { echo "FAIL: second append ($algo)"; cat log; fail=1; }
+    [ "$("$B" list "$a" "$PW" 2>/dev/null | grep -c ' d/\| piped.txt')" = 6 ] || { echo "FAIL: list after second append ($algo)"; fail=1; }
+    rm -rf out && mkdir out
+    "$B" -o out extract - "$PW" < "$a" >/dev/null 2>log && { echo "FAIL: appended archive extracted from a pipe ($algo)"; fail=1; }
+    grep -q "Error: 4 files were appended to the archive" log || { echo "FAIL: no error for a piped appended archive ($algo)"; cat log; fail=1; }
+done
+# An append killed while it writes must leave the old archive intact in the first bytes of the file
+"$B" archive k.slm "$PW" d/1 >/dev/null 2>&1
+cp k.slm before.slm
+mkfifo pipe
+"$B" append k.slm "$PW" - < pipe >/dev/null 2>&1 &
+pid=$!
+disown $pid
+exec 3>pipe
+head -c 3000000 /dev/urandom >&3
+kill -9 $pid
+while kill -0 $pid 2>/dev/null; do sleep 0.1; done
+exec 3>&-
+size=$(stat -c %s before.slm)
+[ "$(stat -c %s k.slm)" -gt "$size" ] || { echo "FAIL: killed append wrote nothing past the old archive"; fail=1; }
+cmp -s -n "$size" before.slm k.slm || { echo "FAIL: killed append changed the old archive"; fail=1; }
+"$B" list k.slm "$PW" >/dev/null 2>log && { echo "FAIL: uncommitted append accepted"; fail=1; }
+grep -q "Error: Invalid archive trailer" log || { echo "FAIL: no trailer error for an uncommitted append"; cat log; fail=1; }
+truncate -s "$size" k.slm
+"$B" verify k.slm "$PW" >/dev/null 2>log || { echo "FAIL: verify after restoring a killed append"; cat log; fail=1; }
+[ $fail = 0 ] && echo "append OK"
+exit $fail
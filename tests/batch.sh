@@ -0,0 +1,62 @@
+#!/bin/bash
+# Batch test: runs a manifest that creates, lists and extracts an archive, and
+# checks that a manifest naming itself with --batch is refused instead of
+# recursing, while the other jobs still run. A second manifest archives on the
+# shared worker threads with changing thread counts, levels, codecs and a
+# dictionary, and every archive must extract to the input.
+# Usage: tests/batch.sh <seclume binary>
+set -u
+B=$(realpath "$1")
+PW='Passw0rd!x'
+T=$(mktemp -d)
+trap 'rm -rf "$T"' EXIT
+fail=0
+cd "$T" || exit 1
+mkdir -p "d/with space"
+seq 1 5000 > "d/with space/nums.txt"
+echo hello > d/hello.txt
+mkdir out
+cat > jobs.txt <<M
+# create, list and extract
+archive a.slm $PW d
+list a.slm $PW
+-o out extract a.slm $PW
+--batch jobs.txt
+-o out -i "d/with space/nums.txt" -f extract a.slm $PW
+M
+timeout 60 "$B" --batch jobs.txt >/dev/null 2>log
+rc=$?
+[ $rc = 1 ] || { echo "FAIL: exit status $rc, expected 1"; cat log; fail=1; }
+grep -q "Error: --batch cannot be used inside a batch manifest" log || { echo "FAIL: nested batch not refused"; cat log; fail=1; }
+[ "$(grep -c "Batch job .* failed" log)" = 1 ] || { echo "FAIL: expected exactly one failed job"; cat log; fail=1; }
+grep -q "Batch finished: 5 jobs, 1 failed" log || { echo "FAIL: later jobs did not run"; cat log; fail=1; }
+diff -r d out/d >/dev/null || { echo "FAIL: extracted tree differs"; fail=1; }
+# Shared worker threads: contexts kept from one job must not leak into the next archive
+for i in $(seq 1 30); do seq "$i" $((i * 300)) > "d/n$i.txt"; done
+cat > shared.txt <<M
+-j 4 -ca zlib -cl 9 archive s1.slm $PW d
+-j 2 -ca zlib -cl 1 archive s2.slm ${PW}2 d
+-j 8 -ca lzma archive s3.slm $PW d
+-j 4 -ca zlib -dt archive s4.slm $PW d
+-j 4 -ca zlib archive s5.slm $PW d
+-j 4 archive - $PW d
+M
+# The last job streams its archive to the batch's standard output
+if timeout 120 "$B" --batch shared.txt > s6.slm 2>log; then
+    n=1
+    for a in s1.slm s2.slm s3.slm s4.slm s5.slm s6.slm; do
+        pw=$PW
+        [ $a = s2.slm ] && pw=${PW}2
+        rm -rf out && mkdir out
+        if "$B" -o out extract "$a" "$pw" >/dev/null 2>log; then
+            diff -r d out/d >/dev/null || { echo "FAIL: shared-thread archive $n differs"; fail=1; }
+        else
+            echo "FAIL: extract of shared-thread archive $n"; cat log; fail=1
+        fi
+        n=$((n + 1))
+    done
+else
+    echo "FAIL: shared-thread batch"; cat log; fail=1
+fi
+[ $fail = 0 ] && echo "batch OK"
+exit $fail
@@ -0,0 +1,51 @@
+#!/bin/bash
+# Dictionary test: archives many similar small files with a trained dictionary
+# under zlib, zstd and auto, checks that the dictionary is recorded and makes
+# the archive smaller, and extracts and verifies it with one and four threads.
+# Usage: tests/dict.sh <seclume binary>
+set -u
+B=$(realpath "$1")
+PW='Passw0rd!x'
+T=$(mktemp -d)
+trap 'rm -rf "$T"' EXIT
+fail=0
+cd "$T" || exit 1
+mkdir -p d/conf
+for i in $(seq 1 300); do
+    printf '[service-%d]\nname = backend-%d\nlisten = 0.0.0.0:%d\nworkers = %d\nlog_level = info\nenabled = true\n' \
+        "$i" "$i" $((8000 + i)) $((i % 16 + 1)) > "d/conf/s$i.conf"
+done
+head -c 300000 /dev/urandom > d/big.bin
+for algo in zlib zstd auto; do
+    rm -f plain.slm dict.slm
+    if ! "$B" -ca "$algo" -dt archive dict.slm "$PW" d >/dev/null 2>log; then
+        grep -q "not compiled in" log && continue
+        echo "FAIL: archive ($algo)"; cat log; fail=1; continue
+    fi
+    "$B" -ca "$algo" archive plain.slm "$PW" d >/dev/null 2>log || { echo "FAIL: archive without dictionary ($algo)"; cat log; fail=1; }
+    [ "$(stat -c %s dict.slm)" -lt "$(stat -c %s plain.slm)" ] || { echo "FAIL: dictionary does not shrink the archive ($algo)"; fail=1; }
+    "$B" list dict.slm "$PW" 2>&1 | grep -q "Compression dictionary" || { echo "FAIL: no dictionary listed ($algo)"; fail=1; }
+    for j in 1 4; do
+        "$B" -j "$j" verify dict.slm "$PW" >/dev/null 2>log || { echo "FAIL: verify with -j $j ($algo)"; cat log; fail=1; }
+        rm -rf out && mkdir out
+        if "$B" -j "$j" -o out extract dict.slm "$PW" >/dev/null 2>log; then
+            diff -r d out/d >/dev/null || { echo "FAIL: extracted tree differs with -j $j ($algo)"; fail=1; }
+        else
+            echo "FAIL: extract with -j $j ($algo)"; cat log; fail=1
+        fi
+    done
+    rm -rf out && mkdir out
+    "$B" -o out -i 'd/conf/s42.conf' extract dict.slm "$PW" >/dev/null 2>log || { echo "FAIL: extract one entry ($algo)"; cat log; fail=1; }
+    cmp -s d/conf/s42.conf out/d/conf/s42.conf || { echo "FAIL: single entry differs ($algo)"; fail=1; }
+done
+# Too few files to sample: the archive gets no dictionary and still round trips
+mkdir few && cp d/conf/s1.conf d/conf/s2.conf few/
+rm -rf out && mkdir out
+if "$B" -ca zlib -dt archive few.slm "$PW" few >/dev/null 2>log && "$B" -o out extract few.slm "$PW" >/dev/null 2>>log; then
+    diff -r few out/few >/dev/null || { echo "FAIL: archive without enough samples differs"; fail=1; }
+else
+    echo "FAIL: archive without enough samples"; cat log; fail=1
+fi
+"$B" -ca lzma -dt archive lzma.slm "$PW" d >/dev/null 2>&1 && { echo "FAIL: dictionary accepted with lzma"; fail=1; }
+[ $fail = 0 ] && echo "dict OK"
+exit $fail
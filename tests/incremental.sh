@@ -0,0 +1,60 @@
+#!/bin/bash
+# Incremental test: archives a tree, then two increments each on top of the
+# previous archive, and checks that only changed files are stored, that every
+# archive of the chain extracts to the tree it was made from, and that an
+# increment whose base is missing is refused.
+# Usage: tests/incremental.sh <seclume binary>
+set -u
+B=$(realpath "$1")
+PW='Passw0rd!x'
+T=$(mktemp -d)
+trap 'rm -rf "$T"' EXIT
+fail=0
+cd "$T" || exit 1
+mkdir -p d/sub
+for i in 1 2 3 4 5; do seq "$i" 30000 > "d/$i"; done
+head -c 500000 /dev/urandom > d/sub/rand.bin
+# Stages the tree of each archive so its extraction can be compared to it
+snap() { rm -rf "snap_$1" && mkdir "snap_$1" && cp -a d "snap_$1/"; }
+"$B" -ca zlib archive full.slm "$PW" d >/dev/null 2>log || { echo "FAIL: full archive"; cat log; exit 1; }
+snap full
+sleep 1.1
+echo changed >> d/1
+rm d/2
+echo new > d/sub/new.txt
+"$B" -inc full.slm archive inc1.slm "$PW" d >/dev/null 2>log || { echo "FAIL: first increment"; cat log; exit 1; }
+snap inc1
+sleep 1.1
+echo again >> d/3
+head -c 200000 /dev/urandom > d/sub/rand.bin
+"$B" -j 4 -inc inc1.slm archive inc2.slm "$PW" d >/dev/null 2>log || { echo "FAIL: second increment"; cat log; exit 1; }
+snap inc2
+"$B" list inc1.slm "$PW" > list1 2>/dev/null || { echo "FAIL: list first increment"; fail=1; }
+for f in d/3 d/4 d/5 d/sub/rand.bin; do
+    grep -q " $f (in base archive)" list1 || { echo "FAIL: unchanged $f not taken from the base"; fail=1; }
+done
+for f in d/1 d/sub/new.txt; do
+    grep -q " $f\$" list1 || { echo "FAIL: changed $f not stored in the increment"; fail=1; }
+done
+grep -q " d/2" list1 && { echo "FAIL: deleted file listed in the increment"; fail=1; }
+"$B" list inc2.slm "$PW" > list2 2>/dev/null || { echo "FAIL: list second increment"; fail=1; }
+grep -q " d/1 (in base archive)" list2 || { echo "FAIL: file stored in the first increment not taken from it"; fail=1; }
+for f in d/3 d/sub/rand.bin; do
+    grep -q " $f\$" list2 || { echo "FAIL: changed $f not stored in the second increment"; fail=1; }
+done
+for a in full inc1 inc2; do
+    "$B" verify "$a.slm" "$PW" >/dev/null 2>log || { echo "FAIL: verify $a"; cat log; fail=1; }
+    for j in 1 4; do
+        rm -rf out && mkdir out
+        if "$B" -j "$j" -o out extract "$a.slm" "$PW" >/dev/null 2>log; then
+            diff -r "snap_$a/d" out/d >/dev/null || { echo "FAIL: $a extracted with -j $j differs"; fail=1; }
+        else
+            echo "FAIL: extract $a with -j $j"; cat log; fail=1
+        fi
+    done
+done
+mv inc1.slm moved.slm
+rm -rf out && mkdir out
+"$B" -o out extract inc2.slm "$PW" >/dev/null 2>&1 && { echo "FAIL: increment extracted without its base"; fail=1; }
+[ $fail = 0 ] && echo "incremental OK"
+exit $fail
@@ -0,0 +1,41 @@
+#!/bin/bash
+# Shrinking input test: truncates a mapped input file from a second process
+# while it is archived, and checks that the run fails with the read error
+# (exit status 1) instead of being killed by SIGBUS (exit status 135). The
+# file is truncated as soon as -vv reports it mapped; lzma at level 9 takes
+# seconds over its 32MB, so the truncation lands long before the last read.
+# Usage: tests/shrink.sh <seclume binary>
+set -u
+B=$(realpath "$1")
+PW='Passw0rd!x'
+T=$(mktemp -d)
+trap 'rm -rf "$T"' EXIT
+cd "$T" || exit 1
+fail=0
+for opts in "" "-j 4" "-bp -j 4" "-dd" "-so"; do
+    head -c 24000000 /dev/urandom | base64 -w 0 > big.txt
+    rm -f a.slm
+    # shellcheck disable=SC2086
+    "$B" -vv -ca lzma -cl 9 $opts archive a.slm "$PW" big.txt >/dev/null 2>log &
+    pid=$!
+    for _ in $(seq 3000); do
+        grep -q "Mapped big.txt for reading" log && break
+        kill -0 $pid 2>/dev/null || break
+        sleep 0.01
+    done
+    if ! grep -q "Mapped big.txt for reading" log; then
+        echo "FAIL: big.txt was not mapped (${opts:-serial})"
+        kill $pid 2>/dev/null
+        wait $pid
+        fail=1
+        continue
+    fi
+    truncate -s 100000 big.txt
+    wait $pid
+    rc=$?
+    [ $rc = 1 ] || { echo "FAIL: exit status $rc, expected 1 (${opts:-serial})"; fail=1; }
+    grep -q "Error: Unexpected EOF reading input file big.txt" log ||
+        { echo "FAIL: no read error reported (${opts:-serial})"; cat log; fail=1; }
+done
+[ $fail = 0 ] && echo "shrink OK"
+exit $fail
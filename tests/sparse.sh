@@ -0,0 +1,48 @@
+#!/bin/bash
+# Sparse test: archives files with holes at the start, in the middle and at the
+# end with every codec, extracts them with one and four threads and compares
+# them, and checks that the holes are recreated where the archive keeps them.
+# Usage: tests/sparse.sh <seclume binary>
+set -u
+B=$(realpath "$1")
+PW='Passw0rd!x'
+T=$(mktemp -d)
+trap 'rm -rf "$T"' EXIT
+fail=0
+cd "$T" || exit 1
+mkdir d
+# Writes count KB of random data at KB offset seek into a file
+put() { head -c $(($3 * 1024)) /dev/urandom | dd of="$1" bs=1024 seek="$2" conv=notrunc 2>/dev/null; }
+truncate -s 64M d/mid; put d/mid 0 64; put d/mid 32768 128; put d/mid 65472 64
+truncate -s 32M d/lead; put d/lead 16384 256
+truncate -s 48M d/tail; put d/tail 0 512
+truncate -s 8M d/hole
+if [ "$(stat -c %b d/mid)" -ge $((64 * 1024 * 2)) ]; then
+    echo "sparse skipped: the file system does not keep holes"; exit 0
+fi
+# Allocated size in bytes, compared with the size to tell a restored hole
+blocks() { echo $(($(stat -c %b "$1") * 512)); }
+for opts in "-ca zlib" "-ca lzma" "-ca zstd" "-ca lz4" "-ca lzma -j 4" "-ca zlib -so" "-ca lzma -bp -j 4" "-ca zlib -dd"; do
+    rm -f a.slm
+    if ! "$B" $opts archive a.slm "$PW" d >/dev/null 2>log; then
+        grep -q "not compiled in" log && continue
+        echo "FAIL: archive ($opts)"; cat log; fail=1; continue
+    fi
+    [ "$(stat -c %s a.slm)" -lt $((4 * 1024 * 1024)) ] || { echo "FAIL: holes archived as data ($opts)"; fail=1; }
+    "$B" verify a.slm "$PW" >/dev/null 2>log || { echo "FAIL: verify ($opts)"; cat log; fail=1; }
+    for j in 1 4; do
+        rm -rf out && mkdir out
+        if ! "$B" -j "$j" -o out extract a.slm "$PW" >/dev/null 2>log; then
+            echo "FAIL: extract with -j $j ($opts)"; cat log; fail=1; continue
+        fi
+        for f in mid lead tail hole; do
+            cmp -s "d/$f" "out/d/$f" || { echo "FAIL: $f differs after extract with -j $j ($opts)"; fail=1; continue; }
+            # -bp and -dd archives store the file as data and extract it whole
+            case "$opts" in *-bp*|*-dd*) continue ;; esac
+            [ "$(blocks "out/d/$f")" -lt "$(stat -c %s "out/d/$f")" ] ||
+                { echo "FAIL: holes of $f not recreated with -j $j ($opts)"; fail=1; }
+        done
+    done
+done
+[ $fail = 0 ] && echo "sparse OK"
+exit $fail
@@ -0,0 +1,40 @@
+#!/bin/bash
+# Standard input test: archives empty and non-empty standard input ("-") into
+# indexed and streamed archives, then lists, verifies and extracts them, the
+# streamed ones also from standard input.
+# Usage: tests/stdin.sh <seclume binary>
+set -u
+B=$(realpath "$1")
+PW='Passw0rd!x'
+T=$(mktemp -d)
+trap 'rm -rf "$T"' EXIT
+fail=0
+cd "$T" || exit 1
+: > empty.in
+head -c 300000 /dev/urandom > data.in
+for input in empty data; do
+    # Indexed archives are written to a file, streamed ones to standard output
+    "$B" --stdin-name "$input.out" archive "i_$input.slm" "$PW" - < "$input.in" >/dev/null 2>log ||
+        { echo "FAIL: archive $input stdin (indexed)"; cat log; fail=1; }
+    "$B" --stdin-name "$input.out" archive - "$PW" - < "$input.in" > "s_$input.slm" 2>log ||
+        { echo "FAIL: archive $input stdin (streamed)"; cat log; fail=1; }
+    for mode in i s; do
+        a="${mode}_$input.slm"
+        "$B" list "$a" "$PW" >/dev/null 2>log || { echo "FAIL: list $a"; cat log; fail=1; }
+        "$B" verify "$a" "$PW" >/dev/null 2>log || { echo "FAIL: verify $a"; cat log; fail=1; }
+        rm -rf out && mkdir out
+        if "$B" -o out extract "$a" "$PW" >/dev/null 2>log; then
+            cmp -s "$input.in" "out/$input.out" || { echo "FAIL: $a extracted data differs"; fail=1; }
+        else
+            echo "FAIL: extract $a"; cat log; fail=1
+        fi
+    done
+    rm -rf out && mkdir out
+    if "$B" -o out extract - "$PW" < "s_$input.slm" >/dev/null 2>log; then
+        cmp -s "$input.in" "out/$input.out" || { echo "FAIL: s_$input.slm piped extraction differs"; fail=1; }
+    else
+        echo "FAIL: extract s_$input.slm from standard input"; cat log; fail=1
+    fi
+done
+[ $fail = 0 ] && echo "stdin OK"
+exit $fail
@@ -6,7 +6,9 @@
 #include "seclume.h"
 #include <stdarg.h>
 #include <string.h>
+#include <errno.h>
 #include <stdlib.h>
+#include <unistd.h>
 #include <sys/stat.h>
 #include <openssl/rand.h>
 #include <openssl/evp.h>
@@ -90,7 +92,10 @@ int derive_key(const char *password, const uint8_t *salt, uint8_t *key, const ch
     params[4] = OSSL_PARAM_construct_octet_string("info", (void *)context, strlen(context));
     params[5] = OSSL_PARAM_construct_end();
 
+    StageTimer timer;
+    stage_begin(&timer);
     int ret = EVP_KDF_derive(kctx, key, AES_KEY_SIZE, params);
+    stage_end(&timer, STAGE_KDF, 0);
     EVP_KDF_CTX_free(kctx);
     if (ret != 1) {
         fprintf(stderr, "Error: Key derivation failed\n");
@@ -99,6 +104,137 @@ int derive_key(const char *password, const uint8_t *salt, uint8_t *key, const ch
     return 0;
 }
 
+/**
+ * @brief Expands a master secret into a purpose-specific key with HKDF-Expand (SHA256).
+ * @param master Master secret (AES_KEY_SIZE bytes).
+ * @param key Output key (AES_KEY_SIZE bytes).
+ * @param context Purpose string used as HKDF info.
+ * @return 0 on success, 1 on failure.
+ */
+int hkdf_expand_key(const uint8_t *master, uint8_t *key, const char *context) {
+    EVP_KDF *kdf = EVP_KDF_fetch(NULL, "HKDF", NULL);
+    if (!kdf) {
+        fprintf(stderr, "Error: HKDF not available\n");
+        return 1;
+    }
+    EVP_KDF_CTX *kctx = EVP_KDF_CTX_new(kdf);
+    EVP_KDF_free(kdf);
+    if (!kctx) {
+        fprintf(stderr, "Error: Failed to create KDF context\n");
+        return 1;
+    }
+
+    OSSL_PARAM params[5];
+    params[0] = OSSL_PARAM_construct_int("mode", &(int){EVP_KDF_HKDF_MODE_EXPAND_ONLY});
+    params[1] = OSSL_PARAM_construct_utf8_string("digest", "SHA256", 0);
+    params[2] = OSSL_PARAM_construct_octet_string("key", (void *)master, AES_KEY_SIZE);
+    params[3] = OSSL_PARAM_construct_octet_string("info", (void *)context, strlen(context));
+    params[4] = OSSL_PARAM_construct_end();
+
+    int ret = EVP_KDF_derive(kctx, key, AES_KEY_SIZE, params);
+    EVP_KDF_CTX_free(kctx);
+    if (ret != 1) {
+        fprintf(stderr, "Error: Key derivation failed\n");
+        return 1;
+    }
+    return 0;
+}
+
+/**
+ * @brief Derives the file and metadata keys of an archive.
+ *
+ * Version 8+ runs PBKDF2 once for a master secret and expands it with HKDF into
+ * both keys. Older versions run one full PBKDF2 per key. With -kc, keys found
+ * in the session key cache are used without derivation; callers add keys to
+ * the cache once the header HMAC has verified them.
+ *
+ * @param password Password string.
+ * @param salt Salt from the archive header.
+ * @param version Archive format version.
+ * @param file_key Output file encryption key (AES_KEY_SIZE bytes).
+ * @param meta_key Output metadata encryption key (AES_KEY_SIZE bytes).
+ * @return 0 on success, 1 on failure.
+ */
+int derive_archive_keys(const char *password, const uint8_t *salt, uint8_t version, uint8_t *file_key, uint8_t *meta_key) {
+    if (key_cache_lookup(password, salt, version, file_key, meta_key)) return 0;
+    if (version < ARCHIVE_VERSION_HKDF) {
+        if (derive_key(password, salt, file_key, "file encryption") != 0 ||
+            derive_key(password, salt, meta_key, "metadata encryption") != 0) {
+            secure_zero(file_key, AES_KEY_SIZE);
+            secure_zero(meta_key, AES_KEY_SIZE);
+            return 1;
+        }
+        return 0;
+    }
+    uint8_t master[AES_KEY_SIZE];
+    int ret = derive_key(password, salt, master, "master key") != 0 ||
+              hkdf_expand_key(master, file_key, "file encryption") != 0 ||
+              hkdf_expand_key(master, meta_key, "metadata encryption") != 0;
+    secure_zero(master, AES_KEY_SIZE);
+    if (ret != 0) {
+        secure_zero(file_key, AES_KEY_SIZE);
+        secure_zero(meta_key, AES_KEY_SIZE);
+    }
+    return ret;
+}
+
+/**
+ * @brief Opens an archive, verifies its header and derives its keys.
+ * @param path Path to the archive file (.slm), or "-" for standard input.
+ * @param password Password for decryption.
+ * @param header Output verified archive header.
+ * @param file_key Output file encryption key (AES_KEY_SIZE bytes).
+ * @param meta_key Output metadata encryption key (AES_KEY_SIZE bytes).
+ * @return Archive file positioned after the header, or NULL on failure.
+ */
+FILE *open_archive(const char *path, const char *password, ArchiveHeader *header, uint8_t *file_key, uint8_t *meta_key) {
+    /* A duplicate of standard input, so closing the archive leaves stdin itself open */
+    int from_stdin = strcmp(path, "-") == 0;
+    if (from_stdin && isatty(STDIN_FILENO)) {
+        fprintf(stderr, "Error: Refusing to read archive data from a terminal\n");
+        return NULL;
+    }
+    int stdin_fd = from_stdin ? dup(STDIN_FILENO) : -1;
+    FILE *in = from_stdin ? (stdin_fd == -1 ? NULL : fdopen(stdin_fd, "rb")) : fopen(path, "rb");
+    if (!in) {
+        fprintf(stderr, "Error: Cannot open archive file %s: %s\n", path, strerror(errno));
+        if (stdin_fd != -1) close(stdin_fd);
+        return NULL;
+    }
+    if (fread(header, sizeof(*header), 1, in) != 1) {
+        fprintf(stderr, "Error: Failed to read archive header\n");
+        fclose(in);
+        return NULL;
+    }
+    if (strncmp(header->magic, "SLM", 4) != 0 || (header->version < 4 || header->version > ARCHIVE_VERSION)) {
+        fprintf(stderr, "Error: Invalid archive format or version (expected 4 to %d, got %d)\n", ARCHIVE_VERSION, header->version);
+        fclose(in);
+        return NULL;
+    }
+    if (header->file_count > MAX_FILES) {
+        fprintf(stderr, "Error: Too many files in archive (%u > %d)\n", header->file_count, MAX_FILES);
+        fclose(in);
+        return NULL;
+    }
+    if (derive_archive_keys(password, header->salt, header->version, file_key, meta_key) != 0) {
+        fclose(in);
+        return NULL;
+    }
+    verbose_print(VERBOSE_DEBUG, "Derived encryption keys");
+    uint8_t computed_hmac[HMAC_SIZE];
+    if (compute_hmac(file_key, (uint8_t *)header, offsetof(ArchiveHeader, hmac), computed_hmac) != 0 ||
+        memcmp(computed_hmac, header->hmac, HMAC_SIZE) != 0) {
+        fprintf(stderr, "Error: Header HMAC verification failed for %s\n", path);
+        secure_zero(file_key, AES_KEY_SIZE);
+        secure_zero(meta_key, AES_KEY_SIZE);
+        fclose(in);
+        return NULL;
+    }
+    verbose_print(VERBOSE_DEBUG, "Verified header HMAC");
+    key_cache_store(password, header->salt, header->version, file_key, meta_key);
+    return in;
+}
+
 /**
  * @brief Computes HMAC-SHA256 of data.
  * @param key HMAC key.
@@ -169,3 +305,15 @@ int check_password_strength(const char *password, int weak_password) {
 int matches_glob_pattern(const char *filename, const char *pattern) {
     return fnmatch(pattern, filename, FNM_PATHNAME) == 0;
 }
+
+/**
+ * @brief Returns the number of bytes that follow a FileEntry for its file data.
+ * @param version Archive format version.
+ * @param compressed_size Compressed size recorded in the entry's metadata.
+ * @return Bytes to skip to reach the next entry (0 for empty files).
+ */
+uint64_t entry_payload_size(uint8_t version, uint64_t compressed_size) {
+    if (compressed_size == 0) return 0;
+    if (version >= 7) return AES_NONCE_SIZE + compressed_size;
+    return AES_NONCE_SIZE + AES_TAG_SIZE + compressed_size;
+}
@@ -30,44 +30,42 @@ int view_comment(const char *archive, const char *password) {
         fclose(in);
         return 1;
     }
-    if (strncmp(header.magic, "SLM", 4) != 0 || (header.version < 4 || header.version > 6)) {
-        fprintf(stderr, "Error: Invalid archive format or version (expected 4 to 6, got %d)\n", header.version);
+    if (strncmp(header.magic, "SLM", 4) != 0 || (header.version < 4 || header.version > ARCHIVE_VERSION)) {
+        fprintf(stderr, "Error: Invalid archive format or version (expected 4 to %d, got %d)\n", ARCHIVE_VERSION, header.version);
         fclose(in);
         return 1;
     }
-    if (header.version >= 5 && header.compression_algo != COMPRESSION_ZLIB && header.compression_algo != COMPRESSION_LZMA) {
+    int codecs = header.version >= ARCHIVE_VERSION_CODECS ? COMPRESSION_AUTO : COMPRESSION_LZMA;
+    if (header.version >= 5 && (header.compression_algo > codecs || header.compression_algo == COMPRESSION_STORE)) {
         fprintf(stderr, "Error: Invalid compression algorithm in header (%d)\n", header.compression_algo);
         fclose(in);
         return 1;
     }
+    uint8_t file_key[AES_KEY_SIZE];
     uint8_t meta_key[AES_KEY_SIZE];
-    if (derive_key(password, header.salt, meta_key, "metadata encryption") != 0) {
+    if (derive_archive_keys(password, header.salt, header.version, file_key, meta_key) != 0) {
         fclose(in);
         return 1;
     }
-    verbose_print(VERBOSE_DEBUG, "Derived metadata encryption key");
+    verbose_print(VERBOSE_DEBUG, "Derived encryption keys");
     size_t hmac_size = offsetof(ArchiveHeader, hmac);
     uint8_t computed_hmac[HMAC_SIZE];
-    uint8_t file_key[AES_KEY_SIZE];
-    if (derive_key(password, header.salt, file_key, "file encryption") != 0) {
-        secure_zero(meta_key, AES_KEY_SIZE);
-        fclose(in);
-        return 1;
-    }
     if (compute_hmac(file_key, (uint8_t *)&header, hmac_size, computed_hmac) != 0) {
         secure_zero(file_key, AES_KEY_SIZE);
         secure_zero(meta_key, AES_KEY_SIZE);
         fclose(in);
         return 1;
     }
-    secure_zero(file_key, AES_KEY_SIZE);
     if (memcmp(computed_hmac, header.hmac, HMAC_SIZE) != 0) {
         fprintf(stderr, "Error: Header HMAC verification failed\n");
+        secure_zero(file_key, AES_KEY_SIZE);
         secure_zero(meta_key, AES_KEY_SIZE);
         fclose(in);
         return 1;
     }
     verbose_print(VERBOSE_DEBUG, "Verified header HMAC");
+    key_cache_store(password, header.salt, header.version, file_key, meta_key);
+    secure_zero(file_key, AES_KEY_SIZE);
     if (header.comment_len == 0) {
         printf("Archive %s has no comment.\n", archive);
         secure_zero(meta_key, AES_KEY_SIZE);